@@ -0,0 +1,78 @@
+#include "LatencyHistogram.hpp"
+
+#define LATENCY_SUB_COUNT (1ULL << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (LATENCY_SUB_COUNT + (LATENCY_MAX_BITS - LATENCY_SUB_BITS) * LATENCY_SUB_COUNT)
+
+LatencyHistogram::LatencyHistogram()
+    : buckets_(LATENCY_BUCKETS, 0)
+    , count_(0)
+    , max_(0)
+    , sum_(0)
+{
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value_us)
+{
+    if (value_us < LATENCY_SUB_COUNT)
+        return static_cast<size_t>(value_us);
+    int msb = 63 - __builtin_clzll(value_us);
+    if (msb >= LATENCY_MAX_BITS)
+        return LATENCY_BUCKETS - 1;
+    int shift = msb - LATENCY_SUB_BITS;
+    // The top bit is implied by the doubling, the next LATENCY_SUB_BITS pick the bucket in it
+    size_t sub = static_cast<size_t>((value_us >> shift) & (LATENCY_SUB_COUNT - 1));
+    return LATENCY_SUB_COUNT + static_cast<size_t>(shift) * LATENCY_SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucketHighest(size_t index)
+{
+    if (index < LATENCY_SUB_COUNT)
+        return index;
+    size_t shift = (index - LATENCY_SUB_COUNT) / LATENCY_SUB_COUNT;
+    uint64_t sub = (index - LATENCY_SUB_COUNT) % LATENCY_SUB_COUNT;
+    uint64_t lowest = (LATENCY_SUB_COUNT + sub) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value_us)
+{
+    ++buckets_[bucketIndex(value_us)];
+    ++count_;
+    sum_ += value_us;
+    if (value_us > max_)
+        max_ = value_us;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < buckets_.size(); ++i)
+        buckets_[i] += other.buckets_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.max_ > max_)
+        max_ = other.max_;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const
+{
+    if (count_ == 0)
+        return 0;
+    uint64_t wanted = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count_) + 0.5);
+    if (wanted == 0)
+        wanted = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets_.size(); ++i)
+    {
+        seen += buckets_[i];
+        if (seen >= wanted)
+            return bucketHighest(i) < max_ ? bucketHighest(i) : max_;
+    }
+    return max_;
+}
+
+double LatencyHistogram::mean() const
+{
+    if (count_ == 0)
+        return 0.0;
+    return static_cast<double>(sum_) / static_cast<double>(count_);
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+# define LATENCY_HISTOGRAM_HPP
+
+# include <cstddef>
+# include <cstdint>
+# include <vector>
+
+# define LATENCY_SUB_BITS 6     // 64 buckets per doubling, values are kept within 1.6%
+# define LATENCY_MAX_BITS 40    // up to 2^40us, about 12 days
+
+/**
+ * @brief Log-linear histogram of latencies in microseconds, like an HDR histogram
+ *
+ * Values below 2^LATENCY_SUB_BITS get a bucket each, every doubling above
+ * is split in 2^LATENCY_SUB_BITS equal buckets. Recording is an index
+ * computation and an increment, percentiles are read by walking the buckets.
+ */
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram();
+
+        /**
+         * @brief counts a value, values over the range go in the last bucket
+         */
+        void record(uint64_t value_us);
+
+        /**
+         * @brief adds the counts of another histogram
+         */
+        void merge(const LatencyHistogram& other);
+
+        /**
+         * @param percentile between 0 and 100
+         * @return the highest value of the bucket the percentile falls in, 0 when empty
+         */
+        uint64_t percentile(double percentile) const;
+
+        uint64_t count() const { return count_; }
+        uint64_t max() const { return max_; }
+        double mean() const;
+
+    private:
+        std::vector<uint64_t> buckets_;
+        uint64_t count_;
+        uint64_t max_;
+        uint64_t sum_;
+
+        static size_t bucketIndex(uint64_t value_us);
+        static uint64_t bucketHighest(size_t index);
+};
+
+#endif
\ No newline at end of file
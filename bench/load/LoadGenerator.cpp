@@ -0,0 +1,676 @@
+#include "LoadGenerator.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <netdb.h>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BENCH_READ_SIZE 65536
+#define BENCH_MAX_EVENTS 256
+
+LoadGenerator::LoadGenerator(const s_bench_options& options)
+    : options_(options)
+    , address_{}
+    , epoll_fd_(-1)
+    , start_us_(0)
+    , end_us_(0)
+    , scheduled_(0)
+    , next_request_(0)
+    , statuses_{}
+    , errors_{}
+    , bytes_read_(0)
+    , idle_open_(0)
+    , idle_closed_(0)
+    , rss_before_kb_(-1)
+    , rss_after_kb_(-1)
+{
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    for (s_bench_connection& connection : connections_)
+    {
+        if (connection.fd != -1)
+            close(connection.fd);
+    }
+    if (epoll_fd_ != -1)
+        close(epoll_fd_);
+}
+
+uint64_t LoadGenerator::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int LoadGenerator::setup()
+{
+    addrinfo hints{};
+    addrinfo* result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int nr = getaddrinfo(options_.host.c_str(), nullptr, &hints, &result);
+    if (nr != 0 || result == nullptr)
+    {
+        std::cerr << "webserv-bench: can not resolve " << options_.host << ": " << gai_strerror(nr) << "\n";
+        return -1;
+    }
+    address_ = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    address_.sin_port = htons(options_.port);
+    freeaddrinfo(result);
+
+    if (!options_.keepalive && options_.pipeline > 1)
+    {
+        std::cerr << "webserv-bench: pipelining needs keep-alive, sending one request per connection\n";
+        options_.pipeline = 1;
+    }
+    if (loadRequests() != 0)
+        return -1;
+    connections_.resize(options_.connections);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1)
+    {
+        std::cerr << "webserv-bench: epoll_create1: " << strerror(errno) << "\n";
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief reads the request mix, one "METHOD path [body bytes]" per line, # starts a comment.
+ * Without a file every request is a GET of the path of the URL
+ */
+int LoadGenerator::loadRequests()
+{
+    if (options_.requests_file.empty())
+    {
+        requests_.push_back({"GET", options_.path, buildRequest("GET", options_.path, 0)});
+        return 0;
+    }
+    std::ifstream file(options_.requests_file);
+    if (!file)
+    {
+        std::cerr << "webserv-bench: can not open " << options_.requests_file << "\n";
+        return -1;
+    }
+    std::string line;
+    size_t number = 0;
+    while (std::getline(file, line))
+    {
+        ++number;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string method;
+        std::string path;
+        size_t body_size = 0;
+        if (!(fields >> method))
+            continue;
+        if (!(fields >> path) || path[0] != '/' || (!(fields >> body_size) && !fields.eof()))
+        {
+            std::cerr << "webserv-bench: " << options_.requests_file << ":" << number << ": expected METHOD /path [body bytes]\n";
+            return -1;
+        }
+        requests_.push_back({method, path, buildRequest(method, path, body_size)});
+    }
+    if (requests_.empty())
+    {
+        std::cerr << "webserv-bench: " << options_.requests_file << " has no requests\n";
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief puts a request in its wire format. A body is filled with a repeating pattern,
+ * what counts for the server is its size
+ */
+std::string LoadGenerator::buildRequest(const std::string& method, const std::string& path, size_t body_size) const
+{
+    std::string wire = method + " " + path + " HTTP/1.1\r\n"
+        + "Host: " + options_.host + ":" + std::to_string(options_.port) + "\r\n"
+        + "User-Agent: webserv-bench\r\n"
+        + "Connection: " + (options_.keepalive ? "keep-alive" : "close") + "\r\n";
+    if (method == "POST" || method == "PUT" || body_size > 0)
+        wire += "Content-Type: application/octet-stream\r\nContent-Length: " + std::to_string(body_size) + "\r\n";
+    wire += "\r\n";
+    wire.reserve(wire.size() + body_size);
+    for (size_t i = 0; i < body_size; ++i)
+        wire += static_cast<char>('a' + i % 26);
+    return wire;
+}
+
+s_bench_pending LoadGenerator::nextRequest(uint64_t intended_us)
+{
+    s_bench_pending pending{intended_us, next_request_};
+    next_request_ = (next_request_ + 1) % requests_.size();
+    return pending;
+}
+
+int LoadGenerator::run()
+{
+    uint64_t send_end = now() + static_cast<uint64_t>(options_.duration * 1000000.0);
+    uint64_t give_up = send_end + static_cast<uint64_t>(options_.timeout * 1000000.0);
+    epoll_event events[BENCH_MAX_EVENTS];
+
+    start_us_ = now();
+    end_us_ = start_us_;
+    while (true)
+    {
+        uint64_t current = now();
+        bool sending = current < send_end;
+        if (!sending && (!busy() || current >= give_up))
+            break;
+        schedule(current, sending);
+
+        for (s_bench_connection& connection : connections_)
+        {
+            bool waiting = connection.state == BENCH_CONNECTING || !connection.in_flight.empty();
+            if (waiting && current - connection.last_progress_us > static_cast<uint64_t>(options_.timeout * 1000000.0))
+                closeClient(connection, BENCH_ERR_TIMEOUT);
+        }
+
+        // The open loop wakes up every millisecond to start what is due
+        int count = epoll_wait(epoll_fd_, events, BENCH_MAX_EVENTS, options_.rate > 0.0 ? 1 : 10);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "webserv-bench: epoll_wait: " << strerror(errno) << "\n";
+            return -1;
+        }
+        current = now();
+        for (int i = 0; i < count; ++i)
+            handleEvent(connections_[events[i].data.u64], events[i].events, current);
+    }
+
+    // What is still open did not make it in time
+    for (s_bench_connection& connection : connections_)
+    {
+        errors_[BENCH_ERR_TIMEOUT] += connection.backlog.size();
+        connection.backlog.clear();
+        closeClient(connection, BENCH_ERR_TIMEOUT);
+    }
+    errors_[BENCH_ERR_TIMEOUT] += pending_.size();
+    pending_.clear();
+    return 0;
+}
+
+/**
+ * @brief reads the resident memory of a process from /proc
+ * @return kB, -1 if the process is not there
+ */
+long LoadGenerator::readRss(int pid)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string field;
+    while (status >> field)
+    {
+        long kb = 0;
+        if (field == "VmRSS:" && status >> kb)
+            return kb;
+    }
+    return -1;
+}
+
+int LoadGenerator::runIdle()
+{
+    epoll_event events[BENCH_MAX_EVENTS];
+    uint64_t hold_end = now() + static_cast<uint64_t>(options_.duration * 1000000.0);
+
+    if (options_.server_pid != 0)
+        rss_before_kb_ = readRss(options_.server_pid);
+    start_us_ = now();
+    for (s_bench_connection& connection : connections_)
+    {
+        connectClient(connection, start_us_);
+        if (connection.state == BENCH_CLOSED)
+            ++errors_[BENCH_ERR_CONNECT];
+    }
+    while (now() < hold_end)
+    {
+        int count = epoll_wait(epoll_fd_, events, BENCH_MAX_EVENTS, 10);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "webserv-bench: epoll_wait: " << strerror(errno) << "\n";
+            return -1;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            s_bench_connection& connection = connections_[events[i].data.u64];
+            if (connection.state == BENCH_CONNECTING)
+            {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+                {
+                    ++errors_[BENCH_ERR_CONNECT];
+                    closeClient(connection, BENCH_ERR_CONNECT);
+                    continue;
+                }
+                connection.state = BENCH_OPEN;
+                watch(connection);
+            }
+            else if (connection.state == BENCH_OPEN)
+            {
+                // Nothing was asked, anything that comes is the server giving up on the connection
+                ++idle_closed_;
+                closeClient(connection, BENCH_ERR_READ);
+            }
+        }
+    }
+    if (options_.server_pid != 0)
+        rss_after_kb_ = readRss(options_.server_pid);
+    end_us_ = now();
+    for (s_bench_connection& connection : connections_)
+    {
+        if (connection.state == BENCH_OPEN)
+            ++idle_open_;
+        if (connection.state == BENCH_CONNECTING)
+            ++errors_[BENCH_ERR_CONNECT];
+        closeClient(connection, BENCH_ERR_COUNT);
+    }
+    return 0;
+}
+
+/**
+ * @brief starts what is due: the open loop queues the requests of the elapsed time,
+ * every connection then takes what it has room for
+ */
+void LoadGenerator::schedule(uint64_t now_us, bool sending)
+{
+    if (options_.rate > 0.0 && sending)
+    {
+        uint64_t due = static_cast<uint64_t>(static_cast<double>(now_us - start_us_) * options_.rate / 1000000.0) + 1;
+        for (; scheduled_ < due; ++scheduled_)
+            pending_.push_back(nextRequest(start_us_ + static_cast<uint64_t>(static_cast<double>(scheduled_) * 1000000.0 / options_.rate)));
+    }
+    for (s_bench_connection& connection : connections_)
+        fill(connection, now_us, sending);
+}
+
+void LoadGenerator::fill(s_bench_connection& connection, uint64_t now_us, bool sending)
+{
+    if (options_.rate > 0.0)
+    {
+        while (!pending_.empty() && connection.backlog.size() + connection.in_flight.size() < options_.pipeline)
+        {
+            connection.backlog.push_back(pending_.front());
+            pending_.pop_front();
+        }
+    }
+    else if (sending && connection.backlog.empty() && connection.in_flight.empty())
+    {
+        for (size_t i = 0; i < options_.pipeline; ++i)
+            connection.backlog.push_back(nextRequest(now_us));
+    }
+    if (connection.backlog.empty())
+        return;
+    if (connection.state == BENCH_CLOSED)
+    {
+        connectClient(connection, now_us);
+        return;
+    }
+    if (connection.state != BENCH_OPEN)
+        return;
+    while (!connection.backlog.empty())
+    {
+        connection.out += requests_[connection.backlog.front().request].wire;
+        connection.in_flight.push_back(connection.backlog.front());
+        connection.backlog.pop_front();
+    }
+    if (writeClient(connection, now_us))
+        watch(connection);
+}
+
+void LoadGenerator::connectClient(s_bench_connection& connection, uint64_t now_us)
+{
+    connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (connection.fd == -1)
+    {
+        closeClient(connection, BENCH_ERR_CONNECT);
+        return;
+    }
+    connection.last_progress_us = now_us;
+    connection.answered = 0;
+    connection.events = 0;
+    if (connect(connection.fd, reinterpret_cast<sockaddr*>(&address_), sizeof(address_)) == -1 && errno != EINPROGRESS)
+    {
+        closeClient(connection, BENCH_ERR_CONNECT);
+        return;
+    }
+    connection.state = BENCH_CONNECTING;
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.u64 = static_cast<uint64_t>(&connection - connections_.data());
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event) == -1)
+    {
+        closeClient(connection, BENCH_ERR_CONNECT);
+        return;
+    }
+    connection.events = EPOLLOUT;
+}
+
+/**
+ * @brief closes the socket. With BENCH_ERR_COUNT the requests that were not answered
+ * are sent again on the next socket, otherwise they count as errors
+ */
+void LoadGenerator::closeClient(s_bench_connection& connection, e_bench_error error)
+{
+    if (connection.fd != -1)
+        close(connection.fd);
+    connection.fd = -1;
+    connection.state = BENCH_CLOSED;
+    connection.events = 0;
+    connection.out.clear();
+    connection.out_offset = 0;
+    connection.in.clear();
+    if (error == BENCH_ERR_COUNT)
+    {
+        connection.backlog.insert(connection.backlog.begin(), connection.in_flight.begin(), connection.in_flight.end());
+        connection.in_flight.clear();
+        return;
+    }
+    // A connection that never opened takes down what it had queued too
+    if (error == BENCH_ERR_CONNECT)
+    {
+        errors_[error] += connection.backlog.size();
+        connection.backlog.clear();
+    }
+    errors_[error] += connection.in_flight.size();
+    connection.in_flight.clear();
+}
+
+void LoadGenerator::handleEvent(s_bench_connection& connection, uint32_t events, uint64_t now_us)
+{
+    if (connection.state == BENCH_CONNECTING)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+        {
+            closeClient(connection, BENCH_ERR_CONNECT);
+            return;
+        }
+        connection.state = BENCH_OPEN;
+        connection.last_progress_us = now_us;
+        fill(connection, now_us, true);
+        return;
+    }
+    if (connection.state != BENCH_OPEN)
+        return;
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+    {
+        if (!readClient(connection, now_us))
+            return;
+    }
+    if ((events & EPOLLOUT) && connection.out_offset < connection.out.size())
+    {
+        if (!writeClient(connection, now_us))
+            return;
+    }
+    watch(connection);
+}
+
+/**
+ * @return false if the connection was closed
+ */
+bool LoadGenerator::writeClient(s_bench_connection& connection, uint64_t now_us)
+{
+    while (connection.out_offset < connection.out.size())
+    {
+        ssize_t sent = send(connection.fd, connection.out.data() + connection.out_offset,
+            connection.out.size() - connection.out_offset, MSG_NOSIGNAL);
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (sent <= 0)
+        {
+            closeClient(connection, BENCH_ERR_WRITE);
+            return false;
+        }
+        connection.out_offset += static_cast<size_t>(sent);
+        connection.last_progress_us = now_us;
+    }
+    connection.out.clear();
+    connection.out_offset = 0;
+    return true;
+}
+
+/**
+ * @return false if the connection was closed
+ */
+bool LoadGenerator::readClient(s_bench_connection& connection, uint64_t now_us)
+{
+    char buffer[BENCH_READ_SIZE];
+    bool closed = false;
+    while (true)
+    {
+        ssize_t bytes = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0)
+        {
+            connection.in.append(buffer, static_cast<size_t>(bytes));
+            bytes_read_ += static_cast<uint64_t>(bytes);
+            connection.last_progress_us = now_us;
+            continue;
+        }
+        if (bytes == 0)
+            closed = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            closeClient(connection, BENCH_ERR_READ);
+            return false;
+        }
+        break;
+    }
+
+    bool close_after = false;
+    while (!connection.in_flight.empty() && !close_after)
+    {
+        int status = 0;
+        bool closing = false;
+        size_t used = parseResponse(connection.in, closed, status, closing);
+        if (status == -1)
+        {
+            closeClient(connection, BENCH_ERR_PARSE);
+            return false;
+        }
+        if (used == 0)
+            break;
+        connection.in.erase(0, used);
+        complete(connection, status, now_us);
+        close_after = closing;
+    }
+    if (!closed && !close_after)
+        return true;
+    // The server is done with the socket, unanswered requests go out again on a new one
+    // unless this socket never answered anything or broke off in the middle of a response
+    if (!connection.in_flight.empty() && (connection.answered == 0 || !connection.in.empty()))
+        closeClient(connection, BENCH_ERR_READ);
+    else
+        closeClient(connection, BENCH_ERR_COUNT);
+    return false;
+}
+
+/**
+ * @brief finds the end of the first response in the buffer
+ * 
+ * @param in bytes read so far
+ * @param closed true if the server closed the socket, which ends a response without a length
+ * @param status set to the status code, -1 if the bytes are no HTTP response
+ * @param close_after set when the server closes the socket after this response
+ * @return the size of the response, 0 while it is incomplete
+ */
+size_t LoadGenerator::parseResponse(const std::string& in, bool closed, int& status, bool& close_after) const
+{
+    size_t header_end = in.find("\r\n\r\n");
+    if (header_end == std::string::npos)
+    {
+        if (closed && !in.empty())
+            status = -1;
+        return 0;
+    }
+    if (in.compare(0, 5, "HTTP/") != 0 || header_end < 12)
+    {
+        status = -1;
+        return 0;
+    }
+    status = std::atoi(in.c_str() + 9);
+    std::string header = in.substr(0, header_end);
+    std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+    bool chunked = header.find("\r\ntransfer-encoding: chunked") != std::string::npos;
+    close_after = header.find("\r\nconnection: close") != std::string::npos
+        || (header.compare(0, 8, "http/1.0") == 0 && header.find("\r\nconnection: keep-alive") == std::string::npos);
+    size_t body_start = header_end + 4;
+
+    if (status / 100 == 1 || status == 204 || status == 304)
+        return body_start;
+    size_t length = header.find("\r\ncontent-length:");
+    if (length != std::string::npos && !chunked)
+    {
+        size_t total = body_start + std::strtoull(header.c_str() + length + 17, nullptr, 10);
+        return in.size() >= total ? total : 0;
+    }
+    if (chunked)
+    {
+        size_t pos = body_start;
+        while (true)
+        {
+            size_t line_end = in.find("\r\n", pos);
+            if (line_end == std::string::npos)
+                return 0;
+            size_t size = std::strtoull(in.c_str() + pos, nullptr, 16);
+            if (size == 0)
+            {
+                // Trailers, if any, end with an empty line
+                size_t end = in.find("\r\n\r\n", line_end);
+                if (in.compare(line_end, 4, "\r\n\r\n") == 0)
+                    end = line_end;
+                return end == std::string::npos ? 0 : end + 4;
+            }
+            pos = line_end + 2 + size + 2;
+            if (pos > in.size())
+                return 0;
+        }
+    }
+    // No length, the body runs until the server closes
+    close_after = true;
+    return closed ? in.size() : 0;
+}
+
+void LoadGenerator::complete(s_bench_connection& connection, int status, uint64_t now_us)
+{
+    s_bench_pending done = connection.in_flight.front();
+    connection.in_flight.pop_front();
+    latency_.record(now_us - done.intended_us);
+    ++statuses_[status >= 100 && status < 600 ? status / 100 : 0];
+    ++connection.answered;
+    end_us_ = now_us;
+}
+
+void LoadGenerator::watch(s_bench_connection& connection)
+{
+    if (connection.state != BENCH_OPEN)
+        return;
+    uint32_t wanted = EPOLLIN;
+    if (connection.out_offset < connection.out.size())
+        wanted |= EPOLLOUT;
+    if (wanted == connection.events)
+        return;
+    epoll_event event{};
+    event.events = wanted;
+    event.data.u64 = static_cast<uint64_t>(&connection - connections_.data());
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event) == -1)
+    {
+        closeClient(connection, BENCH_ERR_READ);
+        return;
+    }
+    connection.events = wanted;
+}
+
+bool LoadGenerator::busy() const
+{
+    if (!pending_.empty())
+        return true;
+    for (const s_bench_connection& connection : connections_)
+    {
+        if (!connection.backlog.empty() || !connection.in_flight.empty())
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief prints a latency with a unit that keeps it readable
+ */
+static std::string formatLatency(uint64_t us)
+{
+    char buffer[32];
+    if (us < 1000)
+        std::snprintf(buffer, sizeof(buffer), "%lluus", static_cast<unsigned long long>(us));
+    else if (us < 1000000)
+        std::snprintf(buffer, sizeof(buffer), "%.2fms", static_cast<double>(us) / 1000.0);
+    else
+        std::snprintf(buffer, sizeof(buffer), "%.2fs", static_cast<double>(us) / 1000000.0);
+    return buffer;
+}
+
+void LoadGenerator::report(std::ostream& out) const
+{
+    static const std::pair<double, const char*> percentiles[] = {
+        {50.0, "50%"}, {90.0, "90%"}, {99.0, "99%"}, {99.9, "99.9%"}, {99.99, "99.99%"}};
+    double elapsed = static_cast<double>(end_us_ - start_us_) / 1000000.0;
+    uint64_t answered = latency_.count();
+    uint64_t errors = 0;
+    for (uint64_t count : errors_)
+        errors += count;
+    char line[128];
+
+    out << "webserv-bench http://" << options_.host << ":" << options_.port << options_.path << "\n"
+        << "  " << options_.connections << " connections, ";
+    if (options_.rate > 0.0)
+        out << "open loop at " << options_.rate << " requests/s";
+    else
+        out << "closed loop";
+    out << ", pipeline " << options_.pipeline << ", keep-alive " << (options_.keepalive ? "on" : "off")
+        << ", " << options_.duration << "s, " << requests_.size() << (requests_.size() == 1 ? " request" : " different requests") << "\n";
+    std::snprintf(line, sizeof(line), "  answered    %llu in %.2fs, %.1f/s\n",
+        static_cast<unsigned long long>(answered), elapsed, elapsed > 0.0 ? static_cast<double>(answered) / elapsed : 0.0);
+    out << line
+        << "  statuses    2xx " << statuses_[2] << "  3xx " << statuses_[3] << "  4xx " << statuses_[4]
+        << "  5xx " << statuses_[5] << "  other " << statuses_[0] + statuses_[1] << "\n"
+        << "  errors      " << errors << " (connect " << errors_[BENCH_ERR_CONNECT] << ", read " << errors_[BENCH_ERR_READ]
+        << ", write " << errors_[BENCH_ERR_WRITE] << ", timeout " << errors_[BENCH_ERR_TIMEOUT]
+        << ", parse " << errors_[BENCH_ERR_PARSE] << ")\n";
+    std::snprintf(line, sizeof(line), "  read        %.2f MB\n", static_cast<double>(bytes_read_) / (1024.0 * 1024.0));
+    out << line
+        << "  latency" << (options_.rate > 0.0 ? " from the intended send time, corrected for coordinated omission" : "") << "\n"
+        << "    mean      " << formatLatency(static_cast<uint64_t>(latency_.mean())) << "\n";
+    for (const std::pair<double, const char*>& percentile : percentiles)
+    {
+        std::snprintf(line, sizeof(line), "    %-9s %s\n", percentile.second, formatLatency(latency_.percentile(percentile.first)).c_str());
+        out << line;
+    }
+    out << "    max       " << formatLatency(latency_.max()) << "\n";
+}
+
+void LoadGenerator::reportIdle(std::ostream& out) const
+{
+    out << "webserv-bench http://" << options_.host << ":" << options_.port << options_.path << "\n"
+        << "  " << options_.connections << " idle connections held for " << options_.duration << "s\n"
+        << "  open        " << idle_open_ << " at the end, " << idle_closed_ << " closed by the server, "
+        << errors_[BENCH_ERR_CONNECT] << " failed to connect\n";
+    if (rss_before_kb_ < 0 || rss_after_kb_ < 0)
+        return;
+    out << "  server rss  " << rss_before_kb_ << "kB before, " << rss_after_kb_ << "kB with the connections";
+    if (idle_open_ > 0)
+        out << ", " << (rss_after_kb_ - rss_before_kb_) * 1024 / static_cast<long>(idle_open_) << " bytes per connection";
+    out << "\n";
+}
\ No newline at end of file
@@ -0,0 +1,161 @@
+#ifndef LOAD_GENERATOR_HPP
+# define LOAD_GENERATOR_HPP
+
+# include "LatencyHistogram.hpp"
+# include <array>
+# include <cstdint>
+# include <deque>
+# include <ostream>
+# include <string>
+# include <vector>
+# include <netinet/in.h>
+
+// What the command line asked for
+struct s_bench_options
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 80;
+    std::string path = "/";
+    size_t connections = 10;
+    double duration = 10.0;         // seconds new requests are started
+    double rate = 0.0;              // requests per second of the open loop, 0 runs a closed loop
+    size_t pipeline = 1;            // requests in flight on one connection
+    bool keepalive = false;
+    std::string requests_file;      // "METHOD path [body bytes]" per line, sent in turn
+    double timeout = 5.0;           // seconds a connection may go without progress
+    bool idle = false;              // open the connections and send nothing, to measure what they cost
+    int server_pid = 0;             // server whose memory the idle mode reads, 0 for none
+};
+
+// A request of the mix, already in the bytes that go on the wire
+struct s_bench_request
+{
+    std::string method;
+    std::string path;
+    std::string wire;
+};
+
+// A request that is due, queued until a connection can take it
+struct s_bench_pending
+{
+    uint64_t intended_us;           // when it should have been sent, latency counts from here
+    size_t request;                 // index in the mix
+};
+
+// Where a connection is
+enum e_bench_state
+{
+    BENCH_CLOSED,
+    BENCH_CONNECTING,
+    BENCH_OPEN
+};
+
+struct s_bench_connection
+{
+    int fd = -1;
+    e_bench_state state = BENCH_CLOSED;
+    std::deque<s_bench_pending> backlog;    // taken by this connection, not written yet
+    std::deque<s_bench_pending> in_flight;  // written, waiting for the response
+    std::string out;
+    size_t out_offset = 0;
+    std::string in;
+    size_t answered = 0;                    // responses on the current socket
+    uint64_t last_progress_us = 0;
+    uint32_t events = 0;                    // what epoll watches for, to skip needless changes
+};
+
+// What went wrong, a request counts once
+enum e_bench_error
+{
+    BENCH_ERR_CONNECT,
+    BENCH_ERR_READ,
+    BENCH_ERR_WRITE,
+    BENCH_ERR_TIMEOUT,
+    BENCH_ERR_PARSE,
+    BENCH_ERR_COUNT
+};
+
+/**
+ * @brief epoll based HTTP/1.1 load generator
+ *
+ * A closed loop keeps pipeline requests in flight on every connection and
+ * sends the next ones as soon as they are answered. An open loop starts
+ * requests at a fixed rate whether the server keeps up or not, a request
+ * that has to wait for a free connection is late and its latency counts
+ * from when it should have been sent, so a stalled server is not hidden
+ * by the generator slowing down with it (coordinated omission).
+ */
+class LoadGenerator
+{
+    public:
+        explicit LoadGenerator(const s_bench_options& options);
+        ~LoadGenerator();
+
+        /**
+         * @brief resolves the target and loads the request mix
+         * @return 0 when done, -1 with a message on std::cerr otherwise
+         */
+        int setup();
+
+        /**
+         * @brief sends requests for the duration and waits for the last answers
+         * @return 0 when done, -1 if epoll could not be used
+         */
+        int run();
+
+        /**
+         * @brief opens every connection and holds it for the duration without sending,
+         * the memory of the server is read before and at the end
+         * @return 0 when done, -1 if epoll could not be used
+         */
+        int runIdle();
+
+        /**
+         * @brief writes the totals and the latency percentiles
+         */
+        void report(std::ostream& out) const;
+
+        /**
+         * @brief writes how many idle connections stayed open and what they cost the server
+         */
+        void reportIdle(std::ostream& out) const;
+
+    private:
+        s_bench_options options_;
+        std::vector<s_bench_request> requests_;
+        std::vector<s_bench_connection> connections_;
+        std::deque<s_bench_pending> pending_;   // due requests no connection could take yet
+        sockaddr_in address_;
+        int epoll_fd_;
+        uint64_t start_us_;
+        uint64_t end_us_;                       // when the last request was answered or given up
+        uint64_t scheduled_;                    // requests the open loop started so far
+        size_t next_request_;
+        LatencyHistogram latency_;
+        std::array<uint64_t, 6> statuses_;      // responses per status class, 0 for codes out of range
+        std::array<uint64_t, BENCH_ERR_COUNT> errors_;
+        uint64_t bytes_read_;
+        size_t idle_open_;                      // idle connections still open at the end
+        size_t idle_closed_;                    // idle connections the server closed
+        long rss_before_kb_;                    // RSS of the server before the idle connections, -1 unknown
+        long rss_after_kb_;                     // and with them
+
+        int loadRequests();
+        std::string buildRequest(const std::string& method, const std::string& path, size_t body_size) const;
+        s_bench_pending nextRequest(uint64_t intended_us);
+        void schedule(uint64_t now_us, bool sending);
+        void fill(s_bench_connection& connection, uint64_t now_us, bool sending);
+        void connectClient(s_bench_connection& connection, uint64_t now_us);
+        void closeClient(s_bench_connection& connection, e_bench_error error);
+        void handleEvent(s_bench_connection& connection, uint32_t events, uint64_t now_us);
+        bool writeClient(s_bench_connection& connection, uint64_t now_us);
+        bool readClient(s_bench_connection& connection, uint64_t now_us);
+        size_t parseResponse(const std::string& in, bool closed, int& status, bool& close_after) const;
+        void complete(s_bench_connection& connection, int status, uint64_t now_us);
+        void watch(s_bench_connection& connection);
+        bool busy() const;
+        static uint64_t now();
+        static long readRss(int pid);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "LoadGenerator.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+
+static void usage()
+{
+    std::cerr << "usage: webserv-bench [options] http://host[:port][/path]\n"
+              << "  -c connections   connections to keep open (10)\n"
+              << "  -d seconds       how long new requests are started (10)\n"
+              << "  -r rate          open loop at this many requests per second, a closed loop without it\n"
+              << "  -p depth         requests in flight per connection, needs -k (1)\n"
+              << "  -k               keep connections alive between requests\n"
+              << "  -f file          request mix, one \"METHOD /path [body bytes]\" per line, sent in turn\n"
+              << "  -t seconds       give up on a connection without progress for this long (5)\n"
+              << "  -i               idle: open the connections, send nothing and hold them for the duration\n"
+              << "  -P pid           with -i, report the memory the connections cost this server process\n";
+}
+
+/**
+ * @brief splits http://host[:port][/path] into the options
+ * @return false if it is no http URL
+ */
+static bool parseUrl(const std::string& url, s_bench_options& options)
+{
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0)
+        return false;
+    std::string rest = url.substr(scheme.size());
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    options.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    size_t colon = authority.find(':');
+    options.host = authority.substr(0, colon);
+    if (colon != std::string::npos)
+    {
+        char* end = nullptr;
+        unsigned long port = std::strtoul(authority.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || port == 0 || port > 65535)
+            return false;
+        options.port = static_cast<uint16_t>(port);
+    }
+    return !options.host.empty();
+}
+
+/**
+ * @brief reads a positive number of an option
+ * @return false if it is no number or not above 0
+ */
+static bool parsePositive(const char* text, double& value)
+{
+    char* end = nullptr;
+    value = std::strtod(text, &end);
+    return *end == '\0' && value > 0.0;
+}
+
+int main(int argc, char** argv)
+{
+    s_bench_options options;
+    double value = 0.0;
+    int option;
+    while ((option = getopt(argc, argv, "c:d:r:p:kf:t:iP:h")) != -1)
+    {
+        switch (option)
+        {
+            case 'k':
+                options.keepalive = true;
+                continue;
+            case 'f':
+                options.requests_file = optarg;
+                continue;
+            case 'i':
+                options.idle = true;
+                continue;
+            case 'c':
+            case 'd':
+            case 'r':
+            case 'p':
+            case 't':
+            case 'P':
+                break;
+            default:
+                usage();
+                return 1;
+        }
+        if (!parsePositive(optarg, value))
+        {
+            std::cerr << "webserv-bench: -" << static_cast<char>(option) << " needs a number above 0\n";
+            return 1;
+        }
+        if (option == 'c')
+            options.connections = static_cast<size_t>(value);
+        else if (option == 'd')
+            options.duration = value;
+        else if (option == 'r')
+            options.rate = value;
+        else if (option == 'p')
+            options.pipeline = static_cast<size_t>(value);
+        else if (option == 'P')
+            options.server_pid = static_cast<int>(value);
+        else
+            options.timeout = value;
+    }
+    if (optind != argc - 1 || !parseUrl(argv[optind], options) || options.connections == 0 || options.pipeline == 0)
+    {
+        usage();
+        return 1;
+    }
+
+    LoadGenerator generator(options);
+    if (generator.setup() != 0)
+        return 1;
+    if (options.idle)
+    {
+        if (generator.runIdle() != 0)
+            return 1;
+        generator.reportIdle(std::cout);
+        return 0;
+    }
+    if (generator.run() != 0)
+        return 1;
+    generator.report(std::cout);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include "MicroBench.hpp"
+#include "config/ConfigBuilder.hpp"
+#include "config/ConfigLexer.hpp"
+#include "server/ServerRequestHandler.hpp"
+#include "server/ServerResponseHandler.hpp"
+#include "server/ServerResponseValidator.hpp"
+#include "server/AllocProfile.hpp"
+#include "server/RouteTable.hpp"
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief splits a path on '/' like sourceChunker does, for building fixtures
+ */
+static std::vector<std::string> splitPath(const std::string& path)
+{
+    std::vector<std::string> tokens;
+    std::istringstream stream(path);
+    std::string token;
+    while (std::getline(stream, token, '/'))
+    {
+        if (!token.empty())
+            tokens.push_back(token);
+    }
+    if (tokens.empty())
+        tokens.push_back("/");
+    return tokens;
+}
+
+// A client of the request handler with the requests it parses
+struct s_request_fixture
+{
+    std::shared_ptr<Config> config = ConfigBuilder().build();
+    ServerRequestHandler handler{config->getClientMaxBodySize()};
+    s_client_data* data = nullptr;
+    s_client_data* chunked_data = nullptr;
+    std::string get;
+    std::string post;
+    std::string chunked;
+    size_t chunked_body = 0;
+};
+
+void MicroBench::registerRequestBenchmarks()
+{
+    std::shared_ptr<s_request_fixture> fixture = std::make_shared<s_request_fixture>();
+    fixture->handler.setConfigForClient(fixture->config, 0, "127.0.0.1");
+    fixture->data = fixture->handler.getRequest(0);
+    fixture->handler.setConfigForClient(fixture->config, 1, "127.0.0.1");
+    fixture->chunked_data = fixture->handler.getRequest(1);
+    fixture->get = "GET /images/logo.png HTTP/1.1\r\n"
+        "Host: localhost:9999\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+        "Accept: image/avif,image/webp,image/png,image/*;q=0.8,*/*;q=0.5\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n"
+        "Referer: http://localhost:9999/index.html\r\n"
+        "\r\n";
+    fixture->post = "POST /upload HTTP/1.1\r\n"
+        "Host: localhost:9999\r\n"
+        "User-Agent: curl/8.5.0\r\n"
+        "Accept: */*\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\n"
+        "Content-Length: 27\r\n"
+        "\r\n"
+        "name=webserv&value=12345678";
+    std::string chunks;
+    for (int i = 0; i < 16; ++i)
+        chunks += "100\r\n" + std::string(256, static_cast<char>('a' + i)) + "\r\n";
+    fixture->chunked = "POST /upload HTTP/1.1\r\n"
+        "Host: localhost:9999\r\n"
+        "Content-Type: text/plain\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n" + chunks + "0\r\n\r\n";
+
+    // Every round is the next client of the same slot, like the server reuses them
+    std::function<void(const std::string&)> header = [fixture](const std::string& request)
+    {
+        AllocPhase phase(ALLOC_PHASE_PARSE);
+        s_client_data& data = *fixture->data;
+        data.reset("127.0.0.1");
+        data.request_buffer.assign(request);
+        if (fixture->handler.readHeader(data, request.find("\r\n\r\n")) != E_ROK)
+            throw std::runtime_error("header benchmark request was rejected");
+    };
+    header(fixture->get);
+    header(fixture->post);
+    add("request/header_get", [header, fixture](size_t iterations)
+    {
+        for (size_t i = 0; i < iterations; ++i)
+            header(fixture->get);
+    });
+    add("request/header_post", [header, fixture](size_t iterations)
+    {
+        for (size_t i = 0; i < iterations; ++i)
+            header(fixture->post);
+    });
+
+    fixture->chunked_body = fixture->chunked.find("\r\n\r\n") + 4;
+    fixture->chunked_data->request_buffer = fixture->chunked;
+    add("request/chunked_16x256", [fixture](size_t iterations)
+    {
+        AllocPhase phase(ALLOC_PHASE_PARSE);
+        s_client_data& data = *fixture->chunked_data;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            data.request_body.clear();
+            data.parse_pos = fixture->chunked_body;
+            if (fixture->handler.handleChunkedRequest(data) != E_ROK)
+                throw std::runtime_error("chunked benchmark body was rejected");
+        }
+    });
+}
+
+// A server with count locations and the requests routed through it
+struct s_router_fixture
+{
+    std::shared_ptr<Config> config;
+    std::unique_ptr<RouteTable> routes;
+    std::unique_ptr<ServerResponseValidator> validator;
+    std::vector<std::vector<std::string>> tokens;
+    std::deque<s_client_data> clients;
+};
+
+void MicroBench::registerRouterBenchmarks()
+{
+    for (size_t count : {10, 100, 1000})
+    {
+        std::shared_ptr<s_router_fixture> fixture = std::make_shared<s_router_fixture>();
+        ConfigBuilder builder;
+        builder.setRoot("/var/www");
+        builder.startLocation("/");
+        builder.endLocation();
+        for (size_t i = 1; i < count; ++i)
+        {
+            builder.startLocation("/section" + std::to_string(i));
+            builder.setLocationRoot("/section" + std::to_string(i));
+            builder.endLocation();
+        }
+        fixture->config = builder.build();
+        fixture->routes = std::make_unique<RouteTable>(fixture->config);
+        fixture->validator = std::make_unique<ServerResponseValidator>(fixture->config->getRoot());
+
+        // Hits spread over the list, the root and a path no location has
+        std::vector<std::string> paths = {"/", "/missing/page"};
+        for (size_t i = 1; i < count; i += (count + 13) / 14)
+            paths.push_back("/section" + std::to_string(i));
+        for (const std::string& path : paths)
+        {
+            fixture->tokens.push_back(splitPath(path));
+            fixture->clients.emplace_back(fixture->config);
+            fixture->clients.back().request_source = fixture->clients.back().arena.copy(path);
+        }
+        add("router/check_locations_" + std::to_string(count), [fixture](size_t iterations)
+        {
+            AllocPhase phase(ALLOC_PHASE_ROUTE);
+            const RouteTable& routes = *fixture->routes;
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                size_t request = i % fixture->tokens.size();
+                std::string file_path;
+                t_route_iterator location_it = routes.begin();
+                fixture->validator->checkLocations(routes, fixture->tokens[request], file_path, location_it, fixture->clients[request]);
+            }
+        });
+    }
+}
+
+// A response handler of an empty server, for the helpers that do not touch its state
+struct s_response_fixture
+{
+    std::shared_ptr<Config> config = ConfigBuilder().build();
+    ServerResponseHandler handler{config->getRoot(), config->getErrorPages()};
+    std::vector<std::string> files;
+    std::vector<std::string> sources;
+};
+
+// A static site served to one end of a socket pair, the other end is read empty after each response
+struct s_static_fixture
+{
+    std::shared_ptr<Config> config;
+    std::unique_ptr<RouteTable> routes;
+    std::unique_ptr<ServerResponseHandler> handler;
+    std::unique_ptr<ServerRequestHandler> requests;
+    s_client_data* data = nullptr;
+    int fds[2] = {-1, -1};
+
+    ~s_static_fixture()
+    {
+        for (int fd : fds)
+        {
+            if (fd != -1)
+                close(fd);
+        }
+    }
+};
+
+void MicroBench::registerResponseBenchmarks()
+{
+    std::shared_ptr<s_response_fixture> fixture = std::make_shared<s_response_fixture>();
+    fixture->files = {"/var/www/index.html", "/var/www/css/main.css", "/var/www/js/app.js", "/var/www/img/logo.png",
+        "/var/www/img/photo.jpeg", "/var/www/api/data.json", "/var/www/cgi-bin/script.py", "/var/www/README"};
+    fixture->sources = {"/", "/index.html", "/images/logo.png", "/api/v1/users/42/profile", "/a/b/c/d/e/f/g/h.txt"};
+
+    add("response/get_content_type", [fixture](size_t iterations)
+    {
+        AllocPhase phase(ALLOC_PHASE_RESPOND);
+        for (size_t i = 0; i < iterations; ++i)
+            fixture->handler.getContentType(fixture->files[i % fixture->files.size()]);
+    });
+    add("response/source_chunker", [fixture](size_t iterations)
+    {
+        AllocPhase phase(ALLOC_PHASE_ROUTE);
+        for (size_t i = 0; i < iterations; ++i)
+            fixture->handler.sourceChunker(fixture->sources[i % fixture->sources.size()]);
+    });
+
+    // A whole GET of the index page through handleResponse, the site of webserv.conf
+    // is served from ./example so this one needs the top of the repository as working directory
+    struct stat site;
+    if (stat("example/index.html", &site) != 0)
+    {
+        std::cerr << "response/handle_static skipped, example/index.html is not in the working directory\n";
+        return;
+    }
+    std::shared_ptr<s_static_fixture> serve = std::make_shared<s_static_fixture>();
+    ConfigBuilder builder;
+    builder.setRoot("/example");
+    builder.setIndex("index.html");
+    builder.startLocation("/");
+    builder.setLocationMethods({"GET"});
+    builder.endLocation();
+    serve->config = builder.build();
+    serve->routes = std::make_unique<RouteTable>(serve->config);
+    serve->handler = std::make_unique<ServerResponseHandler>(serve->config->getRoot(), serve->config->getErrorPages());
+    serve->requests = std::make_unique<ServerRequestHandler>(serve->config->getClientMaxBodySize());
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, serve->fds) != 0)
+        throw std::runtime_error("socketpair for the static benchmark failed");
+    serve->requests->setConfigForClient(serve->config, serve->fds[0], "127.0.0.1");
+    serve->data = serve->requests->getRequest(serve->fds[0]);
+    add("response/handle_static", [serve](size_t iterations)
+    {
+        char drain[BUFFER_SIZE / 16];
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            s_client_data& data = *serve->data;
+            data.reset("127.0.0.1");
+            data.request_method = data.arena.copy("GET");
+            data.request_source = data.arena.copy("/");
+            data.http_version = data.arena.copy("HTTP/1.1");
+            if (serve->handler->handleResponse(serve->fds[0], data, *serve->routes) != SRH_OK || data.status != 200)
+                throw std::runtime_error("static benchmark request was not answered with 200");
+            while (recv(serve->fds[1], drain, sizeof(drain), MSG_DONTWAIT) > 0)
+                ;
+        }
+    });
+}
+
+// A config file and a lexer part way through it
+struct s_lexer_fixture
+{
+    std::string text;
+    std::istringstream stream;
+    std::unique_ptr<ConfigLexer> lexer;
+};
+
+void MicroBench::registerConfigBenchmarks()
+{
+    std::shared_ptr<s_lexer_fixture> fixture = std::make_shared<s_lexer_fixture>();
+    std::ostringstream text;
+    text << "server {\n    listen 9999;\n    server_name localhost;\n    root /example;\n"
+         << "    client_max_body_size 300000;\n    error_page 404 /errorPages/404.html;\n";
+    for (int i = 0; i < 50; ++i)
+    {
+        text << "    # location " << i << "\n"
+             << "    location /section" << i << " {\n"
+             << "        root /section" << i << ";\n"
+             << "        index index.html;\n"
+             << "        allow_methods GET POST;\n"
+             << "        return 301 \"/moved/" << i << "\";\n"
+             << "    }\n"
+             << "    location ~ \\.(php|py)$ {\n        cgi_ext php py;\n    }\n";
+    }
+    text << "}\n";
+    fixture->text = text.str();
+    fixture->stream.str(fixture->text);
+    fixture->lexer = std::make_unique<ConfigLexer>(fixture->stream);
+
+    add("config/lexer_next_token", [fixture](size_t iterations)
+    {
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            Token token = fixture->lexer->nextToken();
+            if (token.type == TokenType::INVALID)
+                throw std::runtime_error("lexer benchmark config has an invalid token: " + token.value);
+            if (token.type == TokenType::END_OF_FILE)
+            {
+                fixture->stream.clear();
+                fixture->stream.seekg(0);
+                fixture->lexer = std::make_unique<ConfigLexer>(fixture->stream);
+            }
+        }
+    });
+}
\ No newline at end of file
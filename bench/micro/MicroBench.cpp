@@ -0,0 +1,288 @@
+#include "MicroBench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <new>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+#ifndef ALLOC_PROFILE
+// Only the benchmark thread allocates while a round runs, the logger is never started
+static uint64_t g_allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++g_allocations;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+#endif
+
+MicroBench::MicroBench()
+    : cycle_source_(CYCLES_NONE)
+    , perf_fd_(-1)
+{
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (perf_fd_ != -1)
+        cycle_source_ = CYCLES_PERF;
+#if defined(__x86_64__) || defined(__i386__)
+    else
+        cycle_source_ = CYCLES_TSC;
+#endif
+}
+
+MicroBench::~MicroBench()
+{
+    if (perf_fd_ != -1)
+        close(perf_fd_);
+}
+
+uint64_t MicroBench::allocations()
+{
+#ifdef ALLOC_PROFILE
+    s_alloc_counts counts = AllocProfile::snapshot();
+    uint64_t total = 0;
+    for (uint64_t phase : counts.allocations)
+        total += phase;
+    return total;
+#else
+    return g_allocations;
+#endif
+}
+
+void MicroBench::add(const std::string& name, t_micro_body body)
+{
+    cases_.push_back({name, body});
+}
+
+void MicroBench::registerAll()
+{
+    registerRequestBenchmarks();
+    registerRouterBenchmarks();
+    registerResponseBenchmarks();
+    registerConfigBenchmarks();
+}
+
+uint64_t MicroBench::cycles() const
+{
+    if (cycle_source_ == CYCLES_PERF)
+    {
+        uint64_t value = 0;
+        if (read(perf_fd_, &value, sizeof(value)) != sizeof(value))
+            return 0;
+        return value;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (cycle_source_ == CYCLES_TSC)
+        return __rdtsc();
+#endif
+    return 0;
+}
+
+std::vector<s_micro_result> MicroBench::run(const std::string& filter, double round_ms, size_t rounds)
+{
+    std::vector<s_micro_result> results;
+    for (const s_micro_case& micro : cases_)
+    {
+        if (micro.name.find(filter) == std::string::npos)
+            continue;
+        results.push_back(measure(micro, round_ms, rounds));
+        std::fprintf(stderr, "%-40s %12.1f ns/op\n", micro.name.c_str(), results.back().ns_per_op);
+    }
+    return results;
+}
+
+s_micro_result MicroBench::measure(const s_micro_case& micro, double round_ms, size_t rounds)
+{
+    typedef std::chrono::steady_clock clock;
+
+    // Grow the iterations until one round takes long enough to time it well
+    size_t iterations = 1;
+    while (true)
+    {
+        clock::time_point start = clock::now();
+        micro.body(iterations);
+        double elapsed_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        if (elapsed_ms >= round_ms || iterations >= (1UL << 30))
+            break;
+        double wanted = elapsed_ms <= 0.0 ? iterations * 10.0 : iterations * round_ms * 1.2 / elapsed_ms;
+        iterations = static_cast<size_t>(std::min(std::max(wanted, iterations * 2.0), iterations * 10.0));
+    }
+    micro.body(iterations);
+
+    std::vector<s_micro_result> samples;
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        s_alloc_counts phases_before = AllocProfile::snapshot();
+        uint64_t allocations_before = allocations();
+        uint64_t cycles_before = cycles();
+        clock::time_point start = clock::now();
+        micro.body(iterations);
+        clock::time_point end = clock::now();
+        uint64_t cycles_after = cycles();
+        uint64_t allocations_after = allocations();
+        s_alloc_counts phases_after = AllocProfile::snapshot();
+
+        s_micro_result sample;
+        sample.name = micro.name;
+        sample.iterations = iterations;
+        sample.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(iterations);
+        sample.allocs_per_op = static_cast<double>(allocations_after - allocations_before) / static_cast<double>(iterations);
+        for (size_t phase = 0; phase < ALLOC_PHASE_COUNT; ++phase)
+            sample.phase_allocs_per_op[phase] = static_cast<double>(phases_after.allocations[phase] - phases_before.allocations[phase]) / static_cast<double>(iterations);
+        if (cycle_source_ != CYCLES_NONE)
+            sample.cycles_per_op = static_cast<double>(cycles_after - cycles_before) / static_cast<double>(iterations);
+        samples.push_back(sample);
+    }
+    std::sort(samples.begin(), samples.end(),
+        [](const s_micro_result& a, const s_micro_result& b) { return a.ns_per_op < b.ns_per_op; });
+    return samples[samples.size() / 2];
+}
+
+void MicroBench::writeJson(std::ostream& out, const std::vector<s_micro_result>& results) const
+{
+    static const char* const sources[] = {"none", "perf", "tsc"};
+    char line[512];
+    out << "{\n  \"cycles\": \"" << sources[cycle_source_] << "\",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const s_micro_result& result = results[i];
+        char cycles[32] = "null";
+        if (result.cycles_per_op >= 0.0)
+            std::snprintf(cycles, sizeof(cycles), "%.1f", result.cycles_per_op);
+        std::snprintf(line, sizeof(line),
+            "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"allocs_per_op\": %.3f, \"cycles_per_op\": %s",
+            result.name.c_str(), static_cast<unsigned long long>(result.iterations), result.ns_per_op,
+            result.allocs_per_op, cycles);
+        out << line;
+        if (AllocProfile::enabled)
+        {
+            out << ", \"allocs_by_phase\": {";
+            for (size_t phase = 0; phase < ALLOC_PHASE_COUNT; ++phase)
+            {
+                std::snprintf(line, sizeof(line), "%s\"%s\": %.3f", phase == 0 ? "" : ", ",
+                    AllocProfile::name(static_cast<e_alloc_phase>(phase)), result.phase_allocs_per_op[phase]);
+                out << line;
+            }
+            out << "}";
+        }
+        out << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    out << "  ]\n}\n";
+}
+
+/**
+ * @brief reads the number after "key": on a line of writeJson, null gives -1
+ */
+static double jsonNumber(const std::string& line, const std::string& key)
+{
+    size_t pos = line.find("\"" + key + "\": ");
+    if (pos == std::string::npos)
+        return -1.0;
+    pos += key.size() + 4;
+    if (line.compare(pos, 4, "null") == 0)
+        return -1.0;
+    return std::strtod(line.c_str() + pos, nullptr);
+}
+
+bool MicroBench::readJson(const std::string& path, std::vector<s_micro_result>& results)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+    std::string line;
+    const std::string name_key = "{\"name\": \"";
+    while (std::getline(file, line))
+    {
+        size_t name = line.find(name_key);
+        if (name == std::string::npos)
+            continue;
+        name += name_key.size();
+        s_micro_result result;
+        result.name = line.substr(name, line.find('"', name) - name);
+        result.iterations = static_cast<uint64_t>(jsonNumber(line, "iterations"));
+        result.ns_per_op = jsonNumber(line, "ns_per_op");
+        result.allocs_per_op = jsonNumber(line, "allocs_per_op");
+        result.cycles_per_op = jsonNumber(line, "cycles_per_op");
+        results.push_back(result);
+    }
+    return true;
+}
+
+size_t MicroBench::compare(std::ostream& out, const std::vector<s_micro_result>& before, const std::vector<s_micro_result>& after, double threshold)
+{
+    char line[256];
+    size_t regressions = 0;
+    std::snprintf(line, sizeof(line), "%-40s %12s %12s %9s %10s %10s\n", "benchmark", "ns/op before", "after", "change", "allocs/op", "after");
+    out << line;
+    for (const s_micro_result& now : after)
+    {
+        std::vector<s_micro_result>::const_iterator then = std::find_if(before.begin(), before.end(),
+            [&now](const s_micro_result& result) { return result.name == now.name; });
+        if (then == before.end())
+        {
+            std::snprintf(line, sizeof(line), "%-40s %12s %12.1f %9s %10s %10.2f  new\n", now.name.c_str(), "-", now.ns_per_op, "-", "-", now.allocs_per_op);
+            out << line;
+            continue;
+        }
+        double change = then->ns_per_op > 0.0 ? (now.ns_per_op - then->ns_per_op) * 100.0 / then->ns_per_op : 0.0;
+        // Allocation counts do not jitter, any growth is real
+        bool regressed = change > threshold || now.allocs_per_op > then->allocs_per_op + 0.005;
+        if (regressed)
+            ++regressions;
+        std::snprintf(line, sizeof(line), "%-40s %12.1f %12.1f %+8.1f%% %10.2f %10.2f%s\n", now.name.c_str(), then->ns_per_op,
+            now.ns_per_op, change, then->allocs_per_op, now.allocs_per_op, regressed ? "  REGRESSION" : "");
+        out << line;
+    }
+    for (const s_micro_result& then : before)
+    {
+        bool kept = std::any_of(after.begin(), after.end(), [&then](const s_micro_result& result) { return result.name == then.name; });
+        if (!kept)
+        {
+            std::snprintf(line, sizeof(line), "%-40s %12.1f %12s %9s %10.2f %10s  gone\n", then.name.c_str(), then.ns_per_op, "-", "-", then.allocs_per_op, "-");
+            out << line;
+        }
+    }
+    out << regressions << (regressions == 1 ? " regression" : " regressions") << " (ns/op over " << threshold << "% or more allocations)\n";
+    return regressions;
+}
\ No newline at end of file
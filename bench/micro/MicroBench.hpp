@@ -0,0 +1,113 @@
+#ifndef MICRO_BENCH_HPP
+# define MICRO_BENCH_HPP
+
+# include <array>
+# include <cstddef>
+# include <cstdint>
+# include <functional>
+# include <memory>
+# include <ostream>
+# include <string>
+# include <vector>
+# include "server/AllocProfile.hpp"
+
+// How cycles are counted, perf counts the cycles of the core, the TSC ticks at a fixed rate
+enum e_cycle_source
+{
+    CYCLES_NONE,
+    CYCLES_PERF,
+    CYCLES_TSC
+};
+
+// Does iterations operations of a benchmark
+typedef std::function<void(size_t iterations)> t_micro_body;
+
+struct s_micro_case
+{
+    std::string name;
+    t_micro_body body;
+};
+
+// What a benchmark measured, the median of its rounds
+struct s_micro_result
+{
+    std::string name;
+    uint64_t iterations = 0;        // per round
+    double ns_per_op = 0.0;
+    double allocs_per_op = 0.0;
+    std::array<double, ALLOC_PHASE_COUNT> phase_allocs_per_op{}; // only counted in a make allocprof build
+    double cycles_per_op = -1.0;    // -1 when cycles can not be counted
+};
+
+/**
+ * @brief Repeatable microbenchmarks of the hot paths of the server
+ *
+ * Each case is calibrated until a round takes the round time, warmed up
+ * once and then run for a number of rounds. The round with the median
+ * time is reported with its allocations and cycles per operation. The
+ * operator new of the program counts allocations, cycles come from a perf
+ * counter when the kernel allows it and from the TSC otherwise. Built with
+ * ALLOC_PROFILE the operator new of the server counts instead, and the
+ * allocations are also split by the phase of the request they were made in.
+ *
+ * A friend of the request and response handlers, so their private parsers
+ * can be timed without going through a socket.
+ */
+class MicroBench
+{
+    public:
+        MicroBench();
+        ~MicroBench();
+
+        /**
+         * @brief registers the benchmarks of the server
+         */
+        void registerAll();
+
+        /**
+         * @brief runs the benchmarks whose name holds filter
+         * @param filter part of a name, empty runs all of them
+         * @param round_ms how long a round should take
+         * @param rounds measured rounds per benchmark
+         */
+        std::vector<s_micro_result> run(const std::string& filter, double round_ms, size_t rounds);
+
+        /**
+         * @brief writes results as JSON, one benchmark per line
+         */
+        void writeJson(std::ostream& out, const std::vector<s_micro_result>& results) const;
+
+        /**
+         * @brief reads results that writeJson wrote
+         * @return false if the file can not be read
+         */
+        static bool readJson(const std::string& path, std::vector<s_micro_result>& results);
+
+        /**
+         * @brief prints how the benchmarks of two runs differ
+         * @param threshold percent ns/op may grow before it is a regression
+         * @return the number of regressions, more allocations per operation count too
+         */
+        static size_t compare(std::ostream& out, const std::vector<s_micro_result>& before, const std::vector<s_micro_result>& after, double threshold);
+
+        /**
+         * @return allocations made by the program so far
+         */
+        static uint64_t allocations();
+
+    private:
+        std::vector<s_micro_case> cases_;
+        e_cycle_source cycle_source_;
+        int perf_fd_;
+
+        void add(const std::string& name, t_micro_body body);
+        uint64_t cycles() const;
+        s_micro_result measure(const s_micro_case& micro, double round_ms, size_t rounds);
+
+        void registerRequestBenchmarks();
+        void registerRouterBenchmarks();
+        void registerResponseBenchmarks();
+        void registerConfigBenchmarks();
+};
+
+#endif
\ No newline at end of file
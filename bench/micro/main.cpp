@@ -0,0 +1,104 @@
+#include "MicroBench.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+static void usage()
+{
+    std::cerr << "usage: webserv-microbench [--filter NAME] [--round-ms MS] [--rounds N] [--out FILE]\n"
+              << "       webserv-microbench --compare BEFORE.json AFTER.json [--threshold PERCENT]\n"
+              << "  --filter      only benchmarks whose name holds NAME\n"
+              << "  --round-ms    time of one measured round (100)\n"
+              << "  --rounds      measured rounds, the median is reported (5)\n"
+              << "  --out         write the JSON to FILE instead of stdout\n"
+              << "  --compare     diff two runs, exits 1 if a benchmark regressed\n"
+              << "  --threshold   percent ns/op may grow before it is a regression (5)\n";
+}
+
+/**
+ * @brief reads a number above 0 of an option
+ * @return false if it is no number or not above 0
+ */
+static bool parsePositive(const char* text, double& value)
+{
+    char* end = nullptr;
+    value = std::strtod(text, &end);
+    return *end == '\0' && value > 0.0;
+}
+
+static int compareRuns(const std::string& before_path, const std::string& after_path, double threshold)
+{
+    std::vector<s_micro_result> before;
+    std::vector<s_micro_result> after;
+    if (!MicroBench::readJson(before_path, before) || !MicroBench::readJson(after_path, after))
+    {
+        std::cerr << "webserv-microbench: can not read " << before_path << " or " << after_path << "\n";
+        return 2;
+    }
+    return MicroBench::compare(std::cout, before, after, threshold) == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    std::string out_path;
+    std::string before;
+    std::string after;
+    double round_ms = 100.0;
+    double rounds = 5.0;
+    double threshold = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--compare" && i + 2 < argc)
+        {
+            before = argv[++i];
+            after = argv[++i];
+        }
+        else if (option == "--filter" && has_value)
+            filter = argv[++i];
+        else if (option == "--out" && has_value)
+            out_path = argv[++i];
+        else if ((option == "--round-ms" && has_value && parsePositive(argv[i + 1], round_ms))
+            || (option == "--rounds" && has_value && parsePositive(argv[i + 1], rounds))
+            || (option == "--threshold" && has_value && parsePositive(argv[i + 1], threshold)))
+            ++i;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (!before.empty())
+        return compareRuns(before, after, threshold);
+
+    MicroBench bench;
+    std::vector<s_micro_result> results;
+    try
+    {
+        bench.registerAll();
+        results = bench.run(filter, round_ms, static_cast<size_t>(rounds));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "webserv-microbench: " << e.what() << "\n";
+        return 2;
+    }
+    if (out_path.empty())
+    {
+        bench.writeJson(std::cout, results);
+        return 0;
+    }
+    std::ofstream out(out_path);
+    bench.writeJson(out, results);
+    if (!out)
+    {
+        std::cerr << "webserv-microbench: can not write " << out_path << "\n";
+        return 2;
+    }
+    return 0;
+}
\ No newline at end of file
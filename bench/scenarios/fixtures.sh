@@ -0,0 +1,147 @@
+#!/usr/bin/env bash
+# Generates the files the scenarios serve into a work directory, the same
+# tree for the same settings, so runs on different commits compare.
+#
+# usage: fixtures.sh WORK_DIR
+#
+# Sizes come from the environment:
+#   SMALL_FILES     small static files, spread over 100 directories (10000)
+#   SMALL_SIZE      bytes of the largest small file, sizes cycle up to it (4096)
+#   LARGE_FILES     huge static files (4)
+#   LARGE_SIZE_MB   megabytes of each huge file (64)
+#   DEEP_LEVELS     nesting of the deep location hierarchy (16)
+#   DEEP_SIBLINGS   locations next to each level of the hierarchy (8)
+#   REGEX_ROUTES    regex locations of the regex routing scenario (200)
+set -euo pipefail
+
+WORK=${1:?usage: fixtures.sh WORK_DIR}
+SMALL_FILES=${SMALL_FILES:-10000}
+SMALL_SIZE=${SMALL_SIZE:-4096}
+LARGE_FILES=${LARGE_FILES:-4}
+LARGE_SIZE_MB=${LARGE_SIZE_MB:-64}
+DEEP_LEVELS=${DEEP_LEVELS:-16}
+DEEP_SIBLINGS=${DEEP_SIBLINGS:-8}
+REGEX_ROUTES=${REGEX_ROUTES:-200}
+
+SETTINGS="$SMALL_FILES $SMALL_SIZE $LARGE_FILES $LARGE_SIZE_MB $DEEP_LEVELS $DEEP_SIBLINGS $REGEX_ROUTES"
+if [ -f "$WORK/.fixtures" ] && [ "$(cat "$WORK/.fixtures")" = "$SETTINGS" ]; then
+    exit 0  # Already generated with these settings
+fi
+rm -rf "$WORK/www" "$WORK/generated"
+mkdir -p "$WORK/www/small" "$WORK/www/large" "$WORK/www/deep" "$WORK/www/regex" "$WORK/www/cgi" "$WORK/generated"
+WWW="$WORK/www"
+GEN="$WORK/generated"
+
+# Fills a file with a repeating pattern
+fill() {
+    yes 'webserv benchmark fixture 0123456789abcdefghijklmnopqrstuvwxyz' | head -c "$2" > "$1" || true
+}
+
+echo "fixtures: $SMALL_FILES small files"
+# Cut from one string in the shell, a process per file would take minutes
+pattern=""
+while [ ${#pattern} -lt $((64 + SMALL_SIZE)) ]; do
+    pattern+="webserv benchmark fixture 0123456789abcdefghijklmnopqrstuvwxyz"$'\n'
+done
+for ((dir = 0; dir < 100; dir++)); do
+    mkdir -p "$WWW/small/$(printf 'd%02d' "$dir")"
+done
+: > "$GEN/static_small.requests"
+for ((i = 0; i < SMALL_FILES; i++)); do
+    path=$(printf 'small/d%02d/f%05d.html' $((i % 100)) "$i")
+    printf '%s' "${pattern:0:$((64 + (i * 997) % SMALL_SIZE))}" > "$WWW/$path"
+    echo "GET /$path" >> "$GEN/static_small.requests"
+done
+
+echo "fixtures: $LARGE_FILES files of ${LARGE_SIZE_MB}MB"
+: > "$GEN/static_large.requests"
+for ((i = 0; i < LARGE_FILES; i++)); do
+    fill "$WWW/large/huge$i.bin" $((LARGE_SIZE_MB * 1024 * 1024))
+    echo "GET /large/huge$i.bin" >> "$GEN/static_large.requests"
+done
+
+# Locations only answer their own path with their index, every level of the
+# hierarchy is a location of its own, with siblings the router has to skip
+echo "fixtures: location hierarchy of $DEEP_LEVELS levels"
+{
+    echo "server {"
+    echo "    listen      @PORT@;"
+    echo "    server_name localhost;"
+    echo "    root        /www;"
+    echo "    index       index.html;"
+    echo ""
+    echo "    location / {"
+    echo "        allow_methods GET;"
+    echo "    }"
+} > "$GEN/deep_locations.conf.in"
+: > "$GEN/deep_locations.requests"
+prefix=""
+for ((level = 0; level < DEEP_LEVELS; level++)); do
+    for ((sibling = 0; sibling <= DEEP_SIBLINGS; sibling++)); do
+        path="$prefix/l${level}s${sibling}"
+        mkdir -p "$WWW/deep$path"
+        fill "$WWW/deep$path/index.html" 512
+        {
+            echo "    location $path {"
+            echo "        root          /deep$path;"
+            echo "        index         index.html;"
+            echo "        allow_methods GET;"
+            echo "    }"
+        } >> "$GEN/deep_locations.conf.in"
+        echo "GET $path" >> "$GEN/deep_locations.requests"
+    done
+    prefix="$prefix/l${level}s0"
+done
+echo "}" >> "$GEN/deep_locations.conf.in"
+
+# Every request is checked against every regex location
+echo "fixtures: $REGEX_ROUTES regex locations"
+{
+    echo "server {"
+    echo "    listen      @PORT@;"
+    echo "    server_name localhost;"
+    echo "    root        /www;"
+    echo "    index       index.html;"
+    echo ""
+    echo "    location / {"
+    echo "        allow_methods GET;"
+    echo "    }"
+} > "$GEN/regex_routing.conf.in"
+: > "$GEN/regex_routing.requests"
+for ((route = 0; route < REGEX_ROUTES; route++)); do
+    name=$(printf 'r%04d' "$route")
+    mkdir -p "$WWW/regex/$name"
+    fill "$WWW/regex/$name/item-$route.html" 512
+    {
+        echo "    location ~ ^/$name/item-[0-9]+\\.html\$ {"
+        echo "        root          /regex;"
+        echo "        allow_methods GET;"
+        echo "    }"
+    } >> "$GEN/regex_routing.conf.in"
+    echo "GET /$name/item-$route.html" >> "$GEN/regex_routing.requests"
+done
+echo "}" >> "$GEN/regex_routing.conf.in"
+
+echo "fixtures: cgi scripts"
+cat > "$WWW/cgi/hello.py" <<'PY'
+import os
+body = "hello from python, query " + os.environ.get("QUERY_STRING", "") + "\n"
+print("Content-Type: text/plain")
+print()
+print(body, end="")
+PY
+cat > "$WWW/cgi/hello.sh" <<'SH'
+echo "Content-Type: text/plain"
+echo
+echo "hello from bash"
+SH
+# Drains the body of an upload and answers with its size
+cat > "$WWW/cgi/upload.sh" <<'SH'
+size=$(head -c "${CONTENT_LENGTH:-0}" | wc -c)
+echo "Content-Type: text/plain"
+echo
+echo "received $size bytes"
+SH
+fill "$WWW/index.html" 1024
+
+echo "$SETTINGS" > "$WORK/.fixtures"
@@ -0,0 +1,170 @@
+#!/usr/bin/env bash
+# Runs benchmark scenarios end to end: generates the fixtures, starts webserv
+# with the config of the scenario on a free port, warms it up and runs
+# webserv-bench with the request mix of the scenario against it. Besides the
+# report of webserv-bench it prints what the server process used: its
+# resident memory and the CPU time per answered request.
+#
+# usage: run.sh [scenario...]     all scenarios without one
+#
+# Settings come from the environment:
+#   BENCH_ARGS   options of webserv-bench ("-c 32 -d 10")
+#   BENCH_WORK   directory of the fixtures and the server (/tmp/webserv-scenarios)
+#   WARMUP       seconds of load before the measured run (2)
+# and the sizes of fixtures.sh.
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+REPO=$(cd "$HERE/../.." && pwd)
+BENCH_ARGS=${BENCH_ARGS:--c 32 -d 10}
+WORK=${BENCH_WORK:-/tmp/webserv-scenarios}
+WARMUP=${WARMUP:-2}
+PYTHON=${PYTHON:-$(command -v python3 || echo /usr/bin/python3)}
+BASH_PATH=${BASH_PATH:-$(command -v bash)}
+ALL="static_small static_large deep_locations regex_routing cgi_mix upload idle_connections"
+CLK_TCK=$(getconf CLK_TCK)
+
+for binary in webserv webserv-bench; do
+    if [ ! -x "$REPO/$binary" ]; then
+        echo "run.sh: $REPO/$binary is missing, run make and make bench first" >&2
+        exit 1
+    fi
+done
+
+# A port nothing listens on, picked at random so parallel runs do not collide.
+# It stays below the range of local ports, the connections of webserv-bench
+# leave thousands of those in TIME_WAIT
+free_port() {
+    local port low
+    read -r low _ < /proc/sys/net/ipv4/ip_local_port_range
+    for _ in $(seq 100); do
+        port=$((10000 + RANDOM % (low - 10000)))
+        if ! (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            echo "$port"
+            return 0
+        fi
+    done
+    echo "run.sh: no free port found" >&2
+    return 1
+}
+
+# Looks for a file of the scenario next to this script, then in the generated ones
+scenario_file() {
+    if [ -f "$HERE/$1$2" ]; then
+        echo "$HERE/$1$2"
+    elif [ -f "$WORK/generated/$1$2.in" ]; then
+        echo "$WORK/generated/$1$2.in"
+    elif [ -f "$WORK/generated/$1$2" ]; then
+        echo "$WORK/generated/$1$2"
+    else
+        echo "run.sh: scenario $1 has no $2 file" >&2
+        return 1
+    fi
+}
+
+# utime stime cutime cstime of a process in clock ticks, the name may hold spaces
+cpu_ticks() {
+    sed 's/.*) //' "/proc/$1/stat" | awk '{print $12, $13, $14, $15}'
+}
+
+# A field of /proc/PID/status in kB
+status_kb() {
+    awk -v field="$2:" '$1 == field {print $2}' "/proc/$1/status"
+}
+
+stop_server() {
+    if [ -n "${SERVER_PID:-}" ] && kill -0 "$SERVER_PID" 2>/dev/null; then
+        kill "$SERVER_PID"
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    SERVER_PID=""
+}
+trap stop_server EXIT
+
+"$HERE/fixtures.sh" "$WORK"
+
+SUMMARY=""
+for scenario in ${@:-$ALL}; do
+    config=$(scenario_file "$scenario" .conf)
+    # A scenario can bring its own options, with -i it holds idle connections instead of a request mix
+    args=$BENCH_ARGS
+    if [ -f "$HERE/$scenario.args" ]; then
+        args=$(grep -v '^#' "$HERE/$scenario.args")
+    fi
+    mix=()
+    if [[ " $args " != *" -i "* ]]; then
+        mix=(-f "$(scenario_file "$scenario" .requests)")
+    fi
+    started=""
+    for attempt in 1 2 3; do
+        port=$(free_port)
+        sed -e "s|@PORT@|$port|g" -e "s|@PYTHON@|$PYTHON|g" -e "s|@BASH@|$BASH_PATH|g" \
+            "$config" > "$WORK/$scenario.conf"
+
+        # Roots in the configs are relative to the directory webserv runs in
+        (cd "$WORK" && exec "$REPO/webserv" "$WORK/$scenario.conf" > "$WORK/$scenario.out" 2>&1) &
+        SERVER_PID=$!
+        for _ in $(seq 50); do
+            if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+                started=1
+                break 2
+            fi
+            if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+                break  # Someone took the port in between, try another one
+            fi
+            sleep 0.1
+        done
+        stop_server
+    done
+    if [ -z "$started" ]; then
+        echo "run.sh: webserv did not start for $scenario:" >&2
+        cat "$WORK/$scenario.out" >&2
+        exit 1
+    fi
+
+    url="http://127.0.0.1:$port/"
+    if [ ${#mix[@]} -eq 0 ]; then
+        args+=" -P $SERVER_PID"
+    fi
+    # Not for idle connections, they would find the freed memory of the warm up and cost nothing
+    if [ "$WARMUP" != 0 ] && [ ${#mix[@]} -ne 0 ]; then
+        "$REPO/webserv-bench" $args -d "$WARMUP" "${mix[@]}" "$url" > /dev/null
+    fi
+    rss_start=$(status_kb "$SERVER_PID" VmRSS)
+    read -r user_start system_start child_user_start child_system_start < <(cpu_ticks "$SERVER_PID")
+
+    echo "== $scenario"
+    report=$("$REPO/webserv-bench" $args "${mix[@]}" "$url")
+    echo "$report"
+
+    read -r user_end system_end child_user_end child_system_end < <(cpu_ticks "$SERVER_PID")
+    rss_end=$(status_kb "$SERVER_PID" VmRSS)
+    rss_peak=$(status_kb "$SERVER_PID" VmHWM)
+    stop_server
+
+    answered=$(echo "$report" | awk '$1 == "answered" {print $2}')
+    rate=$(echo "$report" | awk '$1 == "answered" {sub("/s", "", $5); print $5}')
+    errors=$(echo "$report" | awk '$1 == "errors" {print $2} $1 == "open" {print $(NF - 3)}')
+    per_connection=$(echo "$report" | awk '/bytes per connection/ {print $(NF - 3) "B"}')
+    p50=$(echo "$report" | awk '$1 == "50%" {print $2}')
+    p99=$(echo "$report" | awk '$1 == "99%" {print $2}')
+    p999=$(echo "$report" | awk '$1 == "99.9%" {print $2}')
+    # CPU of the server and of the CGI scripts it waited for, per answered request
+    per_request() {
+        awk -v ticks="$1" -v hz="$CLK_TCK" -v n="$answered" \
+            'BEGIN { if (n > 0) printf "%.1f", ticks / hz * 1000000 / n; else printf "-" }'
+    }
+    cpu_user=$(per_request $((user_end - user_start)))
+    cpu_system=$(per_request $((system_end - system_start)))
+    cpu=$(per_request $((user_end - user_start + system_end - system_start)))
+    cpu_cgi=$(per_request $((child_user_end - child_user_start + child_system_end - child_system_start)))
+    echo "  server"
+    echo "    rss       ${rss_start}kB before, ${rss_end}kB after, ${rss_peak}kB peak"
+    echo "    cpu       ${cpu}us/request (user ${cpu_user}us, system ${cpu_system}us), cgi ${cpu_cgi}us/request"
+    echo
+    SUMMARY+=$(printf '%-16s %10s %7s %10s %10s %10s %10s %10s %9s %9s' "$scenario" "${rate:--}" "$errors" \
+        "${p50:--}" "${p99:--}" "${p999:--}" "$((rss_peak / 1024))MB" "${cpu}us" "${cpu_cgi}us" "${per_connection:--}")$'\n'
+done
+
+printf '%-16s %10s %7s %10s %10s %10s %10s %10s %9s %9s\n' scenario "req/s" errors p50 p99 p99.9 "rss peak" "cpu/req" "cgi/req" "mem/conn"
+printf '%s' "$SUMMARY"
@@ -62,6 +62,61 @@ public:
      */
     const std::vector<std::shared_ptr<Location>>& getLocations() const { return locations_; }
 
+    /**
+     * @return List of all upstream groups defined in this server block
+     */
+    const std::vector<std::shared_ptr<Upstream>>& getUpstreams() const { return upstreams_; }
+
+    /**
+     * @return Path of the access log, empty when requests are not logged
+     */
+    const std::string& getAccessLogPath() const { return access_log_path_; }
+
+    /**
+     * @return true if access log records are JSON, false for the compact text format
+     */
+    bool isAccessLogJson() const { return access_log_json_; }
+
+    /**
+     * @return Share of the requests that is logged, between 0 and 1
+     */
+    double getAccessLogSample() const { return access_log_sample_; }
+
+    /**
+     * @return Path of the error log, empty for the default logs/error.log
+     */
+    const std::string& getErrorLogPath() const { return error_log_path_; }
+
+    /**
+     * @return Highest LOG_LEVEL_* written to the error log
+     */
+    int getErrorLogLevel() const { return error_log_level_; }
+
+    /**
+     * @return Requests the request trace keeps, 0 when tracing is off
+     */
+    size_t getRequestTrace() const { return request_trace_; }
+
+    /**
+     * @return Milliseconds after which a request is logged as slow, 0 when off
+     */
+    uint64_t getSlowRequestThreshold() const { return slow_request_threshold_; }
+
+    /**
+     * @return Slow requests logged per second at most
+     */
+    size_t getSlowRequestRate() const { return slow_request_rate_; }
+
+    /**
+     * @return Seconds open requests get to finish when the server stops or is upgraded
+     */
+    uint64_t getShutdownTimeout() const { return shutdown_timeout_; }
+
+    /**
+     * @return Worker processes to fork, 0 to serve in one process, -1 for one per CPU
+     */
+    int getWorkerProcesses() const { return worker_processes_; }
+
 private:
     // Only ConfigBuilder can modify the configuration to ensure consistency
     friend class ConfigBuilder;
@@ -78,6 +133,31 @@ private:
 
     // List of location blocks defining URL-specific behaviors
     std::vector<std::shared_ptr<Location>> locations_;
+
+    // Named groups of backend servers proxy_pass can refer to
+    std::vector<std::shared_ptr<Upstream>> upstreams_;
+
+    // One record per request, off unless a path is set
+    std::string access_log_path_;
+    bool access_log_json_ = false;
+    double access_log_sample_ = 1.0;
+
+    // Error log of the process, the first server block that sets it wins
+    std::string error_log_path_;
+    int error_log_level_ = 0;   // LOG_LEVEL_ERROR
+
+    // Phase timestamps of the last requests, also for the whole process
+    size_t request_trace_ = 0;
+
+    // Requests slower than the threshold are logged in detail, a few per second at most
+    uint64_t slow_request_threshold_ = 0;
+    size_t slow_request_rate_ = 10;
+
+    // Time to drain on SIGTERM, SIGQUIT or an upgrade, the longest of all servers is used
+    uint64_t shutdown_timeout_ = 30;
+
+    // Workers of a master process, like the error log the first server block that sets it wins
+    int worker_processes_ = 0;
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,9 @@
 # define MAX_EVENTS 1024
 # define TIMEOUT_MS 20000 // 20 seconds
 # define EPOLL_WAIT_TIME 10000 // 10 seconds
+# define UPGRADE_LISTEN_ENV "WEBSERV_LISTEN_FDS" // address:port=fd;... sockets handed to a new binary
+# define UPGRADE_READY_ENV "WEBSERV_READY_FD" // pipe the new binary writes to once it accepts
+# define WORKER_RESPAWN_MS 1000 // a worker that dies sooner after its start waits this long to start again
 
 # include "Config.hpp"
 # include <string>
@@ -14,7 +17,12 @@
 # include "server/ServerValidator.hpp"
 # include "server/ServerRequestHandler.hpp"
 # include "server/ServerResponseHandler.hpp"
+# include "log/AccessLog.hpp"
+# include "log/SlowRequestLog.hpp"
 # include <arpa/inet.h>
+# include <chrono>
+# include <deque>
+# include <list>
 
 struct configInfo
 {
@@ -24,29 +32,72 @@ struct configInfo
     std::shared_ptr<Config> config_;
     std::string root_folder_;
     std::string main_index_;
-    std::vector<std::shared_ptr<Location>> locations_;
+    RouteTable routes_; // routing of the server, a reload builds new servers with tables of their own
     std::map<uint16_t, std::string> error_pages_;
     int server_fd_;
     std::string server_name_;
     uint16_t port_;
+    AccessLog access_log_;
+    SlowRequestLog slow_log_;
+    bool retired_ = false; // replaced by a reload, finishes its clients without listening
+};
+
+// What a drain found and did, logged when the server stops
+struct s_drain_summary
+{
+    const char* reason = nullptr;                  // "shutdown" or "upgrade"
+    std::chrono::steady_clock::time_point started;
+    size_t idle = 0;                               // connections that sent nothing yet, closed right away
+    size_t active = 0;                             // requests left to finish
+    int64_t scripts = 0;                           // CGI scripts running
+    size_t forced = 0;                             // requests still open at the shutdown timeout
+};
+
+// A worker process of the master, see Server::masterLoop
+struct s_worker
+{
+    pid_t pid = -1;                                 // -1 while it waits to be started again
+    int cpu = -1;                                   // CPU it is pinned to, -1 when it may run on any
+    bool stopping = false;                          // told to stop, not started again when it exits
+    std::chrono::steady_clock::time_point started;  // when pid is -1, when to start it again
+};
+
+// When a client runs out of time, all clients get the same timeout so these come in order
+struct s_client_timer
+{
+    std::chrono::steady_clock::time_point deadline;
+    int client_fd;
 };
 
 class Server
 {
     public:
-        Server(std::vector<std::shared_ptr<Config>>& config);
+        Server(std::vector<std::shared_ptr<Config>>& config, char** argv);
         ~Server();
         int setupEpoll();
         int serverLoop();
     protected:
     private:
-        std::vector<configInfo> config_info_;
-        size_t conf_size_;
+        std::list<configInfo> config_info_; // a list, clients and CGI pipes point at their server across reloads
+        char** argv_; // started again by an upgrade
+        const char* config_path_; // loaded again on SIGHUP, nullptr for the default file
+        int upgrade_fd_; // ready pipe of the new binary while an upgrade starts, -1 otherwise
+        pid_t upgrade_pid_;
+        bool draining_; // stopped accepting, the loop ends when the last client is gone
+        std::chrono::steady_clock::time_point drain_deadline_; // clients still open then are closed
+        s_drain_summary drain_;
+        size_t worker_processes_; // workers the master forks, 0 serves in this process
+        bool worker_ = false; // forked by a master, SIGWINCH stops it without closing idle clients
+        std::vector<int> cpus_; // CPUs the process may run on, worker i is pinned to cpus_[i % size]
+        std::vector<s_worker> workers_;
+        size_t respawned_ = 0; // workers started again after they died
         ServerValidator validator_;
         int epoll_fd_;
-        int stdout_pipe_[2];
-        int stderr_pipe_[2];
-        std::unordered_map<int, int> client_timers_;
+        int signal_fd_; // the signals of handleSignal or handleMasterSignal as epoll events
+        int timer_fd_; // one timer for all clients, armed for the first deadline
+        std::deque<s_client_timer> client_timers_; // by deadline, closed clients are skipped when their turn comes
+        std::unordered_map<int, configInfo*> cgi_fds_; // CGI pipe/pidfd -> server running the script
+        ProxyHandler proxy_;
 
 
         int createServerSocket(std::string& server_name, uint16_t port, int& server_fd);
@@ -55,14 +106,45 @@ class Server
         int listenServer(int server_fd);
         void setNonBlocking(int fd);
         int doEpollCtl(int mode, int fd, epoll_event* event);
-        int setupPipe();
-        int putCoutCerrInEpoll();
         int listenLoop();
         int checkEvents(epoll_event event);
         int setupConnection(int server_fd, configInfo& config);
-        int setTimer(int client_fd);
-        int checkForTimeout(int fd, epoll_event& event);
+        int openServer(configInfo& config);
+        int reload();
+        void reapServers();
+        int upgrade();
+        int handleUpgrade();
+        void reapUpgrade();
+        void notifyUpgrade();
+        void startDrain(const char* reason, bool close_idle);
+        void stopListening();
+        size_t closeClients();
+        void logDrainSummary() const;
+        int masterLoop();
+        int handleMasterSignal();
+        void startWorkers();
+        int spawnWorker(s_worker& worker);
+        [[noreturn]] void runWorker(int cpu, pid_t master);
+        void reapWorkers();
+        void stopWorkers(int signal, size_t count);
+        int getRespawnTimeout() const;
+        int getDrainTimeout() const;
+        int setupTimer();
+        void setTimer(int client_fd, configInfo& config);
+        void extendTimer(int client_fd, s_client_data& data);
+        void armTimer();
+        int handleTimeouts();
+        int timeoutClient(const s_client_timer& timer);
         int handleReadEvents(int fd, epoll_event& event);
+        void applyCGIUpdate(configInfo& config);
+        int handleCGIEvent(int fd);
+        void updateCGI(configInfo& config);
+        void finishProxy();
+        void stopTimer(s_client_data& data);
+        int setupSignals();
+        int handleSignal();
+        void closeClient(int client_fd, configInfo& config);
+        void finishClient(int client_fd, configInfo& config);
         std::string epollEventToString(uint32_t events);
         std::string getFdType(int fd);
 };
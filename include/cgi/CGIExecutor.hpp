@@ -2,8 +2,8 @@
 #define CGI_EXECUTOR_HPP
 
 #include <string>
-#include <map>
 #include <vector>
+#include <sys/types.h>
 
 /**
  * @brief CGI exit status enum
@@ -15,39 +15,105 @@ enum class CGIExitStatus {
     KilledBySignal = -3
 };
 
+/**
+ * @brief Result of handling an event on one of the script's descriptors
+ */
+enum class CGIEvent {
+    Pending,   ///< More I/O is expected on this descriptor
+    FdClosed,  ///< The descriptor is done and has been closed
+    Finished   ///< The script has exited and all output is collected
+};
+
 /**
  * @brief Handles CGI script execution and I/O management
- * 
+ *
  * This class is responsible for:
- * - Executing CGI scripts using fork and execve
- * - Managing pipes for script I/O
- * - Setting up environment variables
+ * - Executing CGI scripts using posix_spawn
+ * - Managing non-blocking pipes for script I/O
+ * - Passing the prepared environment to the script
+ *
+ * Nothing in here blocks. The owner registers the descriptors returned
+ * by the getters in its event loop and calls handleEvent() whenever one
+ * of them is ready, so the request body is written while the output is
+ * read and a script can never deadlock on a full pipe.
  */
 class CGIExecutor {
 public:
-    CGIExecutor() = default;
-    ~CGIExecutor() = default;
+    CGIExecutor();
+    ~CGIExecutor();
+
+    CGIExecutor(const CGIExecutor&) = delete;
+    CGIExecutor& operator=(const CGIExecutor&) = delete;
 
     /**
-     * @brief Execute a CGI script
+     * @brief Start a CGI script
      * @param interpreter Path to the script interpreter (e.g., /usr/bin/python3)
      * @param script_path Path to the CGI script
-     * @param request_body Data to pass to script
-     * @param env_vars Environment variables for the script
-     * @return Pair of {exit_code, output}
+     * @param request_body Data to pass to script, must outlive the executor
+     * @param env Environment for the script in KEY=VALUE format
      * @throw std::runtime_error on execution failure
      */
-    std::pair<int, std::string> execute(
+    void start(
         const std::string& interpreter,
         const std::string& script_path,
         const std::string& request_body,
-        const std::map<std::string, std::string>& env_vars);
+        const std::vector<std::string>& env);
+
+    /**
+     * @brief Continue the I/O for a descriptor that became ready
+     * @param fd One of the descriptors returned by the getters
+     * @return Pending, FdClosed or Finished
+     */
+    CGIEvent handleEvent(int fd);
+
+    /**
+     * @brief Kill the script and mark it as timed out
+     */
+    void terminate();
+
+    /**
+     * @return Write end of the script's stdin, -1 once the body is written
+     */
+    int getInputFd() const { return input_pipe_[1]; }
+
+    /**
+     * @return Read end of the script's stdout, -1 once closed
+     */
+    int getOutputFd() const { return output_pipe_[0]; }
+
+    /**
+     * @return Read end of the script's stderr, -1 once closed
+     */
+    int getErrorFd() const { return error_pipe_[0]; }
+
+    /**
+     * @return pidfd that becomes readable when the script exits, -1 once reaped
+     */
+    int getProcessFd() const { return process_fd_; }
+
+    /**
+     * @return Exit code of the script or a CGIExitStatus value
+     */
+    int getExitCode() const { return exit_code_; }
+
+    /**
+     * @return Script's output, or its errors when it wrote nothing to stdout
+     */
+    const std::string& getOutput() const;
 
 private:
     // Pipe management
     int input_pipe_[2];   // For writing to script
     int output_pipe_[2];  // For reading from script
     int error_pipe_[2];   // For errors from script
+    int process_fd_;      // pidfd of the script
+    pid_t pid_;
+
+    const std::string* request_body_;
+    size_t body_offset_;
+    std::string output_;
+    std::string error_;
+    int exit_code_;
 
     /**
      * @brief Set up pipes for communication with CGI script
@@ -61,33 +127,44 @@ private:
     void closePipes();
 
     /**
-     * @brief Convert environment map to array format for execve
-     * @param env_vars Map of environment variables
-     * @return Vector of strings in KEY=VALUE format
+     * @brief Close a descriptor and mark it as closed
+     * @param fd Descriptor to close, set to -1
+     */
+    void closeFd(int& fd);
+
+    /**
+     * @brief Start the script with its pipes connected to stdin/stdout/stderr
+     *
+     * argv and envp are fully built before the call. posix_spawn uses
+     * vfork semantics, so no page tables are copied and the cost does
+     * not grow with the memory of the server.
+     *
+     * @param argv Null terminated argument array
+     * @param envp Null terminated environment array
+     * @return PID of the started script
+     * @throw std::runtime_error if the script could not be started
      */
-    std::vector<std::string> prepareEnvironment(
-        const std::map<std::string, std::string>& env_vars) const;
+    pid_t spawn(char* const argv[], char* const envp[]);
 
     /**
-     * @brief Read output from CGI script
-     * @return Script's output as string
+     * @brief Write as much of the request body as the pipe accepts
+     * @return FdClosed when the whole body is written, Pending otherwise
      */
-    std::string readOutput();
+    CGIEvent writeInput();
 
     /**
-     * @brief Wait for child process to finish with timeout handling
-     * 
-     * @param pid PID of CGI child process
-     * @return int exit_code
+     * @brief Read whatever the script has written to a pipe
+     * @param fd Read end of stdout or stderr
+     * @param buffer String the data is appended to
+     * @return FdClosed on end of file, Pending otherwise
      */
-    int wait_for_child_with_timeout(pid_t pid);
+    CGIEvent readPipe(int& fd, std::string& buffer);
 
     /**
-     * @brief Read the error messeges from the CGI script
-     * 
-     * @return Script's error as string
+     * @brief Collect the exit status of the script and drain its pipes
+     * @return Finished
      */
-    std::string readError();
+    CGIEvent reap();
 };
 
 #endif // CGI_EXECUTOR_HPP
\ No newline at end of file
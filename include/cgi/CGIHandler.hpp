@@ -4,7 +4,7 @@
 #include "cgi/CGIExecutor.hpp"
 #include "config/Location.hpp"
 #include <string>
-#include <map>
+#include <vector>
 #include <memory>
 
 /**
@@ -14,7 +14,6 @@
  * - Using Location config to validate CGI requests
  * - Setting up CGI environment variables
  * - Managing script execution via CGIExecutor
- * - Formatting responses according to HTTP spec
  */
 class CGIHandler {
 public:
@@ -26,23 +25,32 @@ public:
     ~CGIHandler() = default;
 
     /**
-     * @brief Process a CGI request
+     * @brief Start processing a CGI request
+     *
+     * The script runs asynchronously, its descriptors are available
+     * through getExecutor() for the event loop.
+     *
      * @param script_path Path to the CGI script
      * @param request_method HTTP method (GET/POST)
-     * @param request_body Request body data (for POST)
+     * @param request_body Request body data (for POST), must outlive the handler
      * @param query_string Query string from URL (for GET)
-     * @param server_name Server's hostname
-     * @param server_port Server's port
-     * @return Pair of {status_code, response_content}
      * @throw std::runtime_error on processing failure
      */
-    std::pair<int, std::string> handleRequest(
+    void start(
         const std::string& script_path,
         const std::string& request_method,
         const std::string& request_body,
-        const std::string& query_string,
-        const std::string& server_name,
-        uint16_t server_port);
+        const std::string& query_string);
+
+    /**
+     * @return Executor running the script
+     */
+    CGIExecutor& getExecutor() { return executor_; }
+
+    /**
+     * @return Location the script belongs to
+     */
+    const Location& getLocation() const { return location_; }
 
 private:
     CGIExecutor executor_;
@@ -58,20 +66,20 @@ private:
 
     /**
      * @brief Set up CGI environment variables
+     *
+     * Starts from the static part precomputed for the location and
+     * appends the variables that change per request.
+     *
      * @param script_path Path to CGI script
      * @param request_method HTTP method
      * @param query_string Query string from URL
-     * @param server_name Server's hostname
-     * @param server_port Server's port
      * @param content_length Length of request body
-     * @return Map of environment variables
+     * @return Environment in KEY=VALUE format
      */
-    std::map<std::string, std::string> setupEnvironment(
+    std::vector<std::string> setupEnvironment(
         const std::string& script_path,
         const std::string& request_method,
         const std::string& query_string,
-        const std::string& server_name,
-        uint16_t server_port,
         size_t content_length) const;
 
     /**
@@ -2,6 +2,7 @@
 #define CONFIG_BUILDER_HPP
 
 #include "Location.hpp"
+#include "Upstream.hpp"
 #include <memory>
 #include <string>
 #include <vector>
@@ -66,6 +67,54 @@ public:
      */
     ConfigBuilder& addErrorPage(uint16_t code, const std::string& page);
 
+    /**
+     * @brief Sets the access log of the server
+     * @param path Log file, empty turns the access log off
+     * @param json true for JSON records, false for the compact text format
+     * @param sample Share of the requests to log (0 < sample <= 1)
+     * @return Reference to this builder for method chaining
+     * @throws std::runtime_error if sample is out of range
+     */
+    ConfigBuilder& setAccessLog(const std::string& path, bool json, double sample);
+
+    /**
+     * @brief Sets the error log of the server
+     * @param path Log file
+     * @param level Highest LOG_LEVEL_* that is written
+     * @return Reference to this builder for method chaining
+     */
+    ConfigBuilder& setErrorLog(const std::string& path, int level);
+
+    /**
+     * @brief Sets how many requests the request trace keeps
+     * @param records Size of the ring, 0 turns tracing off
+     * @return Reference to this builder for method chaining
+     */
+    ConfigBuilder& setRequestTrace(size_t records);
+
+    /**
+     * @brief Sets when a request is logged as slow
+     * @param threshold_ms Milliseconds from accept to close, 0 turns the slow request log off
+     * @param rate Slow requests logged per second at most (rate > 0)
+     * @return Reference to this builder for method chaining
+     * @throws std::runtime_error if rate is 0
+     */
+    ConfigBuilder& setSlowRequestLog(uint64_t threshold_ms, size_t rate);
+
+    /**
+     * @brief Sets how long open requests may take to finish when the server stops
+     * @param seconds Time until the clients that are left are closed, 0 closes them right away
+     * @return Reference to this builder for method chaining
+     */
+    ConfigBuilder& setShutdownTimeout(uint64_t seconds);
+
+    /**
+     * @brief Sets how many worker processes a master forks
+     * @param workers Number of workers, 0 serves in one process, -1 starts one per CPU
+     * @return Reference to this builder for method chaining
+     */
+    ConfigBuilder& setWorkerProcesses(int workers);
+
     // Location configuration methods
     /**
      * @brief Starts a new location block configuration
@@ -139,12 +188,117 @@ public:
      */
     void setLocationCGIExt(const std::vector<std::string>& extensions);
 
+    /**
+     * @brief Limits the number of CGI scripts running at once for current location
+     * @param count Maximum running scripts, 0 for unlimited
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationCGIMaxConcurrent(size_t count);
+
+    /**
+     * @brief Sets how many CGI requests may wait for a free slot
+     * @param size Maximum queue length, 0 rejects requests over the limit right away
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationCGIQueueSize(size_t size);
+
+    /**
+     * @brief Sets how long a CGI request may wait in the queue
+     * @param seconds Maximum wait before the request gets a 503
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationCGIQueueTimeout(size_t seconds);
+
+    /**
+     * @brief Sets how long successful GET responses of a CGI location are cached
+     * @param seconds Lifetime of a cached response, 0 disables the cache
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationCGICacheValid(size_t seconds);
+
+    /**
+     * @brief Forwards requests of current location to an upstream server or group
+     * @param host Upstream group name, host name or address
+     * @param port Upstream port, 0 when the URL has none
+     * @param uri Path that replaces the location path, empty to pass the request path unchanged
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationProxyPass(const std::string& host, uint16_t port, const std::string& uri);
+
+    /**
+     * @brief Sets how long to wait for a connection to the upstream
+     * @param seconds Maximum time to connect
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationProxyConnectTimeout(size_t seconds);
+
+    /**
+     * @brief Sets how long a proxied request may go without progress
+     * @param seconds Maximum time between reads from or writes to the upstream
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationProxyReadTimeout(size_t seconds);
+
+    /**
+     * @brief Sets how many idle upstream connections are kept for reuse
+     * @param count Maximum idle connections per upstream, 0 closes them after each request
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationProxyKeepalive(size_t count);
+
+    /**
+     * @brief Makes the location answer with the live server counters
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationStubStatus();
+
+    /**
+     * @brief Makes the location answer with the Prometheus metrics
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationMetrics();
+
+    /**
+     * @brief Makes the location answer with the requests of the request trace
+     * @throws std::runtime_error if no location is being configured
+     */
+    void setLocationTraceDump();
+
     /**
      * @brief Finalizes current location configuration
      * @throws std::runtime_error if no location is being configured
      */
     void endLocation();
 
+    // Upstream configuration methods
+    /**
+     * @brief Starts a new upstream block configuration
+     * @param name Name proxy_pass refers to
+     * @throws std::runtime_error if an upstream with this name already exists
+     */
+    void startUpstream(const std::string& name);
+
+    /**
+     * @brief Adds a backend server to current upstream
+     * @param server Address, weight and failure settings of the server
+     * @throws std::runtime_error if no upstream is being configured
+     */
+    void addUpstreamServer(const Upstream::Server& server);
+
+    /**
+     * @brief Sets the balancing policy of current upstream
+     * @param balance Policy to pick a server with
+     * @param key Request key hashed by Upstream::Balance::HASH
+     * @throws std::runtime_error if no upstream is being configured
+     */
+    void setUpstreamBalance(Upstream::Balance balance, Upstream::HashKey key = Upstream::HashKey::REQUEST_URI);
+
+    /**
+     * @brief Finalizes current upstream configuration
+     * @throws std::runtime_error if no upstream is being configured or it has no servers
+     */
+    void endUpstream();
+
     /**
      * @brief Builds and returns the completed configuration
      * @return Shared pointer to the built Config object
@@ -163,8 +317,25 @@ private:
         }
     }
 
+    /**
+     * @brief Ensures an upstream block is being configured
+     * @param method Name of the calling method for error messages
+     * @throws std::runtime_error if no upstream is being configured
+     */
+    void ensureUpstreamContext(const std::string& method) const {
+        if (!current_upstream_) {
+            throw std::runtime_error(method + " called outside upstream context");
+        }
+    }
+
+    /**
+     * @brief Points every proxy_pass at its upstream group, a plain host becomes a group of one
+     */
+    void resolveUpstreams();
+
     std::shared_ptr<Config> config_;             ///< Configuration being built
     std::shared_ptr<Location> current_location_; ///< Location currently being configured
+    std::shared_ptr<Upstream> current_upstream_; ///< Upstream currently being configured
 };
 
 #endif
\ No newline at end of file
@@ -96,6 +96,34 @@ private:
     void parseLocationReturn(ConfigBuilder& builder);
     void parseLocationCGIPath(ConfigBuilder& builder);
     void parseLocationCGIExt(ConfigBuilder& builder);
+    void parseLocationCGIMaxConcurrent(ConfigBuilder& builder);
+    void parseLocationCGIQueueSize(ConfigBuilder& builder);
+    void parseLocationCGIQueueTimeout(ConfigBuilder& builder);
+    void parseLocationCGICacheValid(ConfigBuilder& builder);
+    void parseLocationProxyPass(ConfigBuilder& builder);
+    void parseLocationProxyConnectTimeout(ConfigBuilder& builder);
+    void parseLocationProxyReadTimeout(ConfigBuilder& builder);
+    void parseLocationProxyKeepalive(ConfigBuilder& builder);
+
+    /**
+     * @brief Parses an upstream block
+     * @param builder Configuration builder to store settings
+     * @throws ParseError on invalid upstream block syntax
+     */
+    void parseUpstreamBlock(ConfigBuilder& builder);
+
+    // Upstream directive handlers
+    void parseUpstreamServer(ConfigBuilder& builder);
+    void parseUpstreamHash(ConfigBuilder& builder);
+
+    /**
+     * @brief Splits host[:port] of an upstream address
+     * @param authority Address to split
+     * @param host Receives the host
+     * @param port Receives the port, 0 if there is none
+     * @throws ParseError if the host is empty or the port is invalid
+     */
+    void parseHostPort(const std::string& authority, std::string& host, uint16_t& port);
 
     // Server directive handlers
     void parseServerDirective(ConfigBuilder& builder, const std::string& directive);
@@ -105,6 +133,12 @@ private:
     void parseServerIndex(ConfigBuilder& builder);
     void parseServerBodySize(ConfigBuilder& builder);
     void parseServerErrorPage(ConfigBuilder& builder);
+    void parseServerAccessLog(ConfigBuilder& builder);
+    void parseServerErrorLog(ConfigBuilder& builder);
+    void parseServerRequestTrace(ConfigBuilder& builder);
+    void parseServerSlowRequestThreshold(ConfigBuilder& builder);
+    void parseServerShutdownTimeout(ConfigBuilder& builder);
+    void parseServerWorkerProcesses(ConfigBuilder& builder);
 
     /**
      * @brief Generic directive handler with validation
@@ -48,6 +48,13 @@ private:
      */
     static void printErrorPages(std::ostream& out, const Config& config);
 
+    /**
+     * @brief Prints all upstream blocks
+     * @param out Output stream to write to
+     * @param config Configuration to print from
+     */
+    static void printUpstreams(std::ostream& out, const Config& config);
+
     /**
      * @brief Prints all location blocks
      * @param out Output stream to write to
@@ -83,6 +90,13 @@ private:
      */
     static void printCGIConfig(std::ostream& out, const Location::CGIConfig& cgi);
 
+    /**
+     * @brief Prints upstream forwarding configuration
+     * @param out Output stream to write to
+     * @param proxy Proxy configuration to print
+     */
+    static void printProxyConfig(std::ostream& out, const Location::ProxyConfig& proxy);
+
     /**
      * @brief Converts location match type to string representation
      * @param type Location match type
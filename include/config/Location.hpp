@@ -5,6 +5,8 @@
 #include <vector>
 #include <optional>
 #include <regex>
+#include <memory>
+#include "Upstream.hpp"
 
 /**
  * @brief Location block configuration for URL-specific behavior
@@ -77,6 +79,11 @@ public:
     struct CGIConfig {
         std::vector<std::string> interpreters; ///< Paths to CGI interpreters
         std::vector<std::string> extensions;   ///< File extensions to handle as CGI
+        std::vector<std::string> static_env;   ///< Request independent KEY=VALUE pairs, filled by ConfigBuilder::build()
+        size_t max_concurrent = 0;             ///< Scripts running at once, 0 is unlimited
+        size_t queue_size = 0;                 ///< Requests waiting for a free slot, 0 rejects right away
+        size_t queue_timeout = 10;             ///< Seconds a request may wait in the queue
+        size_t cache_valid = 0;                ///< Seconds a GET response is reused, 0 disables caching
 
         /**
          * @return true if CGI is enabled (has both interpreters and extensions)
@@ -86,6 +93,26 @@ public:
         }
     };
 
+    /**
+     * @brief Configuration for forwarding requests to an upstream server
+     */
+    struct ProxyConfig {
+        std::string host;                      ///< Upstream group name or host, empty when proxying is off
+        uint16_t port = 0;                     ///< Port from the URL, 0 when none was given
+        std::string uri;                       ///< Replaces the location path when set
+        size_t connect_timeout = 5;            ///< Seconds to wait for the connection
+        size_t read_timeout = 60;              ///< Seconds without progress before giving up
+        size_t keepalive = 16;                 ///< Idle upstream connections kept for reuse
+        std::shared_ptr<const Upstream> upstream; ///< Servers to forward to, filled by ConfigBuilder::build()
+
+        /**
+         * @return true if requests are forwarded to an upstream
+         */
+        bool isEnabled() const {
+            return !host.empty();
+        }
+    };
+
     /**
      * @brief Creates a location block for the specified URL path
      * @param path URL path this location handles
@@ -139,6 +166,11 @@ public:
      */
     const CGIConfig& getCGIConfig() const;
 
+    /**
+     * @return Upstream forwarding configuration
+     */
+    const ProxyConfig& getProxyConfig() const;
+
     /**
      * @return Compiled regex pattern if this is a regex location
      */
@@ -165,6 +197,26 @@ public:
      */
     bool hasCGI() const;
 
+    /**
+     * @return true if requests are forwarded to an upstream
+     */
+    bool hasProxy() const;
+
+    /**
+     * @return true if this location answers with the live server counters
+     */
+    bool hasStubStatus() const;
+
+    /**
+     * @return true if this location answers with the Prometheus metrics
+     */
+    bool hasMetrics() const;
+
+    /**
+     * @return true if this location answers with the requests of the request trace
+     */
+    bool hasTraceDump() const;
+
     /**
      * @brief Checks if a file extension should be handled as CGI
      * @param ext File extension to check (including dot)
@@ -184,6 +236,10 @@ private:
     bool autoindex_ = false;                        ///< Default: directory listing off
     ReturnDirective return_directive_;              ///< Return/redirect configuration
     CGIConfig cgi_config_;                          ///< CGI processing settings
+    ProxyConfig proxy_config_;                      ///< Upstream forwarding settings
+    bool stub_status_ = false;                      ///< Default: serve files, not the status page
+    bool metrics_ = false;                          ///< Default: serve files, not the metrics
+    bool trace_dump_ = false;                       ///< Default: serve files, not the request trace
     std::regex regex_;                              ///< Compiled regex pattern for regex locations
 
     /**
@@ -0,0 +1,81 @@
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Upstream block configuration, a named group of backend servers
+ *
+ * A location forwards to the group with proxy_pass http://name. Which
+ * server gets a request is decided by the balancing policy, servers that
+ * keep failing are taken out for a while and brought back slowly.
+ */
+class Upstream {
+public:
+    /**
+     * @brief How a server is picked for a request
+     */
+    enum class Balance {
+        ROUND_ROBIN,  ///< Weighted round robin (default)
+        LEAST_CONN,   ///< Fewest active requests relative to the weight
+        HASH          ///< Consistent hash of a request key
+    };
+
+    /**
+     * @brief Request key of the HASH policy
+     */
+    enum class HashKey {
+        REQUEST_URI,  ///< $request_uri
+        REMOTE_ADDR   ///< $remote_addr
+    };
+
+    /**
+     * @brief One backend server of the group
+     */
+    struct Server {
+        std::string host;           ///< Host name or address
+        uint16_t port = 80;         ///< Port
+        size_t weight = 1;          ///< Share of the requests
+        size_t max_fails = 1;       ///< Failures within fail_timeout before the server is taken out, 0 never
+        size_t fail_timeout = 10;   ///< Seconds failures are counted and the server stays out
+        size_t slow_start = 0;      ///< Seconds to ramp the weight back up after being out, 0 disables
+    };
+
+    /**
+     * @brief Creates an empty upstream group
+     * @param name Name proxy_pass refers to
+     */
+    explicit Upstream(const std::string& name);
+
+    /**
+     * @return Name of the group
+     */
+    const std::string& getName() const;
+
+    /**
+     * @return Servers of the group in configuration order
+     */
+    const std::vector<Server>& getServers() const;
+
+    /**
+     * @return Balancing policy
+     */
+    Balance getBalance() const;
+
+    /**
+     * @return Request key of the HASH policy
+     */
+    HashKey getHashKey() const;
+
+private:
+    friend class ConfigBuilder; // Only builder can modify the group
+
+    std::string name_;                        ///< Name proxy_pass refers to
+    std::vector<Server> servers_;             ///< Backend servers
+    Balance balance_ = Balance::ROUND_ROBIN;  ///< Balancing policy
+    HashKey hash_key_ = HashKey::REQUEST_URI; ///< Key for Balance::HASH
+};
+
+#endif // UPSTREAM_HPP
\ No newline at end of file
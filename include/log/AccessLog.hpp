@@ -0,0 +1,46 @@
+#ifndef ACCESS_LOG_HPP
+#define ACCESS_LOG_HPP
+
+#include <string>
+
+struct s_client_data;
+
+/**
+ * @brief Access log of one server, a record per finished request
+ *
+ * Records hold the client address, the request line, the status, the bytes
+ * sent and where the time went: accept to the end of the request headers,
+ * headers to the first byte of the response and accept to close. They are
+ * handed to the Logger, so writing one never blocks the event loop. With a
+ * sample below 1 only that share of the requests is logged, spread evenly.
+ */
+class AccessLog {
+public:
+    AccessLog();
+
+    /**
+     * @brief Open the log file with the Logger
+     * @param path Log file, empty keeps the access log off
+     * @param json true for JSON records, false for the compact text format
+     * @param sample Share of the requests to log
+     * @return 0 when done, -1 if the file can not be opened
+     */
+    int open(const std::string& path, bool json, double sample);
+
+    /**
+     * @brief Log the request of a client that is being closed
+     * @param data Request data of the client
+     */
+    void log(const s_client_data& data);
+
+private:
+    int file_;       // Logger file id, -1 when off
+    bool json_;
+    double sample_;
+    double credit_;  // grows by sample_ per request, a record is written each time it reaches 1
+
+    void appendText(std::string& record, const s_client_data& data, const char* time, double header_ms, double start_ms, double total_ms) const;
+    void appendJson(std::string& record, const s_client_data& data, const char* time, double header_ms, double start_ms, double total_ms) const;
+};
+
+#endif // ACCESS_LOG_HPP
\ No newline at end of file
@@ -0,0 +1,227 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#define LOG_DIRECTORY "logs"
+#define STANDARD_LOG_FILE "log.log"
+#define STANDARD_ERROR_LOG_FILE "error.log"
+#define LOG_RING_SIZE (1024 * 1024)
+#define LOG_FLUSH_INTERVAL_MS 50
+
+/**
+ * Levels of the LOG_* macros, a message is kept if its level is at most the
+ * level of the error_log. Levels above LOG_COMPILE_LEVEL are compiled out,
+ * the Makefile sets it from LOG_LEVEL (INFO by default, TRACE for make debug).
+ */
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
+#ifndef LOG_COMPILE_LEVEL
+# define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+/**
+ * Writes a message built with << to the error log, for example
+ * LOG_ERROR("accept failed: " << strerror(errno)). The message is only
+ * formatted when its level is enabled.
+ */
+#define LOG_AT(level, message) \
+    do { \
+        if ((level) <= LOG_COMPILE_LEVEL && Logger::instance().isEnabled(level)) { \
+            std::ostringstream log_stream_; \
+            log_stream_ << message; \
+            Logger::instance().log((level), log_stream_.str()); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(message) LOG_AT(LOG_LEVEL_ERROR, message)
+#define LOG_WARN(message) LOG_AT(LOG_LEVEL_WARN, message)
+#define LOG_INFO(message) LOG_AT(LOG_LEVEL_INFO, message)
+#define LOG_DEBUG(message) LOG_AT(LOG_LEVEL_DEBUG, message)
+#define LOG_TRACE(message) LOG_AT(LOG_LEVEL_TRACE, message)
+
+/**
+ * @brief Log files every server has, further files are added with Logger::addFile()
+ */
+enum e_log_file {
+    LOG_STANDARD_FILE = 0, ///< logs/log.log, what is written to std::cout
+    LOG_ERROR_FILE = 1 ///< logs/error.log or the error_log, std::cerr and the LOG_* macros
+};
+
+/**
+ * @brief Single producer, single consumer ring of log records of one thread
+ *
+ * Records are a file id and a length followed by the bytes. The owning
+ * thread only moves head, the flusher only moves tail, so neither side
+ * takes a lock.
+ */
+struct s_log_ring {
+    std::unique_ptr<char[]> data{new char[LOG_RING_SIZE]};
+    std::atomic<size_t> head{0};        // next byte the producer writes
+    std::atomic<size_t> tail{0};        // next byte the flusher reads
+    std::atomic<uint64_t> dropped{0};   // records that did not fit
+    uint64_t reported = 0;              // drops the flusher already logged
+};
+
+/**
+ * @brief A log file the flusher keeps open
+ */
+struct s_log_file {
+    std::string path;
+    int fd = -1;
+    std::string batch;  // what the current flush writes to the file
+};
+
+/**
+ * @brief Stream buffer that hands everything written to it to the logger
+ */
+class LogStreamBuf : public std::streambuf {
+public:
+    explicit LogStreamBuf(int file);
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    int file_;
+};
+
+/**
+ * @brief Asynchronous logger for the whole process
+ *
+ * This class is responsible for:
+ * - Taking log records from any thread without a lock or a system call,
+ *   each thread writes into its own ring
+ * - Writing the records to log files that stay open, from a background
+ *   thread that batches everything it finds in the rings into one write
+ *   per file
+ * - Counting records that are dropped because a ring is full
+ *
+ * start() points std::cout at logs/log.log and std::cerr at
+ * logs/error.log, so the existing output of the server is logged without
+ * going through a pipe and the event loop.
+ */
+class Logger {
+public:
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    /**
+     * @return The logger of the process
+     */
+    static Logger& instance();
+
+    /**
+     * @brief Open the standard log files, redirect std::cout and std::cerr and start the flusher
+     * @return 0 when done, -1 if the log directory or a file can not be opened
+     */
+    int start();
+
+    /**
+     * @brief Restore std::cout and std::cerr, write what is left and stop the flusher
+     */
+    void stop();
+
+    /**
+     * @brief Open another log file
+     * @param path Path of the file, created when missing
+     * @return Id to write to, -1 if the file can not be opened
+     */
+    int addFile(const std::string& path);
+
+    /**
+     * @brief Set the error log, must be called before start()
+     * @param path Path of the file, empty keeps logs/error.log
+     * @param level Highest level the LOG_* macros write
+     */
+    void setErrorLog(const std::string& path, int level);
+
+    /**
+     * @return true if messages of the level are written
+     */
+    bool isEnabled(int level) const { return level <= level_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Queue a message of the LOG_* macros for the error log, with a time and level prefix
+     * @param level Level of the message
+     * @param message Message, a newline is added
+     */
+    void log(int level, const std::string& message);
+
+    /**
+     * @brief Ask the flusher to reopen every log file by its path, for log rotation
+     *
+     * Safe to call from anywhere, the flusher first writes what it has to the
+     * old files and then swaps in the new ones under the same descriptors.
+     */
+    void reopen();
+
+    /**
+     * @brief Queue bytes for a log file, never blocks and never makes a system call
+     * @param file Id of the file
+     * @param data Bytes to log
+     * @param size Number of bytes
+     */
+    void write(int file, const char* data, size_t size);
+
+    /**
+     * @return Records dropped so far because a ring was full
+     */
+    uint64_t getDropped() const;
+
+private:
+    Logger();
+
+    mutable std::mutex rings_mutex_;                    // guards rings_, only taken by write() for a new thread
+    mutable std::mutex mutex_;                          // guards files_, writing to std::cerr under it is fine
+    std::vector<std::unique_ptr<s_log_ring>> rings_;
+    std::vector<s_log_file> files_;
+    std::thread flusher_;
+    std::atomic<bool> running_;
+    std::atomic<int> level_;                            // highest level the LOG_* macros write
+    std::atomic<bool> reopen_;                          // set by reopen(), handled by the flusher
+    LogStreamBuf out_buf_;
+    LogStreamBuf err_buf_;
+    std::streambuf* old_out_;
+    std::streambuf* old_err_;
+
+    /**
+     * @return Ring of the calling thread, registered on first use
+     */
+    s_log_ring& getRing();
+
+    /**
+     * @brief Loop of the background thread
+     */
+    void flushLoop();
+
+    /**
+     * @brief Move every complete record from the rings to the files
+     * @return true if the rings were busy enough to go again right away
+     */
+    bool flush();
+
+    /**
+     * @brief Open the paths of all files again and put them in place of the old descriptors
+     */
+    void reopenFiles();
+
+    int openFile(const std::string& path);
+};
+
+#endif // LOGGER_HPP
\ No newline at end of file
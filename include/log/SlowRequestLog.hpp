@@ -0,0 +1,47 @@
+#ifndef SLOW_REQUEST_LOG_HPP
+#define SLOW_REQUEST_LOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+struct s_client_data;
+
+/**
+ * @brief Detailed records of the requests of one server that took too long
+ *
+ * A request whose time from accept to close goes over the threshold is
+ * written to the error log with everything known about it: the phase
+ * timestamps, the location it was routed to, the bytes read and written,
+ * how often the socket would have blocked and how long it waited for a
+ * CGI slot. At most rate records are written per second, the ones over
+ * it are counted and reported with the next record, so a slowdown does
+ * not flood the disk.
+ */
+class SlowRequestLog {
+public:
+    SlowRequestLog();
+
+    /**
+     * @brief Set the threshold and the rate cap
+     * @param threshold_ms Milliseconds a request may take, 0 keeps the log off
+     * @param rate Records per second at most
+     */
+    void open(uint64_t threshold_ms, size_t rate);
+
+    /**
+     * @brief Log the request of a client that is being closed if it was slow
+     * @param data Request data of the client
+     * @param total_us Microseconds from accept to close
+     */
+    void log(const s_client_data& data, uint64_t total_us);
+
+private:
+    uint64_t threshold_us_;  // 0 when off
+    size_t rate_;
+    time_t second_;          // second the records in logged_ were written in
+    size_t logged_;
+    uint64_t suppressed_;    // slow requests over the rate since the last record
+};
+
+#endif // SLOW_REQUEST_LOG_HPP
\ No newline at end of file
@@ -0,0 +1,308 @@
+#ifndef PROXY_HANDLER_HPP
+#define PROXY_HANDLER_HPP
+
+#include "server/ServerRequestHandler.hpp"
+#include "config/Location.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+#define PROXY_BUFFER_SIZE 65536
+#define PROXY_HEADER_MAX 16384
+#define PROXY_KEEPALIVE_TIMEOUT 60
+#define PROXY_SEND_TIMEOUT 60
+#define PROXY_HASH_POINTS 160
+#define PROXY_WEIGHT_SCALE 1000
+
+/**
+ * @brief Progress of a proxied request
+ */
+enum class ProxyState {
+    Connecting,     ///< Waiting for the upstream connection
+    Sending,        ///< Writing the request to the upstream
+    ReadingHeader,  ///< Waiting for the complete response header
+    ReadingBody     ///< Passing the response body to the client
+};
+
+/**
+ * @brief How the end of the upstream response is found
+ */
+enum class ProxyBody {
+    None,     ///< No body (HEAD, 204, 304)
+    Length,   ///< Content-Length bytes
+    Chunked,  ///< Until the last chunk
+    Close     ///< Until the upstream closes the connection
+};
+
+/**
+ * @brief Where the chunked body scanner is
+ */
+enum class ProxyChunk {
+    Size,     ///< Reading the chunk size line
+    Data,     ///< Inside the chunk data
+    DataEnd,  ///< CRLF after the chunk data
+    Trailer   ///< Trailer lines after the last chunk
+};
+
+/**
+ * @brief State of one request that is forwarded to an upstream
+ */
+struct s_proxy_session {
+    int client_fd;
+    int upstream_fd = -1;
+    const s_client_data* client_data;
+    const Location::ProxyConfig* config;
+    const Upstream* upstream;
+    size_t peer = 0;                // server of the upstream in use
+    std::vector<bool> tried;        // servers already tried for this request
+    std::string upstream_key;       // host:port of the server, key of the connection pool
+    ProxyState state = ProxyState::Connecting;
+    bool reused = false;            // the connection came from the pool
+    bool received = false;          // the upstream sent something
+    std::string request_head;
+    size_t request_offset = 0;      // bytes of head and body written
+    std::string response_head;
+    std::string out;                // read from the upstream, not yet sent to the client
+    size_t out_offset = 0;
+    bool client_started = false;    // the client got part of the response
+    ProxyBody body = ProxyBody::Close;
+    ProxyChunk chunk = ProxyChunk::Size;
+    uint64_t body_left = 0;
+    bool chunk_ext = false;
+    size_t trailer_line = 0;
+    bool keep_alive = false;        // the connection can be reused after the response
+    bool complete = false;          // the whole response is read
+    std::chrono::steady_clock::time_point deadline;
+};
+
+/**
+ * @brief Health and balancing state of one server of an upstream group
+ */
+struct s_upstream_peer {
+    size_t active = 0;              // requests using the server right now
+    int64_t current_weight = 0;     // smooth weighted round robin counter
+    size_t fails = 0;               // failures since fail_start
+    std::chrono::steady_clock::time_point fail_start;
+    std::chrono::steady_clock::time_point down_until;  // taken out of rotation until then
+    bool recovering = false;        // slow start runs from down_until
+};
+
+/**
+ * @brief Runtime state of an upstream group
+ */
+struct s_upstream_state {
+    std::vector<s_upstream_peer> peers;
+    std::vector<std::pair<uint32_t, size_t>> ring;  // consistent hash points -> server index
+};
+
+/**
+ * @brief An idle keep-alive connection to an upstream
+ */
+struct s_idle_upstream {
+    int fd;
+    std::chrono::steady_clock::time_point since;
+};
+
+/**
+ * @brief Forwards requests to upstream servers from the server's event loop
+ *
+ * This class is responsible for:
+ * - Picking a server of the upstream group by round robin, least
+ *   connections or consistent hash, skipping servers that failed
+ *   max_fails times and ramping them up again with slow start
+ * - Connecting to the server without blocking, or reusing an idle
+ *   keep-alive connection from the pool
+ * - Writing the request and passing the response to the client as it
+ *   arrives, reading from the upstream only while the client keeps up
+ * - Connect and read timeouts for the upstream, PROXY_SEND_TIMEOUT for
+ *   a client that stops reading
+ *
+ * The handler registers the upstream descriptors in the epoll itself and
+ * changes the events of the client while a request is proxied. The server
+ * passes every event of those descriptors to handleEvent() and closes the
+ * clients returned by takeFinished().
+ */
+class ProxyHandler {
+public:
+    ProxyHandler();
+    ~ProxyHandler();
+
+    ProxyHandler(const ProxyHandler&) = delete;
+    ProxyHandler& operator=(const ProxyHandler&) = delete;
+
+    /**
+     * @param epoll_fd Epoll the descriptors are registered in
+     */
+    void setEpollFd(int epoll_fd);
+
+    /**
+     * @brief Start forwarding a request
+     * @param client_fd Client socket
+     * @param client_data Request data, must stay valid until the client is finished or removed
+     * @param location Location with the upstream configuration
+     * @return false if no connection to the upstream could be started
+     */
+    bool start(int client_fd, const s_client_data& client_data, const Location& location);
+
+    /**
+     * @param fd Descriptor that had an event
+     * @return true if the descriptor is a proxied client or one of its upstream connections
+     */
+    bool hasFd(int fd) const;
+
+    /**
+     * @brief Continue the request the descriptor belongs to
+     * @param fd Client or upstream descriptor
+     * @param events Events epoll reported
+     */
+    void handleEvent(int fd, uint32_t events);
+
+    /**
+     * @brief Drop the request of a client that is closed, its upstream connection is closed too
+     * @param client_fd Client socket
+     */
+    void removeClient(int client_fd);
+
+    /**
+     * @brief Drop the balancing and health state of an upstream group that is about to be freed
+     * @param upstream Upstream of a config that was replaced by a reload
+     */
+    void removeUpstream(const Upstream* upstream);
+
+    /**
+     * @brief Fail requests whose timeout passed and close pooled connections that idled too long
+     */
+    void update();
+
+    /**
+     * @return Milliseconds until the first timeout, -1 if nothing can time out
+     */
+    int getTimeout() const;
+
+    /**
+     * @brief Hand the finished requests to the server
+     * @param finished Client sockets with the status to answer, 0 when the response is sent
+     * @return true if any request finished
+     */
+    bool takeFinished(std::vector<std::pair<int, uint16_t>>& finished);
+
+private:
+    int epoll_fd_;
+    std::unordered_map<int, s_proxy_session> sessions_;  // client fd -> request
+    std::unordered_map<int, int> upstream_fds_;          // upstream fd -> client fd
+    std::unordered_map<std::string, std::vector<s_idle_upstream>> idle_;
+    std::unordered_map<std::string, sockaddr_in> addresses_;
+    std::unordered_map<const Upstream*, s_upstream_state> upstreams_;
+    std::vector<std::pair<int, uint16_t>> finished_;
+
+    /**
+     * @brief Pick the next server of the upstream group that was not tried yet
+     * @return false if every server was tried or is taken out
+     */
+    bool selectPeer(s_proxy_session& session);
+
+    /**
+     * @brief Connect to the next usable server until one accepts the connect
+     * @return false if no server is left
+     */
+    bool connectNext(s_proxy_session& session);
+
+    /**
+     * @brief Take a connection to the selected server from the pool or open a new one
+     * @param session Request to connect
+     * @return false if connecting failed right away
+     */
+    bool connectUpstream(s_proxy_session& session);
+
+    /**
+     * @brief Count a failure of the selected server, taking it out after max_fails
+     */
+    void peerFailed(s_proxy_session& session);
+
+    /**
+     * @brief Move a request that could not connect on to the next server
+     * @return true if another server is tried
+     */
+    bool retryNext(s_proxy_session& session);
+
+    /**
+     * @return State of the group, created on first use
+     */
+    s_upstream_state& getState(const Upstream& upstream);
+
+    /**
+     * @return Weight of a server, lowered while it is in slow start
+     */
+    int64_t effectiveWeight(const Upstream::Server& server, s_upstream_peer& peer, std::chrono::steady_clock::time_point now);
+
+    static uint32_t hash(std::string_view key);
+
+    /**
+     * @brief Resolve a server once, later calls use the cached address
+     * @return false if the host can not be resolved
+     */
+    bool resolve(const Upstream::Server& server, const std::string& key, sockaddr_in& address);
+
+    /**
+     * @brief Build the request line and headers sent to the upstream
+     */
+    std::string buildRequestHead(const s_client_data& client_data, const Location::ProxyConfig& config, const std::string& location_path);
+
+    void handleUpstream(s_proxy_session& session, uint32_t events);
+    void writeRequest(s_proxy_session& session);
+    void readResponse(s_proxy_session& session);
+
+    /**
+     * @brief Parse the response header and start the response to the client
+     * @return false if the header is invalid
+     */
+    bool parseResponseHead(s_proxy_session& session, size_t head_end);
+
+    /**
+     * @brief Add body bytes to the client buffer and track where the response ends
+     */
+    void addBody(s_proxy_session& session, const char* data, size_t size);
+
+    /**
+     * @brief Follow the chunked framing of the response
+     * @return Bytes that belong to the response
+     */
+    size_t scanChunked(s_proxy_session& session, const char* data, size_t size);
+
+    /**
+     * @brief Send what is buffered to the client
+     * @return true if the buffer is empty
+     */
+    bool flushClient(s_proxy_session& session);
+
+    /**
+     * @brief Send the buffered response when the client is writable again
+     */
+    void writeClient(s_proxy_session& session);
+
+    /**
+     * @brief Retry a request on a new connection when a pooled one turned out to be closed
+     * @return true if the request is retried
+     */
+    bool retry(s_proxy_session& session);
+
+    /**
+     * @brief Put the upstream connection back in the pool or close it
+     */
+    void releaseUpstream(s_proxy_session& session, bool reusable);
+
+    /**
+     * @brief End a request and hand the client to the server
+     * @param status Status to answer with, 0 when the response is sent
+     */
+    void finish(s_proxy_session& session, uint16_t status);
+
+    void setEvents(int fd, uint32_t events, int op = EPOLL_CTL_MOD);
+    void touch(s_proxy_session& session, size_t seconds);
+};
+
+#endif // PROXY_HANDLER_HPP
@@ -0,0 +1,89 @@
+#ifndef ALLOC_PROFILE_HPP
+# define ALLOC_PROFILE_HPP
+
+# include <array>
+# include <cstdint>
+
+// Parts of a request the allocations of a make allocprof build are counted for
+enum e_alloc_phase
+{
+    ALLOC_PHASE_OTHER,      // the event loop, accepting and closing clients, the logger
+    ALLOC_PHASE_PARSE,      // reading and parsing the request
+    ALLOC_PHASE_ROUTE,      // finding the location of the request
+    ALLOC_PHASE_RESPOND,    // building and sending the response, proxying it
+    ALLOC_PHASE_CGI,        // starting scripts and handling what they write
+    ALLOC_PHASE_COUNT
+};
+
+// Allocations made so far in each phase
+struct s_alloc_counts
+{
+    std::array<uint64_t, ALLOC_PHASE_COUNT> allocations{};
+};
+
+/**
+ * @brief Counts allocations of the process by the phase of the request they were made in
+ *
+ * Built with ALLOC_PROFILE (make allocprof) the global operator new counts
+ * every allocation for the phase of the calling thread. The phase is a
+ * thread local tag the server sets with an AllocPhase around the work of
+ * each phase. Without ALLOC_PROFILE nothing is counted and the tags compile
+ * away, so the normal build pays nothing for them.
+ */
+class AllocProfile
+{
+    public:
+#ifdef ALLOC_PROFILE
+        static constexpr bool enabled = true;
+
+        static void enter(e_alloc_phase phase) { current_ = phase; }
+        static e_alloc_phase phase() { return current_; }
+
+        /**
+         * @brief counts an allocation for the phase of the calling thread, called by operator new
+         */
+        static void count();
+#else
+        static constexpr bool enabled = false;
+
+        static void enter(e_alloc_phase) {}
+        static e_alloc_phase phase() { return ALLOC_PHASE_OTHER; }
+#endif
+
+        /**
+         * @brief starts counting from zero again
+         */
+        static void reset();
+
+        /**
+         * @return the counts of all threads, all zero without ALLOC_PROFILE
+         */
+        static s_alloc_counts snapshot();
+
+        /**
+         * @return the name of a phase for the status page and the microbenchmarks
+         */
+        static const char* name(e_alloc_phase phase);
+
+#ifdef ALLOC_PROFILE
+    private:
+        static inline thread_local e_alloc_phase current_ = ALLOC_PHASE_OTHER;
+#endif
+};
+
+/**
+ * @brief Tags the allocations of a scope with a phase, the phase before comes back at its end
+ */
+class AllocPhase
+{
+    public:
+        explicit AllocPhase(e_alloc_phase phase) : previous_(AllocProfile::phase()) { AllocProfile::enter(phase); }
+        ~AllocPhase() { AllocProfile::enter(previous_); }
+        AllocPhase(const AllocPhase&) = delete;
+        AllocPhase& operator=(const AllocPhase&) = delete;
+
+    private:
+        e_alloc_phase previous_;
+};
+
+#endif
\ No newline at end of file
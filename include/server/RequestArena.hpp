@@ -0,0 +1,64 @@
+#ifndef REQUEST_ARENA_HPP
+# define REQUEST_ARENA_HPP
+
+# include <cstddef>
+# include <memory>
+# include <string_view>
+# include <vector>
+
+#define REQUEST_ARENA_SIZE 2048          // first block, enough for the headers of most requests
+#define REQUEST_ARENA_MAX (64 * 1024)    // largest block a reset grows to
+
+/**
+ * @brief Bump pointer memory for the strings of one request
+ *
+ * The request line, the headers and scratch strings of a request are copied
+ * in here instead of getting a heap string each. Nothing is freed on its own,
+ * reset() hands everything back in one step before the next request. When a
+ * request did not fit, reset() grows the first block to what it needed, so
+ * the next request of the same size does not allocate at all.
+ */
+class RequestArena
+{
+    public:
+        RequestArena() = default;
+        RequestArena(const RequestArena&) = delete;
+        RequestArena& operator=(const RequestArena&) = delete;
+
+        /**
+         * @brief hands out size bytes, valid until the next reset()
+         */
+        char* allocate(size_t size);
+
+        /**
+         * @brief copies text into the arena
+         * @return the copy, valid until the next reset()
+         */
+        std::string_view copy(std::string_view text);
+
+        /**
+         * @brief frees everything handed out, the first block is kept for the next request
+         */
+        void reset();
+
+        /**
+         * @return bytes handed out since the last reset()
+         */
+        size_t used() const { return used_; }
+
+        /**
+         * @return bytes the arena holds on the heap
+         */
+        size_t capacity() const;
+
+    private:
+        std::unique_ptr<char[]> block_;                 // first block, lives as long as the arena
+        size_t size_ = 0;                               // size of block_
+        size_t offset_ = 0;                             // next free byte of the current block
+        size_t used_ = 0;
+        std::vector<std::unique_ptr<char[]>> overflow_; // blocks of a request that did not fit in block_
+        size_t overflow_size_ = 0;                      // size of the last overflow block
+        size_t overflow_total_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,89 @@
+#ifndef REQUEST_TRACE_HPP
+# define REQUEST_TRACE_HPP
+
+# include <array>
+# include <cstdint>
+# include <ctime>
+# include <string>
+# include <vector>
+
+struct s_client_data;
+
+// Points in the life of a request that get a timestamp when tracing is on
+enum e_trace_phase
+{
+    TRACE_ACCEPT,           // accept() returned the client
+    TRACE_FIRST_BYTE,       // first bytes of the request were read
+    TRACE_HEADERS,          // end of the request headers was found
+    TRACE_ROUTE,            // the location was looked up
+    TRACE_HANDLER,          // the file, CGI, proxy or status handler was started
+    TRACE_FIRST_WRITE,      // first bytes of the response were sent
+    TRACE_CLOSE,            // the connection was closed
+    TRACE_PHASE_COUNT
+};
+
+// Nanoseconds of CLOCK_MONOTONIC_COARSE for each phase, 0 if the request never got there
+typedef std::array<uint64_t, TRACE_PHASE_COUNT> t_trace_stamps;
+
+// A closed request in the ring, fixed size so recording never allocates
+struct s_trace_record
+{
+    t_trace_stamps at{};
+    int fd = -1;
+    uint16_t status = 0;
+    char method[8] = "";
+    char target[64] = "";
+};
+
+/**
+ * @brief Per phase timestamps of the last requests, to see where the time of slow ones goes
+ *
+ * Off unless a server sets request_trace or slow_request_threshold. Each client keeps its own stamps,
+ * taken from the coarse monotonic clock which the vDSO reads without a
+ * system call. When the client is closed its stamps go into a ring that
+ * keeps the last requests, a trace_dump location shows the ring.
+ */
+class RequestTrace
+{
+    public:
+        /**
+         * @brief turns the stamps on, must be called before the event loop starts
+         * @param records how many requests the ring keeps, 0 only stamps them for the slow request log
+         */
+        static void enable(size_t records);
+
+        /**
+         * @brief stamps a phase the first time a request reaches it
+         */
+        static void stamp(t_trace_stamps& stamps, e_trace_phase phase)
+        {
+            if (enabled_ && stamps[phase] == 0)
+                stamps[phase] = now();
+        }
+
+        /**
+         * @brief puts a closed request in the ring if there is one, overwriting the oldest request when it is full
+         * @param client_fd the file descriptor the client had
+         * @param data the request
+         */
+        static void record(int client_fd, const s_client_data& data);
+
+        /**
+         * @return the ring as text, oldest request first
+         */
+        static std::string dump();
+
+    private:
+        static bool enabled_;
+        static std::vector<s_trace_record> ring_;
+        static uint64_t recorded_;
+
+        static uint64_t now()
+        {
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+        }
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef ROUTE_TABLE_HPP
+# define ROUTE_TABLE_HPP
+
+# include <cstddef>
+# include <cstdint>
+# include <memory>
+# include <string_view>
+# include <unordered_map>
+# include <vector>
+# include "../Config.hpp"
+# include "../config/Location.hpp"
+
+typedef std::vector<const Location*>::const_iterator t_route_iterator;
+
+/**
+ * @brief Immutable routing snapshot of one server, built once from its config
+ *
+ * The locations are kept as plain pointers in config order, the config the
+ * table holds keeps them alive. Requests look the table up through a pointer
+ * or reference, so routing a request copies no shared_ptr and touches no
+ * reference count. Lookups the router does for every request are compiled
+ * up front: prefix paths are hashed, the locations handling everything
+ * below their path are ordered longest first and regex locations get a list
+ * of their own.
+ */
+class RouteTable
+{
+    public:
+        explicit RouteTable(std::shared_ptr<const Config> config);
+        RouteTable(const RouteTable&) = delete;
+        RouteTable& operator=(const RouteTable&) = delete;
+
+        t_route_iterator begin() const { return locations_.begin(); }
+        t_route_iterator end() const { return locations_.end(); }
+        size_t size() const { return locations_.size(); }
+        t_route_iterator at(size_t index) const { return locations_.begin() + index; }
+
+        /**
+         * @brief finds the location with exactly this path
+         * @return its index in config order, size() when there is none
+         */
+        size_t find(std::string_view path) const;
+
+        /**
+         * @brief finds the longest location that is not a regex and matches the path
+         * @return it, end() when none matches
+         */
+        t_route_iterator longestPrefix(std::string_view path) const;
+
+        // Indexes of the regex locations in config order
+        const std::vector<size_t>& regexLocations() const { return regex_; }
+
+        // True when a location proxies or answers with the status, the metrics or the trace
+        bool hasHandlers() const { return has_handlers_; }
+
+        const Config& config() const { return *config_; }
+
+    private:
+        std::shared_ptr<const Config> config_;
+        std::vector<const Location*> locations_;
+        std::unordered_map<std::string_view, size_t> paths_; // the views point into the locations
+        std::vector<size_t> prefixes_;                       // locations that are not regexes, longest path first
+        std::vector<size_t> regex_;
+        bool has_handlers_ = false;
+};
+
+#endif
\ No newline at end of file
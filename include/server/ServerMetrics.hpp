@@ -0,0 +1,119 @@
+#ifndef SERVER_METRICS_HPP
+# define SERVER_METRICS_HPP
+
+# include <array>
+# include <atomic>
+# include <cstdint>
+# include <memory>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# define METRICS_MIN_SHIFT 6    // the first bucket holds everything up to 64us
+# define METRICS_OCTAVES 21     // doubling ranges after it, up to 2^27us (134s)
+# define METRICS_BUCKETS (1 + 2 * METRICS_OCTAVES)
+
+class Config;
+class Location;
+
+// Histograms of the whole process, next to the request latency of each series
+enum e_metric_histogram
+{
+    HIST_CGI_SPAWN,         // time to start a script
+    HIST_CGI_QUEUE_WAIT,    // time a request waited for a free CGI slot
+    HIST_COUNT
+};
+
+/**
+ * @brief Log-linear histogram in microseconds, two buckets per doubling like an HDR histogram.
+ * The last entry of buckets counts what is above the last bound
+ */
+struct s_histogram
+{
+    std::array<std::atomic<uint64_t>, METRICS_BUCKETS + 1> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_us{0};
+};
+
+// Requests of one server and location
+struct s_metric_series
+{
+    std::array<std::atomic<uint64_t>, 5> status{};  // 1xx to 5xx
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+    s_histogram latency;
+};
+
+// What one thread recorded, only that thread writes to it
+struct s_metrics_slot
+{
+    std::unique_ptr<s_metric_series[]> series;
+    size_t size = 0;
+    std::array<s_histogram, HIST_COUNT> histograms;
+};
+
+/**
+ * @brief Request metrics for the Prometheus /metrics page
+ *
+ * Every server and location is registered as a series before the event
+ * loop starts, a reload registers the servers of the new config and reuses
+ * the series whose labels did not change. Each thread records into its own slot with plain loads and
+ * stores, a scrape merges the slots and writes the text format. The
+ * counters of ServerStats are exported next to them.
+ */
+class ServerMetrics
+{
+    public:
+        /**
+         * @brief registers a series for the server and one for each of its locations
+         * @param config the server
+         */
+        static void registerServer(const Config& config);
+
+        /**
+         * @brief forgets the server and its locations, their series keep what they counted
+         * @param config the server, about to be freed
+         */
+        static void unregisterServer(const Config& config);
+
+        /**
+         * @brief records a finished request
+         * @param config the server that handled it
+         * @param location the location it was routed to, nullptr when there was none
+         * @param status the status code that was sent, requests without a response are not counted
+         * @param bytes_in bytes received from the client
+         * @param bytes_out bytes sent to the client
+         * @param duration_us microseconds from accept to close
+         */
+        static void recordRequest(const Config* config, const Location* location, uint16_t status, uint64_t bytes_in, uint64_t bytes_out, uint64_t duration_us);
+
+        /**
+         * @brief records a value in one of the process wide histograms
+         */
+        static void recordHistogram(e_metric_histogram histogram, uint64_t value_us);
+
+        /**
+         * @return all metrics in the Prometheus text exposition format
+         */
+        static std::string exposition();
+
+    private:
+        // Labels of a series, its index is the position in the list
+        struct s_series_info
+        {
+            std::string server;
+            std::string location;
+        };
+
+        static s_metrics_slot& local();
+        static void grow(s_metrics_slot& slot);
+        static size_t seriesFor(const std::string& server, const std::string& location);
+        static std::mutex& mutex();
+        static std::vector<std::unique_ptr<s_metrics_slot>>& slots();
+        static std::vector<s_series_info>& series();
+        static std::unordered_map<const void*, size_t>& index();
+        static void record(s_histogram& histogram, uint64_t value_us);
+};
+
+#endif
\ No newline at end of file
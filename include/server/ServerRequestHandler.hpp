@@ -1,20 +1,32 @@
 #ifndef SERVER_REQUEST_HANDLER_HPP
 # define SERVER_REQUEST_HANDLER_HPP
 
-# include <unordered_map>
 # include <any>
 # include <string>
+# include <string_view>
 # include <array>
+# include <vector>
+# include <chrono>
+# include <arpa/inet.h>
 # include <sys/epoll.h>
 # include "../Config.hpp"
+# include "ServerStats.hpp"
+# include "RequestTrace.hpp"
+# include "RequestArena.hpp"
+
+class RouteTable;
 
 #define BUFFER_SIZE 1024 * 1024
+#define CLIENT_SLAB_MAX 65536           // most clients one server keeps, higher descriptors are turned away
+#define CLIENT_KEEP_BUFFER (64 * 1024)  // largest buffer a slot keeps for its next client
+#define CLIENT_KEEP_TOTAL (4 * 1024 * 1024) // most bytes the free slots of a server keep together
+#define REQUEST_HEADER_MAX (64 * 1024)  // largest request line and headers a client may send
+#define REQUEST_CHUNK_LINE_MAX 4096     // room for a chunk size line and the CRLFs around the chunk
 
 enum e_reponses {
     E_ROK,
     MODIFY_CLIENT_WRITE,
     HANDLE_CLIENT_EMPTY,
-    HANDLE_COUT_CERR_OUTPUT,
     READ_REQUEST_EMPTY,
     READ_HEADER_BODY_TOO_LARGE,
     NO_CONTENT_TYPE,
@@ -22,46 +34,154 @@ enum e_reponses {
     RECV_FAILED,
     RECV_EMPTY,
     EXCEPTION,
+    READ_INCOMPLETE,
+    CLIENT_SLAB_FULL,
 };
 
 struct s_client_data
 {
     s_client_data(std::shared_ptr<Config>& conf);
-    s_client_data(const s_client_data& other);
-    std::string request_type;
-    std::string request_header;
+    s_client_data(const s_client_data& other) = delete;
+    s_client_data& operator=(const s_client_data& other) = delete;
+    RequestArena arena;             // request line, headers and scratch strings, reset with the record
+    std::string_view request_type;  // the views point into the arena
+    std::string_view request_header;
     std::string request_body;
-    std::string request_method;
-    std::string request_source;
-    std::string http_version;
+    std::string_view request_method;
+    std::string_view request_source;
+    std::string_view http_version;
+    std::string request_buffer; // raw bytes of the request
+    size_t body_start = std::string::npos;
+    size_t parse_pos = 0; // next chunk header of a chunked body
+    uint64_t content_length = 0;
     bool chunked = false;
+    char address[INET6_ADDRSTRLEN] = "";
+    std::string_view client_address; // address of the peer, hashed by ip_hash upstreams
     std::shared_ptr<Config>& config_;
+    const RouteTable* routes = nullptr; // routing table of the server the connection was accepted by
+
+    // Timings and totals of the response for the access log, counted by whoever sends to the client
+    std::chrono::steady_clock::time_point accepted_at = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point header_at{};          // end of the request headers
+    mutable std::chrono::steady_clock::time_point response_at{}; // first byte of the response
+    mutable uint16_t status = 0;
+    mutable uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    const Location* location = nullptr;    // where the request was routed, for the metrics
+    e_client_state state = CLIENT_WAITING; // counted in the reading and writing gauges
+    mutable t_trace_stamps trace{};        // phases of the request, only stamped when tracing is on
+    mutable uint32_t eagains = 0;          // reads and sends that found the socket not ready, for the slow request log
+    mutable uint64_t cgi_wait_us = 0;      // time spent in the queue of a CGI location
+    bool timer_stopped = false;            // the request times out on its own, like a proxied one
+    std::chrono::steady_clock::time_point deadline{}; // when the client times out, its earlier timers are skipped
+
+    // Response bytes the socket did not take yet, sent on EPOLLOUT. A file follows what is in out
+    mutable std::string out;
+    mutable size_t out_offset = 0;
+    mutable int file_fd = -1;
+    mutable off_t file_offset = 0;
+    mutable uint64_t file_left = 0;
+    mutable bool file_chunked = false;     // the file goes out in chunks, a last empty chunk follows it
+    mutable std::array<uint32_t, 4> memory{}; // bytes in the STAT_MEMORY_* gauges, record, buffer, headers and body
+
+    void reset(std::string_view peer);
+    void countSent(const char* data, ssize_t sent) const;
+    bool hasOutput() const { return out_offset < out.size() || file_fd != -1; }
+    void clearOutput() const;
+    void accountMemory() const;
+    void releaseMemory() const;
+    size_t memoryUsage() const;
+};
+
+/**
+ * @brief Client records of a server, one slot for each file descriptor
+ *
+ * The slots are one block that is made once, a slot is only written when a
+ * client with its descriptor shows up. A record stays built when its client
+ * goes, so the next client with the descriptor gets its arena and buffers
+ * back without asking the heap.
+ */
+class ClientSlab
+{
+    public:
+        ClientSlab();
+        ~ClientSlab();
+        ClientSlab(ClientSlab&& other);
+        ClientSlab(const ClientSlab&) = delete;
+        ClientSlab& operator=(const ClientSlab&) = delete;
+
+        /**
+         * @brief takes the slot of fd for a new client
+         * @return the record, nullptr if fd is past the capacity or already taken
+         */
+        s_client_data* acquire(int fd, std::shared_ptr<Config>& conf);
+
+        /**
+         * @return the record of the client on fd, nullptr if there is none
+         */
+        s_client_data* get(int fd) const
+        {
+            if (fd < 0 || static_cast<size_t>(fd) >= capacity_ || state_[fd] != SLOT_USED)
+                return nullptr;
+            return slot(fd);
+        }
+
+        /**
+         * @brief gives the slot of fd back. Its record is kept for the next client,
+         * unless the free slots would keep more than CLIENT_KEEP_TOTAL bytes
+         */
+        void release(int fd);
+
+        size_t capacity() const { return capacity_; }
+
+        /**
+         * @return slots with a client
+         */
+        size_t used() const { return used_; }
+
+        /**
+         * @return the descriptors of the clients in the slab
+         */
+        std::vector<int> clients() const;
+
+    private:
+        enum e_slot_state : uint8_t { SLOT_EMPTY, SLOT_FREE, SLOT_USED };
+
+        size_t capacity_;
+        size_t used_ = 0;
+        size_t kept_ = 0;                           // heap bytes the records of free slots hold on to
+        std::unique_ptr<unsigned char[]> slots_;    // capacity_ records, built on first use
+        std::unique_ptr<e_slot_state[]> state_;
+
+        s_client_data* slot(int fd) const { return reinterpret_cast<s_client_data*>(slots_.get() + sizeof(s_client_data) * fd); }
+        static size_t keptBytes(const s_client_data& data);
 };
 
 class ServerRequestHandler
 {
     public:
         ServerRequestHandler(uint64_t client_body_size);
+        ServerRequestHandler(ServerRequestHandler&& other) = default;
         ~ServerRequestHandler();
         s_client_data* getRequest(int fd);
         void removeNodeFromRequest(int fd);
-        e_reponses readRequest(int client_fd, std::string& request_buffer);
-        e_reponses handleClient(std::string& request_buffer, epoll_event& event);
-        void setStdoutPipe(int out_pipe[]);
-        void setStderrPipe(int err_pipe[]);
-        void setConfigForClient(std::shared_ptr<Config>& conf, int client_fd);
+        size_t clientCount() const;
+        std::vector<int> getClients() const;
+        e_reponses readRequest(int client_fd);
+        e_reponses handleClient(const std::string& request_buffer, epoll_event& event);
+        e_reponses setConfigForClient(std::shared_ptr<Config>& conf, int client_fd, std::string_view client_address);
     private:
-        std::unordered_map<int, s_client_data> request_;
+        friend class MicroBench; // bench/micro times the header and body parsers
+        ClientSlab request_;
         uint64_t max_size_;
-        int stdout_pipe_[2];
-        int stderr_pipe_[2];
-
-        e_reponses readHeader(std::string& request_buffer, size_t header_end, int client_fd, char buffer[]);
-        e_reponses setContentTypeRequest(std::string& request_buffer, size_t header_end, int client_fd);
-        e_reponses setMethodSourceHttpVersion(std::string& request_buffer, int client_fd);
-        e_reponses handleChunkedRequest(size_t body_start, std::string& request_buffer, int client_fd, char buffer[]);
-        int useRecv(int client_fd, char buffer[], std::string& request_buffer);
-        e_reponses handleContentLength(size_t size, std::string& request_buffer, size_t body_start, int client_fd, char buffer[]);
+
+        e_reponses readHeader(s_client_data& data, size_t header_end);
+        e_reponses setContentTypeRequest(s_client_data& data);
+        e_reponses setMethodSourceHttpVersion(s_client_data& data);
+        e_reponses readBody(s_client_data& data);
+        e_reponses handleChunkedRequest(s_client_data& data);
+        e_reponses handleContentLength(s_client_data& data);
+        bool overBufferLimit(const s_client_data& data) const;
 };
 
 #endif
\ No newline at end of file
@@ -4,12 +4,14 @@
 # include "server/ServerRequestHandler.hpp"
 # include "server/ServerResponseValidator.hpp"
 # include "cgi/CGIHandler.hpp"
+# include "proxy/ProxyHandler.hpp"
 # include "../Config.hpp"
 # include <sys/epoll.h>
 # include <vector>
-
-# define STANDARD_LOG_FILE "log.log"
-# define STANDARD_ERROR_LOG_FILE "error.log"
+# include <memory>
+# include <unordered_map>
+# include <deque>
+# include <chrono>
 
 enum e_server_request_return
 {
@@ -20,46 +22,130 @@ enum e_server_request_return
     SRH_FSTREAM_ERROR,
     SRH_CGI_ERROR,
     SRH_DO_TIMEOUT,
+    SRH_CGI_PENDING,
+    SRH_PROXY_PENDING,
+};
+
+# define CGI_TIMEOUT_MS 20000
+# define SEND_FILE_BLOCK (64 * 1024) // bytes of a file handed to sendfile() or read for a chunk at once
+# define CGI_CACHE_MAX_ENTRIES 1024
+
+struct s_cgi_waiting
+{
+    int client_fd;
+    const s_client_data* client_data;
+    std::string script_path;
+    std::string cache_key;
+    std::chrono::steady_clock::time_point queued_at;
+};
+
+// runtime state of the CGI scripts of one location
+struct s_cgi_pool
+{
+    size_t running = 0;
+    std::deque<s_cgi_waiting> queue;
+    uint64_t queued_total = 0;
+    uint64_t rejected_total = 0;
+    uint64_t expired_total = 0;
+    uint64_t wait_total_us = 0;
+    uint64_t wait_max_us = 0;
+};
+
+// a running script and the clients waiting for its output,
+// a cache refresh has no clients
+struct s_cgi_job
+{
+    std::unique_ptr<CGIHandler> handler;
+    std::vector<std::pair<int, const s_client_data*>> clients;
+    std::vector<int> fds;
+    std::string cache_key;
+    std::chrono::steady_clock::time_point started;
+};
+
+// cached output of a GET request, job is the script filling or refreshing it
+struct s_cgi_cache_entry
+{
+    std::string output;
+    bool valid = false;
+    std::chrono::steady_clock::time_point stored_at;
+    std::chrono::seconds lifetime{0};
+    int job = -1;
+};
+
+// changes the server has to make to its epoll after CGI work
+struct s_cgi_update
+{
+    std::vector<epoll_event> added;
+    std::vector<int> closed;
+    std::vector<int> waiting;
+    std::vector<std::pair<int, e_server_request_return>> answered;
 };
 
 class ServerResponseHandler
 {
     public:
-        ServerResponseHandler(const std::vector<std::shared_ptr<Location>>& locations, const std::string& root, const std::map<uint16_t, std::string>& error_map);
+        ServerResponseHandler(const std::string& root, const std::map<uint16_t, std::string>& error_map);
+        ServerResponseHandler(ServerResponseHandler&& other) = default;
         ~ServerResponseHandler();
-        e_server_request_return handleResponse(int client_fd, s_client_data& client_data, std::vector<std::shared_ptr<Location>> locations);
+        e_server_request_return handleResponse(int client_fd, s_client_data& client_data, const RouteTable& routes);
         e_server_request_return setupResponse(int client_fd, uint16_t code, const s_client_data& data, std::string location = "");
-        void handleCoutErrOutput(int fd);
-        void setStdoutPipe(int stdout_pipe[]);
+        e_server_request_return flushClient(int client_fd, const s_client_data& data);
+        void setProxy(ProxyHandler* proxy);
+        void handleCGIEvent(int fd);
+        void timeoutCGI(int client_fd);
+        bool hasCGI(int client_fd) const;
+        bool hasCGIJobs() const;
+        void removeCGI(int client_fd);
+        void updateCGI();
+        int getCGITimeout() const;
+        bool takeCGIUpdate(s_cgi_update& update);
+        const std::unordered_map<const Location*, s_cgi_pool>& getCGIPools() const;
     private:
+        friend class MicroBench; // bench/micro times getContentType and sourceChunker
         ServerResponseValidator SRV_;
         const std::map<uint16_t, std::string>& error_pages_;
-        int stdout_pipe_[2];
+        ProxyHandler* proxy_;
         std::map<uint16_t, std::string> status_codes_;
+        std::unordered_map<int, s_cgi_job> cgi_jobs_;
+        std::unordered_map<int, int> cgi_fd_jobs_;
+        std::unordered_map<int, int> cgi_client_jobs_;
+        std::unordered_map<const Location*, s_cgi_pool> cgi_pools_;
+        std::unordered_map<std::string, s_cgi_cache_entry> cgi_cache_;
+        s_cgi_update cgi_update_;
+        size_t cgi_waiting_;
+        int cgi_next_job_;
 
-        e_server_request_return handleReturns(int client_fd, e_responeValReturn nr, s_client_data& data, std::vector<std::shared_ptr<Location>>::const_iterator& location_it);
+        e_server_request_return handleReturns(int client_fd, e_responeValReturn nr, s_client_data& data, t_route_iterator& location_it);
         e_server_request_return buildDirectoryResponse(const std::string& path, std::string& body);
         e_server_request_return sendResponse(int client_fd, const std::string& status, const std::string& file_location, const s_client_data& data, bool d_list = false);
         std::string getContentType(const std::string& file_path);
-        e_server_request_return sendChunkedResponse(int client_fd, std::ifstream& file_stream);
-        e_server_request_return sendFile(int client_fd, std::ifstream& file_stream, std::streamsize size);
+        ssize_t sendClient(int client_fd, const s_client_data& data, const char* buffer, size_t size);
         std::vector<std::string> sourceChunker(std::string& source);
-        void logMsg(const char* msg, int fd);
 
         /**
-         * @brief Handle CGI request processing
+         * @brief Start CGI request processing
          * @param client_fd Client socket
          * @param client_data Request data
          * @param location Location configuration
          * @param script_path Path to CGI script
-         * @return SRH_OK on success, error code otherwise
+         * @return SRH_CGI_PENDING when the client waits for a script, error code otherwise
          */
         e_server_request_return handleCGI(
             int client_fd,
             const s_client_data& client_data,
             const Location& location,
             const std::string& script_path);
-        e_server_request_return sendRedirectResponse(int client_fd, uint16_t code, std::string& location);
+        e_server_request_return startCGI(int client_fd, const s_client_data* client_data, const Location& location, const std::string& script_path, const std::string& cache_key);
+        bool serveCachedCGI(int client_fd, const s_client_data& client_data, const Location& location, const std::string& script_path, const std::string& cache_key, e_server_request_return& result);
+        void storeCGIResponse(const std::string& cache_key, const std::string& output);
+        bool reserveCGICacheEntry(const std::string& cache_key);
+        void finishCGI(int job_id);
+        void releaseCGI(int job_id);
+        e_server_request_return sendCGIResponse(int client_fd, const s_client_data& client_data, int exit_code, const std::string& output, const char* cache_status = nullptr);
+        e_server_request_return sendStatus(int client_fd, const s_client_data& client_data);
+        e_server_request_return sendMetrics(int client_fd, const s_client_data& client_data);
+        e_server_request_return sendTrace(int client_fd, const s_client_data& client_data);
+        e_server_request_return sendRedirectResponse(int client_fd, uint16_t code, std::string& location, const s_client_data& data);
         void fillStatusCodes();
         e_server_request_return removeFile(int client_fd, s_client_data& client_data);
 };
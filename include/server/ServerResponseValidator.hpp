@@ -2,11 +2,13 @@
 # define SERVER_RESPONSE_VALIDATOR_HPP
 
 # include <string>
+# include <string_view>
 # include <sys/epoll.h>
 # include <vector>
 # include "../config/Location.hpp"
 # include "../Config.hpp"
 # include "ServerRequestHandler.hpp"
+# include "RouteTable.hpp"
 
 enum e_responeValReturn
 {
@@ -27,23 +29,23 @@ enum e_responeValReturn
 class ServerResponseValidator
 {
     public:
-        ServerResponseValidator(const std::vector<std::shared_ptr<Location>>& locations, const std::string& root);
+        ServerResponseValidator(const std::string& root);
         ~ServerResponseValidator();
-        bool checkHTTPVersion(std::string& http_version);
-        e_responeValReturn checkLocations(std::vector<std::string>& token_location, std::string& file_path, std::vector<std::shared_ptr<Location>>::const_iterator& location_it, s_client_data& client_data);
-        e_responeValReturn checkAllowedMethods(std::vector<std::shared_ptr<Location>>::const_iterator& location_it, std::string& method);
-        e_responeValReturn checkFile(std::string& file_path, std::vector<std::shared_ptr<Location>>::const_iterator& location_it);
-        e_responeValReturn checkAutoIndexing(std::vector<std::shared_ptr<Location>>::const_iterator& location_it);
+        bool checkHTTPVersion(std::string_view http_version);
+        e_responeValReturn checkLocations(const RouteTable& routes, std::vector<std::string>& token_location, std::string& file_path, t_route_iterator& location_it, s_client_data& client_data);
+        e_responeValReturn checkHandlerLocation(const RouteTable& routes, const std::string& path, t_route_iterator& location_it);
+        e_responeValReturn checkAllowedMethods(t_route_iterator& location_it, std::string_view method);
+        e_responeValReturn checkFile(std::string& file_path, t_route_iterator& location_it);
+        e_responeValReturn checkAutoIndexing(t_route_iterator& location_it);
         bool isDirectory(std::string& path);
         bool filePermission(const std::string& path);
         const std::string& getRoot() const;
         bool fileExists(const std::string& path);
     private:
-        const std::vector<std::shared_ptr<Location>>& locations_;
         const std::string& root_;
 
-        void setPossibleLocation(size_t token_size, std::vector<std::string>& token_location, std::map<size_t, std::shared_ptr<Location>>& found_location);
-        void setPossibleRegexLocation(std::map<size_t, std::shared_ptr<Location>>& found_location, s_client_data& client_data);
+        void setPossibleLocation(const RouteTable& routes, size_t token_size, std::vector<std::string>& token_location, std::map<size_t, const Location*>& found_location);
+        void setPossibleRegexLocation(const RouteTable& routes, std::map<size_t, const Location*>& found_location, s_client_data& client_data);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef SERVER_STATS_HPP
+# define SERVER_STATS_HPP
+
+# include <array>
+# include <atomic>
+# include <cstdint>
+# include <memory>
+# include <mutex>
+# include <vector>
+
+// Counters of the whole process, totals only go up, gauges go up and down
+enum e_stat_counter
+{
+    STAT_ACCEPTED,          // connections accepted
+    STAT_HANDLED,           // connections that made it into the epoll
+    STAT_CLOSED,            // connections closed again
+    STAT_REQUESTS,          // requests read completely
+    STAT_READING,           // gauge, clients sending their request
+    STAT_WRITING,           // gauge, clients waiting for or getting their response
+    STAT_CGI_RUNNING,       // gauge, scripts in flight
+    STAT_CGI_TIMEOUTS,      // scripts killed for running too long
+    STAT_CGI_CACHE_HITS,
+    STAT_CGI_CACHE_STALE,
+    STAT_CGI_CACHE_MISSES,
+    STAT_CGI_CACHE_COLLAPSED,
+    STAT_CGI_CACHE_STORES,
+    STAT_MEMORY_CLIENTS,    // gauge, bytes of the client records themselves
+    STAT_MEMORY_BUFFERS,    // gauge, bytes of requests that are still being read
+    STAT_MEMORY_HEADERS,    // gauge, bytes of request lines, headers and client addresses
+    STAT_MEMORY_BODIES,     // gauge, bytes of request bodies
+    STAT_COUNT
+};
+
+// Where a client is, the READING and WRITING gauges count clients per state
+enum e_client_state
+{
+    CLIENT_WAITING,         // connected, nothing received yet
+    CLIENT_READING,
+    CLIENT_WRITING,
+    CLIENT_CLOSED
+};
+
+// Counters of one thread, on their own cache line so threads do not share one
+struct alignas(64) s_stats_slot
+{
+    std::array<std::atomic<int64_t>, STAT_COUNT> counters{};
+};
+
+/**
+ * @brief Live counters of the server
+ *
+ * Each thread counts in its own slot, only the owner writes to it so an
+ * update is a plain load and store instead of a locked instruction. The
+ * slots are summed when somebody asks, like the status page does.
+ */
+class ServerStats
+{
+    public:
+        /**
+         * @brief adds to a counter of the calling thread
+         */
+        static void add(e_stat_counter counter, int64_t amount = 1)
+        {
+            std::atomic<int64_t>& value = local().counters[counter];
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief moves a client to another state, keeping the gauges right
+         */
+        static void moveClient(e_client_state& state, e_client_state to);
+
+        /**
+         * @return the counters summed over all threads
+         */
+        static std::array<int64_t, STAT_COUNT> snapshot();
+
+    private:
+        static s_stats_slot& local();
+        static std::mutex& slotsMutex();
+        static std::vector<std::unique_ptr<s_stats_slot>>& slots();
+};
+
+#endif
\ No newline at end of file
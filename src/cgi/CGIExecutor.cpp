@@ -1,184 +1,244 @@
 #include "cgi/CGIExecutor.hpp"
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <stdexcept>
 #include <cstring>
-#include <sstream>
 #include <fcntl.h>
-#include <thread>
-
+#include <spawn.h>
+#include <csignal>
+#include <cerrno>
+
+#define CGI_READ_SIZE 65536
+
+CGIExecutor::CGIExecutor()
+    : process_fd_(-1)
+    , pid_(-1)
+    , request_body_(nullptr)
+    , body_offset_(0)
+    , exit_code_(static_cast<int>(CGIExitStatus::Error))
+{
+    for (int i = 0; i < 2; ++i) {
+        input_pipe_[i] = -1;
+        output_pipe_[i] = -1;
+        error_pipe_[i] = -1;
+    }
+}
 
-#define TIMEOUT_MS 20000 // 20 seconds
+CGIExecutor::~CGIExecutor()
+{
+    if (pid_ > 0) {
+        kill(pid_, SIGKILL);
+        int status;
+        waitpid(pid_, &status, 0);
+    }
+    closeFd(process_fd_);
+    closePipes();
+}
 
-std::pair<int, std::string> CGIExecutor::execute(
+void CGIExecutor::start(
     const std::string& interpreter,
     const std::string& script_path,
     const std::string& request_body,
-    const std::map<std::string, std::string>& env_vars)
+    const std::vector<std::string>& env)
 {
-    setupPipes();
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        closePipes();
-        throw std::runtime_error("Fork failed: " + std::string(strerror(errno)));
+    // Prepare environment and arguments before anything is started
+    std::vector<char*> env_array;
+    env_array.reserve(env.size() + 1);
+    for (const auto& str : env) {
+        env_array.push_back(const_cast<char*>(str.c_str()));
     }
+    env_array.push_back(nullptr);
+    std::string new_script_path = script_path.substr(1, script_path.size());
+    char* const args[] = {
+        const_cast<char*>(interpreter.c_str()),
+        const_cast<char*>(new_script_path.c_str()),
+        nullptr
+    };
 
-    if (pid == 0) {  // Child process
-        // Close unused pipe ends
-        close(input_pipe_[1]);   // Close write end of input
-        close(output_pipe_[0]);  // Close read end of output
-        close(error_pipe_[0]);  // Cloase read end of error
+    setupPipes();
+    pid_ = spawn(args, env_array.data());
 
-        // Redirect stdin to input pipe
-        if (dup2(input_pipe_[0], STDIN_FILENO) == -1) {
-            exit(EXIT_FAILURE);
-        }
+    // Parent process
+    closeFd(input_pipe_[0]);   // Close read end of input
+    closeFd(output_pipe_[1]);  // Close write end of output
+    closeFd(error_pipe_[1]);  // Close write end of error
 
-        // Redirect stdout to output pipe
-        if (dup2(output_pipe_[1], STDOUT_FILENO) == -1) {
-            exit(EXIT_FAILURE);
-        }
+    process_fd_ = static_cast<int>(syscall(SYS_pidfd_open, pid_, 0));
+    if (process_fd_ == -1) {
+        throw std::runtime_error("pidfd_open failed: " + std::string(strerror(errno)));
+    }
 
-        // Redirect stderr to error pipe
-        if (dup2(error_pipe_[1], STDERR_FILENO) == -1) {
-            exit(EXIT_FAILURE);
-        }
+    // The body is written from the event loop, an empty one means EOF right away
+    request_body_ = &request_body;
+    body_offset_ = 0;
+    if (request_body.empty()) {
+        closeFd(input_pipe_[1]);
+    }
+}
 
-        // Prepare environment
-        std::vector<std::string> env_strings = prepareEnvironment(env_vars);
-        std::vector<const char*> env_array;
-        for (const auto& str : env_strings) {
-            env_array.push_back(str.c_str());
-        }
-        env_array.push_back(nullptr);
-        std::string new_script_path = script_path.substr(1, script_path.size());
+CGIEvent CGIExecutor::handleEvent(int fd)
+{
+    if (fd == -1) {
+        return CGIEvent::Pending;
+    }
+    if (fd == input_pipe_[1]) {
+        return writeInput();
+    }
+    if (fd == output_pipe_[0]) {
+        return readPipe(output_pipe_[0], output_);
+    }
+    if (fd == error_pipe_[0]) {
+        return readPipe(error_pipe_[0], error_);
+    }
+    if (fd == process_fd_) {
+        return reap();
+    }
+    return CGIEvent::Pending;
+}
 
-        // Prepare arguments
-        const char* args[] = {
-            interpreter.c_str(),
-            new_script_path.c_str(),
-            nullptr
-        };
-        execve(interpreter.c_str(), const_cast<char* const*>(args), const_cast<char* const*>(env_array.data()));
-        exit(EXIT_FAILURE);  // Only reached if execve fails
+void CGIExecutor::terminate()
+{
+    if (pid_ > 0) {
+        kill(pid_, SIGKILL);
+        int status;
+        waitpid(pid_, &status, 0);
+        pid_ = -1;
     }
+    closeFd(process_fd_);
+    closePipes();
+    exit_code_ = static_cast<int>(CGIExitStatus::Timeout);
+}
 
+const std::string& CGIExecutor::getOutput() const
+{
+    if (output_.empty()) {
+        return error_;
+    }
+    return output_;
+}
 
-    // Parent process
-    close(input_pipe_[0]);   // Close read end of input
-    close(output_pipe_[1]);  // Close write end of output
-    close(error_pipe_[1]);  // Close write end of error
-
-    // Write request body to script if present
-    if (!request_body.empty()) {
-        if (write(input_pipe_[1], request_body.data(), request_body.length()) == -1) {
-            close(input_pipe_[1]); close(output_pipe_[0]); close(error_pipe_[0]);
-            kill(pid, SIGKILL);
-            int status;
-            waitpid(pid, &status, 0);
-            throw std::runtime_error("Write failed: to CGI has not been successful\n");
+CGIEvent CGIExecutor::writeInput()
+{
+    while (body_offset_ < request_body_->size()) {
+        ssize_t written = write(input_pipe_[1],
+            request_body_->data() + body_offset_,
+            request_body_->size() - body_offset_);
+        if (written == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return CGIEvent::Pending;  // Pipe is full, wait until the script reads
+            }
+            break;  // EPIPE: the script does not want the (rest of the) body
         }
+        body_offset_ += static_cast<size_t>(written);
     }
-    close(input_pipe_[1]);  // Close after writing
-
-    int exit_code = wait_for_child_with_timeout(pid);
+    closeFd(input_pipe_[1]);  // Close after writing so the script sees EOF
+    return CGIEvent::FdClosed;
+}
 
-    // Read script output
-    std::string output = readOutput();
-    if (output.empty())
-        output = readError();
+CGIEvent CGIExecutor::readPipe(int& fd, std::string& buffer)
+{
+    char chunk[CGI_READ_SIZE];
+    ssize_t bytes_read;
 
-    return {exit_code, output};
+    while ((bytes_read = read(fd, chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, bytes_read);
+    }
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return CGIEvent::Pending;
+    }
+    closeFd(fd);
+    return CGIEvent::FdClosed;
 }
 
-int CGIExecutor::wait_for_child_with_timeout(pid_t pid)
+CGIEvent CGIExecutor::reap()
 {
-    const int interval_ms = 100;
-    const int timeout_ms = TIMEOUT_MS;
-
-    int elapsed = 0;
     int status;
+    pid_t result = waitpid(pid_, &status, WNOHANG);
+    if (result == 0) {
+        return CGIEvent::Pending;
+    }
+    pid_ = -1;
+    if (result == -1) {
+        exit_code_ = static_cast<int>(CGIExitStatus::Error);
+    } else if (WIFEXITED(status)) {
+        exit_code_ = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        exit_code_ = static_cast<int>(CGIExitStatus::KilledBySignal);
+    } else {
+        exit_code_ = static_cast<int>(CGIExitStatus::Error);
+    }
 
-    while (true) {
-        pid_t result = waitpid(pid, &status, WNOHANG);
-        if (result == -1) {
-            return static_cast<int>(CGIExitStatus::Error);
-        }
-        if (result == pid) {
-            if (WIFEXITED(status)) return WEXITSTATUS(status);
-            if (WIFSIGNALED(status)) return static_cast<int>(CGIExitStatus::KilledBySignal);
-            return static_cast<int>(CGIExitStatus::Error);
-        }
-
-        if (elapsed >= timeout_ms) {
-            kill(pid, SIGKILL);
-            waitpid(pid, &status, 0);
-            return static_cast<int>(CGIExitStatus::Timeout);
-        }
+    // Whatever is still in the pipes was written before the script exited
+    if (output_pipe_[0] != -1) {
+        readPipe(output_pipe_[0], output_);
+    }
+    if (error_pipe_[0] != -1) {
+        readPipe(error_pipe_[0], error_);
+    }
+    closeFd(process_fd_);
+    closePipes();
+    return CGIEvent::Finished;
+}
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
-        elapsed += interval_ms;
+pid_t CGIExecutor::spawn(char* const argv[], char* const envp[])
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // Redirect stdin, stdout and stderr to the pipes, the other ends are close-on-exec
+    posix_spawn_file_actions_adddup2(&actions, input_pipe_[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_pipe_[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, error_pipe_[1], STDERR_FILENO);
+
+    // The script should not inherit the ignored SIGPIPE or a blocked signal mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, argv[0], &actions, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        closePipes();
+        throw std::runtime_error("Spawn failed: " + std::string(strerror(err)));
     }
+    return pid;
 }
 
 void CGIExecutor::setupPipes()
 {
-    if (pipe(input_pipe_) == -1 || pipe(output_pipe_) == -1 || pipe(error_pipe_) == -1) {
+    if (pipe2(input_pipe_, O_CLOEXEC) == -1 || pipe2(output_pipe_, O_CLOEXEC) == -1 || pipe2(error_pipe_, O_CLOEXEC) == -1) {
+        closePipes();
         throw std::runtime_error("Pipe creation failed: " + std::string(strerror(errno)));
     }
 
-    // Set pipes to non-blocking mode
+    // The parent ends are driven by the event loop and must never block
+    fcntl(input_pipe_[1], F_SETFL, O_NONBLOCK);
     fcntl(output_pipe_[0], F_SETFL, O_NONBLOCK);
+    fcntl(error_pipe_[0], F_SETFL, O_NONBLOCK);
 }
 
 void CGIExecutor::closePipes()
 {
-    close(input_pipe_[0]);
-    close(input_pipe_[1]);
-    close(output_pipe_[0]);
-    close(output_pipe_[1]);
-    close(error_pipe_[0]);
-    close(error_pipe_[1]);
-}
-
-std::vector<std::string> CGIExecutor::prepareEnvironment(
-    const std::map<std::string, std::string>& env_vars) const
-{
-    std::vector<std::string> result;
-    result.reserve(env_vars.size());
-
-    for (const auto& [key, value] : env_vars) {
-        result.push_back(key + "=" + value);
-    }
-
-    return result;
+    closeFd(input_pipe_[0]);
+    closeFd(input_pipe_[1]);
+    closeFd(output_pipe_[0]);
+    closeFd(output_pipe_[1]);
+    closeFd(error_pipe_[0]);
+    closeFd(error_pipe_[1]);
 }
 
-std::string CGIExecutor::readOutput()
+void CGIExecutor::closeFd(int& fd)
 {
-    std::stringstream output;
-    char buffer[4096];
-    ssize_t bytes_read;
-
-    while ((bytes_read = read(output_pipe_[0], buffer, sizeof(buffer))) > 0) {
-        output.write(buffer, bytes_read);
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
     }
-
-    close(output_pipe_[0]);
-    return output.str();
 }
-
-std::string CGIExecutor::readError()
-{
-    std::stringstream error;
-    char buffer[4096];
-    ssize_t bytes_read;
-
-    while ((bytes_read = read(error_pipe_[0], buffer, sizeof(buffer))) > 0) {
-        error.write(buffer, bytes_read);
-    }
-
-    close(error_pipe_[0]);
-    return error.str();
-}
\ No newline at end of file
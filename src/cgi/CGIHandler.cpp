@@ -11,13 +11,11 @@ CGIHandler::CGIHandler(const Location& location)
     }
 }
 
-std::pair<int, std::string> CGIHandler::handleRequest(
+void CGIHandler::start(
     const std::string& script_path,
     const std::string& request_method,
     const std::string& request_body,
-    const std::string& query_string,
-    const std::string& server_name,
-    uint16_t server_port)
+    const std::string& query_string)
 {
     // Get interpreter for this script type
     std::string interpreter = getInterpreter(script_path);
@@ -27,13 +25,11 @@ std::pair<int, std::string> CGIHandler::handleRequest(
         script_path,
         request_method,
         query_string,
-        server_name,
-        server_port,
         request_body.length()
     );
 
-    // Execute the script
-    return executor_.execute(interpreter, script_path, request_body, env_vars);
+    // Start the script, the event loop takes it from here
+    executor_.start(interpreter, script_path, request_body, env_vars);
 }
 
 std::string CGIHandler::getInterpreter(const std::string& script_path) const
@@ -53,35 +49,30 @@ std::string CGIHandler::getInterpreter(const std::string& script_path) const
     throw std::runtime_error("No interpreter found for extension: " + ext);
 }
 
-std::map<std::string, std::string> CGIHandler::setupEnvironment(
+std::vector<std::string> CGIHandler::setupEnvironment(
     const std::string& script_path,
     const std::string& request_method,
     const std::string& query_string,
-    const std::string& server_name,
-    uint16_t server_port,
     size_t content_length) const
 {
-    std::map<std::string, std::string> env;
-    
+    // GATEWAY_INTERFACE, SERVER_* are the same for every request on this location
+    std::vector<std::string> env = location_.getCGIConfig().static_env;
+    env.reserve(env.size() + 8);
+
     // Required CGI variables per CGI/1.1 spec
-    env["GATEWAY_INTERFACE"] = "CGI/1.1";
-    env["SERVER_PROTOCOL"] = "HTTP/1.1";
-    env["SERVER_SOFTWARE"] = "webserv/1.0";
-    env["SERVER_NAME"] = server_name;
-    env["SERVER_PORT"] = std::to_string(server_port);
-    env["REQUEST_METHOD"] = request_method;
-    env["SCRIPT_NAME"] = script_path;
-    env["PATH_INFO"] = "";  // We don't support path info
-    env["PATH_TRANSLATED"] = script_path;
+    env.push_back("REQUEST_METHOD=" + request_method);
+    env.push_back("SCRIPT_NAME=" + script_path);
+    env.push_back("PATH_INFO=");  // We don't support path info
+    env.push_back("PATH_TRANSLATED=" + script_path);
 
     // Optional but commonly used variables
     if (!query_string.empty()) {
-        env["QUERY_STRING"] = query_string;
+        env.push_back("QUERY_STRING=" + query_string);
     }
 
     if (content_length > 0) {
-        env["CONTENT_LENGTH"] = std::to_string(content_length);
-        env["CONTENT_TYPE"] = "multipart/form-data";
+        env.push_back("CONTENT_LENGTH=" + std::to_string(content_length));
+        env.push_back("CONTENT_TYPE=multipart/form-data");
     }
 
     return env;
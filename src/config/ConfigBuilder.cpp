@@ -32,6 +32,46 @@ ConfigBuilder& ConfigBuilder::addErrorPage(uint16_t code, const std::string& pag
     return *this;
 }
 
+ConfigBuilder& ConfigBuilder::setAccessLog(const std::string& path, bool json, double sample) {
+    if (!(sample > 0.0 && sample <= 1.0)) {
+        throw std::runtime_error("Access log sample must be above 0 and at most 1");
+    }
+    config_->access_log_path_ = path;
+    config_->access_log_json_ = json;
+    config_->access_log_sample_ = sample;
+    return *this;
+}
+
+ConfigBuilder& ConfigBuilder::setErrorLog(const std::string& path, int level) {
+    config_->error_log_path_ = path;
+    config_->error_log_level_ = level;
+    return *this;
+}
+
+ConfigBuilder& ConfigBuilder::setRequestTrace(size_t records) {
+    config_->request_trace_ = records;
+    return *this;
+}
+
+ConfigBuilder& ConfigBuilder::setSlowRequestLog(uint64_t threshold_ms, size_t rate) {
+    if (rate == 0) {
+        throw std::runtime_error("Slow request rate must be at least 1");
+    }
+    config_->slow_request_threshold_ = threshold_ms;
+    config_->slow_request_rate_ = rate;
+    return *this;
+}
+
+ConfigBuilder& ConfigBuilder::setShutdownTimeout(uint64_t seconds) {
+    config_->shutdown_timeout_ = seconds;
+    return *this;
+}
+
+ConfigBuilder& ConfigBuilder::setWorkerProcesses(int workers) {
+    config_->worker_processes_ = workers;
+    return *this;
+}
+
 void ConfigBuilder::startLocation(const std::string& path, Location::MatchType type) {
     current_location_ = std::make_shared<Location>(path, type);
     current_location_->index_ = config_.get()->getIndex();
@@ -85,6 +125,63 @@ void ConfigBuilder::setLocationCGIExt(const std::vector<std::string>& extensions
     current_location_->cgi_config_.extensions = extensions;
 }
 
+void ConfigBuilder::setLocationCGIMaxConcurrent(size_t count) {
+    ensureLocationContext("setLocationCGIMaxConcurrent");
+    current_location_->cgi_config_.max_concurrent = count;
+}
+
+void ConfigBuilder::setLocationCGIQueueSize(size_t size) {
+    ensureLocationContext("setLocationCGIQueueSize");
+    current_location_->cgi_config_.queue_size = size;
+}
+
+void ConfigBuilder::setLocationCGIQueueTimeout(size_t seconds) {
+    ensureLocationContext("setLocationCGIQueueTimeout");
+    current_location_->cgi_config_.queue_timeout = seconds;
+}
+
+void ConfigBuilder::setLocationCGICacheValid(size_t seconds) {
+    ensureLocationContext("setLocationCGICacheValid");
+    current_location_->cgi_config_.cache_valid = seconds;
+}
+
+void ConfigBuilder::setLocationProxyPass(const std::string& host, uint16_t port, const std::string& uri) {
+    ensureLocationContext("setLocationProxyPass");
+    current_location_->proxy_config_.host = host;
+    current_location_->proxy_config_.port = port;
+    current_location_->proxy_config_.uri = uri;
+}
+
+void ConfigBuilder::setLocationProxyConnectTimeout(size_t seconds) {
+    ensureLocationContext("setLocationProxyConnectTimeout");
+    current_location_->proxy_config_.connect_timeout = seconds;
+}
+
+void ConfigBuilder::setLocationProxyReadTimeout(size_t seconds) {
+    ensureLocationContext("setLocationProxyReadTimeout");
+    current_location_->proxy_config_.read_timeout = seconds;
+}
+
+void ConfigBuilder::setLocationProxyKeepalive(size_t count) {
+    ensureLocationContext("setLocationProxyKeepalive");
+    current_location_->proxy_config_.keepalive = count;
+}
+
+void ConfigBuilder::setLocationStubStatus() {
+    ensureLocationContext("setLocationStubStatus");
+    current_location_->stub_status_ = true;
+}
+
+void ConfigBuilder::setLocationMetrics() {
+    ensureLocationContext("setLocationMetrics");
+    current_location_->metrics_ = true;
+}
+
+void ConfigBuilder::setLocationTraceDump() {
+    ensureLocationContext("setLocationTraceDump");
+    current_location_->trace_dump_ = true;
+}
+
 void ConfigBuilder::endLocation() {
     if (current_location_) {
         config_->locations_.push_back(current_location_);
@@ -92,9 +189,77 @@ void ConfigBuilder::endLocation() {
     }
 }
 
+void ConfigBuilder::startUpstream(const std::string& name) {
+    for (const auto& upstream : config_->upstreams_) {
+        if (upstream->name_ == name) {
+            throw std::runtime_error("Duplicate upstream: " + name);
+        }
+    }
+    current_upstream_ = std::make_shared<Upstream>(name);
+}
+
+void ConfigBuilder::addUpstreamServer(const Upstream::Server& server) {
+    ensureUpstreamContext("addUpstreamServer");
+    current_upstream_->servers_.push_back(server);
+}
+
+void ConfigBuilder::setUpstreamBalance(Upstream::Balance balance, Upstream::HashKey key) {
+    ensureUpstreamContext("setUpstreamBalance");
+    current_upstream_->balance_ = balance;
+    current_upstream_->hash_key_ = key;
+}
+
+void ConfigBuilder::endUpstream() {
+    ensureUpstreamContext("endUpstream");
+    if (current_upstream_->servers_.empty()) {
+        throw std::runtime_error("Upstream " + current_upstream_->name_ + " has no servers");
+    }
+    config_->upstreams_.push_back(current_upstream_);
+    current_upstream_.reset();
+}
+
+void ConfigBuilder::resolveUpstreams() {
+    for (auto& location : config_->locations_) {
+        Location::ProxyConfig& proxy = location->proxy_config_;
+        if (!proxy.isEnabled()) {
+            continue;
+        }
+        // Like nginx, a name without a port refers to an upstream block defined anywhere in the server
+        if (proxy.port == 0) {
+            for (const auto& upstream : config_->upstreams_) {
+                if (upstream->name_ == proxy.host) {
+                    proxy.upstream = upstream;
+                    break;
+                }
+            }
+        }
+        if (!proxy.upstream) {
+            auto single = std::make_shared<Upstream>(proxy.host);
+            Upstream::Server server;
+            server.host = proxy.host;
+            server.port = proxy.port == 0 ? 80 : proxy.port;
+            single->servers_.push_back(server);
+            proxy.upstream = single;
+        }
+    }
+}
+
 std::shared_ptr<Config> ConfigBuilder::build() {
     if (current_location_) {
         endLocation(); // Ensure any in-progress location is added
     }
+    resolveUpstreams();
+    // Server settings are only final now, so the CGI environment is built here
+    for (auto& location : config_->locations_) {
+        if (location->hasCGI()) {
+            location->cgi_config_.static_env = {
+                "GATEWAY_INTERFACE=CGI/1.1",
+                "SERVER_PROTOCOL=HTTP/1.1",
+                "SERVER_SOFTWARE=webserv/1.0",
+                "SERVER_NAME=" + config_->server_name_,
+                "SERVER_PORT=" + std::to_string(config_->port_),
+            };
+        }
+    }
     return config_;
 }
\ No newline at end of file
@@ -58,6 +58,7 @@ Token ConfigLexer::readIdentifier() {
     auto isValidIdentChar = [](char c) {
         return std::isalnum(static_cast<unsigned char>(c)) ||   // Alphanumeric
                c == '_' || c == '-' || c == '/' || c == '.' ||  // Basic path chars
+               c == ':' ||                                      // Host:port in URLs
                c == '\\' || c == '|' ||                         // Regex escapes and alternation
                c == '[' || c == ']' ||                         // Character classes
                c == '(' || c == ')' ||                         // Groups
@@ -68,7 +69,13 @@ Token ConfigLexer::readIdentifier() {
 
 Token ConfigLexer::readNumber() {
     auto isDigit = [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; };
-    return readWhile(isDigit, TokenType::NUMBER);
+    Token number = readWhile(isDigit, TokenType::NUMBER);
+    if (current_char_ != '.' && current_char_ != ':') {
+        return number;
+    }
+    // An address like 127.0.0.1:8080 also starts with a digit
+    Token rest = readIdentifier();
+    return Token(TokenType::IDENTIFIER, number.value + rest.value, number.start, rest.end);
 }
 
 Token ConfigLexer::readString() {
@@ -149,7 +156,8 @@ Token ConfigLexer::nextToken() {
     }
 
     if (std::isalpha(static_cast<unsigned char>(current_char_)) || 
-        current_char_ == '_' || current_char_ == '/' || current_char_ == '\\') {
+        current_char_ == '_' || current_char_ == '/' || current_char_ == '\\' ||
+        current_char_ == '$') { // Variables like $request_uri
         return readIdentifier();
     }
 
@@ -1,4 +1,5 @@
 #include "Config.hpp"
+#include "log/Logger.hpp"
 
 std::vector<std::shared_ptr<Config>> ConfigParser::parse(std::istream& input) {
     ConfigLexer lexer(input);
@@ -131,6 +132,9 @@ void ConfigParser::parseServerBlockContent(ConfigBuilder& builder) {
         if (current_token_.value == "location") {
             advance();
             parseLocationBlock(builder);
+        } else if (current_token_.value == "upstream") {
+            advance();
+            parseUpstreamBlock(builder);
         } else {
             parseDirective(builder, false);
         }
@@ -199,6 +203,34 @@ void ConfigParser::parseLocationDirective(ConfigBuilder& builder, const std::str
         parseLocationCGIPath(builder);
     } else if (directive == "cgi_ext") {
         parseLocationCGIExt(builder);
+    } else if (directive == "cgi_max_concurrent") {
+        parseLocationCGIMaxConcurrent(builder);
+    } else if (directive == "cgi_queue_size") {
+        parseLocationCGIQueueSize(builder);
+    } else if (directive == "cgi_queue_timeout") {
+        parseLocationCGIQueueTimeout(builder);
+    } else if (directive == "cgi_cache_valid") {
+        parseLocationCGICacheValid(builder);
+    } else if (directive == "proxy_pass") {
+        parseLocationProxyPass(builder);
+    } else if (directive == "proxy_connect_timeout") {
+        parseLocationProxyConnectTimeout(builder);
+    } else if (directive == "proxy_read_timeout") {
+        parseLocationProxyReadTimeout(builder);
+    } else if (directive == "proxy_keepalive") {
+        parseLocationProxyKeepalive(builder);
+    } else if (directive == "stub_status") {
+        valueToken = current_token_;
+        builder.setLocationStubStatus();
+        expectSemicolon();
+    } else if (directive == "metrics") {
+        valueToken = current_token_;
+        builder.setLocationMetrics();
+        expectSemicolon();
+    } else if (directive == "trace_dump") {
+        valueToken = current_token_;
+        builder.setLocationTraceDump();
+        expectSemicolon();
     } else {
         throw ParseError("Unknown location directive: " + directive, current_token_);
     }
@@ -284,6 +316,189 @@ void ConfigParser::parseLocationCGIExt(ConfigBuilder& builder) {
     expectSemicolon();
 }
 
+void ConfigParser::parseLocationCGIMaxConcurrent(ConfigBuilder& builder) {
+    uint64_t count = readNumber("Expected number of concurrent CGI scripts");
+    builder.setLocationCGIMaxConcurrent(static_cast<size_t>(count));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationCGIQueueSize(ConfigBuilder& builder) {
+    uint64_t size = readNumber("Expected CGI queue size");
+    builder.setLocationCGIQueueSize(static_cast<size_t>(size));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationCGIQueueTimeout(ConfigBuilder& builder) {
+    uint64_t seconds = readNumber("Expected CGI queue timeout in seconds");
+    if (seconds == 0) {
+        throw ParseError("CGI queue timeout must be at least 1 second", valueToken);
+    }
+    builder.setLocationCGIQueueTimeout(static_cast<size_t>(seconds));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationCGICacheValid(ConfigBuilder& builder) {
+    uint64_t seconds = readNumber("Expected CGI cache lifetime in seconds");
+    builder.setLocationCGICacheValid(static_cast<size_t>(seconds));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationProxyPass(ConfigBuilder& builder) {
+    std::string url = readValue("Expected upstream URL");
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        throw ParseError("Only http:// upstreams are supported", valueToken);
+    }
+    size_t host_start = scheme.size();
+    size_t uri_start = url.find('/', host_start);
+    std::string authority = url.substr(host_start, uri_start - host_start);
+    std::string uri = (uri_start == std::string::npos) ? "" : url.substr(uri_start);
+
+    std::string host;
+    uint16_t port;
+    parseHostPort(authority, host, port);
+    builder.setLocationProxyPass(host, port, uri);
+    expectSemicolon();
+}
+
+void ConfigParser::parseHostPort(const std::string& authority, std::string& host, uint16_t& port) {
+    size_t colon = authority.find(':');
+    host = authority.substr(0, colon);
+    uint64_t number = 0;
+    if (colon != std::string::npos) {
+        std::string port_str = authority.substr(colon + 1);
+        if (port_str.empty() || port_str.size() > 5 || port_str.find_first_not_of("0123456789") != std::string::npos) {
+            throw ParseError("Invalid upstream port: " + port_str, valueToken);
+        }
+        number = std::stoull(port_str);
+        if (number == 0 || number > 65535) {
+            throw ParseError("Invalid upstream port: " + port_str, valueToken);
+        }
+    }
+    if (host.empty()) {
+        throw ParseError("Invalid upstream address: " + authority, valueToken);
+    }
+    port = static_cast<uint16_t>(number);
+}
+
+void ConfigParser::parseUpstreamBlock(ConfigBuilder& builder) {
+    Token name_token = current_token_;
+    std::string name = expectIdentifier("Expected upstream name");
+    try {
+        builder.startUpstream(name);
+    } catch (const std::runtime_error& e) {
+        throw ParseError(e.what(), name_token);
+    }
+
+    expect(TokenType::LBRACE, "Expected '{' after upstream name");
+
+    while (current_token_.type != TokenType::RBRACE) {
+        if (current_token_.type == TokenType::END_OF_FILE) {
+            throw ParseError("Unexpected end of file", current_token_);
+        }
+        valueToken = current_token_;
+        std::string directive = expectIdentifier("Expected directive name");
+        if (directive == "server") {
+            parseUpstreamServer(builder);
+        } else if (directive == "least_conn") {
+            builder.setUpstreamBalance(Upstream::Balance::LEAST_CONN);
+            expectSemicolon();
+        } else if (directive == "ip_hash") {
+            builder.setUpstreamBalance(Upstream::Balance::HASH, Upstream::HashKey::REMOTE_ADDR);
+            expectSemicolon();
+        } else if (directive == "hash") {
+            parseUpstreamHash(builder);
+        } else {
+            throw ParseError("Unknown upstream directive: " + directive, valueToken);
+        }
+    }
+
+    try {
+        builder.endUpstream();
+    } catch (const std::runtime_error& e) {
+        throw ParseError(e.what(), current_token_);
+    }
+    advance();
+}
+
+void ConfigParser::parseUpstreamServer(ConfigBuilder& builder) {
+    Upstream::Server server;
+    std::string address = readValue("Expected upstream server address");
+    uint16_t port;
+    parseHostPort(address, server.host, port);
+    server.port = port == 0 ? 80 : port;
+
+    // Parameters are written as name=value
+    while (current_token_.type == TokenType::IDENTIFIER) {
+        Token param_token = current_token_;
+        std::string param = expectIdentifier("Expected server parameter");
+        if (current_token_.type != TokenType::MODIFIER || current_token_.value != "=") {
+            throw ParseError("Expected '=' after " + param, param_token, true);
+        }
+        advance();
+        uint64_t value = readNumber("Expected number for " + param);
+        if (param == "weight") {
+            if (value == 0) {
+                throw ParseError("Server weight must be at least 1", valueToken);
+            }
+            server.weight = static_cast<size_t>(value);
+        } else if (param == "max_fails") {
+            server.max_fails = static_cast<size_t>(value);
+        } else if (param == "fail_timeout") {
+            if (value == 0) {
+                throw ParseError("fail_timeout must be at least 1 second", valueToken);
+            }
+            server.fail_timeout = static_cast<size_t>(value);
+        } else if (param == "slow_start") {
+            server.slow_start = static_cast<size_t>(value);
+        } else {
+            throw ParseError("Unknown server parameter: " + param, param_token);
+        }
+    }
+    builder.addUpstreamServer(server);
+    expectSemicolon();
+}
+
+void ConfigParser::parseUpstreamHash(ConfigBuilder& builder) {
+    std::string key = readValue("Expected hash key");
+    if (key == "$request_uri") {
+        builder.setUpstreamBalance(Upstream::Balance::HASH, Upstream::HashKey::REQUEST_URI);
+    } else if (key == "$remote_addr") {
+        builder.setUpstreamBalance(Upstream::Balance::HASH, Upstream::HashKey::REMOTE_ADDR);
+    } else {
+        throw ParseError("hash key must be $request_uri or $remote_addr", valueToken);
+    }
+    // Hashing is always consistent, the nginx keyword is accepted for familiarity
+    if (current_token_.type == TokenType::IDENTIFIER && current_token_.value == "consistent") {
+        advance();
+    }
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationProxyConnectTimeout(ConfigBuilder& builder) {
+    uint64_t seconds = readNumber("Expected proxy connect timeout in seconds");
+    if (seconds == 0) {
+        throw ParseError("Proxy connect timeout must be at least 1 second", valueToken);
+    }
+    builder.setLocationProxyConnectTimeout(static_cast<size_t>(seconds));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationProxyReadTimeout(ConfigBuilder& builder) {
+    uint64_t seconds = readNumber("Expected proxy read timeout in seconds");
+    if (seconds == 0) {
+        throw ParseError("Proxy read timeout must be at least 1 second", valueToken);
+    }
+    builder.setLocationProxyReadTimeout(static_cast<size_t>(seconds));
+    expectSemicolon();
+}
+
+void ConfigParser::parseLocationProxyKeepalive(ConfigBuilder& builder) {
+    uint64_t count = readNumber("Expected number of idle upstream connections");
+    builder.setLocationProxyKeepalive(static_cast<size_t>(count));
+    expectSemicolon();
+}
+
 void ConfigParser::parseServerDirective(ConfigBuilder& builder, const std::string& directive) {
     if (directive == "listen") {
         uint64_t port = readNumber("Expected port number");
@@ -305,6 +520,18 @@ void ConfigParser::parseServerDirective(ConfigBuilder& builder, const std::strin
         uint64_t size = readNumber("Expected body size");
         builder.setClientMaxBodySize(size);
         expectSemicolon();
+    } else if (directive == "access_log") {
+        parseServerAccessLog(builder);
+    } else if (directive == "error_log") {
+        parseServerErrorLog(builder);
+    } else if (directive == "request_trace") {
+        parseServerRequestTrace(builder);
+    } else if (directive == "slow_request_threshold") {
+        parseServerSlowRequestThreshold(builder);
+    } else if (directive == "shutdown_timeout") {
+        parseServerShutdownTimeout(builder);
+    } else if (directive == "worker_processes") {
+        parseServerWorkerProcesses(builder);
     } else if (directive == "error_page") {
         uint64_t code = readNumber("Expected error code");
         if (code < 400 || code > 599) {
@@ -316,4 +543,131 @@ void ConfigParser::parseServerDirective(ConfigBuilder& builder, const std::strin
     } else {
         throw ParseError("Unknown server directive: " + directive, current_token_);
     }
+}
+
+void ConfigParser::parseServerAccessLog(ConfigBuilder& builder) {
+    std::string path = readValue("Expected access log path or off");
+    if (path == "off") {
+        builder.setAccessLog("", false, 1.0);
+        expectSemicolon();
+        return;
+    }
+    bool json = false;
+    double sample = 1.0;
+    while (current_token_.type == TokenType::IDENTIFIER) {
+        Token param_token = current_token_;
+        std::string param = expectIdentifier("Expected access log format or sample");
+        if (param == "json" || param == "text") {
+            json = param == "json";
+            continue;
+        }
+        if (param != "sample") {
+            throw ParseError("Unknown access log parameter: " + param, param_token);
+        }
+        if (current_token_.type != TokenType::MODIFIER || current_token_.value != "=") {
+            throw ParseError("Expected '=' after sample", param_token, true);
+        }
+        advance();
+        // A rate like 0.25 is lexed as an identifier, a plain 1 as a number
+        valueToken = current_token_;
+        if (current_token_.type != TokenType::NUMBER && current_token_.type != TokenType::IDENTIFIER) {
+            throw ParseError("Expected sample rate", current_token_);
+        }
+        size_t used = 0;
+        try {
+            sample = std::stod(current_token_.value, &used);
+        } catch (const std::exception&) {
+            used = 0;
+        }
+        if (used != current_token_.value.size() || !(sample > 0.0 && sample <= 1.0)) {
+            throw ParseError("Sample rate must be above 0 and at most 1", valueToken);
+        }
+        advance();
+    }
+    builder.setAccessLog(path, json, sample);
+    expectSemicolon();
+}
+
+void ConfigParser::parseServerErrorLog(ConfigBuilder& builder) {
+    std::string path = readValue("Expected error log path");
+    int level = LOG_LEVEL_ERROR;
+    if (current_token_.type == TokenType::IDENTIFIER) {
+        static const char* const levels[] = {"error", "warn", "info", "debug", "trace"};
+        std::string name = readValue("Expected error log level");
+        level = -1;
+        for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_TRACE; ++i) {
+            if (name == levels[i]) {
+                level = i;
+            }
+        }
+        if (level == -1) {
+            throw ParseError("Error log level must be error, warn, info, debug or trace", valueToken);
+        }
+    }
+    builder.setErrorLog(path, level);
+    expectSemicolon();
+}
+
+void ConfigParser::parseServerRequestTrace(ConfigBuilder& builder) {
+    if (current_token_.type == TokenType::IDENTIFIER && current_token_.value == "off") {
+        advance();
+        builder.setRequestTrace(0);
+        expectSemicolon();
+        return;
+    }
+    uint64_t records = readNumber("Expected number of traced requests or off");
+    if (records == 0 || records > 1024 * 1024) {
+        throw ParseError("Number of traced requests must be between 1 and 1048576", valueToken);
+    }
+    builder.setRequestTrace(static_cast<size_t>(records));
+    expectSemicolon();
+}
+
+void ConfigParser::parseServerSlowRequestThreshold(ConfigBuilder& builder) {
+    uint64_t threshold = readNumber("Expected slow request threshold in milliseconds");
+    if (threshold == 0) {
+        throw ParseError("Slow request threshold must be at least 1 millisecond", valueToken);
+    }
+    uint64_t rate = 10;
+    if (current_token_.type == TokenType::IDENTIFIER) {
+        Token param_token = current_token_;
+        std::string param = expectIdentifier("Expected rate");
+        if (param != "rate") {
+            throw ParseError("Unknown slow request parameter: " + param, param_token);
+        }
+        if (current_token_.type != TokenType::MODIFIER || current_token_.value != "=") {
+            throw ParseError("Expected '=' after rate", param_token, true);
+        }
+        advance();
+        rate = readNumber("Expected slow requests per second");
+        if (rate == 0) {
+            throw ParseError("Slow request rate must be at least 1", valueToken);
+        }
+    }
+    builder.setSlowRequestLog(threshold, static_cast<size_t>(rate));
+    expectSemicolon();
+}
+
+void ConfigParser::parseServerShutdownTimeout(ConfigBuilder& builder) {
+    uint64_t seconds = readNumber("Expected shutdown timeout in seconds");
+    if (seconds > 3600) {
+        throw ParseError("Shutdown timeout must be at most 3600 seconds", valueToken);
+    }
+    builder.setShutdownTimeout(seconds);
+    expectSemicolon();
+}
+
+void ConfigParser::parseServerWorkerProcesses(ConfigBuilder& builder) {
+    if (current_token_.type == TokenType::IDENTIFIER && current_token_.value == "auto") {
+        advance();
+        builder.setWorkerProcesses(-1);
+        expectSemicolon();
+        return;
+    }
+    uint64_t workers = readNumber("Expected number of worker processes or auto");
+    if (workers == 0 || workers > 1024) {
+        throw ParseError("Number of worker processes must be between 1 and 1024", valueToken);
+    }
+    builder.setWorkerProcesses(static_cast<int>(workers));
+    expectSemicolon();
 }
\ No newline at end of file
@@ -19,6 +19,11 @@ void ConfigPrinter::print(std::ostream& out, const Config& config) {
     
     printErrorPages(out, config);
     out << NEWLINE;
+
+    if (!config.getUpstreams().empty()) {
+        printUpstreams(out, config);
+        out << NEWLINE;
+    }
     
     printLocations(out, config);
 }
@@ -29,6 +34,16 @@ void ConfigPrinter::printServerInfo(std::ostream& out, const Config& config) {
         << "Root: " << config.getRoot() << NEWLINE
         << "Index: " << config.getIndex() << NEWLINE
         << "Client max body size: " << config.getClientMaxBodySize() << " bytes" << NEWLINE
+        << "Access log: " << (config.getAccessLogPath().empty() ? "off" : config.getAccessLogPath()
+            + (config.isAccessLogJson() ? " (json" : " (text") + ", sample " + std::to_string(config.getAccessLogSample()) + ")") << NEWLINE
+        << "Error log: " << (config.getErrorLogPath().empty() ? "default" : config.getErrorLogPath())
+            << " (level " << config.getErrorLogLevel() << ")" << NEWLINE
+        << "Request trace: " << (config.getRequestTrace() == 0 ? "off" : std::to_string(config.getRequestTrace()) + " requests") << NEWLINE
+        << "Slow request threshold: " << (config.getSlowRequestThreshold() == 0 ? "off" : std::to_string(config.getSlowRequestThreshold())
+            + "ms (" + std::to_string(config.getSlowRequestRate()) + " per second)") << NEWLINE
+        << "Shutdown timeout: " << config.getShutdownTimeout() << "s" << NEWLINE
+        << "Worker processes: " << (config.getWorkerProcesses() == 0 ? "off" : config.getWorkerProcesses() == -1 ? "auto"
+            : std::to_string(config.getWorkerProcesses())) << NEWLINE
         << "Number of locations: " << config.getLocations().size();
 }
 
@@ -46,6 +61,28 @@ void ConfigPrinter::printErrorPages(std::ostream& out, const Config& config) {
     }
 }
 
+void ConfigPrinter::printUpstreams(std::ostream& out, const Config& config) {
+    static const char* const balances[] = {"round robin", "least connections", "hash"};
+    for (const auto& upstream : config.getUpstreams()) {
+        out << "Upstream: " << upstream->getName() << " ("
+            << balances[static_cast<int>(upstream->getBalance())];
+        if (upstream->getBalance() == Upstream::Balance::HASH) {
+            out << (upstream->getHashKey() == Upstream::HashKey::REQUEST_URI ? " $request_uri" : " $remote_addr");
+        }
+        out << ")" << NEWLINE;
+        for (const auto& server : upstream->getServers()) {
+            out << INDENT << server.host << ":" << server.port
+                << " weight=" << server.weight
+                << " max_fails=" << server.max_fails
+                << " fail_timeout=" << server.fail_timeout << "s";
+            if (server.slow_start != 0) {
+                out << " slow_start=" << server.slow_start << "s";
+            }
+            out << NEWLINE;
+        }
+    }
+}
+
 void ConfigPrinter::printLocations(std::ostream& out, const Config& config) {
     out << "Locations:" << NEWLINE;
     
@@ -97,6 +134,22 @@ void ConfigPrinter::printLocation(std::ostream& out, const Location& location) {
         printCGIConfig(out, location.getCGIConfig());
     }
 
+    if (location.hasProxy()) {
+        printProxyConfig(out, location.getProxyConfig());
+    }
+
+    if (location.hasStubStatus()) {
+        out << INDENT << "Stub status: on" << NEWLINE;
+    }
+
+    if (location.hasMetrics()) {
+        out << INDENT << "Metrics: on" << NEWLINE;
+    }
+
+    if (location.hasTraceDump()) {
+        out << INDENT << "Trace dump: on" << NEWLINE;
+    }
+
     if (location.getMatchType() == Location::MatchType::REGEX || 
         location.getMatchType() == Location::MatchType::REGEX_INSENSITIVE) {
         out << INDENT << "Pattern: " << location.getPath() << NEWLINE;
@@ -140,4 +193,22 @@ void ConfigPrinter::printCGIConfig(std::ostream& out, const Location::CGIConfig&
         out << " " << ext;
     }
     out << NEWLINE;
+
+    if (cgi.max_concurrent != 0) {
+        out << INDENT << "CGI Max concurrent: " << cgi.max_concurrent
+            << " (queue " << cgi.queue_size << ", timeout " << cgi.queue_timeout << "s)" << NEWLINE;
+    }
+    if (cgi.cache_valid != 0) {
+        out << INDENT << "CGI Cache valid: " << cgi.cache_valid << "s" << NEWLINE;
+    }
+}
+
+void ConfigPrinter::printProxyConfig(std::ostream& out, const Location::ProxyConfig& proxy) {
+    out << INDENT << "Proxy pass: http://" << proxy.host;
+    if (proxy.port != 0) {
+        out << ":" << proxy.port;
+    }
+    out << proxy.uri << NEWLINE;
+    out << INDENT << "Proxy timeouts: connect " << proxy.connect_timeout
+        << "s, read " << proxy.read_timeout << "s, keepalive " << proxy.keepalive << NEWLINE;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Config.hpp"
+#include "Server.hpp"
 
 void ConfigValidator::validateConfigs(const std::vector<std::unique_ptr<Config>>& configs) {
     if (configs.empty()) {
@@ -176,6 +177,12 @@ void ConfigValidator::validateLocation(const Location& location) {
     
     validateMethods(location.getAllowedMethods());
 
+    // A request may not wait in the queue as long as a whole client may take
+    if (location.getCGIConfig().queue_timeout >= TIMEOUT_MS / 1000) {
+        throw ValidationError("Location " + location.getPath() + ": cgi_queue_timeout must be below "
+            + std::to_string(TIMEOUT_MS / 1000) + "s");
+    }
+
     // Validate return directive if present
     if (location.hasReturn()) {
         validateReturnDirective(location.getReturn(), 
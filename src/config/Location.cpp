@@ -23,6 +23,10 @@ Location::Location(const Location& other)
     , autoindex_(other.autoindex_)
     , return_directive_(other.return_directive_)
     , cgi_config_(other.cgi_config_)
+    , proxy_config_(other.proxy_config_)
+    , stub_status_(other.stub_status_)
+    , metrics_(other.metrics_)
+    , trace_dump_(other.trace_dump_)
     , regex_(other.regex_) {}
 
 Location& Location::operator=(const Location& other) {
@@ -35,6 +39,10 @@ Location& Location::operator=(const Location& other) {
         autoindex_ = other.autoindex_;
         return_directive_ = other.return_directive_;
         cgi_config_ = other.cgi_config_;
+        proxy_config_ = other.proxy_config_;
+        stub_status_ = other.stub_status_;
+        metrics_ = other.metrics_;
+        trace_dump_ = other.trace_dump_;
         regex_ = other.regex_;
     }
     return *this;
@@ -72,6 +80,10 @@ const Location::CGIConfig& Location::getCGIConfig() const {
     return cgi_config_;
 }
 
+const Location::ProxyConfig& Location::getProxyConfig() const {
+    return proxy_config_;
+}
+
 const std::regex& Location::getRegex() const {
     return regex_;
 }
@@ -92,6 +104,22 @@ bool Location::hasCGI() const {
     return cgi_config_.isEnabled();
 }
 
+bool Location::hasProxy() const {
+    return proxy_config_.isEnabled();
+}
+
+bool Location::hasStubStatus() const {
+    return stub_status_;
+}
+
+bool Location::hasMetrics() const {
+    return metrics_;
+}
+
+bool Location::hasTraceDump() const {
+    return trace_dump_;
+}
+
 bool Location::isCGIExtension(const std::string& ext) const {
     if (!hasCGI()) return false;
     return std::find(cgi_config_.extensions.begin(), 
@@ -0,0 +1,20 @@
+#include "config/Upstream.hpp"
+
+Upstream::Upstream(const std::string& name)
+    : name_(name) {}
+
+const std::string& Upstream::getName() const {
+    return name_;
+}
+
+const std::vector<Upstream::Server>& Upstream::getServers() const {
+    return servers_;
+}
+
+Upstream::Balance Upstream::getBalance() const {
+    return balance_;
+}
+
+Upstream::HashKey Upstream::getHashKey() const {
+    return hash_key_;
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "log/AccessLog.hpp"
+#include "log/Logger.hpp"
+#include "server/ServerRequestHandler.hpp"
+#include <cstdio>
+#include <ctime>
+#include <string_view>
+
+/**
+ * @return milliseconds between two points, -1 if either was never reached
+ */
+static double elapsedMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    if (from == std::chrono::steady_clock::time_point{} || to == std::chrono::steady_clock::time_point{}) {
+        return -1;
+    }
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief appends a timing, "-" in text or null in JSON when it is missing
+ */
+static void appendMs(std::string& record, double ms, bool json)
+{
+    if (ms < 0) {
+        record += json ? "null" : "-";
+        return;
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", ms);
+    record += buffer;
+}
+
+/**
+ * @brief appends a value of the request as a JSON string, "-" when it is empty
+ */
+static void appendJsonString(std::string& record, std::string_view value)
+{
+    record += '"';
+    if (value.empty()) {
+        record += '-';
+    }
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            record += '\\';
+            record += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            record += escaped;
+        } else {
+            record += static_cast<char>(c);
+        }
+    }
+    record += '"';
+}
+
+AccessLog::AccessLog()
+    : file_(-1)
+    , json_(false)
+    , sample_(1.0)
+    , credit_(0.0)
+{
+}
+
+int AccessLog::open(const std::string& path, bool json, double sample)
+{
+    json_ = json;
+    sample_ = sample;
+    credit_ = 0.0;
+    if (path.empty()) {
+        file_ = -1;
+        return 0;
+    }
+    file_ = Logger::instance().addFile(path);
+    return file_ == -1 ? -1 : 0;
+}
+
+void AccessLog::log(const s_client_data& data)
+{
+    // A connection that closed before sending a request line is no request
+    if (file_ == -1 || (data.request_method.empty() && data.status == 0)) {
+        return;
+    }
+    credit_ += sample_;
+    if (credit_ < 1.0) {
+        return;
+    }
+    credit_ -= 1.0;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double header_ms = elapsedMs(data.accepted_at, data.header_at);
+    double start_ms = elapsedMs(data.header_at, data.response_at);
+    double total_ms = elapsedMs(data.accepted_at, now);
+
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    tm utc;
+    gmtime_r(&wall.tv_sec, &utc);
+    char time[40];
+    size_t length = std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(time + length, sizeof(time) - length, ".%03ldZ", wall.tv_nsec / 1000000);
+
+    std::string record;
+    record.reserve(256 + data.request_source.size());
+    if (json_) {
+        appendJson(record, data, time, header_ms, start_ms, total_ms);
+    } else {
+        appendText(record, data, time, header_ms, start_ms, total_ms);
+    }
+    record += '\n';
+    Logger::instance().write(file_, record.data(), record.size());
+}
+
+/**
+ * @brief 127.0.0.1 [2024-01-01T12:00:00.000Z] "GET / HTTP/1.1" 200 612 0.210 0.095 0.480
+ * with the timings in milliseconds: accept to headers, headers to response, total
+ */
+void AccessLog::appendText(std::string& record, const s_client_data& data, const char* time, double header_ms, double start_ms, double total_ms) const
+{
+    record += data.client_address.empty() ? "-" : data.client_address;
+    record += " [";
+    record += time;
+    record += "] \"";
+    record += data.request_method.empty() ? "-" : data.request_method;
+    record += ' ';
+    record += data.request_source.empty() ? "-" : data.request_source;
+    record += ' ';
+    record += data.http_version.empty() ? "-" : data.http_version;
+    record += "\" ";
+    record += std::to_string(data.status);
+    record += ' ';
+    record += std::to_string(data.bytes_sent);
+    record += ' ';
+    appendMs(record, header_ms, false);
+    record += ' ';
+    appendMs(record, start_ms, false);
+    record += ' ';
+    appendMs(record, total_ms, false);
+}
+
+void AccessLog::appendJson(std::string& record, const s_client_data& data, const char* time, double header_ms, double start_ms, double total_ms) const
+{
+    record += "{\"time\":\"";
+    record += time;
+    record += "\",\"client\":";
+    appendJsonString(record, data.client_address);
+    record += ",\"method\":";
+    appendJsonString(record, data.request_method);
+    record += ",\"uri\":";
+    appendJsonString(record, data.request_source);
+    record += ",\"protocol\":";
+    appendJsonString(record, data.http_version);
+    record += ",\"status\":";
+    record += std::to_string(data.status);
+    record += ",\"bytes\":";
+    record += std::to_string(data.bytes_sent);
+    record += ",\"header_ms\":";
+    appendMs(record, header_ms, true);
+    record += ",\"response_ms\":";
+    appendMs(record, start_ms, true);
+    record += ",\"total_ms\":";
+    appendMs(record, total_ms, true);
+    record += '}';
+}
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include "log/Logger.hpp"
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_RECORD_HEADER (2 * sizeof(uint32_t))
+
+/**
+ * @brief copies bytes into the ring at a position that may wrap around its end
+ */
+static void copyIn(s_log_ring& ring, size_t pos, const void* src, size_t size)
+{
+    size_t index = pos % LOG_RING_SIZE;
+    size_t first = std::min(size, LOG_RING_SIZE - index);
+    std::memcpy(ring.data.get() + index, src, first);
+    std::memcpy(ring.data.get(), static_cast<const char*>(src) + first, size - first);
+}
+
+/**
+ * @brief copies bytes out of the ring at a position that may wrap around its end
+ */
+static void copyOut(const s_log_ring& ring, size_t pos, void* dst, size_t size)
+{
+    size_t index = pos % LOG_RING_SIZE;
+    size_t first = std::min(size, LOG_RING_SIZE - index);
+    std::memcpy(dst, ring.data.get() + index, first);
+    std::memcpy(static_cast<char*>(dst) + first, ring.data.get(), size - first);
+}
+
+LogStreamBuf::LogStreamBuf(int file)
+    : file_(file)
+{
+}
+
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type c)
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        char ch = traits_type::to_char_type(c);
+        Logger::instance().write(file_, &ch, 1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n)
+{
+    Logger::instance().write(file_, s, static_cast<size_t>(n));
+    return n;
+}
+
+Logger::Logger()
+    : running_(false)
+    , level_(LOG_LEVEL_ERROR)
+    , reopen_(false)
+    , out_buf_(LOG_STANDARD_FILE)
+    , err_buf_(LOG_ERROR_FILE)
+    , old_out_(nullptr)
+    , old_err_(nullptr)
+{
+    files_.resize(2);
+    files_[LOG_STANDARD_FILE].path = std::string(LOG_DIRECTORY) + "/" + STANDARD_LOG_FILE;
+    files_[LOG_ERROR_FILE].path = std::string(LOG_DIRECTORY) + "/" + STANDARD_ERROR_LOG_FILE;
+}
+
+Logger::~Logger()
+{
+    stop();
+    for (s_log_file& file : files_) {
+        if (file.fd != -1) {
+            close(file.fd);
+        }
+    }
+}
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+int Logger::start()
+{
+    if (running_) {
+        return 0;
+    }
+    if (mkdir(LOG_DIRECTORY, 0777) == -1 && errno != EEXIST) {
+        std::cerr << "mkdir() failed to make directory " << LOG_DIRECTORY << "\n";
+        return -1;
+    }
+    for (int file : {LOG_STANDARD_FILE, LOG_ERROR_FILE}) {
+        if (files_[file].fd == -1) {
+            files_[file].fd = openFile(files_[file].path);
+            if (files_[file].fd == -1) {
+                return -1;
+            }
+        }
+    }
+
+    // Raw writes to the descriptors, like a perror(), still end up in the logs
+    dup2(files_[LOG_STANDARD_FILE].fd, STDOUT_FILENO);
+    dup2(files_[LOG_ERROR_FILE].fd, STDERR_FILENO);
+    old_out_ = std::cout.rdbuf(&out_buf_);
+    old_err_ = std::cerr.rdbuf(&err_buf_);
+
+    running_ = true;
+    flusher_ = std::thread(&Logger::flushLoop, this);
+    return 0;
+}
+
+void Logger::stop()
+{
+    if (!running_) {
+        return;
+    }
+    std::cout.rdbuf(old_out_);
+    std::cerr.rdbuf(old_err_);
+    running_ = false;
+    flusher_.join();
+    flush();  // What was logged after the last round of the flusher
+}
+
+int Logger::addFile(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < files_.size(); ++i) {
+        if (files_[i].path == path) {
+            return static_cast<int>(i);
+        }
+    }
+    int fd = openFile(path);
+    if (fd == -1) {
+        return -1;
+    }
+    s_log_file file;
+    file.path = path;
+    file.fd = fd;
+    files_.push_back(std::move(file));
+    return static_cast<int>(files_.size() - 1);
+}
+
+void Logger::setErrorLog(const std::string& path, int level)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!path.empty() && !running_) {
+        files_[LOG_ERROR_FILE].path = path;
+    }
+    level_.store(level, std::memory_order_relaxed);
+}
+
+void Logger::log(int level, const std::string& message)
+{
+    static const char* const names[] = {"error", "warn", "info", "debug", "trace"};
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    tm local;
+    localtime_r(&wall.tv_sec, &local);
+    char prefix[64];
+    size_t length = std::strftime(prefix, sizeof(prefix), "%Y/%m/%d %H:%M:%S", &local);
+    std::snprintf(prefix + length, sizeof(prefix) - length, " [%s] ", names[level]);
+
+    std::string record;
+    record.reserve(std::strlen(prefix) + message.size() + 1);
+    record += prefix;
+    record += message;
+    if (record.back() != '\n') {
+        record += '\n';
+    }
+    write(LOG_ERROR_FILE, record.data(), record.size());
+}
+
+void Logger::reopen()
+{
+    reopen_.store(true, std::memory_order_relaxed);
+}
+
+void Logger::write(int file, const char* data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    s_log_ring& ring = getRing();
+    size_t needed = LOG_RECORD_HEADER + size;
+    size_t head = ring.head.load(std::memory_order_relaxed);
+    size_t tail = ring.tail.load(std::memory_order_acquire);
+    if (needed > LOG_RING_SIZE - (head - tail)) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t header[2] = {static_cast<uint32_t>(file), static_cast<uint32_t>(size)};
+    copyIn(ring, head, header, LOG_RECORD_HEADER);
+    copyIn(ring, head + LOG_RECORD_HEADER, data, size);
+    ring.head.store(head + needed, std::memory_order_release);
+}
+
+uint64_t Logger::getDropped() const
+{
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    uint64_t dropped = 0;
+    for (const std::unique_ptr<s_log_ring>& ring : rings_) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+s_log_ring& Logger::getRing()
+{
+    thread_local s_log_ring* ring = nullptr;
+    if (ring == nullptr) {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::make_unique<s_log_ring>());
+        ring = rings_.back().get();
+    }
+    return *ring;
+}
+
+void Logger::flushLoop()
+{
+    while (running_) {
+        // A quiet round waits, so records pile up and go out in one write per file
+        bool busy = flush();
+        if (reopen_.exchange(false, std::memory_order_relaxed)) {
+            reopenFiles();  // after the flush, so records before the signal are in the rotated files
+        }
+        if (!busy) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+    }
+}
+
+bool Logger::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+    size_t moved = 0;
+    for (std::unique_ptr<s_log_ring>& ring : rings_) {
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t head = ring->head.load(std::memory_order_acquire);
+        moved += head - tail;
+        while (tail != head) {
+            uint32_t header[2];
+            copyOut(*ring, tail, header, LOG_RECORD_HEADER);
+            if (header[0] < files_.size()) {
+                std::string& batch = files_[header[0]].batch;
+                size_t start = batch.size();
+                batch.resize(start + header[1]);
+                copyOut(*ring, tail + LOG_RECORD_HEADER, &batch[start], header[1]);
+            }
+            tail += LOG_RECORD_HEADER + header[1];
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+        if (dropped != ring->reported) {
+            files_[LOG_ERROR_FILE].batch += "logger: dropped " + std::to_string(dropped - ring->reported)
+                + " log records, the buffer was full\n";
+            ring->reported = dropped;
+        }
+    }
+
+    for (s_log_file& file : files_) {
+        size_t offset = 0;
+        while (offset < file.batch.size()) {
+            ssize_t written = ::write(file.fd, file.batch.data() + offset, file.batch.size() - offset);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                break;  // Nowhere left to report it, the batch is lost
+            }
+            offset += static_cast<size_t>(written);
+        }
+        file.batch.clear();
+    }
+    // Only a busy round goes again right away, a handful of records can wait
+    return moved >= LOG_RING_SIZE / 4;
+}
+
+void Logger::reopenFiles()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (s_log_file& file : files_) {
+        int fd = openFile(file.path);
+        if (fd == -1) {
+            continue;  // Keep writing to the old file rather than losing records
+        }
+        // dup3() swaps the file in one step, the id of the file keeps its descriptor
+        // and, unlike dup2(), its close-on-exec flag, so scripts do not inherit it
+        if (dup3(fd, file.fd, O_CLOEXEC) == -1) {
+            std::cerr << "reopening log file " << file.path << " failed: " << strerror(errno) << "\n";
+        }
+        close(fd);
+    }
+    dup2(files_[LOG_STANDARD_FILE].fd, STDOUT_FILENO);
+    dup2(files_[LOG_ERROR_FILE].fd, STDERR_FILENO);
+}
+
+int Logger::openFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        std::cerr << "opening log file " << path << " failed: " << strerror(errno) << "\n";
+    }
+    return fd;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "log/SlowRequestLog.hpp"
+#include "log/Logger.hpp"
+#include "server/ServerRequestHandler.hpp"
+#include "config/Location.hpp"
+#include <cstdio>
+
+/**
+ * @brief appends microseconds as milliseconds with three decimals
+ */
+static void appendMs(std::string& record, uint64_t us)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3fms", static_cast<double>(us) / 1000.0);
+    record += buffer;
+}
+
+SlowRequestLog::SlowRequestLog()
+    : threshold_us_(0)
+    , rate_(0)
+    , second_(0)
+    , logged_(0)
+    , suppressed_(0)
+{
+}
+
+void SlowRequestLog::open(uint64_t threshold_ms, size_t rate)
+{
+    threshold_us_ = threshold_ms * 1000;
+    rate_ = rate;
+    second_ = 0;
+    logged_ = 0;
+    suppressed_ = 0;
+}
+
+void SlowRequestLog::log(const s_client_data& data, uint64_t total_us)
+{
+    if (threshold_us_ == 0 || total_us < threshold_us_ || data.request_method.empty()) {
+        return;
+    }
+    time_t now = std::time(nullptr);
+    if (now != second_) {
+        second_ = now;
+        logged_ = 0;
+    }
+    if (logged_ >= rate_) {
+        ++suppressed_;
+        return;
+    }
+    ++logged_;
+
+    static const char* const phases[] = {"accept", "first_byte", "headers", "route", "handler", "first_write", "close"};
+    std::string record = "slow request ";
+    appendMs(record, total_us);
+    record += ": ";
+    record.append(data.request_method).append(" ").append(data.request_source).append(" ").append(data.http_version);
+    record.append(" from ").append(data.client_address);
+    record += " status=" + std::to_string(data.status)
+        + " location=" + (data.location != nullptr ? data.location->getPath() : "-")
+        + " read=" + std::to_string(data.bytes_received)
+        + " written=" + std::to_string(data.bytes_sent)
+        + " eagain=" + std::to_string(data.eagains)
+        + " memory=" + std::to_string(data.memoryUsage())
+        + " cgi_wait=";
+    appendMs(record, data.cgi_wait_us);
+    // Offsets from accept, phases the request never reached are left out
+    record += " phases";
+    for (int phase = TRACE_FIRST_BYTE; phase < TRACE_PHASE_COUNT; ++phase) {
+        if (data.trace[phase] != 0 && data.trace[TRACE_ACCEPT] != 0) {
+            record += " ";
+            record += phases[phase];
+            record += "=";
+            appendMs(record, (data.trace[phase] - data.trace[TRACE_ACCEPT]) / 1000);
+        }
+    }
+    if (suppressed_ != 0) {
+        record += " (" + std::to_string(suppressed_) + " slow requests not logged before this one)";
+        suppressed_ = 0;
+    }
+    // Asked for with a directive of its own, so the level of the error log does not hide it
+    Logger::instance().log(LOG_LEVEL_WARN, record);
+}
\ No newline at end of file
@@ -8,7 +8,7 @@ int main(int argc, char* argv[]) {
     (void) argc;
     try {
         std::vector<std::shared_ptr<Config>> configs = ConfigLoader::load(argv[1]);
-        Server server(configs);
+        Server server(configs, argv);
         int nr = server.setupEpoll();
         if (nr != 0)
             return nr * -1;
@@ -0,0 +1,828 @@
+#include "proxy/ProxyHandler.hpp"
+#include "log/Logger.hpp"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+ProxyHandler::ProxyHandler()
+    : epoll_fd_(-1)
+{
+}
+
+ProxyHandler::~ProxyHandler()
+{
+    for (const auto& upstream : upstream_fds_) {
+        close(upstream.first);
+    }
+    for (const auto& pool : idle_) {
+        for (const s_idle_upstream& idle : pool.second) {
+            close(idle.fd);
+        }
+    }
+}
+
+void ProxyHandler::setEpollFd(int epoll_fd)
+{
+    epoll_fd_ = epoll_fd;
+}
+
+bool ProxyHandler::start(int client_fd, const s_client_data& client_data, const Location& location)
+{
+    const Location::ProxyConfig& config = location.getProxyConfig();
+    s_proxy_session session;
+    session.client_fd = client_fd;
+    session.client_data = &client_data;
+    session.config = &config;
+    session.upstream = config.upstream.get();
+    session.tried.assign(session.upstream->getServers().size(), false);
+    session.request_head = buildRequestHead(client_data, config, location.getPath());
+
+    s_proxy_session& added = sessions_.emplace(client_fd, std::move(session)).first->second;
+    if (!connectNext(added)) {
+        sessions_.erase(client_fd);
+        return false;
+    }
+    // The client only gets events again once there is a response to send
+    setEvents(client_fd, 0);
+    return true;
+}
+
+bool ProxyHandler::hasFd(int fd) const
+{
+    return sessions_.find(fd) != sessions_.end() || upstream_fds_.find(fd) != upstream_fds_.end();
+}
+
+void ProxyHandler::handleEvent(int fd, uint32_t events)
+{
+    std::unordered_map<int, int>::iterator upstream = upstream_fds_.find(fd);
+    if (upstream != upstream_fds_.end()) {
+        handleUpstream(sessions_.at(upstream->second), events);
+        return;
+    }
+    std::unordered_map<int, s_proxy_session>::iterator session = sessions_.find(fd);
+    if (session == sessions_.end()) {
+        return;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        // The client is gone, whatever the upstream still sends is of no use
+        finish(session->second, 0);
+        return;
+    }
+    if (events & EPOLLOUT) {
+        writeClient(session->second);
+    }
+}
+
+void ProxyHandler::removeClient(int client_fd)
+{
+    std::unordered_map<int, s_proxy_session>::iterator session = sessions_.find(client_fd);
+    if (session == sessions_.end()) {
+        return;
+    }
+    releaseUpstream(session->second, false);
+    sessions_.erase(session);
+}
+
+void ProxyHandler::removeUpstream(const Upstream* upstream)
+{
+    // The pooled connections are kept by address, a new config with the same servers reuses them
+    upstreams_.erase(upstream);
+}
+
+void ProxyHandler::update()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::vector<int> expired;
+    for (const auto& session : sessions_) {
+        if (now >= session.second.deadline) {
+            expired.push_back(session.first);
+        }
+    }
+    for (int client_fd : expired) {
+        s_proxy_session& session = sessions_.at(client_fd);
+        const char* what = session.state == ProxyState::Connecting ? "connect to" : "read from";
+        if (!session.out.empty()) {
+            what = "send to client of";
+        }
+        LOG_ERROR("proxy: " << what << " " << session.upstream_key << " timed out");
+        if (session.state != ProxyState::ReadingBody) {
+            peerFailed(session);
+        }
+        // Only a connect is safe to repeat elsewhere, the request may have had effects already
+        if (session.state == ProxyState::Connecting && retryNext(session)) {
+            continue;
+        }
+        finish(session, session.client_started ? 0 : 504);
+    }
+
+    // The oldest idle connections are at the front, the newest are reused first
+    for (auto& pool : idle_) {
+        std::vector<s_idle_upstream>& idle = pool.second;
+        size_t stale = 0;
+        while (stale < idle.size() && now - idle[stale].since >= std::chrono::seconds(PROXY_KEEPALIVE_TIMEOUT)) {
+            close(idle[stale].fd);
+            ++stale;
+        }
+        idle.erase(idle.begin(), idle.begin() + stale);
+    }
+}
+
+int ProxyHandler::getTimeout() const
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t timeout = -1;
+    auto consider = [&](std::chrono::steady_clock::time_point deadline) {
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        if (left < 0) {
+            left = 0;
+        }
+        if (timeout == -1 || left < timeout) {
+            timeout = left;
+        }
+    };
+    for (const auto& session : sessions_) {
+        consider(session.second.deadline);
+    }
+    for (const auto& pool : idle_) {
+        if (!pool.second.empty()) {
+            consider(pool.second.front().since + std::chrono::seconds(PROXY_KEEPALIVE_TIMEOUT));
+        }
+    }
+    return static_cast<int>(timeout);
+}
+
+bool ProxyHandler::takeFinished(std::vector<std::pair<int, uint16_t>>& finished)
+{
+    if (finished_.empty()) {
+        return false;
+    }
+    finished = std::move(finished_);
+    finished_.clear();
+    return true;
+}
+
+bool ProxyHandler::selectPeer(s_proxy_session& session)
+{
+    const Upstream& upstream = *session.upstream;
+    const std::vector<Upstream::Server>& servers = upstream.getServers();
+    s_upstream_state& state = getState(upstream);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    auto usable = [&](size_t i) {
+        return !session.tried[i] && now >= state.peers[i].down_until;
+    };
+
+    size_t best = servers.size();
+    if (upstream.getBalance() == Upstream::Balance::HASH) {
+        // The key maps to the same server as long as it is up, failing over to the next one on the ring
+        std::string_view key = upstream.getHashKey() == Upstream::HashKey::REQUEST_URI
+            ? session.client_data->request_source : session.client_data->client_address;
+        std::vector<std::pair<uint32_t, size_t>>::const_iterator point = std::lower_bound(
+            state.ring.begin(), state.ring.end(), std::make_pair(hash(key), size_t(0)));
+        for (size_t n = 0; n < state.ring.size() && best == servers.size(); ++n, ++point) {
+            if (point == state.ring.end()) {
+                point = state.ring.begin();
+            }
+            if (usable(point->second)) {
+                best = point->second;
+            }
+        }
+    } else {
+        // Smooth weighted round robin, least_conn uses it to break ties
+        int64_t total = 0;
+        int64_t best_weight = 0;
+        for (size_t i = 0; i < servers.size(); ++i) {
+            if (!usable(i)) {
+                continue;
+            }
+            s_upstream_peer& peer = state.peers[i];
+            int64_t weight = effectiveWeight(servers[i], peer, now);
+            peer.current_weight += weight;
+            total += weight;
+            bool better = best == servers.size();
+            if (!better && upstream.getBalance() == Upstream::Balance::LEAST_CONN) {
+                int64_t load = static_cast<int64_t>(peer.active) * best_weight;
+                int64_t best_load = static_cast<int64_t>(state.peers[best].active) * weight;
+                better = load < best_load
+                    || (load == best_load && peer.current_weight > state.peers[best].current_weight);
+            } else if (!better) {
+                better = peer.current_weight > state.peers[best].current_weight;
+            }
+            if (better) {
+                best = i;
+                best_weight = weight;
+            }
+        }
+        if (best != servers.size()) {
+            state.peers[best].current_weight -= total;
+        }
+    }
+    if (best == servers.size()) {
+        return false;
+    }
+    session.peer = best;
+    session.tried[best] = true;
+    session.upstream_key = servers[best].host + ":" + std::to_string(servers[best].port);
+    return true;
+}
+
+bool ProxyHandler::connectNext(s_proxy_session& session)
+{
+    while (selectPeer(session)) {
+        if (connectUpstream(session)) {
+            return true;
+        }
+        peerFailed(session);
+    }
+    LOG_ERROR("proxy: no live server left in upstream " << session.upstream->getName());
+    return false;
+}
+
+bool ProxyHandler::connectUpstream(s_proxy_session& session)
+{
+    std::vector<s_idle_upstream>& idle = idle_[session.upstream_key];
+    while (!idle.empty()) {
+        int fd = idle.back().fd;
+        idle.pop_back();
+        // An idle connection the upstream has closed in the meantime reads as end of file
+        char byte;
+        ssize_t peeked = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            session.upstream_fd = fd;
+            session.reused = true;
+            session.state = ProxyState::Sending;
+            upstream_fds_[fd] = session.client_fd;
+            ++getState(*session.upstream).peers[session.peer].active;
+            setEvents(fd, EPOLLOUT, EPOLL_CTL_ADD);
+            touch(session, session.config->read_timeout);
+            return true;
+        }
+        close(fd);
+    }
+
+    sockaddr_in address;
+    if (!resolve(session.upstream->getServers()[session.peer], session.upstream_key, address)) {
+        return false;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG_ERROR("proxy: socket failed: " << strerror(errno));
+        return false;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 && errno != EINPROGRESS) {
+        LOG_ERROR("proxy: connecting to " << session.upstream_key << " failed: " << strerror(errno));
+        close(fd);
+        return false;
+    }
+    session.upstream_fd = fd;
+    session.reused = false;
+    session.state = ProxyState::Connecting;
+    upstream_fds_[fd] = session.client_fd;
+    ++getState(*session.upstream).peers[session.peer].active;
+    setEvents(fd, EPOLLOUT, EPOLL_CTL_ADD);
+    touch(session, session.config->connect_timeout);
+    return true;
+}
+
+void ProxyHandler::peerFailed(s_proxy_session& session)
+{
+    const std::vector<Upstream::Server>& servers = session.upstream->getServers();
+    const Upstream::Server& server = servers[session.peer];
+    // A single server is never taken out, there would be nothing left to send to
+    if (servers.size() == 1 || server.max_fails == 0) {
+        return;
+    }
+    s_upstream_peer& peer = getState(*session.upstream).peers[session.peer];
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - peer.fail_start >= std::chrono::seconds(server.fail_timeout)) {
+        peer.fails = 0;
+        peer.fail_start = now;
+    }
+    if (++peer.fails < server.max_fails) {
+        return;
+    }
+    peer.fails = 0;
+    peer.down_until = now + std::chrono::seconds(server.fail_timeout);
+    peer.recovering = server.slow_start != 0;
+    LOG_WARN("proxy: " << session.upstream_key << " of upstream " << session.upstream->getName()
+        << " is down for " << server.fail_timeout << "s");
+}
+
+bool ProxyHandler::retryNext(s_proxy_session& session)
+{
+    releaseUpstream(session, false);
+    session.request_offset = 0;
+    session.response_head.clear();
+    session.received = false;
+    return connectNext(session);
+}
+
+s_upstream_state& ProxyHandler::getState(const Upstream& upstream)
+{
+    std::unordered_map<const Upstream*, s_upstream_state>::iterator found = upstreams_.find(&upstream);
+    if (found != upstreams_.end()) {
+        return found->second;
+    }
+    s_upstream_state& state = upstreams_[&upstream];
+    const std::vector<Upstream::Server>& servers = upstream.getServers();
+    state.peers.resize(servers.size());
+    if (upstream.getBalance() == Upstream::Balance::HASH) {
+        // Every server owns points in proportion to its weight, so adding or losing one moves few keys
+        for (size_t i = 0; i < servers.size(); ++i) {
+            std::string name = servers[i].host + ":" + std::to_string(servers[i].port) + "-";
+            for (size_t point = 0; point < servers[i].weight * PROXY_HASH_POINTS; ++point) {
+                state.ring.push_back({hash(name + std::to_string(point)), i});
+            }
+        }
+        std::sort(state.ring.begin(), state.ring.end());
+    }
+    return state;
+}
+
+int64_t ProxyHandler::effectiveWeight(const Upstream::Server& server, s_upstream_peer& peer, std::chrono::steady_clock::time_point now)
+{
+    int64_t weight = static_cast<int64_t>(server.weight) * PROXY_WEIGHT_SCALE;
+    if (!peer.recovering) {
+        return weight;
+    }
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - peer.down_until).count();
+    int64_t ramp = static_cast<int64_t>(server.slow_start) * 1000;
+    if (elapsed >= ramp) {
+        peer.recovering = false;
+        return weight;
+    }
+    return std::max<int64_t>(1, weight * elapsed / ramp);
+}
+
+uint32_t ProxyHandler::hash(std::string_view key)
+{
+    // FNV-1a with a final mix, neighbouring keys like "host-1" and "host-2" land far apart
+    uint32_t value = 2166136261u;
+    for (unsigned char c : key) {
+        value = (value ^ c) * 16777619u;
+    }
+    value ^= value >> 16;
+    value *= 0x85ebca6bu;
+    value ^= value >> 13;
+    value *= 0xc2b2ae35u;
+    value ^= value >> 16;
+    return value;
+}
+
+bool ProxyHandler::resolve(const Upstream::Server& server, const std::string& key, sockaddr_in& address)
+{
+    std::unordered_map<std::string, sockaddr_in>::iterator cached = addresses_.find(key);
+    if (cached != addresses_.end()) {
+        address = cached->second;
+        return true;
+    }
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    int err = getaddrinfo(server.host.c_str(), std::to_string(server.port).c_str(), &hints, &result);
+    if (err != 0 || result == nullptr) {
+        LOG_ERROR("proxy: resolving " << server.host << " failed: " << gai_strerror(err));
+        return false;
+    }
+    address = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+    freeaddrinfo(result);
+    addresses_[key] = address;
+    return true;
+}
+
+std::string ProxyHandler::buildRequestHead(const s_client_data& client_data, const Location::ProxyConfig& config, const std::string& location_path)
+{
+    // A URI in proxy_pass replaces the location path, otherwise the request goes up unchanged
+    std::string uri(client_data.request_source);
+    if (!config.uri.empty() && uri.compare(0, location_path.size(), location_path) == 0) {
+        uri = config.uri + uri.substr(location_path.size());
+    }
+
+    std::string head(client_data.request_method);
+    head += " " + uri + " HTTP/1.1\r\n";
+    head += "Host: " + config.host;
+    if (config.port != 0 && config.port != 80) {
+        head += ":" + std::to_string(config.port);
+    }
+    head += "\r\n";
+
+    // Hop-by-hop headers stay here and the body goes up with a Content-Length
+    static const char* const skipped[] = {
+        "host", "connection", "keep-alive", "proxy-connection", "te",
+        "transfer-encoding", "content-length", "upgrade", "trailer"
+    };
+    std::string_view headers = client_data.request_header;
+    size_t pos = headers.find("\r\n"); // Skip the request line
+    while (pos != std::string::npos) {
+        pos += 2;
+        size_t end = headers.find("\r\n", pos);
+        std::string line(headers.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos));
+        pos = end;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (std::find_if(std::begin(skipped), std::end(skipped),
+                [&name](const char* skip) { return name == skip; }) != std::end(skipped)) {
+            continue;
+        }
+        head += line + "\r\n";
+    }
+    if (!client_data.request_body.empty() || client_data.request_method == "POST") {
+        head += "Content-Length: " + std::to_string(client_data.request_body.size()) + "\r\n";
+    }
+    head += "Connection: keep-alive\r\n\r\n";
+    return head;
+}
+
+void ProxyHandler::handleUpstream(s_proxy_session& session, uint32_t events)
+{
+    if (session.state == ProxyState::Connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(session.upstream_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & EPOLLERR)) {
+            LOG_ERROR("proxy: connecting to " << session.upstream_key << " failed: " << strerror(err));
+            peerFailed(session);
+            if (!retryNext(session)) {
+                finish(session, 502);
+            }
+            return;
+        }
+        session.state = ProxyState::Sending;
+    }
+    if (session.state == ProxyState::Sending) {
+        writeRequest(session);
+        return;
+    }
+    readResponse(session);
+}
+
+void ProxyHandler::writeRequest(s_proxy_session& session)
+{
+    const std::string& head = session.request_head;
+    const std::string& body = session.client_data->request_body;
+    size_t total = head.size() + body.size();
+    while (session.request_offset < total) {
+        ssize_t sent;
+        if (session.request_offset < head.size()) {
+            sent = send(session.upstream_fd, head.data() + session.request_offset,
+                head.size() - session.request_offset, MSG_NOSIGNAL);
+        } else {
+            sent = send(session.upstream_fd, body.data() + (session.request_offset - head.size()),
+                total - session.request_offset, MSG_NOSIGNAL);
+        }
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                touch(session, session.config->read_timeout);
+                return;  // The upstream reads slower than we write, wait for EPOLLOUT
+            }
+            if (retry(session)) {
+                return;
+            }
+            LOG_ERROR("proxy: sending to " << session.upstream_key << " failed: " << strerror(errno));
+            peerFailed(session);
+            finish(session, 502);
+            return;
+        }
+        session.request_offset += static_cast<size_t>(sent);
+    }
+    session.state = ProxyState::ReadingHeader;
+    setEvents(session.upstream_fd, EPOLLIN);
+    touch(session, session.config->read_timeout);
+}
+
+void ProxyHandler::readResponse(s_proxy_session& session)
+{
+    char buffer[PROXY_BUFFER_SIZE];
+    while (true) {
+        ssize_t bytes = recv(session.upstream_fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0) {
+            session.received = true;
+            touch(session, session.config->read_timeout);
+            if (session.state == ProxyState::ReadingHeader) {
+                session.response_head.append(buffer, bytes);
+                size_t head_end;
+                while (session.state == ProxyState::ReadingHeader
+                        && (head_end = session.response_head.find("\r\n\r\n")) != std::string::npos) {
+                    if (!parseResponseHead(session, head_end)) {
+                        LOG_ERROR("proxy: invalid response header from " << session.upstream_key);
+                        peerFailed(session);
+                        finish(session, 502);
+                        return;
+                    }
+                }
+                if (session.state == ProxyState::ReadingHeader) {
+                    if (session.response_head.size() > PROXY_HEADER_MAX) {
+                        LOG_ERROR("proxy: response header from " << session.upstream_key << " too large");
+                        peerFailed(session);
+                        finish(session, 502);
+                        return;
+                    }
+                    continue;
+                }
+            } else {
+                addBody(session, buffer, static_cast<size_t>(bytes));
+            }
+            if (session.complete) {
+                releaseUpstream(session, session.keep_alive);
+                if (flushClient(session)) {
+                    finish(session, 0);
+                } else {
+                    setEvents(session.client_fd, EPOLLOUT);
+                }
+                return;
+            }
+            if (!flushClient(session)) {
+                // The client is slower than the upstream, stop reading until it caught up
+                setEvents(session.upstream_fd, 0);
+                setEvents(session.client_fd, EPOLLOUT);
+                return;
+            }
+            continue;
+        }
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        // The upstream closed the connection or failed
+        if (session.state == ProxyState::ReadingBody && session.body == ProxyBody::Close) {
+            session.complete = true;
+            releaseUpstream(session, false);
+            if (flushClient(session)) {
+                finish(session, 0);
+            } else {
+                setEvents(session.client_fd, EPOLLOUT);
+            }
+            return;
+        }
+        if (retry(session)) {
+            return;
+        }
+        LOG_ERROR("proxy: " << session.upstream_key << " closed the connection early");
+        if (session.state != ProxyState::ReadingBody) {
+            peerFailed(session);
+        }
+        finish(session, session.client_started ? 0 : 502);
+        return;
+    }
+}
+
+bool ProxyHandler::parseResponseHead(s_proxy_session& session, size_t head_end)
+{
+    std::string head = session.response_head.substr(0, head_end);
+    std::string rest = session.response_head.substr(head_end + 4);
+    session.response_head.clear();
+
+    size_t line_end = head.find("\r\n");
+    std::string status_line = head.substr(0, line_end);
+    if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12) {
+        return false;
+    }
+    int status = std::atoi(status_line.c_str() + 9);
+    if (status < 100 || status > 999) {
+        return false;
+    }
+    if (status < 200) {
+        // Interim response, the real one follows
+        session.response_head = rest;
+        return true;
+    }
+    // A complete header means the server works, earlier failures no longer count
+    getState(*session.upstream).peers[session.peer].fails = 0;
+    bool close_after = status_line.compare(0, 8, "HTTP/1.1") != 0;
+    bool chunked = false;
+    bool has_length = false;
+    uint64_t length = 0;
+
+    // The client connection is closed after the response, the upstream one may be kept
+    std::string client_head = status_line + "\r\n";
+    size_t pos = line_end;
+    while (pos != std::string::npos) {
+        pos += 2;
+        size_t end = head.find("\r\n", pos);
+        std::string line = head.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (name == "connection") {
+            if (value.find("close") != std::string::npos) {
+                close_after = true;
+            } else if (value.find("keep-alive") != std::string::npos) {
+                close_after = false;
+            }
+            continue;
+        }
+        if (name == "keep-alive" || name == "proxy-connection") {
+            continue;
+        }
+        if (name == "transfer-encoding" && value.find("chunked") != std::string::npos) {
+            chunked = true;
+        } else if (name == "content-length") {
+            char* parse_end = nullptr;
+            length = std::strtoull(value.c_str(), &parse_end, 10);
+            has_length = parse_end != value.c_str();
+        }
+        client_head += line + "\r\n";
+    }
+    client_head += "Connection: close\r\n\r\n";
+    session.out += client_head;
+    session.state = ProxyState::ReadingBody;
+    session.keep_alive = !close_after;
+
+    if (session.client_data->request_method == "HEAD" || status == 204 || status == 304) {
+        session.body = ProxyBody::None;
+    } else if (chunked) {
+        session.body = ProxyBody::Chunked;
+    } else if (has_length) {
+        session.body = ProxyBody::Length;
+        session.body_left = length;
+    } else {
+        session.body = ProxyBody::Close;
+        session.keep_alive = false;
+    }
+    if (session.body == ProxyBody::None || (session.body == ProxyBody::Length && length == 0)) {
+        session.complete = true;
+    }
+    if (!rest.empty()) {
+        addBody(session, rest.data(), rest.size());
+    }
+    return true;
+}
+
+void ProxyHandler::addBody(s_proxy_session& session, const char* data, size_t size)
+{
+    if (session.complete) {
+        // More than the response, the connection is out of step
+        session.keep_alive = false;
+        return;
+    }
+    size_t used = size;
+    if (session.body == ProxyBody::Length) {
+        used = std::min<uint64_t>(size, session.body_left);
+        session.body_left -= used;
+        session.complete = session.body_left == 0;
+    } else if (session.body == ProxyBody::Chunked) {
+        used = scanChunked(session, data, size);
+    }
+    session.out.append(data, used);
+    if (used < size) {
+        session.keep_alive = false;
+    }
+}
+
+size_t ProxyHandler::scanChunked(s_proxy_session& session, const char* data, size_t size)
+{
+    // The chunks are passed on as they are, this only looks for the end of the body
+    size_t i = 0;
+    while (i < size && !session.complete) {
+        char c = data[i];
+        switch (session.chunk) {
+        case ProxyChunk::Size:
+            ++i;
+            if (c == '\n') {
+                session.chunk = session.body_left == 0 ? ProxyChunk::Trailer : ProxyChunk::Data;
+                session.chunk_ext = false;
+                session.trailer_line = 0;
+            } else if (c == ';') {
+                session.chunk_ext = true;
+            } else if (!session.chunk_ext && std::isxdigit(static_cast<unsigned char>(c))) {
+                session.body_left = session.body_left * 16
+                    + static_cast<uint64_t>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+            }
+            break;
+        case ProxyChunk::Data: {
+            size_t take = std::min<uint64_t>(size - i, session.body_left);
+            i += take;
+            session.body_left -= take;
+            if (session.body_left == 0) {
+                session.chunk = ProxyChunk::DataEnd;
+            }
+            break;
+        }
+        case ProxyChunk::DataEnd:
+            ++i;
+            if (c == '\n') {
+                session.chunk = ProxyChunk::Size;
+            }
+            break;
+        case ProxyChunk::Trailer:
+            ++i;
+            if (c == '\n') {
+                if (session.trailer_line == 0) {
+                    session.complete = true;
+                }
+                session.trailer_line = 0;
+            } else if (c != '\r') {
+                ++session.trailer_line;
+            }
+            break;
+        }
+    }
+    return i;
+}
+
+bool ProxyHandler::flushClient(s_proxy_session& session)
+{
+    while (session.out_offset < session.out.size()) {
+        ssize_t sent = send(session.client_fd, session.out.data() + session.out_offset,
+            session.out.size() - session.out_offset, MSG_NOSIGNAL);
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            ++session.client_data->eagains;
+        }
+        session.client_data->countSent(session.out.data() + session.out_offset, sent);
+        if (sent <= 0) {
+            // A full socket waits for EPOLLOUT, a failed one reports EPOLLERR
+            touch(session, PROXY_SEND_TIMEOUT);
+            return false;
+        }
+        session.out_offset += static_cast<size_t>(sent);
+        session.client_started = true;
+    }
+    session.out.clear();
+    session.out_offset = 0;
+    touch(session, session.config->read_timeout);
+    return true;
+}
+
+void ProxyHandler::writeClient(s_proxy_session& session)
+{
+    if (!flushClient(session)) {
+        return;
+    }
+    if (session.complete) {
+        finish(session, 0);
+        return;
+    }
+    // The client caught up, continue with the upstream
+    setEvents(session.client_fd, 0);
+    setEvents(session.upstream_fd, EPOLLIN);
+}
+
+bool ProxyHandler::retry(s_proxy_session& session)
+{
+    if (!session.reused || session.received) {
+        return false;
+    }
+    // The upstream closed the pooled connection just as it was reused, nothing was lost
+    releaseUpstream(session, false);
+    session.request_offset = 0;
+    session.response_head.clear();
+    return connectUpstream(session);
+}
+
+void ProxyHandler::releaseUpstream(s_proxy_session& session, bool reusable)
+{
+    int fd = session.upstream_fd;
+    if (fd == -1) {
+        return;
+    }
+    upstream_fds_.erase(fd);
+    session.upstream_fd = -1;
+    --getState(*session.upstream).peers[session.peer].active;
+    std::vector<s_idle_upstream>& idle = idle_[session.upstream_key];
+    if (reusable && idle.size() < session.config->keepalive) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        idle.push_back({fd, std::chrono::steady_clock::now()});
+        return;
+    }
+    close(fd);  // Closing also removes it from the epoll
+}
+
+void ProxyHandler::finish(s_proxy_session& session, uint16_t status)
+{
+    int client_fd = session.client_fd;
+    releaseUpstream(session, false);
+    finished_.push_back({client_fd, status});
+    sessions_.erase(client_fd);
+}
+
+void ProxyHandler::setEvents(int fd, uint32_t events, int op)
+{
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, op, fd, &event) == -1) {
+        LOG_ERROR("proxy: epoll_ctl failed for " << fd << ": " << strerror(errno));
+    }
+}
+
+void ProxyHandler::touch(s_proxy_session& session, size_t seconds)
+{
+    session.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+}
@@ -0,0 +1,92 @@
+#include "server/AllocProfile.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+const char* AllocProfile::name(e_alloc_phase phase)
+{
+    static const char* const names[ALLOC_PHASE_COUNT] = {"other", "parse", "route", "respond", "cgi"};
+    return names[phase];
+}
+
+#ifdef ALLOC_PROFILE
+
+// Plain arrays of atomics, operator new can not take a lock or allocate to count itself
+static std::atomic<uint64_t> g_allocations[ALLOC_PHASE_COUNT];
+
+void AllocProfile::count()
+{
+    g_allocations[current_].fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocProfile::reset()
+{
+    for (std::atomic<uint64_t>& allocations : g_allocations)
+        allocations.store(0, std::memory_order_relaxed);
+}
+
+s_alloc_counts AllocProfile::snapshot()
+{
+    s_alloc_counts counts;
+    for (size_t phase = 0; phase < ALLOC_PHASE_COUNT; ++phase)
+        counts.allocations[phase] = g_allocations[phase].load(std::memory_order_relaxed);
+    return counts;
+}
+
+void* operator new(size_t size)
+{
+    AllocProfile::count();
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    AllocProfile::count();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+#else
+
+void AllocProfile::reset()
+{
+}
+
+s_alloc_counts AllocProfile::snapshot()
+{
+    return s_alloc_counts();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include "server/RequestArena.hpp"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief hands out size bytes from the current block, a new block is only
+ * made when the first one is missing or full
+ */
+char* RequestArena::allocate(size_t size)
+{
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    used_ += size;
+    if (!block_)
+    {
+        size_ = std::max<size_t>(REQUEST_ARENA_SIZE, size);
+        block_.reset(new char[size_]);
+    }
+    if (overflow_.empty() && offset_ + size <= size_)
+    {
+        offset_ += size;
+        return block_.get() + offset_ - size;
+    }
+    if (overflow_.empty() || offset_ + size > overflow_size_)
+    {
+        overflow_size_ = std::max(size_, size);
+        overflow_.emplace_back(new char[overflow_size_]);
+        overflow_total_ += overflow_size_;
+        offset_ = 0;
+    }
+    offset_ += size;
+    return overflow_.back().get() + offset_ - size;
+}
+
+std::string_view RequestArena::copy(std::string_view text)
+{
+    if (text.empty())
+        return std::string_view();
+    char* to = allocate(text.size());
+    std::memcpy(to, text.data(), text.size());
+    return std::string_view(to, text.size());
+}
+
+void RequestArena::reset()
+{
+    if (!overflow_.empty())
+    {
+        // Whatever the last request needed in one block, up to the limit
+        size_t needed = std::min<size_t>(std::max(size_, used_), REQUEST_ARENA_MAX);
+        overflow_.clear();
+        overflow_total_ = 0;
+        overflow_size_ = 0;
+        if (needed > size_)
+        {
+            size_ = needed;
+            block_.reset(new char[size_]);
+        }
+    }
+    offset_ = 0;
+    used_ = 0;
+}
+
+size_t RequestArena::capacity() const
+{
+    return size_ + overflow_total_;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "server/RequestTrace.hpp"
+#include "server/ServerRequestHandler.hpp"
+#include <cstring>
+#include <sstream>
+
+bool RequestTrace::enabled_ = false;
+std::vector<s_trace_record> RequestTrace::ring_;
+uint64_t RequestTrace::recorded_ = 0;
+
+void RequestTrace::enable(size_t records)
+{
+    enabled_ = true;
+    if (records > ring_.size())
+    {
+        ring_.assign(records, s_trace_record());
+        recorded_ = 0;
+    }
+}
+
+void RequestTrace::record(int client_fd, const s_client_data& data)
+{
+    if (ring_.empty())
+        return;
+    s_trace_record& slot = ring_[recorded_ % ring_.size()];
+    slot.at = data.trace;
+    slot.fd = client_fd;
+    slot.status = data.status;
+    // Cut to fit, the start of the target is enough to tell requests apart
+    slot.method[data.request_method.copy(slot.method, sizeof(slot.method) - 1)] = '\0';
+    slot.target[data.request_source.copy(slot.target, sizeof(slot.target) - 1)] = '\0';
+    ++recorded_;
+}
+
+std::string RequestTrace::dump()
+{
+    static const char* const names[] = {"accept", "first_byte", "headers", "route", "handler", "first_write", "close"};
+    std::ostringstream out;
+    if (ring_.empty())
+    {
+        out << "# request tracing is off, turn it on with request_trace in a server block\n";
+        return out.str();
+    }
+    timespec resolution;
+    clock_getres(CLOCK_MONOTONIC_COARSE, &resolution);
+    size_t kept = recorded_ < ring_.size() ? recorded_ : ring_.size();
+    out << "# " << kept << " of " << recorded_ << " requests, clock resolution "
+        << (resolution.tv_sec * 1000000 + resolution.tv_nsec / 1000) << "us\n"
+        << "# microseconds after accept, - when the request did not get there\n"
+        << "fd method target status";
+    for (int phase = TRACE_FIRST_BYTE; phase < TRACE_PHASE_COUNT; ++phase)
+        out << " " << names[phase];
+    out << "\n";
+    for (uint64_t i = recorded_ - kept; i < recorded_; ++i)
+    {
+        const s_trace_record& record = ring_[i % ring_.size()];
+        out << record.fd << " " << (record.method[0] ? record.method : "-") << " "
+            << (record.target[0] ? record.target : "-") << " " << record.status;
+        for (int phase = TRACE_FIRST_BYTE; phase < TRACE_PHASE_COUNT; ++phase)
+        {
+            if (record.at[phase] == 0 || record.at[TRACE_ACCEPT] == 0)
+                out << " -";
+            else
+                out << " " << (record.at[phase] - record.at[TRACE_ACCEPT]) / 1000;
+        }
+        out << "\n";
+    }
+    return out.str();
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "server/RouteTable.hpp"
+#include <algorithm>
+
+RouteTable::RouteTable(std::shared_ptr<const Config> config) : config_(std::move(config))
+{
+    const std::vector<std::shared_ptr<Location>>& locations = config_->getLocations();
+    locations_.reserve(locations.size());
+    paths_.reserve(locations.size());
+    for (const std::shared_ptr<Location>& location : locations)
+    {
+        size_t index = locations_.size();
+        locations_.push_back(location.get());
+        // the validator turns away duplicate paths, the first one wins if it did not run
+        paths_.emplace(location->getPath(), index);
+        Location::MatchType type = location->getMatchType();
+        if (type == Location::MatchType::REGEX || type == Location::MatchType::REGEX_INSENSITIVE)
+            regex_.push_back(index);
+        else
+            prefixes_.push_back(index);
+        if (location->hasProxy() || location->hasStubStatus() || location->hasMetrics() || location->hasTraceDump())
+            has_handlers_ = true;
+    }
+    // stable, of two paths as long as each other the first in the config still wins
+    std::stable_sort(prefixes_.begin(), prefixes_.end(), [this](size_t a, size_t b)
+    {
+        return locations_[a]->getPath().size() > locations_[b]->getPath().size();
+    });
+}
+
+size_t RouteTable::find(std::string_view path) const
+{
+    std::unordered_map<std::string_view, size_t>::const_iterator it = paths_.find(path);
+    return it == paths_.end() ? locations_.size() : it->second;
+}
+
+t_route_iterator RouteTable::longestPrefix(std::string_view path) const
+{
+    for (size_t index : prefixes_)
+    {
+        const std::string& prefix = locations_[index]->getPath();
+        bool matches;
+        if (locations_[index]->getMatchType() == Location::MatchType::EXACT)
+            matches = path == prefix;
+        else
+            matches = path.compare(0, prefix.size(), prefix) == 0
+                && (prefix.back() == '/' || path.size() == prefix.size() || path[prefix.size()] == '/');
+        if (matches)
+            return at(index);
+    }
+    return end();
+}
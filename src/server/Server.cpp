@@ -1,4 +1,7 @@
 #include "Server.hpp"
+#include "log/Logger.hpp"
+#include "server/ServerMetrics.hpp"
+#include "server/AllocProfile.hpp"
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <stdexcept>
@@ -7,26 +10,112 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <csignal>
 #include <sys/stat.h>
+#include <spawn.h>
+#include <cstring>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#include <algorithm>
 
-Server::Server(std::vector<std::shared_ptr<Config>>& config) : validator_()
+extern char** environ;
+
+/**
+ * @brief reads the listening sockets an upgrading binary handed over, address:port=fd;...
+ * The variable is removed so scripts and later upgrades do not see it
+ * 
+ * @return the sockets by their address
+ */
+static std::map<std::string, int> inheritedSockets()
+{
+    std::map<std::string, int> sockets;
+    const char* value = getenv(UPGRADE_LISTEN_ENV);
+    if (value == nullptr)
+        return sockets;
+    std::string list(value);
+    unsetenv(UPGRADE_LISTEN_ENV);
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(';', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string entry = list.substr(start, end - start);
+        size_t equals = entry.rfind('=');
+        if (equals != std::string::npos)
+            sockets[entry.substr(0, equals)] = std::atoi(entry.c_str() + equals + 1);
+        start = end + 1;
+    }
+    return sockets;
+}
+
+/**
+ * @return the CPUs the process may run on, in order
+ */
+static std::vector<int> allowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+        return cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/**
+ * @brief the worker_processes of the first server that sets it, like the error log
+ * 
+ * @return the workers to fork, 0 to serve in this process
+ */
+static size_t workerProcesses(const std::vector<std::shared_ptr<Config>>& configs, size_t cpus)
 {
-    conf_size_ = config.size();
-    config_info_.reserve(conf_size_);
+    for (const std::shared_ptr<Config>& conf : configs)
+    {
+        if (conf->getWorkerProcesses() == -1)
+            return std::max<size_t>(cpus, 1);
+        if (conf->getWorkerProcesses() != 0)
+            return static_cast<size_t>(conf->getWorkerProcesses());
+    }
+    return 0;
+}
 
-    for (size_t i = 0; i < conf_size_; ++i)
+Server::Server(std::vector<std::shared_ptr<Config>>& config, char** argv) : argv_(argv), config_path_(argv[1]), upgrade_fd_(-1), upgrade_pid_(-1), draining_(false), cpus_(allowedCpus()), validator_(), signal_fd_(-1), timer_fd_(-1)
+{
+    worker_processes_ = workerProcesses(config, cpus_.size());
+    std::map<std::string, int> inherited = inheritedSockets();
+    for (std::shared_ptr<Config>& conf : config)
     {
-        configInfo con_info(config[i]);
+        config_info_.emplace_back(conf);
+        configInfo& con_info = config_info_.back();
+        std::map<std::string, int>::iterator socket = inherited.find(con_info.server_name_ + ":" + std::to_string(con_info.port_));
+        if (socket != inherited.end())
+        {
+            // already bound and listening, the old binary keeps its copy until it drained
+            con_info.server_fd_ = socket->second;
+            fcntl(con_info.server_fd_, F_SETFD, FD_CLOEXEC);
+            setNonBlocking(con_info.server_fd_);
+            inherited.erase(socket);
+            continue;
+        }
         if (createServerSocket(con_info.server_name_, con_info.port_, con_info.server_fd_))
         {
-            if (i > 0)
-                for (size_t j = 0; j < i; ++j)
-                    close(config_info_[j].server_fd_);
+            config_info_.pop_back();
+            for (configInfo& con : config_info_)
+                close(con.server_fd_);
             std::cerr << "create server socket error\n";
             throw std::runtime_error("failed to setup server socket");
         }
-        config_info_.push_back({con_info});
     }
+    // addresses the config of the new binary does not have anymore
+    for (std::pair<const std::string, int>& socket : inherited)
+        close(socket.second);
 }
 
 Server::~Server() {};
@@ -41,7 +130,7 @@ Server::~Server() {};
  */
 int Server::setupEpoll()
 {
-    epoll_fd_ = epoll_create(MAX_EVENTS);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
     if (epoll_fd_ == -1)
     {
         std::cerr << "epoll_create error\n";
@@ -51,61 +140,115 @@ int Server::setupEpoll()
         return nr;
     }
 
-    if (setupPipe() != 0)
+    // Before the logger starts its thread, which inherits the blocked signals
+    if (setupSignals() != 0 || setupTimer() != 0)
     {
-        std::cerr << "creating pipes for STDOUT and STDERR failed\n";
         close(epoll_fd_);
-        for(configInfo& con : config_info_)
+        for (configInfo& con : config_info_)
             close(con.server_fd_);
         return -1;
     }
-    int nr = putCoutCerrInEpoll();
-    if (nr != 0)
+
+    // One error log for the whole process, like nginx's main context
+    for (configInfo& con : config_info_)
     {
-        close(stdout_pipe_[0]);
-        close(stderr_pipe_[0]);
+        if (!con.config_->getErrorLogPath().empty())
+        {
+            Logger::instance().setErrorLog(con.config_->getErrorLogPath(), con.config_->getErrorLogLevel());
+            break;
+        }
+    }
+    // Like the error log, the ring is shared by the whole process
+    for (configInfo& con : config_info_)
+    {
+        if (con.config_->getRequestTrace() != 0)
+        {
+            RequestTrace::enable(con.config_->getRequestTrace());
+            break;
+        }
+    }
+    if (Logger::instance().start() != 0)
+    {
+        std::cerr << "starting the logger failed\n";
         close(epoll_fd_);
         for(configInfo& con : config_info_)
             close(con.server_fd_);
-        return nr;
+        return -1;
+    }
+    // A master only holds the listening sockets, its workers open the servers
+    if (worker_processes_ != 0)
+        return 0;
+    for (configInfo& con : config_info_)
+    {
+        if (openServer(con) != 0)
+        {
+            close(epoll_fd_);
+            for (configInfo& server : config_info_)
+                close(server.server_fd_);
+            return -1;
+        }
     }
+    proxy_.setEpollFd(epoll_fd_);
+    int nr;
 
-    for (size_t i = 0; i < conf_size_; ++i)
+    for (configInfo& con : config_info_)
     {
         epoll_event event{};
-        event.events = EPOLLIN;
-        event.data.fd = config_info_[i].server_fd_;
+        // Workers share the listening sockets, one of them is woken for a connection instead of all
+        event.events = worker_ ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN;
+        event.data.fd = con.server_fd_;
 
-        nr = doEpollCtl(EPOLL_CTL_ADD, config_info_[i].server_fd_, &event);
+        nr = doEpollCtl(EPOLL_CTL_ADD, con.server_fd_, &event);
         if (nr != 0)
         {
-            std::cerr << "adding server_fd " << i << "failed\n";
+            LOG_ERROR("adding server_fd " << con.server_fd_ << "failed");
             close(epoll_fd_);
             for(configInfo& con : config_info_)
                 close(con.server_fd_);
         }  
-        config_info_[i].responseHandler_.setStdoutPipe(stdout_pipe_);
-        config_info_[i].requestHandler_.setStdoutPipe(stdout_pipe_);
-        config_info_[i].requestHandler_.setStderrPipe(stderr_pipe_);
     }
     return 0;
 }
 
+/**
+ * @brief opens the logs of a server and registers its metrics, for the servers
+ * of the first config and for the ones a reload makes
+ * 
+ * @param config the server
+ * @return 0 when done,
+ * @return -1 if the access log can not be opened
+ */
+int Server::openServer(configInfo& config)
+{
+    if (config.access_log_.open(config.config_->getAccessLogPath(), config.config_->isAccessLogJson(), config.config_->getAccessLogSample()) != 0)
+    {
+        LOG_ERROR("opening the access log " << config.config_->getAccessLogPath() << " failed");
+        return -1;
+    }
+    ServerMetrics::registerServer(*config.config_);
+    config.slow_log_.open(config.config_->getSlowRequestThreshold(), config.config_->getSlowRequestRate());
+    // The slow request log shows the phases, so the requests need their stamps
+    if (config.config_->getSlowRequestThreshold() != 0)
+        RequestTrace::enable(0);
+    config.responseHandler_.setProxy(&proxy_);
+    return 0;
+}
+
 
 int Server::serverLoop()
 {
+    AllocProfile::reset(); // reading the config is not part of any request
+    if (worker_processes_ != 0)
+        return masterLoop();
+    notifyUpgrade();
     int nr = listenLoop();
     if (nr < 0)
     {
-        close(stdout_pipe_[0]);
-        close(stderr_pipe_[0]);
         close(epoll_fd_);
         for(configInfo& con : config_info_)
             close(con.server_fd_);
         return nr;
     }
-    close(stdout_pipe_[0]);
-    close(stderr_pipe_[0]);
     return 0;
 }
 // private functions
@@ -123,7 +266,7 @@ int Server::serverLoop()
  */
 int Server::createServerSocket(std::string& server_name, uint16_t port, int& server_fd)
 {
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (server_fd == -1)
         return 1;
     int opt = 1;
@@ -222,13 +365,13 @@ int Server::doEpollCtl(int mode, int fd, epoll_event* event)
 {
     if (epoll_ctl(epoll_fd_, mode, fd, event) == -1)
     {
-        std::cerr << "first round epoll_ctl error\n";
+        LOG_ERROR("first round epoll_ctl error");
         int nr = validator_.checkErrno(errno);
         if (nr == 1)
         {
             if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, event) == -1)
             {
-                std::cerr << "epoll mod error\n";
+                LOG_ERROR("epoll mod error");
                 nr = validator_.checkErrno(errno);
                 return nr;
             }
@@ -237,7 +380,7 @@ int Server::doEpollCtl(int mode, int fd, epoll_event* event)
         {
             if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, event) == -1)
             {
-                std::cerr << "epoll add error\n";
+                LOG_ERROR("epoll add error");
                 nr = validator_.checkErrno(errno);
                 return nr;
             }
@@ -247,57 +390,6 @@ int Server::doEpollCtl(int mode, int fd, epoll_event* event)
     }
     return 0;
 }
-/**
- * @brief makes pipes for the standard output and standard error
- * and makes them non blocking
- * 
- * @return 0 when done,
- * @return -1 if pipe creation failed
- */
-int Server::setupPipe()
-{
-    if (pipe(stdout_pipe_) == -1 || pipe(stderr_pipe_) == -1)
-        return -1;
-    
-    setNonBlocking(stdout_pipe_[0]);
-    setNonBlocking(stdout_pipe_[1]);
-    setNonBlocking(stderr_pipe_[0]);
-    setNonBlocking(stderr_pipe_[1]);
-
-    dup2(stdout_pipe_[1], STDOUT_FILENO);
-    dup2(stderr_pipe_[1], STDERR_FILENO);
-
-    close(stdout_pipe_[1]);
-    close(stderr_pipe_[1]);
-
-    std::cout.setf(std::ios::unitbuf);
-
-    return 0;
-}
-
-/**
- * @brief adds the pipes that represend the standard output and standard error to the epoll
- * 
- * @return 0 when done
- * @return -1 on error,
- * @return -2 on critical error
- */
-int Server::putCoutCerrInEpoll()
-{
-    struct epoll_event std_event;
-    std_event.events = EPOLLIN;
-    std_event.data.fd = stdout_pipe_[0];
-    int nr = doEpollCtl(EPOLL_CTL_ADD, stdout_pipe_[0], &std_event);
-    if (nr < 0)
-        return nr;
-    
-    std_event.data.fd = stderr_pipe_[0];
-    nr = doEpollCtl(EPOLL_CTL_ADD, stderr_pipe_[0], &std_event);
-    if (nr < 0)
-        return nr;
-    return 0;
-}
-
 /**
  * @brief the main loop that listens to the events that need to be handled
  * 
@@ -308,16 +400,43 @@ int Server::putCoutCerrInEpoll()
 int Server::listenLoop()
 {
     epoll_event events[MAX_EVENTS];
-    while (true)
+    while (!draining_ || !config_info_.empty())
     {
-        int event_count = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        int timeout = -1;
+        for (configInfo& con : config_info_)
+        {
+            int cgi_timeout = con.responseHandler_.getCGITimeout();
+            if (cgi_timeout != -1 && (timeout == -1 || cgi_timeout < timeout))
+                timeout = cgi_timeout;
+        }
+        int proxy_timeout = proxy_.getTimeout();
+        if (proxy_timeout != -1 && (timeout == -1 || proxy_timeout < timeout))
+            timeout = proxy_timeout;
+        int drain_timeout = getDrainTimeout();
+        if (drain_timeout != -1 && (timeout == -1 || drain_timeout < timeout))
+            timeout = drain_timeout;
+        int event_count = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
         for (int i = 0; i < event_count; ++i)
         {
             int nr = checkEvents(events[i]);
             if (nr == -2)
                 return nr;
         }
+        for (configInfo& con : config_info_)
+            updateCGI(con);
+        proxy_.update();
+        finishProxy();
+        reapServers();
+        if (draining_ && std::chrono::steady_clock::now() >= drain_deadline_)
+        {
+            LOG_WARN("drain timeout reached, closing the clients that are left");
+            drain_.forced = closeClients();
+            break;
+        }
     }
+    if (config_info_.empty())
+        LOG_INFO("all clients drained, stopping");
+    logDrainSummary();
     close(epoll_fd_);
     for(configInfo& con : config_info_)
         close(con.server_fd_);
@@ -327,10 +446,9 @@ int Server::listenLoop()
 /**
  * @brief checks what action to take on the based on the fd of the event.
  * If it's  a new fd then a new connection is being made.
- * If the events hold the status of EPOLLIN than first it will check if the fd is a timeout fd
- * if it isn't than a read event needs to be handeled.
- * If the events hold the status of EPOLLOUT than first it will check if the fd is a timeout fd 
- * if it isn't than a write events needs to be handeled.
+ * If it's the timer then the clients whose deadline passed time out.
+ * If the events hold the status of EPOLLIN than a read event needs to be handeled.
+ * If the events hold the status of EPOLLOUT than a write events needs to be handeled.
  * 
  * @param event the event with the fd and the events needed for handeling
  * @return 0 when done,
@@ -341,6 +459,12 @@ int Server::checkEvents(epoll_event event)
 {
 
     int fd = event.data.fd;
+    if (fd == signal_fd_)
+        return handleSignal();
+    if (fd == timer_fd_)
+        return handleTimeouts();
+    if (fd == upgrade_fd_)
+        return handleUpgrade();
     for (configInfo& con : config_info_)
     {
         if (fd == con.server_fd_) // new conection
@@ -355,11 +479,14 @@ int Server::checkEvents(epoll_event event)
             return 0;
         }
     }
-    if (event.events & EPOLLIN || event.events & EPOLLOUT) // timeout
+    if (cgi_fds_.find(fd) != cgi_fds_.end()) // CGI script I/O
+        return handleCGIEvent(fd);
+    if (proxy_.hasFd(fd)) // proxied client or its upstream
     {
-        int nr = checkForTimeout(fd, event);
-        if (nr != 1)
-            return nr;
+        AllocPhase phase(ALLOC_PHASE_RESPOND);
+        proxy_.handleEvent(fd, event.events);
+        finishProxy();
+        return 0;
     }
     if (event.events & EPOLLIN) // read event
     {
@@ -367,8 +494,8 @@ int Server::checkEvents(epoll_event event)
     }
     else if (event.events & EPOLLOUT) // write 
     {
-        std::vector<configInfo>::iterator it = config_info_.begin();
-        std::vector<configInfo>::iterator ite = config_info_.end();
+        std::list<configInfo>::iterator it = config_info_.begin();
+        std::list<configInfo>::iterator ite = config_info_.end();
         while (it != ite)
         {
             if (it->requestHandler_.getRequest(fd) != nullptr)
@@ -377,53 +504,60 @@ int Server::checkEvents(epoll_event event)
         }
         if (it == ite)
             return -2;
-        e_server_request_return nr = it->responseHandler_.handleResponse(fd, *(it->requestHandler_.getRequest(fd)), it->config_->getLocations());
+        s_client_data& data = *(it->requestHandler_.getRequest(fd));
+        if (data.hasOutput()) // the rest of a response the socket did not take earlier
+        {
+            if (it->responseHandler_.flushClient(fd, data) != SRH_OK || !data.hasOutput())
+                closeClient(fd, *it);
+            else
+                extendTimer(fd, data);
+            return 0;
+        }
+        e_server_request_return nr = it->responseHandler_.handleResponse(fd, data, *data.routes);
+        if (nr == SRH_CGI_PENDING)
+        {
+            applyCGIUpdate(*it);
+            return 0;
+        }
+        if (nr == SRH_PROXY_PENDING) // the proxy has its own connect and read timeouts
+        {
+            stopTimer(*(it->requestHandler_.getRequest(fd)));
+            return 0;
+        }
         if (nr == SRH_INCORRECT_HTTP_VERSION)
         {
             e_server_request_return srhr = it->responseHandler_.setupResponse(fd, 505, *(it->requestHandler_.getRequest(fd)));
-            doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-            doEpollCtl(EPOLL_CTL_DEL, client_timers_[fd], nullptr);
-            close(fd);
-            close(client_timers_[fd]);
-            it->requestHandler_.removeNodeFromRequest(fd);
-            client_timers_.erase(fd);
+            finishClient(fd, *it);
             if (srhr != SRH_OK)
                 return -2;
             return 0;
         }
-        else
+        if (nr == SRH_SEND_ERROR) // the client went away during its response
+        {
+            closeClient(fd, *it);
+            return 0;
+        }
+        else if (nr != SRH_OK)
             it->responseHandler_.setupResponse(fd, 500, *(it->requestHandler_.getRequest(fd)));
-        doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-        doEpollCtl(EPOLL_CTL_DEL, client_timers_[fd], nullptr);
-        close(fd);
-        close(client_timers_[fd]);
-        it->requestHandler_.removeNodeFromRequest(fd);
-        client_timers_.erase(fd);
+        finishClient(fd, *it);
         if (nr != SRH_OK)
             return -2;
         return 0;
     }
     else
     {
-        std::vector<configInfo>::iterator it = config_info_.begin();
-        std::vector<configInfo>::iterator ite = config_info_.end();
+        std::list<configInfo>::iterator it = config_info_.begin();
+        std::list<configInfo>::iterator ite = config_info_.end();
         while (it != ite)
         {
             if (it->requestHandler_.getRequest(fd) != nullptr)
                 break;
             ++it;
         }
-        if (it == ite)
-            return -2;
-        std::cerr << "epoll_event is [" << epollEventToString(event.events) << "] fd type is [" << getFdType(fd) << "\n";
-        int nr = doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-        doEpollCtl(EPOLL_CTL_DEL, client_timers_[fd], nullptr);
-        close(fd);
-        close(client_timers_[fd]);
-        it->requestHandler_.removeNodeFromRequest(fd);
-        client_timers_.erase(fd);
-        if (nr != SRH_OK)
-            return -2;
+        if (it == ite) // closed earlier in this round of events, its hang up came in the same round
+            return 0;
+        LOG_INFO("epoll_event is [" << epollEventToString(event.events) << "] fd type is [" << getFdType(fd));
+        closeClient(fd, *it);
         return 0;
 
     }
@@ -442,10 +576,20 @@ int Server::setupConnection(int server_fd, configInfo& config)
 {
     sockaddr_in clientAddr{};
     socklen_t clientLen = sizeof(clientAddr);
-    int client_fd = accept(server_fd, (sockaddr*)&clientAddr, &clientLen);
+    int client_fd = accept4(server_fd, (sockaddr*)&clientAddr, &clientLen, SOCK_CLOEXEC);
     if (client_fd != -1)
     {
-        config.requestHandler_.setConfigForClient(config.config_, client_fd);
+        ServerStats::add(STAT_ACCEPTED);
+        char address[INET_ADDRSTRLEN] = "";
+        inet_ntop(AF_INET, &clientAddr.sin_addr, address, sizeof(address));
+        if (config.requestHandler_.setConfigForClient(config.config_, client_fd, address) != E_ROK)
+        {
+            LOG_WARN("no room for client " << client_fd << ", at most " << CLIENT_SLAB_MAX << " are kept");
+            close(client_fd);
+            ServerStats::add(STAT_CLOSED);
+            return 0;
+        }
+        config.requestHandler_.getRequest(client_fd)->routes = &config.routes_;
         setNonBlocking(client_fd);
         epoll_event client_event{};
         client_event.events = EPOLLIN;
@@ -453,108 +597,174 @@ int Server::setupConnection(int server_fd, configInfo& config)
         int nr = doEpollCtl(EPOLL_CTL_ADD, client_fd, &client_event);
         if (nr != 0)
         {
-            std::cerr << "setup connecton new client to epoll failed\n";
+            LOG_ERROR("setup connecton new client to epoll failed");
             return nr;
         }
-        nr = setTimer(client_fd);
-        if (nr != 0)
-            return nr;
+        setTimer(client_fd, config);
+        ServerStats::add(STAT_HANDLED);
         return 0;
     }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0; // another worker accepted it
     else
     {
-        std::cerr << "accept error\n";
+        LOG_ERROR("accept error");
         return validator_.checkErrno(errno);
     }
 }
 
 /**
- * @brief sets a timeout timer for the client so we dont have hanging connections
+ * @brief makes the one timer of all clients and adds it to the epoll
  * 
- * @param client_fd the client fd the timer is for
  * @return 0 when done,
- * @return -1 on error,
- * @return -2 on critical error
+ * @return -1 on error
  */
-int Server::setTimer(int client_fd)
+int Server::setupTimer()
 {
-    int timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-    if (timer_fd == -1)
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ == -1)
+    {
+        std::cerr << "timerfd_create failed\n";
+        return -1;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event) == -1)
     {
-        std::cerr << "failed to create timerfd\n";
+        std::cerr << "adding timerfd to epoll failed\n";
+        close(timer_fd_);
+        timer_fd_ = -1;
         return -1;
     }
+    return 0;
+}
 
-    itimerspec timeout{};
-    timeout.it_value.tv_sec = TIMEOUT_MS / 1000; // timeout in seconds
-    timeout.it_value.tv_nsec = (TIMEOUT_MS % 1000) * 1000000; // timeout in nanoseconds
-    timeout.it_interval.tv_sec = 0; //timer needs to go once, no periodic triggering
-    timeout.it_interval.tv_nsec = 0;
+/**
+ * @brief sets a timeout timer for the client so we dont have hanging connections.
+ * Every client gets the same timeout from its accept, so a new deadline always goes last
+ * and only the first one needs the timer
+ * 
+ * @param client_fd the client fd the timer is for
+ * @param config the server of the client
+ */
+void Server::setTimer(int client_fd, configInfo& config)
+{
+    s_client_data* data = config.requestHandler_.getRequest(client_fd);
+    if (data == nullptr)
+        return;
+    data->deadline = data->accepted_at + std::chrono::milliseconds(TIMEOUT_MS);
+    client_timers_.push_back({data->deadline, client_fd});
+    if (client_timers_.size() == 1)
+        armTimer();
+}
 
-    timerfd_settime(timer_fd, 0, &timeout, nullptr);
+/**
+ * @brief moves the timeout of a client that is still taking its response
+ * TIMEOUT_MS past now. The earlier deadline stays queued and is skipped,
+ * a new one is only queued when it moves by a second or more
+ * 
+ * @param client_fd the client fd the timer is for
+ * @param data the request data of the client
+ */
+void Server::extendTimer(int client_fd, s_client_data& data)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MS);
+    if (!data.timer_stopped && deadline - data.deadline < std::chrono::seconds(1))
+        return;
+    data.timer_stopped = false;
+    data.deadline = deadline;
+    client_timers_.push_back({deadline, client_fd});
+    if (client_timers_.size() == 1)
+        armTimer();
+}
 
-    epoll_event timer_event{};
-    timer_event.data.fd = timer_fd;
-    timer_event.events = EPOLLIN;
-    int nr = doEpollCtl(EPOLL_CTL_ADD, timer_fd, &timer_event);
-    if (nr != 0)
+/**
+ * @brief arms the timer for the first deadline, or disarms it when no client is waiting
+ */
+void Server::armTimer()
+{
+    itimerspec timeout{};
+    if (!client_timers_.empty())
     {
-        std::cerr << "add timer fd to epoll failed\n";
-        return nr;
+        int64_t left_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(client_timers_.front().deadline - std::chrono::steady_clock::now()).count();
+        if (left_ns < 1)
+            left_ns = 1; // already due, a zero would disarm the timer
+        timeout.it_value.tv_sec = left_ns / 1000000000;
+        timeout.it_value.tv_nsec = left_ns % 1000000000;
     }
-    client_timers_[client_fd] = timer_fd;
-    return 0;
+    timerfd_settime(timer_fd_, 0, &timeout, nullptr);
 }
 
 /**
- * @brief checks if the fd is a timer fd, if it is that means a timeout has happend
+ * @brief times out every client whose deadline passed and arms the timer for the next one
  * 
- * @param fd the file descriptor of the timer
- * @param event the epoll event from the fd
- * @return 1 when the fd is not a timer fd,
- * @return 0 when timeout response is send,
- * @return -1 on error,
+ * @return 0 when done,
  * @return -2 on critical error
  */
-int Server::checkForTimeout(int fd, epoll_event& event)
+int Server::handleTimeouts()
 {
-    for (const std::pair<int, int> timer : client_timers_)
+    uint64_t expirations;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
     {
-        if (timer.second == fd)
-        {
-            int client_fd = timer.first;
+        LOG_ERROR("Timeout read failed");
+        return -2;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    while (!client_timers_.empty() && client_timers_.front().deadline <= now)
+    {
+        s_client_timer timer = client_timers_.front();
+        client_timers_.pop_front();
+        timeoutClient(timer);
+    }
+    armTimer();
+    return 0;
+}
 
-            uint64_t expirations;
-            ssize_t bytes_read = read(fd, &expirations, sizeof(expirations));
-            if (bytes_read < 0)
-            {
-                std::cerr << "Timeout read failed\n";
-                return -2;
-            }
-            std::vector<configInfo>::iterator it = config_info_.begin();
-            std::vector<configInfo>::iterator ite = config_info_.end();
-            while (it != ite)
-            {
-                if (it->requestHandler_.getRequest(fd) != nullptr)
-                    break;
-                ++it;
-            }
-            if (it == ite)
-                return -1;
-            int nr = it->responseHandler_.setupResponse(client_fd, 408, *(it->requestHandler_.getRequest(fd)));
-            std::cout << "client timeout for " << client_fd << " reached\n";
-            doEpollCtl(EPOLL_CTL_DEL, client_fd, &event);
-            doEpollCtl(EPOLL_CTL_DEL, fd, nullptr);
-            close(client_fd);
-            close(fd);
-            client_timers_.erase(client_fd);
-            it->requestHandler_.removeNodeFromRequest(client_fd);
-            if (nr == SRH_OK)
-                return 0;
-            return nr;
-        }
+/**
+ * @brief sends the client whose timer ran out a 408 and closes it.
+ * The timer of a client that is gone, or whose fd belongs to a newer client by now, is skipped
+ * 
+ * @param timer the deadline that passed
+ * @return 0 when timeout response is send or the client was gone,
+ * @return the error of the response otherwise
+ */
+int Server::timeoutClient(const s_client_timer& timer)
+{
+    int client_fd = timer.client_fd;
+    std::list<configInfo>::iterator it = config_info_.begin();
+    std::list<configInfo>::iterator ite = config_info_.end();
+    while (it != ite)
+    {
+        if (it->requestHandler_.getRequest(client_fd) != nullptr)
+            break;
+        ++it;
+    }
+    if (it == ite)
+        return 0;
+    s_client_data& data = *(it->requestHandler_.getRequest(client_fd));
+    if (data.timer_stopped || data.deadline != timer.deadline)
+        return 0;
+    if (data.hasOutput()) // the response is out already, the client stopped taking it
+    {
+        LOG_INFO("send timeout for " << client_fd << " reached");
+        closeClient(client_fd, *it);
+        return 0;
+    }
+    if (it->responseHandler_.hasCGI(client_fd))
+    {
+        // answers and closes every client waiting for the same script
+        it->responseHandler_.timeoutCGI(client_fd);
+        LOG_INFO("CGI timeout for " << client_fd << " reached");
+        applyCGIUpdate(*it);
+        return 0;
     }
-    return 1;
+    int nr = it->responseHandler_.setupResponse(client_fd, 408, data);
+    LOG_INFO("client timeout for " << client_fd << " reached");
+    finishClient(client_fd, *it);
+    if (nr == SRH_OK)
+        return 0;
+    return nr;
 }
 
 /**
@@ -568,62 +778,40 @@ int Server::checkForTimeout(int fd, epoll_event& event)
  */
 int Server::handleReadEvents(int fd, epoll_event& event)
 {
-    std::string request_buffer;
-    int timer_fd = -1;
-    std::vector<configInfo>::iterator it = config_info_.begin();
-    std::vector<configInfo>::iterator ite = config_info_.end();
-    if (fd != stdout_pipe_[0] && fd != stderr_pipe_[0])
+    std::list<configInfo>::iterator it = config_info_.begin();
+    std::list<configInfo>::iterator ite = config_info_.end();
+    while (it != ite)
     {
-        while (it != ite)
-        {
-            if (it->requestHandler_.getRequest(fd) != nullptr)
-                break;
-            ++it;
-        }
-        if (it == ite)
-            return -1;
+        if (it->requestHandler_.getRequest(fd) != nullptr)
+            break;
+        ++it;
     }
-    e_reponses function_response = it->requestHandler_.readRequest(fd, request_buffer);
+    if (it == ite)
+        return -1;
+    e_reponses function_response = it->requestHandler_.readRequest(fd);
+    it->requestHandler_.getRequest(fd)->accountMemory(); // the buffers of the client grew
+    if (function_response == READ_INCOMPLETE) // rest of the request arrives with a later event
+        return 0;
     if (function_response != E_ROK)
     {
-        request_buffer.clear();
         if (function_response == READ_HEADER_BODY_TOO_LARGE)
         {
-            timer_fd = client_timers_.at(fd);
             int return_value = it->responseHandler_.setupResponse(fd, 413, *(it->requestHandler_.getRequest(fd)));
-            doEpollCtl(EPOLL_CTL_DEL, timer_fd, nullptr);
-            doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-            it->requestHandler_.removeNodeFromRequest(fd);
-            client_timers_.erase(fd);
-            close(fd);
-            close(timer_fd);
+            finishClient(fd, *it);
             return return_value;
         }
-        else if (function_response == HANDLE_COUT_CERR_OUTPUT)
-        {
-            it->responseHandler_.handleCoutErrOutput(fd);
-            return 0;
-        }
-        std::cerr << "function_response is [" << function_response << "]\n";
-        timer_fd = client_timers_.at(fd);
+        LOG_INFO("function_response is [" << function_response << "]");
         it->responseHandler_.setupResponse(fd, 400, *(it->requestHandler_.getRequest(fd)));
-        doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-        doEpollCtl(EPOLL_CTL_DEL, timer_fd, nullptr);
-        it->requestHandler_.removeNodeFromRequest(fd);
-        client_timers_.erase(timer_fd);
-        close(fd);
-        close(timer_fd);
+        finishClient(fd, *it);
         return -1;
     }
-    function_response = it->requestHandler_.handleClient(request_buffer, event);
+    function_response = it->requestHandler_.handleClient(it->requestHandler_.getRequest(fd)->request_buffer, event);
     if (function_response == MODIFY_CLIENT_WRITE)
     {
         if (doEpollCtl(EPOLL_CTL_MOD, fd, &event) != 0)
         {
-            std::cerr << "modify client in main loop failed\n";
-            it->requestHandler_.removeNodeFromRequest(fd);
-            doEpollCtl(EPOLL_CTL_DEL, fd, &event);
-            close(fd);
+            LOG_ERROR("modify client in main loop failed");
+            closeClient(fd, *it);
             return -1;
         }
         return 0;
@@ -631,11 +819,902 @@ int Server::handleReadEvents(int fd, epoll_event& event)
     return -2;
 }
 
-configInfo::configInfo(std::shared_ptr<Config>& conf) : requestHandler_(conf.get()->getClientMaxBodySize()), responseHandler_(conf.get()->getLocations(),conf.get()->getRoot(),conf.get()->getErrorPages()), config_(conf)
+/**
+ * @brief makes the changes to the epoll the CGI work of a server asks for.
+ * Descriptors of scripts are added and removed, clients waiting for a script
+ * get no events until it is done (only errors and hang ups), and clients
+ * that got their response are closed. The timer of a queued client is stopped,
+ * a client whose script started gets a new deadline
+ * 
+ * @param config the server that did the CGI work
+ */
+void Server::applyCGIUpdate(configInfo& config)
+{
+    s_cgi_update update;
+    while (config.responseHandler_.takeCGIUpdate(update))
+    {
+        // closing a descriptor already removed it from the epoll, its number can be reused below
+        for (int fd : update.closed)
+            cgi_fds_.erase(fd);
+        for (epoll_event& cgi_event : update.added)
+        {
+            if (doEpollCtl(EPOLL_CTL_ADD, cgi_event.data.fd, &cgi_event) != 0)
+            {
+                LOG_ERROR("adding CGI fd to epoll failed");
+                continue;
+            }
+            cgi_fds_[cgi_event.data.fd] = &config;
+        }
+        for (int client_fd : update.waiting)
+        {
+            epoll_event client_event{};
+            client_event.data.fd = client_fd;
+            doEpollCtl(EPOLL_CTL_MOD, client_fd, &client_event);
+            s_client_data* data = config.requestHandler_.getRequest(client_fd);
+            if (data == nullptr)
+                continue;
+            // a queued request times out with the queue, its script gets the full time once it starts
+            if (config.responseHandler_.hasCGI(client_fd))
+                extendTimer(client_fd, *data);
+            else
+                stopTimer(*data);
+        }
+        for (std::pair<int, e_server_request_return>& answered : update.answered)
+            finishClient(answered.first, config);
+    }
+}
+
+/**
+ * @brief handles an event on one of the descriptors of a running script.
+ * When the script is done its response is send to the clients waiting for it
+ * 
+ * @param fd the descriptor of the script
+ * @return 0 when done
+ */
+int Server::handleCGIEvent(int fd)
+{
+    configInfo& config = *cgi_fds_.at(fd);
+    config.responseHandler_.handleCGIEvent(fd);
+    applyCGIUpdate(config);
+    return 0;
+}
+
+/**
+ * @brief starts the queued CGI requests that got a free slot, closes the ones
+ * that were answered with a 503 because they waited too long and stops cache refreshes that hang
+ * 
+ * @param config the server to check
+ */
+void Server::updateCGI(configInfo& config)
+{
+    config.responseHandler_.updateCGI();
+    applyCGIUpdate(config);
+}
+
+/**
+ * @brief answers the clients whose proxied request is done and closes them once they have it
+ */
+void Server::finishProxy()
+{
+    std::vector<std::pair<int, uint16_t>> finished;
+    while (proxy_.takeFinished(finished))
+    {
+        for (std::pair<int, uint16_t>& done : finished)
+        {
+            std::list<configInfo>::iterator it = config_info_.begin();
+            while (it != config_info_.end() && it->requestHandler_.getRequest(done.first) == nullptr)
+                ++it;
+            if (it == config_info_.end())
+                continue;
+            if (done.second != 0)
+                it->responseHandler_.setupResponse(done.first, done.second, *(it->requestHandler_.getRequest(done.first)));
+            finishClient(done.first, *it);
+        }
+    }
+}
+
+/**
+ * @brief blocks the signals the server handles and makes a signalfd for them,
+ * so they arrive as events in the loop instead of interrupting it in a handler
+ * 
+ * @return 0 when done,
+ * @return -1 on error
+ */
+int Server::setupSignals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGQUIT);
+    if (!worker_)
+        sigaddset(&signals, SIGCHLD); // a master watches its workers, a single process the new binary of an upgrade
+    if (worker_)
+        sigaddset(&signals, SIGWINCH); // the master replaces its workers
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0)
+    {
+        std::cerr << "blocking signals failed\n";
+        return -1;
+    }
+    signal_fd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd_ == -1)
+    {
+        std::cerr << "signalfd failed\n";
+        return -1;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = signal_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &event) == -1)
+    {
+        std::cerr << "adding signalfd to epoll failed\n";
+        close(signal_fd_);
+        signal_fd_ = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief handles the signals that arrived on the signalfd.
+ * SIGUSR1 reopens the log files, after logrotate moved them,
+ * SIGHUP reloads the config, SIGUSR2 upgrades the binary,
+ * SIGTERM and SIGQUIT shut down after the open requests, a second one right away,
+ * SIGWINCH stops a worker the master replaces, SIGCHLD reaps the new binary of an upgrade
+ * 
+ * @return 0 when done
+ */
+int Server::handleSignal()
+{
+    signalfd_siginfo info;
+    while (read(signal_fd_, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo == SIGCHLD)
+            reapUpgrade();
+        else if (info.ssi_signo == SIGUSR1)
+        {
+            LOG_INFO("reopening log files");
+            Logger::instance().reopen();
+        }
+        else if (info.ssi_signo == SIGHUP && !draining_)
+            reload();
+        else if (info.ssi_signo == SIGUSR2 && !draining_)
+            upgrade();
+        else if ((info.ssi_signo == SIGTERM || info.ssi_signo == SIGQUIT) && !draining_)
+            startDrain("shutdown", true);
+        else if (info.ssi_signo == SIGWINCH && !draining_)
+            startDrain("handover", false);
+        else if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGQUIT)
+        {
+            LOG_WARN("second " << strsignal(info.ssi_signo) << ", closing the clients that are left");
+            drain_deadline_ = std::chrono::steady_clock::now();
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief loads the config file again and moves the servers over to it.
+ * A server whose address did not change hands its listening socket to the
+ * server of the new config, new addresses get a socket and addresses that
+ * are gone stop listening. The servers of the old config are retired, they
+ * finish their clients and scripts with the config those started with and
+ * are freed by reapServers. Nothing changes when the file does not load or a
+ * socket or log can not be opened, the old config keeps running.
+ * A master only moves the listening sockets, its new workers open the servers
+ * 
+ * @return 0 when reloaded,
+ * @return -1 when the old config stays, the reason is logged
+ */
+int Server::reload()
+{
+    std::vector<std::shared_ptr<Config>> configs;
+    try
+    {
+        configs = ConfigLoader::load(config_path_);
+    }
+    catch (const std::exception& e)
+    {
+        LOG_ERROR("reload failed, the running config stays: " << e.what());
+        return -1;
+    }
+    size_t workers = workerProcesses(configs, cpus_.size());
+    if ((workers == 0) != (worker_processes_ == 0))
+    {
+        LOG_ERROR("reload failed, worker_processes can only be turned on or off by an upgrade");
+        return -1;
+    }
+
+    std::list<configInfo> fresh;
+    std::vector<int> opened; // sockets of new addresses, closed again when the reload fails
+    bool failed = false;
+    for (std::shared_ptr<Config>& conf : configs)
+    {
+        fresh.emplace_back(conf);
+        configInfo& con = fresh.back();
+        for (configInfo& old : config_info_)
+        {
+            if (!old.retired_ && old.server_name_ == con.server_name_ && old.port_ == con.port_)
+                con.server_fd_ = old.server_fd_;
+        }
+        for (configInfo& other : fresh)
+        {
+            if (&other != &con && con.server_fd_ != -1 && other.server_fd_ == con.server_fd_)
+                con.server_fd_ = -1; // a second server on the address, its bind fails like at startup
+        }
+        if (con.server_fd_ == -1)
+        {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            if (createServerSocket(con.server_name_, con.port_, con.server_fd_) != 0)
+            {
+                LOG_ERROR("reload failed, can not listen on " << con.server_name_ << ":" << con.port_);
+                failed = true;
+                break;
+            }
+            opened.push_back(con.server_fd_);
+            event.data.fd = con.server_fd_;
+            if (worker_processes_ == 0 && doEpollCtl(EPOLL_CTL_ADD, con.server_fd_, &event) != 0)
+            {
+                failed = true;
+                break;
+            }
+        }
+        if (worker_processes_ == 0 && openServer(con) != 0)
+        {
+            failed = true;
+            break;
+        }
+    }
+    if (failed)
+    {
+        for (configInfo& con : fresh)
+            ServerMetrics::unregisterServer(*con.config_);
+        for (int fd : opened)
+            close(fd);
+        return -1;
+    }
+
+    for (configInfo& old : config_info_)
+    {
+        if (old.retired_)
+            continue;
+        bool kept = false;
+        for (configInfo& con : fresh)
+            kept = kept || con.server_fd_ == old.server_fd_;
+        if (!kept)
+        {
+            if (worker_processes_ == 0)
+                doEpollCtl(EPOLL_CTL_DEL, old.server_fd_, nullptr);
+            close(old.server_fd_);
+            LOG_INFO("stopped listening on " << old.server_name_ << ":" << old.port_);
+        }
+        old.server_fd_ = -1;
+        old.retired_ = true;
+    }
+    for (configInfo& con : fresh)
+    {
+        if (!con.config_->getErrorLogPath().empty())
+        {
+            // the error log stays where it is, only its level follows the config
+            Logger::instance().setErrorLog(con.config_->getErrorLogPath(), con.config_->getErrorLogLevel());
+            break;
+        }
+    }
+    config_info_.splice(config_info_.end(), fresh);
+    if (worker_processes_ != 0)
+        worker_processes_ = workers;
+    LOG_INFO("reloaded " << configs.size() << " servers, " << opened.size() << " new listening sockets");
+    return 0;
+}
+
+/**
+ * @brief frees the servers a reload retired once their last client is closed
+ * and no script of theirs runs anymore
+ */
+void Server::reapServers()
+{
+    std::list<configInfo>::iterator it = config_info_.begin();
+    while (it != config_info_.end())
+    {
+        if (!it->retired_ || it->requestHandler_.clientCount() != 0 || it->responseHandler_.hasCGIJobs())
+        {
+            ++it;
+            continue;
+        }
+        ServerMetrics::unregisterServer(*it->config_);
+        for (const std::shared_ptr<Location>& location : it->config_->getLocations())
+        {
+            if (location->hasProxy())
+                proxy_.removeUpstream(location->getProxyConfig().upstream.get());
+        }
+        LOG_INFO("retired server " << it->server_name_ << ":" << it->port_ << " drained");
+        it = config_info_.erase(it);
+    }
+}
+
+/**
+ * @brief starts the binary on disk again with the listening sockets, for a deploy
+ * without refused connections. The new binary gets the sockets and a pipe in its
+ * environment and writes to the pipe once it accepts, then this one stops accepting
+ * and drains its clients. When the new binary exits before that, nothing changes
+ * 
+ * @return 0, a failed upgrade is only logged
+ */
+int Server::upgrade()
+{
+    if (upgrade_fd_ != -1)
+    {
+        LOG_WARN("upgrade already running, new binary is " << upgrade_pid_);
+        return 0;
+    }
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) == -1)
+    {
+        LOG_ERROR("upgrade failed, no ready pipe");
+        return validator_.checkErrno(errno);
+    }
+
+    // The sockets and the write end of the pipe are the only descriptors the new binary gets
+    std::string sockets;
+    for (configInfo& con : config_info_)
+    {
+        if (con.retired_)
+            continue;
+        sockets += con.server_name_ + ":" + std::to_string(con.port_) + "=" + std::to_string(con.server_fd_) + ";";
+        fcntl(con.server_fd_, F_SETFD, 0);
+    }
+    fcntl(ready[1], F_SETFD, 0);
+    std::vector<std::string> variables;
+    for (char** variable = environ; *variable != nullptr; ++variable)
+    {
+        std::string entry(*variable);
+        if (entry.compare(0, sizeof(UPGRADE_LISTEN_ENV), UPGRADE_LISTEN_ENV "=") != 0 && entry.compare(0, sizeof(UPGRADE_READY_ENV), UPGRADE_READY_ENV "=") != 0)
+            variables.push_back(entry);
+    }
+    variables.push_back(UPGRADE_LISTEN_ENV "=" + sockets);
+    variables.push_back(UPGRADE_READY_ENV "=" + std::to_string(ready[1]));
+    std::vector<char*> envp;
+    for (std::string& variable : variables)
+        envp.push_back(&variable[0]);
+    envp.push_back(nullptr);
+
+    // Like a CGI script the binary should not start with the blocked signals of the loop
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    // searched in PATH like the shell did when the server was started by name,
+    // /proc/self/exe would start the replaced binary again
+    int err = posix_spawnp(&upgrade_pid_, argv_[0], nullptr, &attr, argv_, envp.data());
+    posix_spawnattr_destroy(&attr);
+
+    for (configInfo& con : config_info_)
+    {
+        if (!con.retired_)
+            fcntl(con.server_fd_, F_SETFD, FD_CLOEXEC);
+    }
+    close(ready[1]);
+    if (err != 0)
+    {
+        LOG_ERROR("upgrade failed, can not start " << argv_[0] << ": " << strerror(err));
+        close(ready[0]);
+        upgrade_pid_ = -1;
+        return 0;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = ready[0];
+    if (doEpollCtl(EPOLL_CTL_ADD, ready[0], &event) != 0)
+    {
+        close(ready[0]);
+        return 0;
+    }
+    upgrade_fd_ = ready[0];
+    LOG_INFO("upgrade started, new binary is " << upgrade_pid_);
+    return 0;
+}
+
+/**
+ * @brief reaps the new binary of an upgrade when it exits after it took over,
+ * the exits of scripts are left to their handlers. Before it is ready handleUpgrade reaps it
+ */
+void Server::reapUpgrade()
+{
+    if (upgrade_pid_ == -1 || upgrade_fd_ != -1)
+        return;
+    int status;
+    if (waitpid(upgrade_pid_, &status, WNOHANG) != upgrade_pid_)
+        return;
+    if (WIFSIGNALED(status))
+        LOG_WARN("new binary " << upgrade_pid_ << " was killed by " << strsignal(WTERMSIG(status)));
+    else
+        LOG_WARN("new binary " << upgrade_pid_ << " exited with " << WEXITSTATUS(status));
+    upgrade_pid_ = -1;
+}
+
+/**
+ * @brief the new binary wrote to the ready pipe or exited. When it is ready
+ * this one stops accepting and drains, otherwise it keeps serving
+ * 
+ * @return 0 when done
+ */
+int Server::handleUpgrade()
+{
+    char ready = 0;
+    ssize_t nr = read(upgrade_fd_, &ready, 1);
+    doEpollCtl(EPOLL_CTL_DEL, upgrade_fd_, nullptr);
+    close(upgrade_fd_);
+    upgrade_fd_ = -1;
+    if (nr != 1)
+    {
+        LOG_ERROR("upgrade failed, new binary " << upgrade_pid_ << " exited before it accepted");
+        // the pipe only closes without a write when the binary exits, this does not wait long.
+        // A master may have reaped it with its workers already
+        waitpid(upgrade_pid_, nullptr, 0);
+        upgrade_pid_ = -1;
+        return 0;
+    }
+    LOG_INFO("new binary " << upgrade_pid_ << " accepts");
+    if (worker_processes_ != 0)
+    {
+        // the workers drain their clients, the master is done when they are
+        stopListening();
+        stopWorkers(SIGWINCH, workers_.size());
+        return 0;
+    }
+    startDrain("upgrade", false);
+    return 0;
+}
+
+/**
+ * @brief tells the binary that started this one by an upgrade that it accepts now
+ */
+void Server::notifyUpgrade()
+{
+    const char* value = getenv(UPGRADE_READY_ENV);
+    if (value == nullptr)
+        return;
+    int fd = std::atoi(value);
+    unsetenv(UPGRADE_READY_ENV);
+    if (write(fd, "1", 1) != 1)
+        LOG_ERROR("telling the old binary the upgrade is done failed");
+    close(fd);
+}
+
+/**
+ * @brief stops accepting and gives the clients that are open until the
+ * longest shutdown_timeout of the servers to finish
+ *
+ * @param reason what the summary at the end calls the drain
+ * @param close_idle closes the connections that did not send anything yet,
+ * a shutdown does, an upgrade leaves them to the old binary to answer
+ */
+void Server::startDrain(const char* reason, bool close_idle)
+{
+    drain_ = s_drain_summary();
+    drain_.reason = reason;
+    drain_.started = std::chrono::steady_clock::now();
+    uint64_t timeout = 0;
+    for (configInfo& con : config_info_)
+    {
+        timeout = std::max(timeout, con.config_->getShutdownTimeout());
+        if (close_idle)
+        {
+            for (int client_fd : con.requestHandler_.getClients())
+            {
+                s_client_data* data = con.requestHandler_.getRequest(client_fd);
+                if (data != nullptr && data->state == CLIENT_WAITING && data->bytes_received == 0)
+                {
+                    closeClient(client_fd, con);
+                    ++drain_.idle;
+                }
+            }
+        }
+        drain_.active += con.requestHandler_.clientCount();
+    }
+    drain_.scripts = ServerStats::snapshot()[STAT_CGI_RUNNING];
+    LOG_INFO(reason << ": stopped accepting, " << drain_.active << " requests and " << drain_.scripts
+        << " scripts left to finish in " << timeout << "s, " << drain_.idle << " idle connections closed");
+    stopListening();
+    drain_deadline_ = drain_.started + std::chrono::seconds(timeout);
+}
+
+/**
+ * @brief closes the listening sockets, the servers are retired and freed by
+ * reapServers once their clients are gone, when all are gone the loop ends
+ */
+void Server::stopListening()
+{
+    for (configInfo& con : config_info_)
+    {
+        if (con.retired_)
+            continue;
+        if (worker_processes_ == 0)
+            doEpollCtl(EPOLL_CTL_DEL, con.server_fd_, nullptr);
+        close(con.server_fd_);
+        con.server_fd_ = -1;
+        con.retired_ = true;
+    }
+    draining_ = true;
+}
+
+/**
+ * @brief closes every client that is still open, when draining takes too long
+ *
+ * @return the clients closed
+ */
+size_t Server::closeClients()
+{
+    size_t closed = 0;
+    for (configInfo& con : config_info_)
+    {
+        for (int client_fd : con.requestHandler_.getClients())
+        {
+            closeClient(client_fd, con);
+            ++closed;
+        }
+    }
+    return closed;
+}
+
+/**
+ * @brief writes what the drain did to the standard log, whatever the log level
+ */
+void Server::logDrainSummary() const
+{
+    double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - drain_.started).count();
+    std::ostringstream summary;
+    summary << drain_.reason << " done in " << took << "s: " << drain_.idle << " idle connections closed, "
+        << drain_.active - drain_.forced << " of " << drain_.active << " requests finished, "
+        << drain_.scripts << " scripts were running, " << drain_.forced << " closed at the timeout";
+    // Logged whatever the level of the error log, like the slow request log
+    Logger::instance().log(LOG_LEVEL_WARN, summary.str());
+}
+
+/**
+ * @return milliseconds until the drain deadline, -1 when not draining
+ */
+int Server::getDrainTimeout() const
+{
+    if (!draining_)
+        return -1;
+    int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(drain_deadline_ - std::chrono::steady_clock::now()).count();
+    return left < 0 ? 0 : static_cast<int>(left);
+}
+
+/**
+ * @brief runs the master of worker_processes. It forks the workers, starts
+ * the ones that die again and handles the signals for all of them. The
+ * workers serve the clients on the listening sockets they inherit, each on
+ * a CPU of its own, so a crash only takes the clients of one worker along
+ * 
+ * @return 0 when the last worker stopped
+ */
+int Server::masterLoop()
+{
+    startWorkers();
+    // once the workers run, an old binary that started this one can stop
+    notifyUpgrade();
+    LOG_INFO("master " << getpid() << " started " << workers_.size() << " workers");
+    epoll_event events[MAX_EVENTS];
+    while (!draining_ || !workers_.empty())
+    {
+        int event_count = epoll_wait(epoll_fd_, events, MAX_EVENTS, getRespawnTimeout());
+        for (int i = 0; i < event_count; ++i)
+        {
+            if (events[i].data.fd == signal_fd_)
+                handleMasterSignal();
+            else if (events[i].data.fd == upgrade_fd_)
+                handleUpgrade();
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (s_worker& worker : workers_)
+        {
+            if (worker.pid == -1 && now >= worker.started)
+                spawnWorker(worker);
+        }
+    }
+    Logger::instance().log(LOG_LEVEL_WARN, "master stopped, workers were started again " + std::to_string(respawned_) + " times after they died");
+    close(epoll_fd_);
+    for (configInfo& con : config_info_)
+        close(con.server_fd_);
+    return 0;
+}
+
+/**
+ * @brief handles the signals that arrived on the signalfd of a master.
+ * SIGCHLD reaps the workers, SIGHUP reloads the config and replaces the
+ * workers, SIGUSR2 upgrades the binary, SIGUSR1, SIGTERM and SIGQUIT are
+ * passed on to the workers
+ * 
+ * @return 0 when done
+ */
+int Server::handleMasterSignal()
+{
+    signalfd_siginfo info;
+    while (read(signal_fd_, &info, sizeof(info)) == sizeof(info))
+    {
+        int signal = static_cast<int>(info.ssi_signo);
+        if (signal == SIGCHLD)
+            reapWorkers();
+        else if (signal == SIGUSR1)
+        {
+            LOG_INFO("reopening log files");
+            Logger::instance().reopen();
+            for (s_worker& worker : workers_)
+            {
+                if (worker.pid != -1)
+                    kill(worker.pid, SIGUSR1);
+            }
+        }
+        else if (signal == SIGHUP && !draining_)
+        {
+            size_t old = workers_.size();
+            if (reload() != 0)
+                continue;
+            reapServers(); // the master has no clients, the old servers go right away
+            // the new workers accept next to the old ones, which then finish their clients
+            startWorkers();
+            stopWorkers(SIGWINCH, old);
+        }
+        else if (signal == SIGUSR2 && !draining_)
+            upgrade();
+        else if (signal == SIGTERM || signal == SIGQUIT)
+        {
+            if (!draining_)
+            {
+                LOG_INFO("shutdown: stopping " << workers_.size() << " workers");
+                stopListening();
+            }
+            // a second one reaches the workers as well and closes their clients right away
+            stopWorkers(signal, workers_.size());
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief adds worker_processes workers for the current config, pinned to the CPUs in turn
+ */
+void Server::startWorkers()
+{
+    for (size_t i = 0; i < worker_processes_; ++i)
+    {
+        s_worker worker;
+        if (!cpus_.empty())
+            worker.cpu = cpus_[i % cpus_.size()];
+        workers_.push_back(worker);
+        spawnWorker(workers_.back());
+    }
+}
+
+/**
+ * @brief forks a worker, when that fails it is tried again after WORKER_RESPAWN_MS
+ * 
+ * @param worker the worker, its pid is set
+ * @return 0 when done,
+ * @return -1 if fork fails
+ */
+int Server::spawnWorker(s_worker& worker)
+{
+    pid_t master = getpid();
+    // Only the forking thread lives on in the child, the flusher has to be stopped
+    // around the fork so no record or lock of it is half copied
+    Logger::instance().stop();
+    pid_t pid = fork();
+    if (pid == 0)
+        runWorker(worker.cpu, master);
+    Logger::instance().start();
+    worker.started = std::chrono::steady_clock::now();
+    if (pid == -1)
+    {
+        LOG_ERROR("fork of a worker failed: " << strerror(errno));
+        worker.started += std::chrono::milliseconds(WORKER_RESPAWN_MS);
+        return -1;
+    }
+    worker.pid = pid;
+    LOG_INFO("started worker " << pid << " on CPU " << worker.cpu);
+    return 0;
+}
+
+/**
+ * @brief turns the forked child into a worker that serves like a server
+ * without workers, it exits with the result of its loop
+ * 
+ * @param cpu the CPU to pin the worker to, -1 for any
+ * @param master the process that forked it
+ */
+void Server::runWorker(int cpu, pid_t master)
+{
+    // A worker does not outlive its master, it drains like on a shutdown
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master)
+        std::exit(0);
+    close(epoll_fd_);
+    close(signal_fd_);
+    close(timer_fd_);
+    if (upgrade_fd_ != -1)
+        close(upgrade_fd_);
+    upgrade_fd_ = -1;
+    upgrade_pid_ = -1;
+    // the master tells an old binary when the upgrade is done
+    const char* ready = getenv(UPGRADE_READY_ENV);
+    if (ready != nullptr)
+    {
+        close(std::atoi(ready));
+        unsetenv(UPGRADE_READY_ENV);
+    }
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+    if (cpu != -1)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1)
+            LOG_WARN("pinning worker " << getpid() << " to CPU " << cpu << " failed: " << strerror(errno));
+    }
+    worker_processes_ = 0;
+    workers_.clear();
+    worker_ = true;
+    int nr = setupEpoll();
+    if (nr == 0)
+        nr = serverLoop();
+    std::exit(-nr);
+}
+
+/**
+ * @brief reaps the workers that exited, the ones that were not told to stop
+ * are started again, after WORKER_RESPAWN_MS when they die right after their start
+ */
+void Server::reapWorkers()
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        std::vector<s_worker>::iterator worker = workers_.begin();
+        while (worker != workers_.end() && worker->pid != pid)
+            ++worker;
+        if (worker == workers_.end())
+            continue; // the new binary of a failed upgrade
+        if (worker->stopping)
+        {
+            LOG_INFO("worker " << pid << " stopped");
+            workers_.erase(worker);
+            continue;
+        }
+        if (WIFSIGNALED(status))
+            LOG_ERROR("worker " << pid << " on CPU " << worker->cpu << " was killed by " << strsignal(WTERMSIG(status)) << ", starting it again");
+        else
+            LOG_ERROR("worker " << pid << " on CPU " << worker->cpu << " exited with " << WEXITSTATUS(status) << ", starting it again");
+        worker->pid = -1;
+        worker->started = std::max(std::chrono::steady_clock::now(), worker->started + std::chrono::milliseconds(WORKER_RESPAWN_MS));
+        ++respawned_;
+    }
+}
+
+/**
+ * @brief sends a signal to the first workers and marks them as stopping,
+ * the ones that wait to be started again are dropped
+ * 
+ * @param signal SIGTERM or SIGQUIT for a shutdown, SIGWINCH for workers that are replaced
+ * @param count workers to stop, from the oldest
+ */
+void Server::stopWorkers(int signal, size_t count)
+{
+    std::vector<s_worker>::iterator worker = workers_.begin();
+    for (size_t i = 0; i < count && worker != workers_.end(); ++i)
+    {
+        if (worker->pid == -1)
+        {
+            worker = workers_.erase(worker);
+            continue;
+        }
+        kill(worker->pid, signal);
+        worker->stopping = true;
+        ++worker;
+    }
+}
+
+/**
+ * @return milliseconds until the next worker is started again, -1 when none waits
+ */
+int Server::getRespawnTimeout() const
+{
+    int timeout = -1;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (const s_worker& worker : workers_)
+    {
+        if (worker.pid != -1)
+            continue;
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(worker.started - now).count();
+        int wait = left < 0 ? 0 : static_cast<int>(left);
+        if (timeout == -1 || wait < timeout)
+            timeout = wait;
+    }
+    return timeout;
+}
+
+/**
+ * @brief stops the timer of the client, for requests that time out on their own
+ * 
+ * @param data the request data of the client
+ */
+void Server::stopTimer(s_client_data& data)
+{
+    data.timer_stopped = true;
+}
+
+/**
+ * @brief removes the client from the epoll and closes it together with
+ * whatever script was still running for it, the request goes to the access log.
+ * Its timer stays queued and is skipped when it runs out
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param config the server the client belongs to
+ */
+void Server::closeClient(int client_fd, configInfo& config)
+{
+    config.responseHandler_.removeCGI(client_fd);
+    proxy_.removeClient(client_fd);
+    doEpollCtl(EPOLL_CTL_DEL, client_fd, nullptr);
+    close(client_fd);
+    s_client_data* data = config.requestHandler_.getRequest(client_fd);
+    if (data != nullptr)
+    {
+        data->clearOutput();
+        uint64_t total_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - data->accepted_at).count();
+        RequestTrace::stamp(data->trace, TRACE_CLOSE);
+        config.access_log_.log(*data);
+        config.slow_log_.log(*data, total_us);
+        ServerMetrics::recordRequest(config.config_.get(), data->location, data->status, data->bytes_received, data->bytes_sent, total_us);
+        ServerStats::moveClient(data->state, CLIENT_CLOSED);
+        ServerStats::add(STAT_CLOSED);
+        RequestTrace::record(client_fd, *data);
+    }
+    config.requestHandler_.removeNodeFromRequest(client_fd);
+    applyCGIUpdate(config);
+}
+
+/**
+ * @brief closes a client that got its response. When the socket did not take
+ * all of it the client waits for EPOLLOUT instead and is closed once the rest is sent
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param config the server the client belongs to
+ */
+void Server::finishClient(int client_fd, configInfo& config)
+{
+    s_client_data* data = config.requestHandler_.getRequest(client_fd);
+    if (data == nullptr || !data->hasOutput())
+    {
+        closeClient(client_fd, config);
+        return;
+    }
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.fd = client_fd;
+    if (doEpollCtl(EPOLL_CTL_MOD, client_fd, &event) != 0)
+    {
+        LOG_ERROR("modify client for the rest of its response failed");
+        closeClient(client_fd, config);
+        return;
+    }
+    extendTimer(client_fd, *data);
+}
+
+configInfo::configInfo(std::shared_ptr<Config>& conf) : requestHandler_(conf.get()->getClientMaxBodySize()), responseHandler_(conf.get()->getRoot(),conf.get()->getErrorPages()), config_(conf), routes_(conf)
 {
     std::string root_folder_ = conf.get()->getRoot();
     std::string main_index_ = conf.get()->getIndex();
-    locations_ = conf.get()->getLocations();
     error_pages_ = conf.get()->getErrorPages();
     server_fd_ = -1;
     server_name_ = conf.get()->getServerName();
@@ -0,0 +1,312 @@
+#include "server/ServerMetrics.hpp"
+#include "server/ServerStats.hpp"
+#include "Config.hpp"
+#include "config/Location.hpp"
+#include <cstdio>
+#include <sstream>
+
+/**
+ * @brief adds to a counter only the calling thread writes to, no locked instruction needed
+ */
+static void bump(std::atomic<uint64_t>& value, uint64_t amount)
+{
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/**
+ * @return the bucket of a value, bucket i holds the values up to bucketBound(i)
+ */
+static size_t bucketIndex(uint64_t value_us)
+{
+    if (value_us <= (1ULL << METRICS_MIN_SHIFT))
+        return 0;
+    uint64_t below = value_us - 1;
+    int msb = 63 - __builtin_clzll(below);
+    if (msb >= METRICS_MIN_SHIFT + METRICS_OCTAVES)
+        return METRICS_BUCKETS;
+    size_t half = (below >> (msb - 1)) & 1;
+    return 1 + static_cast<size_t>(msb - METRICS_MIN_SHIFT) * 2 + half;
+}
+
+/**
+ * @return the upper bound of a bucket in microseconds
+ */
+static uint64_t bucketBound(size_t bucket)
+{
+    if (bucket == 0)
+        return 1ULL << METRICS_MIN_SHIFT;
+    int msb = METRICS_MIN_SHIFT + static_cast<int>((bucket - 1) / 2);
+    return (1ULL << msb) + ((bucket - 1) % 2 + 1) * (1ULL << (msb - 1));
+}
+
+/**
+ * @brief escapes a label value, regex locations can hold backslashes and quotes
+ */
+static std::string labelValue(const std::string& value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Merged values of a histogram
+struct s_histogram_sum
+{
+    std::array<uint64_t, METRICS_BUCKETS + 1> buckets{};
+    uint64_t count = 0;
+    uint64_t sum_us = 0;
+
+    void add(const s_histogram& histogram)
+    {
+        for (size_t i = 0; i <= METRICS_BUCKETS; ++i)
+            buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+        count += histogram.count.load(std::memory_order_relaxed);
+        sum_us += histogram.sum_us.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief writes the buckets, sum and count of a histogram in seconds
+ */
+static void writeHistogram(std::ostringstream& out, const std::string& name, const std::string& labels, const s_histogram_sum& histogram)
+{
+    std::string separator = labels.empty() ? "" : ",";
+    uint64_t cumulative = 0;
+    char bound[32];
+    for (size_t i = 0; i < METRICS_BUCKETS; ++i)
+    {
+        cumulative += histogram.buckets[i];
+        std::snprintf(bound, sizeof(bound), "%g", bucketBound(i) / 1e6);
+        out << name << "_bucket{" << labels << separator << "le=\"" << bound << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << histogram.count << "\n";
+    std::snprintf(bound, sizeof(bound), "%.6f", histogram.sum_us / 1e6);
+    out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << bound << "\n";
+    out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << histogram.count << "\n";
+}
+
+void ServerMetrics::registerServer(const Config& config)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    std::string server = config.getServerName() + ":" + std::to_string(config.getPort());
+    index()[&config] = seriesFor(server, "");
+    for (const std::shared_ptr<Location>& location : config.getLocations())
+        index()[location.get()] = seriesFor(server, location->getPath());
+}
+
+void ServerMetrics::unregisterServer(const Config& config)
+{
+    // A new config or location may get the address of this one, it must not find the old entry
+    std::lock_guard<std::mutex> lock(mutex());
+    index().erase(&config);
+    for (const std::shared_ptr<Location>& location : config.getLocations())
+        index().erase(location.get());
+}
+
+void ServerMetrics::recordRequest(const Config* config, const Location* location, uint16_t status, uint64_t bytes_in, uint64_t bytes_out, uint64_t duration_us)
+{
+    if (status < 100 || status > 599)
+        return;
+    // The index is only written by the loop thread, at the start and on a reload, reading it needs no lock
+    std::unordered_map<const void*, size_t>::const_iterator it = location ? index().find(location) : index().find(config);
+    s_metrics_slot& slot = local();
+    if (it == index().end())
+        return;
+    if (it->second >= slot.size) // registered by a reload after the slot was made
+        grow(slot);
+    s_metric_series& series = slot.series[it->second];
+    bump(series.status[status / 100 - 1], 1);
+    bump(series.bytes_in, bytes_in);
+    bump(series.bytes_out, bytes_out);
+    record(series.latency, duration_us);
+}
+
+void ServerMetrics::recordHistogram(e_metric_histogram histogram, uint64_t value_us)
+{
+    record(local().histograms[histogram], value_us);
+}
+
+std::string ServerMetrics::exposition()
+{
+    static const char* const classes[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    std::lock_guard<std::mutex> lock(mutex());
+    size_t count = series().size();
+    std::vector<std::array<uint64_t, 5>> status(count);
+    std::vector<uint64_t> bytes_in(count);
+    std::vector<uint64_t> bytes_out(count);
+    std::vector<s_histogram_sum> latency(count);
+    std::array<s_histogram_sum, HIST_COUNT> histograms;
+    for (const std::unique_ptr<s_metrics_slot>& slot : slots())
+    {
+        for (size_t i = 0; i < slot->size && i < count; ++i)
+        {
+            const s_metric_series& series = slot->series[i];
+            for (size_t c = 0; c < 5; ++c)
+                status[i][c] += series.status[c].load(std::memory_order_relaxed);
+            bytes_in[i] += series.bytes_in.load(std::memory_order_relaxed);
+            bytes_out[i] += series.bytes_out.load(std::memory_order_relaxed);
+            latency[i].add(series.latency);
+        }
+        for (size_t h = 0; h < HIST_COUNT; ++h)
+            histograms[h].add(slot->histograms[h]);
+    }
+
+    std::vector<std::string> labels(count);
+    for (size_t i = 0; i < count; ++i)
+        labels[i] = "server=\"" + labelValue(series()[i].server) + "\",location=\"" + labelValue(series()[i].location) + "\"";
+
+    std::ostringstream out;
+    out << "# HELP webserv_http_requests_total Requests answered, by server, location and status class.\n"
+        << "# TYPE webserv_http_requests_total counter\n";
+    for (size_t i = 0; i < count; ++i)
+        for (size_t c = 0; c < 5; ++c)
+            out << "webserv_http_requests_total{" << labels[i] << ",status=\"" << classes[c] << "\"} " << status[i][c] << "\n";
+    out << "# HELP webserv_http_received_bytes_total Bytes received from clients.\n"
+        << "# TYPE webserv_http_received_bytes_total counter\n";
+    for (size_t i = 0; i < count; ++i)
+        out << "webserv_http_received_bytes_total{" << labels[i] << "} " << bytes_in[i] << "\n";
+    out << "# HELP webserv_http_sent_bytes_total Bytes sent to clients.\n"
+        << "# TYPE webserv_http_sent_bytes_total counter\n";
+    for (size_t i = 0; i < count; ++i)
+        out << "webserv_http_sent_bytes_total{" << labels[i] << "} " << bytes_out[i] << "\n";
+    out << "# HELP webserv_http_request_duration_seconds Time from accept to close.\n"
+        << "# TYPE webserv_http_request_duration_seconds histogram\n";
+    for (size_t i = 0; i < count; ++i)
+        writeHistogram(out, "webserv_http_request_duration_seconds", labels[i], latency[i]);
+
+    out << "# HELP webserv_cgi_spawn_duration_seconds Time to start a CGI script.\n"
+        << "# TYPE webserv_cgi_spawn_duration_seconds histogram\n";
+    writeHistogram(out, "webserv_cgi_spawn_duration_seconds", "", histograms[HIST_CGI_SPAWN]);
+    out << "# HELP webserv_cgi_queue_wait_seconds Time a request waited for a free CGI slot.\n"
+        << "# TYPE webserv_cgi_queue_wait_seconds histogram\n";
+    writeHistogram(out, "webserv_cgi_queue_wait_seconds", "", histograms[HIST_CGI_QUEUE_WAIT]);
+
+    std::array<int64_t, STAT_COUNT> stats = ServerStats::snapshot();
+    int64_t active = stats[STAT_HANDLED] - stats[STAT_CLOSED];
+    out << "# HELP webserv_cgi_timeouts_total CGI scripts killed because they ran too long.\n"
+        << "# TYPE webserv_cgi_timeouts_total counter\n"
+        << "webserv_cgi_timeouts_total " << stats[STAT_CGI_TIMEOUTS] << "\n"
+        << "# HELP webserv_cgi_running CGI scripts in flight.\n"
+        << "# TYPE webserv_cgi_running gauge\n"
+        << "webserv_cgi_running " << stats[STAT_CGI_RUNNING] << "\n"
+        << "# HELP webserv_cgi_cache_lookups_total CGI cache lookups by result.\n"
+        << "# TYPE webserv_cgi_cache_lookups_total counter\n"
+        << "webserv_cgi_cache_lookups_total{result=\"hit\"} " << stats[STAT_CGI_CACHE_HITS] << "\n"
+        << "webserv_cgi_cache_lookups_total{result=\"stale\"} " << stats[STAT_CGI_CACHE_STALE] << "\n"
+        << "webserv_cgi_cache_lookups_total{result=\"miss\"} " << stats[STAT_CGI_CACHE_MISSES] << "\n"
+        << "webserv_cgi_cache_lookups_total{result=\"collapsed\"} " << stats[STAT_CGI_CACHE_COLLAPSED] << "\n"
+        << "# HELP webserv_connections_accepted_total Connections accepted.\n"
+        << "# TYPE webserv_connections_accepted_total counter\n"
+        << "webserv_connections_accepted_total " << stats[STAT_ACCEPTED] << "\n"
+        << "# HELP webserv_connections_handled_total Connections accepted and added to the event loop.\n"
+        << "# TYPE webserv_connections_handled_total counter\n"
+        << "webserv_connections_handled_total " << stats[STAT_HANDLED] << "\n"
+        << "# HELP webserv_connections Open client connections by state.\n"
+        << "# TYPE webserv_connections gauge\n"
+        << "webserv_connections{state=\"reading\"} " << stats[STAT_READING] << "\n"
+        << "webserv_connections{state=\"writing\"} " << stats[STAT_WRITING] << "\n"
+        << "webserv_connections{state=\"waiting\"} " << active - stats[STAT_READING] - stats[STAT_WRITING] << "\n"
+        << "# HELP webserv_connection_memory_bytes Memory held by open client connections, by part.\n"
+        << "# TYPE webserv_connection_memory_bytes gauge\n"
+        << "webserv_connection_memory_bytes{part=\"record\"} " << stats[STAT_MEMORY_CLIENTS] << "\n"
+        << "webserv_connection_memory_bytes{part=\"buffer\"} " << stats[STAT_MEMORY_BUFFERS] << "\n"
+        << "webserv_connection_memory_bytes{part=\"headers\"} " << stats[STAT_MEMORY_HEADERS] << "\n"
+        << "webserv_connection_memory_bytes{part=\"body\"} " << stats[STAT_MEMORY_BODIES] << "\n";
+    return out.str();
+}
+
+void ServerMetrics::record(s_histogram& histogram, uint64_t value_us)
+{
+    bump(histogram.buckets[bucketIndex(value_us)], 1);
+    bump(histogram.count, 1);
+    bump(histogram.sum_us, value_us);
+}
+
+s_metrics_slot& ServerMetrics::local()
+{
+    thread_local s_metrics_slot* slot = nullptr;
+    if (slot == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        std::unique_ptr<s_metrics_slot> created = std::make_unique<s_metrics_slot>();
+        created->size = series().size();
+        created->series = std::make_unique<s_metric_series[]>(created->size);
+        slots().push_back(std::move(created));
+        slot = slots().back().get();
+    }
+    return *slot;
+}
+
+/**
+ * @brief makes room in the slot of the calling thread for the series a reload added,
+ * under the lock so a scrape does not read the old array while it is swapped out
+ */
+void ServerMetrics::grow(s_metrics_slot& slot)
+{
+    std::lock_guard<std::mutex> lock(mutex());
+    size_t size = series().size();
+    std::unique_ptr<s_metric_series[]> grown = std::make_unique<s_metric_series[]>(size);
+    for (size_t i = 0; i < slot.size; ++i)
+    {
+        const s_metric_series& from = slot.series[i];
+        s_metric_series& to = grown[i];
+        for (size_t c = 0; c < 5; ++c)
+            to.status[c].store(from.status[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.bytes_in.store(from.bytes_in.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.bytes_out.store(from.bytes_out.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (size_t b = 0; b <= METRICS_BUCKETS; ++b)
+            to.latency.buckets[b].store(from.latency.buckets[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.latency.count.store(from.latency.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.latency.sum_us.store(from.latency.sum_us.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    slot.series = std::move(grown);
+    slot.size = size;
+}
+
+/**
+ * @return the series with these labels, made when there is none yet. The caller holds the lock
+ */
+size_t ServerMetrics::seriesFor(const std::string& server, const std::string& location)
+{
+    for (size_t i = 0; i < series().size(); ++i)
+    {
+        if (series()[i].server == server && series()[i].location == location)
+            return i;
+    }
+    series().push_back({server, location});
+    return series().size() - 1;
+}
+
+std::mutex& ServerMetrics::mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<s_metrics_slot>>& ServerMetrics::slots()
+{
+    static std::vector<std::unique_ptr<s_metrics_slot>> slots;
+    return slots;
+}
+
+std::vector<ServerMetrics::s_series_info>& ServerMetrics::series()
+{
+    static std::vector<s_series_info> series;
+    return series;
+}
+
+std::unordered_map<const void*, size_t>& ServerMetrics::index()
+{
+    static std::unordered_map<const void*, size_t> index;
+    return index;
+}
\ No newline at end of file
@@ -1,110 +1,361 @@
 #include "server/ServerRequestHandler.hpp"
+#include "log/Logger.hpp"
+#include "server/AllocProfile.hpp"
+#include <charconv>
 #include <functional>
+#include <new>
 #include <stdexcept>
-#include <iostream>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sstream>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 
 s_client_data::s_client_data(std::shared_ptr<Config>& conf) : config_(conf) {}
 
-s_client_data::s_client_data(const s_client_data& other) : config_(other.config_)
+/**
+ * @brief clears the record for the next client of its slot. The arena and
+ * the buffers keep their memory, unless a large request left them bigger
+ * than a slot should hold on to
+ *
+ * @param peer address of the new client
+ */
+void s_client_data::reset(std::string_view peer)
+{
+    arena.reset();
+    request_type = request_header = request_method = request_source = http_version = std::string_view();
+    if (request_buffer.capacity() > CLIENT_KEEP_BUFFER)
+        std::string().swap(request_buffer);
+    request_buffer.clear();
+    if (request_body.capacity() > CLIENT_KEEP_BUFFER)
+        std::string().swap(request_body);
+    request_body.clear();
+    body_start = std::string::npos;
+    parse_pos = 0;
+    content_length = 0;
+    chunked = false;
+    size_t length = peer.copy(address, sizeof(address) - 1);
+    address[length] = '\0';
+    client_address = std::string_view(address, length);
+    accepted_at = std::chrono::steady_clock::now();
+    header_at = {};
+    response_at = {};
+    status = 0;
+    bytes_sent = 0;
+    bytes_received = 0;
+    location = nullptr;
+    routes = nullptr;
+    state = CLIENT_WAITING;
+    trace = {};
+    eagains = 0;
+    cgi_wait_us = 0;
+    timer_stopped = false;
+    deadline = {};
+    clearOutput();
+    memory.fill(0);
+}
+
+/**
+ * @brief drops what was not sent of the response, its file is closed
+ */
+void s_client_data::clearOutput() const
+{
+    if (out.capacity() > CLIENT_KEEP_BUFFER)
+        std::string().swap(out);
+    out.clear();
+    out_offset = 0;
+    if (file_fd != -1)
+        close(file_fd);
+    file_fd = -1;
+    file_offset = 0;
+    file_left = 0;
+    file_chunked = false;
+}
+
+/**
+ * @brief bytes a string holds on the heap, none while it fits in the string itself
+ */
+static uint32_t heapBytes(const std::string& text)
+{
+    static const size_t inline_capacity = std::string().capacity();
+    return text.capacity() > inline_capacity ? static_cast<uint32_t>(text.capacity() + 1) : 0;
+}
+
+/**
+ * @brief counts what the client holds in the memory gauges: its slot in the slab,
+ * the raw bytes of the request, the arena of the request line and headers, and the body.
+ * Only the change since the last call goes into the gauges
+ */
+void s_client_data::accountMemory() const
 {
-    request_type = other.request_type;
-    request_header = other.request_header;
-    request_body = other.request_body;
-    request_method = other.request_method;
-    request_source = other.request_source;
-    chunked = other.chunked;
+    std::array<uint32_t, 4> now = {
+        static_cast<uint32_t>(sizeof(s_client_data)),
+        heapBytes(request_buffer),
+        static_cast<uint32_t>(arena.capacity()),
+        heapBytes(request_body)};
+    for (size_t part = 0; part < now.size(); ++part)
+        ServerStats::add(static_cast<e_stat_counter>(STAT_MEMORY_CLIENTS + part), static_cast<int64_t>(now[part]) - memory[part]);
+    memory = now;
+}
+
+/**
+ * @brief takes what the client held out of the memory gauges, before its record goes away
+ */
+void s_client_data::releaseMemory() const
+{
+    for (size_t part = 0; part < memory.size(); ++part)
+        ServerStats::add(static_cast<e_stat_counter>(STAT_MEMORY_CLIENTS + part), -static_cast<int64_t>(memory[part]));
+    memory.fill(0);
+}
+
+/**
+ * @return the bytes of the client as last counted
+ */
+size_t s_client_data::memoryUsage() const
+{
+    return static_cast<size_t>(memory[0]) + memory[1] + memory[2] + memory[3];
+}
+
+/**
+ * @brief counts bytes sent to the client, the first bytes of the response
+ * also give its start time and the status code of its status line
+ * 
+ * @param data what was handed to send(), nullptr for bytes of a file
+ * @param sent what send() returned
+ */
+void s_client_data::countSent(const char* data, ssize_t sent) const
+{
+    if (sent <= 0)
+        return;
+    if (bytes_sent == 0)
+    {
+        response_at = std::chrono::steady_clock::now();
+        RequestTrace::stamp(trace, TRACE_FIRST_WRITE);
+        // "HTTP/1.1 200 ..."
+        if (data != nullptr && sent >= 12 && std::strncmp(data, "HTTP/", 5) == 0)
+            status = static_cast<uint16_t>(std::atoi(data + 9));
+    }
+    bytes_sent += static_cast<uint64_t>(sent);
+}
+
+/**
+ * @brief reserves room for as many clients as the process may have descriptors,
+ * up to CLIENT_SLAB_MAX. The block is not touched, so only slots that get a
+ * client take memory
+ */
+ClientSlab::ClientSlab()
+{
+    rlimit limit{};
+    capacity_ = CLIENT_SLAB_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < capacity_)
+        capacity_ = static_cast<size_t>(limit.rlim_cur);
+    slots_.reset(new unsigned char[sizeof(s_client_data) * capacity_]);
+    state_.reset(new e_slot_state[capacity_]());
+}
+
+ClientSlab::ClientSlab(ClientSlab&& other)
+    : capacity_(other.capacity_), used_(other.used_), kept_(other.kept_), slots_(std::move(other.slots_)), state_(std::move(other.state_))
+{
+    other.capacity_ = 0;
+    other.used_ = 0;
+    other.kept_ = 0;
+}
+
+ClientSlab::~ClientSlab()
+{
+    for (size_t fd = 0; fd < capacity_; ++fd)
+    {
+        if (state_[fd] != SLOT_EMPTY)
+            slot(static_cast<int>(fd))->~s_client_data();
+    }
+}
+
+s_client_data* ClientSlab::acquire(int fd, std::shared_ptr<Config>& conf)
+{
+    if (fd < 0 || static_cast<size_t>(fd) >= capacity_ || state_[fd] == SLOT_USED)
+        return nullptr;
+    s_client_data* data = slot(fd);
+    if (state_[fd] == SLOT_FREE)
+        kept_ -= keptBytes(*data);
+    else
+        new (data) s_client_data(conf);
+    state_[fd] = SLOT_USED;
+    ++used_;
+    return data;
+}
+
+void ClientSlab::release(int fd)
+{
+    s_client_data* data = get(fd);
+    if (data == nullptr)
+        return;
+    --used_;
+    size_t bytes = keptBytes(*data);
+    if (kept_ + bytes > CLIENT_KEEP_TOTAL)
+    {
+        data->~s_client_data();
+        state_[fd] = SLOT_EMPTY;
+        return;
+    }
+    kept_ += bytes;
+    state_[fd] = SLOT_FREE;
+}
+
+/**
+ * @brief heap bytes a record keeps for the next client of its slot,
+ * its arena and the buffers of the request and the response
+ */
+size_t ClientSlab::keptBytes(const s_client_data& data)
+{
+    return data.arena.capacity() + heapBytes(data.request_buffer) + heapBytes(data.request_body) + heapBytes(data.out);
+}
+
+std::vector<int> ClientSlab::clients() const
+{
+    std::vector<int> fds;
+    fds.reserve(used_);
+    for (size_t fd = 0; fd < capacity_ && fds.size() < used_; ++fd)
+    {
+        if (state_[fd] == SLOT_USED)
+            fds.push_back(static_cast<int>(fd));
+    }
+    return fds;
 }
 
 ServerRequestHandler::ServerRequestHandler(uint64_t client_body_size) 
 {
     max_size_ = client_body_size;
-    stdout_pipe_[0] = -1;
-    stdout_pipe_[1] = -1;
-    stderr_pipe_[0] = -1;
-    stderr_pipe_[1] = -1;
 };
 
 ServerRequestHandler::~ServerRequestHandler() {};
 
 s_client_data* ServerRequestHandler::getRequest(int fd)
 {
-    if (request_.find(fd) != request_.end())
-        return &request_.at(fd);
-    return nullptr;
+    return request_.get(fd);
 }
 
-void ServerRequestHandler::removeNodeFromRequest(int fd)
+/**
+ * @return clients the server has open
+ */
+size_t ServerRequestHandler::clientCount() const
 {
-    request_.erase(fd);
+    return request_.used();
 }
-void ServerRequestHandler::setStdoutPipe(int stdout_pipe[])
+
+/**
+ * @return the file descriptors of the open clients
+ */
+std::vector<int> ServerRequestHandler::getClients() const
 {
-    stdout_pipe_[0] = stdout_pipe[0];
-    stdout_pipe_[1] = stdout_pipe[1];
+    return request_.clients();
 }
 
-void ServerRequestHandler::setStderrPipe(int stderr_pipe[])
+void ServerRequestHandler::removeNodeFromRequest(int fd)
 {
-    stderr_pipe_[0] = stderr_pipe[0];
-    stderr_pipe_[1] = stderr_pipe[1];
+    s_client_data* data = request_.get(fd);
+    if (data == nullptr)
+        return;
+    data->releaseMemory();
+    request_.release(fd);
 }
 
-void ServerRequestHandler::setConfigForClient(std::shared_ptr<Config>& conf, int client_fd)
+/**
+ * @brief gives a new client its slot
+ *
+ * @return E_ROK when done,
+ * @return CLIENT_SLAB_FULL if the descriptor is past what the slab holds
+ */
+e_reponses ServerRequestHandler::setConfigForClient(std::shared_ptr<Config>& conf, int client_fd, std::string_view client_address)
 {
-    if (request_.find(client_fd) == request_.end())
-    {
-        s_client_data node(conf);
-        request_.emplace(client_fd, node);
-    }
+    if (request_.get(client_fd) != nullptr)
+        return E_ROK;
+    s_client_data* data = request_.acquire(client_fd, conf);
+    if (data == nullptr)
+        return CLIENT_SLAB_FULL;
+    data->reset(client_address);
+    RequestTrace::stamp(data->trace, TRACE_ACCEPT);
+    data->accountMemory();
+    return E_ROK;
 }
 
 /**
- * @brief reads the request comming from the client
+ * @brief reads the request comming from the client. A request can arrive over several read events,
+ * what is read so far is kept with the client in its request_buffer. The buffer is capped,
+ * the headers at REQUEST_HEADER_MAX and the body at what client_max_body_size still allows
  * 
  * @param client_fd the file descriptor of the client
- * @param request_buffer the string that will hold the entire request of the client
  * @return E_ROK when done,
+ * @return READ_INCOMPLETE when the socket has no more data but the request is not complete yet,
  * @return NO_CONTENT_TYPE if no content type is in the header,
  * @return CLIENT_REQUEST_DATA_EMPTY if the headers doesnt have a mehtod, source or HTTPVersion,
- * @return READ_HEADER_BODY_TOO_LARGE if the content length of the body is larger than what we allow,
+ * @return READ_HEADER_BODY_TOO_LARGE if the headers or the body are larger than what we allow,
  * @return READ_REQUEST_EMPTY if the client sends a empty request
  */
-e_reponses ServerRequestHandler::readRequest(int client_fd, std::string& request_buffer)
+e_reponses ServerRequestHandler::readRequest(int client_fd)
 {
-    char buffer[BUFFER_SIZE] = {0};
+    AllocPhase phase(ALLOC_PHASE_PARSE);
+    char buffer[BUFFER_SIZE];
     ssize_t bytes_recieved = 0;
-    if (client_fd == stdout_pipe_[0] || client_fd == stderr_pipe_[0])
-        return HANDLE_COUT_CERR_OUTPUT;
+    s_client_data* data = getRequest(client_fd);
     while ((bytes_recieved = recv(client_fd, buffer, BUFFER_SIZE, 0)) > 0)
     {
-        request_buffer.append(buffer, bytes_recieved);
-        size_t header_end = request_buffer.find("\r\n\r\n");
-        if (header_end != std::string::npos)
-            return readHeader(request_buffer, header_end, client_fd, buffer);
+        RequestTrace::stamp(data->trace, TRACE_FIRST_BYTE);
+        data->request_buffer.append(buffer, bytes_recieved);
+        data->bytes_received += static_cast<uint64_t>(bytes_recieved);
+        ServerStats::moveClient(data->state, CLIENT_READING);
+        if (data->body_start == std::string::npos)
+        {
+            size_t header_end = data->request_buffer.find("\r\n\r\n");
+            if (header_end == std::string::npos)
+            {
+                if (data->request_buffer.size() > REQUEST_HEADER_MAX)
+                    return READ_HEADER_BODY_TOO_LARGE;
+                continue;
+            }
+            data->header_at = std::chrono::steady_clock::now();
+            RequestTrace::stamp(data->trace, TRACE_HEADERS);
+            e_reponses nr = readHeader(*data, header_end);
+            if (nr != E_ROK)
+                return nr;
+        }
+        e_reponses nr = readBody(*data);
+        if (nr == E_ROK)
+        {
+            ServerStats::add(STAT_REQUESTS);
+            ServerStats::moveClient(data->state, CLIENT_WRITING);
+        }
+        if (nr != READ_INCOMPLETE)
+            return nr;
+        if (overBufferLimit(*data))
+            return READ_HEADER_BODY_TOO_LARGE;
+    }
+    if (bytes_recieved == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        ++data->eagains;
+        return READ_INCOMPLETE;
     }
-    std::cerr << "read request empty at end\n";
+    LOG_DEBUG("read request empty at end");
     return READ_REQUEST_EMPTY;
 }
 
 /**
  * @brief modifies the client to let epoll know we are done reading and are ready to write to the client fd
  * 
- * @param client_fd the file descriptor of the client
  * @param request_buffer the string holding the request from the client
+ * @param event the epoll event of the client
  * @return MODIFY_CLIENT_WRITE when everything is good and we are ready to change the event to a write event in epoll.
  * @return HANDLE_CLIENT_EMPTY request_buffer is empty error
  */
-e_reponses ServerRequestHandler::handleClient(std::string& request_buffer, epoll_event& event)
+e_reponses ServerRequestHandler::handleClient(const std::string& request_buffer, epoll_event& event)
 {
     event.events = EPOLLOUT;
     if (!request_buffer.empty())
         return MODIFY_CLIENT_WRITE;
     else
     {
-        std::cerr << "handle client request buffer is empty\n";
+        LOG_ERROR("handle client request buffer is empty");
         return HANDLE_CLIENT_EMPTY;
     }
 }
@@ -112,44 +363,49 @@ e_reponses ServerRequestHandler::handleClient(std::string& request_buffer, epoll
 // private functions
 
 /**
- * @brief reads the header from the client and sets the info in the reqeust map
+ * @brief reads the header from the client and sets the info in its record. The headers
+ * are copied into the arena of the client once, the method, source, version and
+ * content type are views into that copy
  * 
- * @param request_buffer the string holding header info
+ * @param data the record of the client, its request_buffer holds the header
  * @param header_end position of where the header ands
- * @param client_fd the file descriptor of the header
- * @param buffer the last bytes read
  * @return E_ROK when done,
  * @return NO_CONTENT_TYPE if no content type is in the header,
- * @return CLIENT_REQUEST_DATA_EMPTY if the headers doesnt have a mehtod, source or HTTPVersion,
+ * @return CLIENT_REQUEST_DATA_EMPTY if the headers doesnt have a mehtod, source or HTTPVersion
+ * or its Content-Length is not a number,
  * @return READ_HEADER_BODY_TOO_LARGE if the content length of the body is larger than what we allow
  */
-e_reponses ServerRequestHandler::readHeader(std::string& request_buffer, size_t header_end, int client_fd, char buffer[])
+e_reponses ServerRequestHandler::readHeader(s_client_data& data, size_t header_end)
 {
-    std::cout << request_buffer << std::endl;
+    std::string_view headers = data.arena.copy(std::string_view(data.request_buffer.data(), header_end));
+    LOG_TRACE(headers);
+    data.request_header = headers;
 
-    if (setMethodSourceHttpVersion(request_buffer, client_fd) == CLIENT_REQUEST_DATA_EMPTY)
+    if (setMethodSourceHttpVersion(data) == CLIENT_REQUEST_DATA_EMPTY)
         return CLIENT_REQUEST_DATA_EMPTY;
 
-    if (setContentTypeRequest(request_buffer, header_end, client_fd) == NO_CONTENT_TYPE)
+    if (setContentTypeRequest(data) == NO_CONTENT_TYPE)
         return NO_CONTENT_TYPE;
 
-    std::string headers = request_buffer.substr(0, header_end);
-    getRequest(client_fd)->request_header = headers;
-    size_t body_start = header_end + 4; // Skip \r\n\r\n
+    data.body_start = header_end + 4; // Skip \r\n\r\n
+    data.parse_pos = data.body_start;
 
     // check if it's chunked transfer encoding
-    if (headers.find("Transfer-Encoding: chunked") != std::string::npos || headers.find("TE: chunked") != std::string::npos)
-        return handleChunkedRequest(body_start, request_buffer, client_fd, buffer);
+    if (headers.find("Transfer-Encoding: chunked") != std::string_view::npos || headers.find("TE: chunked") != std::string_view::npos)
+    {
+        data.chunked = true;
+        return E_ROK;
+    }
     size_t content_length_body = headers.find("Content-Length: ");
-    if (content_length_body != std::string::npos)
+    if (content_length_body != std::string_view::npos)
     {
-        size_t start = content_length_body + 16;
-        std::stringstream stream(headers.substr(start));
-        uint64_t size;
-        stream >> size;
+        const char* start = headers.data() + content_length_body + 16;
+        uint64_t size = 0;
+        if (std::from_chars(start, headers.data() + headers.size(), size).ec != std::errc())
+            return CLIENT_REQUEST_DATA_EMPTY;
         if (size > max_size_)
             return READ_HEADER_BODY_TOO_LARGE;
-        return handleContentLength(size, request_buffer, body_start, client_fd, buffer);
+        data.content_length = size;
     }
     return E_ROK;
 }
@@ -157,162 +413,140 @@ e_reponses ServerRequestHandler::readHeader(std::string& request_buffer, size_t
 /**
  * @brief checks what the content type of the request from the client is
  * 
- * @param request_buffer the string holding the request from the client
- * @param header_end the position where the header ends in the request
- * @param client_fd the file descriptor of the client
+ * @param data the record of the client, with its headers read
  * @return E_ROK when contnet type is found and saved
  * @return NO_CONTENT_TYPE if no content type is found in request header
  */
-e_reponses ServerRequestHandler::setContentTypeRequest(std::string& request_buffer, size_t header_end, int client_fd)
+e_reponses ServerRequestHandler::setContentTypeRequest(s_client_data& data)
 {
-    if (request_.at(client_fd).request_method != "POST")
+    if (data.request_method != "POST")
         return E_ROK;
-    size_t request_type_pos = request_buffer.find("Content-Type: ");
-    if (request_type_pos != std::string::npos)
+    size_t request_type_pos = data.request_header.find("Content-Type: ");
+    if (request_type_pos != std::string_view::npos)
     {
         request_type_pos += 14; // skip past "Content-Type: "
-        size_t end = request_buffer.substr(request_type_pos, header_end - request_type_pos).length();
-        getRequest(client_fd)->request_type = request_buffer.substr(request_type_pos, end);
+        size_t end = data.request_header.find("\r\n", request_type_pos);
+        data.request_type = data.request_header.substr(request_type_pos, end == std::string_view::npos ? end : end - request_type_pos);
         return E_ROK;
     }
     return NO_CONTENT_TYPE;
 }
 
 /**
- * @brief sets the method, source, and http_version from the request to be saved
+ * @brief sets the method, source, and http_version from the request line, the words
+ * between spaces of the first line of the headers
  * 
- * @param request_buffer the string holding the client requets
- * @param client_fd the file descriptor of the client
+ * @param data the record of the client, with its headers read
  * @return E_ROK when done
  */
-e_reponses ServerRequestHandler::setMethodSourceHttpVersion(std::string& request_buffer, int client_fd)
+e_reponses ServerRequestHandler::setMethodSourceHttpVersion(s_client_data& data)
 {
-    std::istringstream stream(request_buffer);
-    stream >> getRequest(client_fd)->request_method >> getRequest(client_fd)->request_source >> getRequest(client_fd)->http_version;
+    std::string_view line = data.request_header.substr(0, data.request_header.find("\r\n"));
+    std::array<std::string_view*, 3> words = {&data.request_method, &data.request_source, &data.http_version};
+    for (std::string_view* word : words)
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string_view::npos)
+            break;
+        line.remove_prefix(start);
+        *word = line.substr(0, line.find_first_of(" \t"));
+        line.remove_prefix(word->size());
+    }
     return E_ROK;
 }
 
 /**
- * @brief un chunks the chunked request for better handeling later
+ * @brief checks if the body of the request is complete
  * 
- * @param body_start position where the body of the request starts
- * @param request_buffer the string holding the entire request
- * @param client_fd the file descriptor of the client
- * @param buffer the buffer being used to read into the request
- * @return E_ROK when done,
- * @return RECV_FAILED when reading ussing recv() failed 
+ * @param data the request data of the client
+ * @return E_ROK when the whole body is read,
+ * @return READ_INCOMPLETE when more of the body still has to arrive,
+ * @return CLIENT_REQUEST_DATA_EMPTY if a chunk size is invalid,
+ * @return READ_HEADER_BODY_TOO_LARGE if the body is larger than what we allow
  */
-e_reponses ServerRequestHandler::handleChunkedRequest(size_t body_start, std::string& request_buffer, int client_fd, char buffer[])
+e_reponses ServerRequestHandler::readBody(s_client_data& data)
 {
-    std::string decoded_body = "";
-    size_t pos = body_start;
+    if (data.chunked)
+        return handleChunkedRequest(data);
+    return handleContentLength(data);
+}
+
+/**
+ * @brief un chunks the chunked request for better handeling later.
+ * Chunks are decoded as they arrive, parse_pos remembers where the next chunk starts.
+ * A chunk larger than what client_max_body_size still allows is refused as soon as its
+ * size is read, and the decoded chunks are dropped from the buffer so it only holds
+ * the headers and the chunk that is still arriving
+ * 
+ * @param data the request data of the client
+ * @return E_ROK when the last chunk is read,
+ * @return READ_INCOMPLETE when more chunks still have to arrive,
+ * @return CLIENT_REQUEST_DATA_EMPTY if a chunk size is invalid,
+ * @return READ_HEADER_BODY_TOO_LARGE if the decoded body is larger than what we allow
+ */
+e_reponses ServerRequestHandler::handleChunkedRequest(s_client_data& data)
+{
+    std::string& request_buffer = data.request_buffer;
     while(true)
     {
         // read chunk size
-        size_t chunk_size_end = request_buffer.find("\r\n", pos);
+        size_t chunk_size_end = request_buffer.find("\r\n", data.parse_pos);
         if (chunk_size_end == std::string::npos)
+            break;
+        size_t chunk_size = 0;
+        const char* size_start = request_buffer.data() + data.parse_pos;
+        std::from_chars_result parsed = std::from_chars(size_start, request_buffer.data() + chunk_size_end, chunk_size, 16);
+        if (parsed.ec != std::errc() || parsed.ptr == size_start)
         {
-            if (useRecv(client_fd, buffer, request_buffer) == -1) return RECV_FAILED;
-            continue;
+            LOG_INFO("invalid chunk size: " << request_buffer.substr(data.parse_pos, chunk_size_end - data.parse_pos));
+            return CLIENT_REQUEST_DATA_EMPTY;
         }
-        std::string chunk_size_hex = request_buffer.substr(pos, chunk_size_end - pos);
-        int chunk_size = std::stoi(chunk_size_hex, nullptr, 16);
-        pos = chunk_size_end + 2; // move past \r\n
-        if (chunk_size == 0) break; // end of chunks
+        if (chunk_size == 0) return E_ROK; // end of chunks
+        // the body never exceeds max_size_, so this can not wrap
+        if (chunk_size > max_size_ - data.request_body.size())
+            return READ_HEADER_BODY_TOO_LARGE;
 
         // ensure the full chunk is recieved
-        while (request_buffer.size() < pos + chunk_size + 2)
-        {
-            int recv_return = useRecv(client_fd, buffer, request_buffer);
-            if (recv_return == -1) return RECV_FAILED;
-            if (recv_return == 0) break;
-        }
+        size_t pos = chunk_size_end + 2; // move past \r\n
+        size_t available = request_buffer.size() - pos;
+        if (available < chunk_size || available - chunk_size < 2)
+            break;
 
         // extract chunk data
-        std::string chunk_data = request_buffer.substr(pos, chunk_size);
-        decoded_body.append(chunk_data);
-        pos += chunk_size + 2; // move past \r\n
+        data.request_body.append(request_buffer, pos, chunk_size);
+        data.parse_pos = pos + chunk_size + 2; // move past \r\n
     }
-    getRequest(client_fd)->request_body = decoded_body;
-    getRequest(client_fd)->chunked = true;
-    return E_ROK;
+    request_buffer.erase(data.body_start, data.parse_pos - data.body_start);
+    data.parse_pos = data.body_start;
+    return READ_INCOMPLETE;
 }
 
 /**
- * @brief uses recv to read with buffer in the the request from the client and stores it into request_buffer
+ * @brief checks if the body with the size from the Content-Length header is read
  * 
- * @param client_fd the file descriptor from the client
- * @param buffer the buffer used to read into the request from the client
- * @param request_buffer the string holding the entire request from the client
- * @return 0 when done,
- * @return -1 if recv() fails or std::length_error happens
+ * @param data the request data of the client
+ * @return E_ROK when done,
+ * @return READ_INCOMPLETE when more of the body still has to arrive
  */
-int ServerRequestHandler::useRecv(int client_fd, char buffer[], std::string& request_buffer)
+e_reponses ServerRequestHandler::handleContentLength(s_client_data& data)
 {
-    ssize_t bytes_recieved = recv(client_fd, buffer, BUFFER_SIZE - 1, MSG_DONTWAIT);
-    if (bytes_recieved < 0)
-        return -1;
-    if (bytes_recieved == 0)
-        return 0;
-    try
-    {
-        request_buffer.append(buffer, bytes_recieved);
-    }
-    catch(std::length_error& e)
-    {
-        std::cerr << "str append error\n";
-        std::cerr << e.what() << "\n";
-        return -1;
-    }
-    return 0;
+    if (data.request_buffer.size() < data.body_start + data.content_length)
+        return READ_INCOMPLETE;
+    data.request_body.assign(data.request_buffer, data.body_start, data.content_length);
+    return E_ROK;
 }
 
 /**
- * @brief reads into the request to read max n size to get the body of the request
+ * @brief checks if the part of the request that is not parsed yet is more than
+ * the request may still grow by
  * 
- * @param size the max size we need to read
- * @param request_buffer the string holding the entire request
- * @param body_start the position where the body starts in request_buffer
- * @param client_fd the file descriptor of the client
- * @param buffer the buffer being used to read the request body from the client
- * @return E_ROK when done,
- * @return RECV_FAILED if useRecv() failed 
+ * @param data the request data of the client, its headers are read
+ * @return true when the client sent more than the headers and client_max_body_size allow
  */
-e_reponses ServerRequestHandler::handleContentLength(size_t size, std::string& request_buffer, size_t body_start, int client_fd, char buffer[])
+bool ServerRequestHandler::overBufferLimit(const s_client_data& data) const
 {
-    // std::cout << "BODY START AT BEGIN IS [" << body_start << "] SIZE AT START IS [" << size << "]\n";
-    while (true)
-    {
-        // std::cout << "body_start + size is [" << body_start + size << "] request_buffer.size() is [" << request_buffer.size() << "]\n";;
-        if (request_buffer.size() < body_start + size)
-        {
-            ssize_t bytes_read = recv(client_fd, buffer, BUFFER_SIZE - 1, MSG_DONTWAIT);
-            if (bytes_read == -1)
-            {
-                std::cerr << "recv failed and returned -1\n";
-                return RECV_FAILED;
-            }
-            else if (bytes_read == 0)
-                break;
-            else
-            {
-                try
-                {
-                    request_buffer.append(buffer, bytes_read);
-                    if (request_buffer.size() >= size + body_start)
-                        break;
-                }
-                catch (std::exception& e)
-                {
-                    std::cerr << "append failed with message: " << e.what() << "\n";
-                    return EXCEPTION;
-                }
-            }
-        }
-        else
-            break;
-    }
-    getRequest(client_fd)->request_body = request_buffer.substr(body_start, size);
-    // std::cout << "request body at and is [" << getRequest(client_fd).request_body << "]" << std::endl;
-    return E_ROK;
-}
\ No newline at end of file
+    size_t pending = data.request_buffer.size() - data.parse_pos;
+    if (pending <= REQUEST_CHUNK_LINE_MAX)
+        return false;
+    return pending - REQUEST_CHUNK_LINE_MAX > max_size_ - data.request_body.size();
+}
@@ -1,5 +1,7 @@
 #include "server/ServerResponseHandler.hpp"
-#include <iostream>
+#include "log/Logger.hpp"
+#include "server/ServerMetrics.hpp"
+#include "server/AllocProfile.hpp"
 #include <sys/types.h>
 #include <dirent.h>
 #include <sstream>
@@ -7,22 +9,31 @@
 #include <fstream>
 #include <sys/stat.h>
 #include <cstring>
+#include <cerrno>
 #include <fcntl.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 #include <filesystem>
+#include <algorithm>
 
-ServerResponseHandler::ServerResponseHandler(const std::vector<std::shared_ptr<Location>>& locations, const std::string& root, const std::map<uint16_t, std::string>& error_map) : SRV_(locations, root), error_pages_(error_map)
+ServerResponseHandler::ServerResponseHandler(const std::string& root, const std::map<uint16_t, std::string>& error_map) : SRV_(root), error_pages_(error_map)
 {
-    stdout_pipe_[0] = -1;
-    stdout_pipe_[1] = -1;
+    cgi_waiting_ = 0;
+    cgi_next_job_ = 0;
+    proxy_ = nullptr;
     fillStatusCodes();
 }
 
 ServerResponseHandler::~ServerResponseHandler() {};
 
-void ServerResponseHandler::setStdoutPipe(int stdout_pipe[])
+/**
+ * @brief sets the proxy that forwards the requests of proxied locations
+ * 
+ * @param proxy the proxy of the server
+ */
+void ServerResponseHandler::setProxy(ProxyHandler* proxy)
 {
-    stdout_pipe_[0] = stdout_pipe[0];
+    proxy_ = proxy;
 }
 
 /**
@@ -34,46 +45,75 @@ void ServerResponseHandler::setStdoutPipe(int stdout_pipe[])
  * 
  * @param client_fd the file descriptor of the client
  * @param client_data the data of the client from the request is send
- * @param locations all locations known to the server and there info
+ * @param routes the routing snapshot the connection was accepted with
  * @return RVR_OK if all info is good and response has been send,
  * @return SRH_INCORRECT_HTTP_VERSION if the HTTPVersion in the request is not supported
  */
-e_server_request_return ServerResponseHandler::handleResponse(int client_fd, s_client_data& client_data, std::vector<std::shared_ptr<Location>> locations)
+e_server_request_return ServerResponseHandler::handleResponse(int client_fd, s_client_data& client_data, const RouteTable& routes)
 {
+    AllocPhase phase(ALLOC_PHASE_ROUTE);
     std::string file_path = "";
-    std::vector<std::shared_ptr<Location>>::const_iterator location_it = locations.begin();
+    t_route_iterator location_it = routes.begin();
 
     if (!SRV_.checkHTTPVersion(client_data.http_version))
         return SRH_INCORRECT_HTTP_VERSION;
     
-    std::vector<std::string> token_location = sourceChunker(client_data.request_source);
-    e_responeValReturn nr = SRV_.checkLocations(token_location, file_path, location_it, client_data);
+    // the query string is only for CGI scripts, locations and files are found with the path
+    std::string request_path(client_data.request_source.substr(0, client_data.request_source.find('?')));
+
+    // proxied and status locations handle everything below their path, there are no files to look at
+    if (SRV_.checkHandlerLocation(routes, request_path, location_it) == RVR_OK)
+    {
+        RequestTrace::stamp(client_data.trace, TRACE_ROUTE);
+        AllocProfile::enter(ALLOC_PHASE_RESPOND);
+        e_responeValReturn nr = SRV_.checkAllowedMethods(location_it, client_data.request_method);
+        if (nr != RVR_OK)
+            return handleReturns(client_fd, nr, client_data, location_it);
+        client_data.location = *location_it;
+        RequestTrace::stamp(client_data.trace, TRACE_HANDLER);
+        if ((*location_it)->hasTraceDump())
+            return sendTrace(client_fd, client_data);
+        if ((*location_it)->hasStubStatus())
+            return sendStatus(client_fd, client_data);
+        if ((*location_it)->hasMetrics())
+            return sendMetrics(client_fd, client_data);
+        if (proxy_ == nullptr || !proxy_->start(client_fd, client_data, **location_it))
+            return setupResponse(client_fd, 502, client_data);
+        return SRH_PROXY_PENDING;
+    }
+
+    std::vector<std::string> token_location = sourceChunker(request_path);
+    e_responeValReturn nr = SRV_.checkLocations(routes, token_location, file_path, location_it, client_data);
+    RequestTrace::stamp(client_data.trace, TRACE_ROUTE);
+    AllocProfile::enter(ALLOC_PHASE_RESPOND);
     if (nr != RVR_OK)
     {
         if (nr != RVR_IS_REGEX)
             return handleReturns(client_fd, nr, client_data, location_it);
         else
         {
-            file_path = client_data.config_.get()->getRoot() + location_it->get()->getRoot() + client_data.request_source;
-            std::cout << "file_path is [" << file_path << "]" << std::endl;
-            std::cout << "root of config is [" << client_data.config_.get()->getRoot() << "]" << std::endl;
-            if (location_it == client_data.config_.get()->getLocations().begin())
-                std::cout << "location is begin" << std::endl;
+            file_path = client_data.config_.get()->getRoot() + (*location_it)->getRoot() + request_path;
+            LOG_DEBUG("file_path is [" << file_path << "]");
+            LOG_DEBUG("root of config is [" << client_data.config_.get()->getRoot() << "]");
+            if (location_it == routes.begin())
+                LOG_DEBUG("location is begin");
             else
-                std::cout << "root of location is [" << location_it->get()->getPath() << "]" << std::endl;
-            std::cout << "request_source is [" << client_data.request_source << "]" << std::endl;
+                LOG_DEBUG("root of location is [" << (*location_it)->getPath() << "]");
+            LOG_DEBUG("request_source is [" << client_data.request_source << "]");
         }
     }
+    client_data.location = *location_it;
 
     nr = SRV_.checkAllowedMethods(location_it, client_data.request_method);
     if (nr != RVR_OK)
         return handleReturns(client_fd, nr, client_data, location_it);
+    RequestTrace::stamp(client_data.trace, TRACE_HANDLER);
     
     // Check for CGI before file handling
-    if (location_it->get()->hasCGI()) {
+    if ((*location_it)->hasCGI()) {
         std::string ext = getContentType(file_path);
-        if (location_it->get()->isCGIExtension(ext)) {
-            return handleCGI(client_fd, client_data, *location_it->get(), file_path);
+        if ((*location_it)->isCGIExtension(ext)) {
+            return handleCGI(client_fd, client_data, **location_it, file_path);
         }
     }
 
@@ -97,7 +137,7 @@ e_server_request_return ServerResponseHandler::handleResponse(int client_fd, s_c
                     return setupResponse(client_fd, 403, client_data);
                 }
             std::string body = "";
-            e_server_request_return response = buildDirectoryResponse(SRV_.getRoot().substr(1) + location_it->get()->getRoot(), body);
+            e_server_request_return response = buildDirectoryResponse(SRV_.getRoot().substr(1) + (*location_it)->getRoot(), body);
             if (response != SRH_OK)
                 return handleReturns(client_fd, RVR_DIR_FAILED, client_data, location_it);
             return sendResponse(client_fd, "200 Ok", body, client_data, true);
@@ -127,7 +167,7 @@ e_server_request_return ServerResponseHandler::setupResponse(int client_fd, uint
     {  
         dot_pos = location.find(".", 0);
         if (dot_pos == std::string::npos)
-            return sendRedirectResponse(client_fd, code, location);
+            return sendRedirectResponse(client_fd, code, location, data);
     }
     std::string status_text = "";
     if (status_codes_.find(code) != status_codes_.end())
@@ -138,7 +178,7 @@ e_server_request_return ServerResponseHandler::setupResponse(int client_fd, uint
         }
         catch(const std::exception& e)
         {
-            std::cerr << e.what() << '\n';
+            LOG_ERROR(e.what());
             status_text = "500 Internal Server Error";
         }
     }
@@ -167,28 +207,6 @@ e_server_request_return ServerResponseHandler::setupResponse(int client_fd, uint
     return SRH_OK;
 }
 
-/**
- * @brief handle buffers being writen to the standard output and standard error and put then in log files
- * 
- * @param fd file descriptor of stdout_pipe[0] or stderr_pipe[0] 
- */
-void ServerResponseHandler::handleCoutErrOutput(int fd)
-{
-    ssize_t bytes_recieved = 0;
-    std::string request_buffer = "";
-    char buffer[BUFFER_SIZE] = {0};
-    while ((bytes_recieved = read(fd, buffer, BUFFER_SIZE - 1)) > 0)
-    {
-        buffer[bytes_recieved] = '\0';
-        request_buffer.append(buffer, bytes_recieved);
-    }
-    if (fd == stdout_pipe_[0])
-        request_buffer.insert(0, "[Captured stdcout]: ");
-    else
-        request_buffer.insert(0, "[Captured stdcerr]: ");
-    logMsg(request_buffer.c_str(), fd);
-}
-
 // private functions
 
 /**
@@ -199,13 +217,13 @@ void ServerResponseHandler::handleCoutErrOutput(int fd)
  * @param data the request data from the user
  * @return SRH_OK when done
  */
-e_server_request_return ServerResponseHandler::handleReturns(int client_fd, e_responeValReturn nr, s_client_data& data, std::vector<std::shared_ptr<Location>>::const_iterator& location_it)
+e_server_request_return ServerResponseHandler::handleReturns(int client_fd, e_responeValReturn nr, s_client_data& data, t_route_iterator& location_it)
 {
     switch (nr)
     {
         case RVR_RETURN:
-            std::cout << "return code is " << location_it->get()->getReturn().code << " return body is " << location_it->get()->getReturn().body << " location is " << location_it->get()->getRoot() << std::endl;
-            setupResponse(client_fd, location_it->get()->getReturn().code, data, location_it->get()->getReturn().body);
+            LOG_DEBUG("return code is " << (*location_it)->getReturn().code << " return body is " << (*location_it)->getReturn().body << " location is " << (*location_it)->getRoot());
+            setupResponse(client_fd, (*location_it)->getReturn().code, data, (*location_it)->getReturn().body);
             break;
         case RVR_NOT_FOUND:
             setupResponse(client_fd, 404, data);
@@ -223,7 +241,7 @@ e_server_request_return ServerResponseHandler::handleReturns(int client_fd, e_re
             setupResponse(client_fd, 500, data);
             break;
         default:
-            std::cerr << "unkown respone validator error " << nr << '\n';
+            LOG_ERROR("unkown respone validator error " << nr);
             setupResponse(client_fd, 500, data);
             break;
     }
@@ -242,7 +260,7 @@ e_server_request_return ServerResponseHandler::buildDirectoryResponse(const std:
     DIR* dir = opendir(path.c_str());
     if (dir == nullptr)
     {
-        std::cerr << "failed to open directory!\n";
+        LOG_ERROR("failed to open directory!");
         return SRH_OPEN_DIR_FAILED;
     }
     body.append("<!DOCTYPE html><html><body><h1>Directory Listing for ");
@@ -261,20 +279,20 @@ e_server_request_return ServerResponseHandler::buildDirectoryResponse(const std:
 }
 
 /**
- * @brief Builds the response header and the body to be send to the client
+ * @brief Builds the response header and the body to be send to the client.
+ * The file is left open in the client data when the socket does not take it all
  * 
  * @param client_fd file descriptor of the client
  * @param status the string holding the status of the response 
  * @param file_location where the file holding the respone is locaded
  * @param data the request data from the client
  * @param d_list true if we need to show directory listing
- * @return SRH_OK when done,
+ * @return SRH_OK when done or queued,
  * @return SRH_SEND_ERROR when send() failes,
- * @return SRH_FSTREAM_ERROR when file stream failed to open 
+ * @return SRH_FSTREAM_ERROR when the file failed to open 
  */
 e_server_request_return ServerResponseHandler::sendResponse(int client_fd, const std::string& status, const std::string& file_location, const s_client_data& data, bool d_list)
 {
-    bool content = false;
     std::ostringstream response;
     response << "HTTP/1.1 " << status << "\r\n";
     response << "Connection: close\r\n";
@@ -284,56 +302,54 @@ e_server_request_return ServerResponseHandler::sendResponse(int client_fd, const
         response << "Content-Type: " << getContentType("x.html") << "\r\n";
         response << "Content-Length: " << file_location.size() << "\r\n\r\n";
         response << file_location;
-        if (send(client_fd, response.str().c_str(), response.str().size(), 0) <= 0)
+        if (sendClient(client_fd, data, response.str().c_str(), response.str().size()) <= 0)
             return SRH_SEND_ERROR;
         return SRH_OK;
     }
 
     response << "Content-Type: " << getContentType(file_location) << "\r\n";
-    std::ifstream file_stream("." + file_location, std::ios::binary);
-    if (!file_stream.is_open())
+    int file_fd = open(("." + file_location).c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1)
     {
         std::string content = status;
         response << "Content-Length: " << content.size() << "\r\n\r\n";
         response << content;
-        std::cerr << "file_stream open: " << file_location << std::endl;
-        if (send(client_fd, response.str().c_str(), response.str().size(), 0) <= 0)
+        LOG_ERROR("file_stream open: " << file_location);
+        if (sendClient(client_fd, data, response.str().c_str(), response.str().size()) <= 0)
             return SRH_SEND_ERROR;
         return SRH_FSTREAM_ERROR;
     }
 
-    if (data.chunked)
+    struct stat file_stat{};
+    uint64_t file_size = 0;
+    bool regular = fstat(file_fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+    if (regular)
     {
-        response << "Transfer-Encoding: chunked\r\n\r\n";
-        if (send(client_fd, response.str().c_str(), response.str().size(), 0) <= 0)
-            return SRH_SEND_ERROR;
-        if (sendChunkedResponse(client_fd, file_stream)!= SRH_OK)
-            return SRH_SEND_ERROR;
+        LOG_DEBUG("locations is: " << file_location);
+        file_size = static_cast<uint64_t>(file_stat.st_size);
     }
+    if (data.chunked)
+        response << "Transfer-Encoding: chunked\r\n\r\n";
     else
+        response << "Content-Length: " << file_size << "\r\n\r\n";
+    if (sendClient(client_fd, data, response.str().c_str(), response.str().size()) <= 0)
     {
-        std::streamsize file_size;
-        if (file_stream.good())
-        {
-            std::cout << "locations is: " << file_location << std::endl;
-            file_stream.seekg(0, std::ios::end);
-            file_size = file_stream.tellg();
-            file_stream.seekg(0, std::ios::beg);
-            response << "Content-Length: " << file_size << "\r\n\r\n";
-            if (file_size > 0)
-                content = true;
-        }
-        else
-            response << "Content-Length: 0\r\n\r\n";
-        if (send(client_fd, response.str().c_str(), response.str().size(), 0) <= 0)
+        close(file_fd);
+        return SRH_SEND_ERROR;
+    }
+    if (!regular || (file_size == 0 && !data.chunked))
+    {
+        close(file_fd);
+        if (data.chunked && sendClient(client_fd, data, "0\r\n\r\n", 5) <= 0)
             return SRH_SEND_ERROR;
-        if (content)
-        {
-            if (sendFile(client_fd, file_stream, file_size) != SRH_OK)
-                return SRH_SEND_ERROR;
-        }
+        return SRH_OK;
     }
-    return SRH_OK;
+    // the body follows the headers, flushClient() sends what the socket does not take now
+    data.file_fd = file_fd;
+    data.file_offset = 0;
+    data.file_left = file_size;
+    data.file_chunked = data.chunked;
+    return flushClient(client_fd, data);
 }
 
 /**
@@ -376,49 +392,115 @@ std::string ServerResponseHandler::getContentType(const std::string& file_path)
 }
 
 /**
- * @brief chunks the response data and send it chunk by chunk to the client
+ * @brief sends what the socket did not take of a response. Called again on
+ * EPOLLOUT until the client has it all, like the proxy does with its sessions.
+ * A file goes out with sendfile(), in chunks it is read a block at a time
  * 
- * @param client_fd file descriptor of the client
- * @param file_stream the file stream holding the respone for the client
- * @return SRH_OK when done,
- * @return SRH_SEND_ERROR is send() fails
+ * @param client_fd the file descriptor of the client
+ * @param data the request data from the client, holds what is left to send
+ * @return SRH_OK when done or when the socket is full, data.hasOutput() tells which,
+ * @return SRH_SEND_ERROR when send() fails or the file can not be read
  */
-e_server_request_return ServerResponseHandler::sendChunkedResponse(int client_fd, std::ifstream& file_stream)
+e_server_request_return ServerResponseHandler::flushClient(int client_fd, const s_client_data& data)
 {
-    char buffer[BUFFER_SIZE];
-    while (file_stream.read(buffer, BUFFER_SIZE) || file_stream.gcount() > 0)
+    while (data.hasOutput())
     {
-        std::ostringstream chunk;
-        chunk << std::hex << file_stream.gcount() << "\r\n"; // chunk size in hex
-        if (send(client_fd, chunk.str().c_str(), chunk.str().size(), 0) <= 0)
-            return SRH_SEND_ERROR;
-        if (send(client_fd, buffer, file_stream.gcount(), 0) <= 0)
-            return SRH_SEND_ERROR;
-        if (send(client_fd, "\r\n\r\n", 2, 0) < 0)
-            return SRH_SEND_ERROR;
-    }
-    if (send(client_fd, "0\r\n\r\n", 5, 0) <= 0)
+        ssize_t sent = 0;
+        if (data.out_offset < data.out.size())
+        {
+            const char* pending = data.out.data() + data.out_offset;
+            sent = send(client_fd, pending, data.out.size() - data.out_offset, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                data.countSent(pending, sent);
+                data.out_offset += static_cast<size_t>(sent);
+                if (data.out_offset == data.out.size())
+                {
+                    data.out.clear();
+                    data.out_offset = 0;
+                }
+                continue;
+            }
+        }
+        else if (data.file_chunked)
+        {
+            char buffer[SEND_FILE_BLOCK];
+            ssize_t got = read(data.file_fd, buffer, sizeof(buffer));
+            if (got == -1)
+                return SRH_SEND_ERROR;
+            if (got == 0)
+            {
+                close(data.file_fd);
+                data.file_fd = -1;
+                data.file_chunked = false;
+                data.out.append("0\r\n\r\n");
+                continue;
+            }
+            std::ostringstream chunk;
+            chunk << std::hex << got << "\r\n"; // chunk size in hex
+            data.out.append(chunk.str());
+            data.out.append(buffer, static_cast<size_t>(got));
+            data.out.append("\r\n");
+            continue;
+        }
+        else
+        {
+            size_t block = static_cast<size_t>(std::min<uint64_t>(data.file_left, SEND_FILE_BLOCK));
+            sent = sendfile(client_fd, data.file_fd, &data.file_offset, block);
+            if (sent > 0)
+            {
+                data.countSent(nullptr, sent);
+                data.file_left -= static_cast<uint64_t>(sent);
+                if (data.file_left == 0)
+                {
+                    close(data.file_fd);
+                    data.file_fd = -1;
+                }
+                continue;
+            }
+        }
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            ++data.eagains;
+            return SRH_OK;
+        }
         return SRH_SEND_ERROR;
+    }
     return SRH_OK;
 }
 
 /**
- * @brief sends the body with the info from the file to the client
+ * @brief sends to the client and counts what was sent for the access log.
+ * What the socket does not take is kept in the client data, flushClient()
+ * sends it once the socket is writable again
  * 
  * @param client_fd the file descriptor of the client
- * @param file_stream tje stream holding the response for the cloent
- * @return SRH_OK when done,
- * @return SRH_SEND_ERROR when send() fails
+ * @param data the request data from the client, holds the counters
+ * @param buffer the bytes to send
+ * @param size the number of bytes
+ * @return size when sent or queued, -1 when send() fails
  */
-e_server_request_return ServerResponseHandler::sendFile(int client_fd, std::ifstream& file_stream, std::streamsize size)
+ssize_t ServerResponseHandler::sendClient(int client_fd, const s_client_data& data, const char* buffer, size_t size)
 {
-    char buffer[BUFFER_SIZE] = {0};
-    while(file_stream.read(buffer, size) || file_stream.gcount() > 0)
+    if (size == 0)
+        return 0;
+    if (data.hasOutput())
     {
-        if (send(client_fd, buffer, file_stream.gcount(), MSG_NOSIGNAL) <= 0)
-            return SRH_SEND_ERROR;
+        data.out.append(buffer, size);
+        return static_cast<ssize_t>(size);
     }
-    return SRH_OK;
+    ssize_t sent = send(client_fd, buffer, size, MSG_NOSIGNAL);
+    if (sent == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        ++data.eagains;
+        sent = 0;
+    }
+    data.countSent(buffer, sent);
+    if (static_cast<size_t>(sent) < size)
+        data.out.append(buffer + sent, size - static_cast<size_t>(sent));
+    return static_cast<ssize_t>(size);
 }
 
 /**
@@ -456,94 +538,692 @@ std::vector<std::string> ServerResponseHandler::sourceChunker(std::string& sourc
 }
 
 /**
- * @brief logs messages from the standard output and standard error to log files
- * 
- * @param msg the message we want to log
- * @param fd either the file descriptor of stdout_pipe[0] or stderr_pipe[0]
+ * @brief Start CGI request processing. The script runs in the background,
+ * the server registers its descriptors in the epoll and feeds events back
+ * through handleCGIEvent(). Every change the server has to make to its epoll
+ * is collected in an s_cgi_update, that it takes with takeCGIUpdate().
+ * When the location already runs its maximum of scripts the request waits
+ * in the queue of the location, or gets a 503 when that is full.
+ * With cgi_cache_valid a GET request is answered from the cache when possible,
+ * and clients asking for the same source while it is not cached share one script
+ *
+ * @param client_fd the file descriptor of the client
+ * @param client_data the data of the client from the request
+ * @param location location info used for CGI configuration
+ * @param script_path path to the CGI script
+ * @return SRH_CGI_PENDING when the client waits for a script,
+ * @return the result of the response if the client is answered right away
  */
-void ServerResponseHandler::logMsg(const char* msg, int fd)
+e_server_request_return ServerResponseHandler::handleCGI(
+    int client_fd,
+    const s_client_data& client_data,
+    const Location& location,
+    const std::string& script_path)
 {
-    std::string file = "";
-    if (fd == stdout_pipe_[0])
-        file = STANDARD_LOG_FILE;
-    else
-        file = STANDARD_ERROR_LOG_FILE;
-    if (mkdir("logs", 0777) < 0 && errno != EEXIST)
+    AllocPhase phase(ALLOC_PHASE_CGI);
+    const Location::CGIConfig& config = location.getCGIConfig();
+    std::string cache_key;
+    if (config.cache_valid != 0 && client_data.request_method == "GET")
     {
-        std::cerr << "mkdir() failed to make directory\n";
-        return;
+        cache_key = client_data.request_source;
+        e_server_request_return result;
+        if (serveCachedCGI(client_fd, client_data, location, script_path, cache_key, result))
+            return result;
+        ServerStats::add(STAT_CGI_CACHE_MISSES);
     }
-    file.insert(0,"logs/");
-    int file_fd = open(file.c_str(), O_CREAT | O_APPEND | O_WRONLY, S_IRUSR | S_IWUSR);
-    if (write(file_fd, msg, strlen(msg)) <= 0)
+
+    s_cgi_pool& pool = cgi_pools_[&location];
+    if (config.max_concurrent != 0 && pool.running >= config.max_concurrent)
     {
-        close(file_fd);
-        throw std::runtime_error("Write failed: to log write has not been successful\n");
+        if (pool.queue.size() >= config.queue_size)
+        {
+            ++pool.rejected_total;
+            return setupResponse(client_fd, 503, client_data);
+        }
+        pool.queue.push_back({client_fd, &client_data, script_path, cache_key, std::chrono::steady_clock::now()});
+        ++pool.queued_total;
+        ++cgi_waiting_;
+        cgi_update_.waiting.push_back(client_fd);
+        return SRH_CGI_PENDING;
     }
-    close(file_fd);
+    return startCGI(client_fd, &client_data, location, script_path, cache_key);
 }
 
 /**
- * @brief Handle CGI request processing
+ * @brief answers the client from the cache when possible.
+ * A fresh entry is send as is. An entry that expired less than its lifetime ago
+ * is still send, while a script refreshes it in the background.
+ * Without a usable entry the client waits for the script that already fills it, if there is one
  *
  * @param client_fd the file descriptor of the client
  * @param client_data the data of the client from the request
  * @param location location info used for CGI configuration
  * @param script_path path to the CGI script
- * @return SRH_OK when done,
- * @return SRH_CGI_ERROR if CGI processing fails
+ * @param cache_key the source of the request
+ * @param result the result of the response, or SRH_CGI_PENDING if the client waits
+ * @return true if the client is answered or waits for a running script,
+ * @return false if a script has to be started for the client
  */
-e_server_request_return ServerResponseHandler::handleCGI(
-    int client_fd,
-    const s_client_data& client_data,
-    const Location& location,
-    const std::string& script_path)
+bool ServerResponseHandler::serveCachedCGI(int client_fd, const s_client_data& client_data, const Location& location, const std::string& script_path, const std::string& cache_key, e_server_request_return& result)
 {
+    std::unordered_map<std::string, s_cgi_cache_entry>::iterator it = cgi_cache_.find(cache_key);
+    if (it == cgi_cache_.end())
+        return false;
+    s_cgi_cache_entry& entry = it->second;
+    if (entry.valid)
+    {
+        std::chrono::steady_clock::duration age = std::chrono::steady_clock::now() - entry.stored_at;
+        if (age < entry.lifetime)
+        {
+            ServerStats::add(STAT_CGI_CACHE_HITS);
+            result = sendCGIResponse(client_fd, client_data, 0, entry.output, "HIT");
+            return true;
+        }
+        if (age < 2 * entry.lifetime)
+        {
+            ServerStats::add(STAT_CGI_CACHE_STALE);
+            const Location::CGIConfig& config = location.getCGIConfig();
+            if (entry.job == -1 && (config.max_concurrent == 0 || cgi_pools_[&location].running < config.max_concurrent))
+                startCGI(-1, nullptr, location, script_path, cache_key);
+            result = sendCGIResponse(client_fd, client_data, 0, entry.output, "STALE");
+            return true;
+        }
+    }
+    if (entry.job == -1)
+        return false;
+    cgi_jobs_.at(entry.job).clients.push_back({client_fd, &client_data});
+    cgi_client_jobs_[client_fd] = entry.job;
+    cgi_update_.waiting.push_back(client_fd);
+    ServerStats::add(STAT_CGI_CACHE_COLLAPSED);
+    result = SRH_CGI_PENDING;
+    return true;
+}
+
+/**
+ * @brief makes sure there is an entry for the source in the cache,
+ * when the cache is full the entries that can no longer be used are dropped first
+ *
+ * @param cache_key the source of the request
+ * @return true if the source has an entry,
+ * @return false if the cache is full
+ */
+bool ServerResponseHandler::reserveCGICacheEntry(const std::string& cache_key)
+{
+    if (cgi_cache_.find(cache_key) != cgi_cache_.end())
+        return true;
+    if (cgi_cache_.size() >= CGI_CACHE_MAX_ENTRIES)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (std::unordered_map<std::string, s_cgi_cache_entry>::iterator it = cgi_cache_.begin(); it != cgi_cache_.end();)
+        {
+            if (it->second.job == -1 && now - it->second.stored_at >= 2 * it->second.lifetime)
+                it = cgi_cache_.erase(it);
+            else
+                ++it;
+        }
+        if (cgi_cache_.size() >= CGI_CACHE_MAX_ENTRIES)
+            return false;
+    }
+    cgi_cache_[cache_key];
+    return true;
+}
+
+/**
+ * @brief starts a CGI script for the client, or a cache refresh without a client
+ *
+ * @param client_fd the file descriptor of the client, -1 for a cache refresh
+ * @param client_data the data of the client from the request, nullptr for a cache refresh
+ * @param location location info used for CGI configuration
+ * @param script_path path to the CGI script
+ * @param cache_key the source the output is cached for, empty if it is not cached
+ * @return SRH_CGI_PENDING when the script is started,
+ * @return the result of the error response if starting failed
+ */
+e_server_request_return ServerResponseHandler::startCGI(int client_fd, const s_client_data* client_data, const Location& location, const std::string& script_path, const std::string& cache_key)
+{
+    static const std::string no_body;
+    // a cache refresh is a plain GET of the cached source
+    std::string_view source = client_data ? client_data->request_source : std::string_view(cache_key);
     try {
-        CGIHandler handler(location);
-        
+        std::unique_ptr<CGIHandler> handler = std::make_unique<CGIHandler>(location);
+
         // Extract query string if present
         std::string query_string;
-        size_t query_pos = client_data.request_source.find('?');
-        if (query_pos != std::string::npos) {
-            query_string = client_data.request_source.substr(query_pos + 1);
+        size_t query_pos = source.find('?');
+        if (query_pos != std::string_view::npos) {
+            query_string = source.substr(query_pos + 1);
         }
 
-        // Execute CGI script
-        auto [status_code, response] = handler.handleRequest(
+        // A cached job keeps running when its client closes and the slot of the client is reused,
+        // so it does not get the body, which is the client's. The cache is keyed by the source only
+        const std::string& body = (client_data && cache_key.empty()) ? client_data->request_body : no_body;
+
+        // Start CGI script
+        std::chrono::steady_clock::time_point spawn_start = std::chrono::steady_clock::now();
+        handler->start(
             script_path,
-            client_data.request_method,
-            client_data.request_body,
-            query_string,
-            client_data.config_.get()->getServerName(),
-            client_data.config_.get()->getPort()
+            client_data ? std::string(client_data->request_method) : "GET",
+            body,
+            query_string
         );
+        ServerMetrics::recordHistogram(HIST_CGI_SPAWN,
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - spawn_start).count());
 
-        if (status_code == -2) {
-            return setupResponse(client_fd, 504, client_data);
+        int job_id = cgi_next_job_++;
+        s_cgi_job& job = cgi_jobs_[job_id];
+        ServerStats::add(STAT_CGI_RUNNING);
+        job.handler = std::move(handler);
+        job.started = std::chrono::steady_clock::now();
+        if (!cache_key.empty() && reserveCGICacheEntry(cache_key))
+        {
+            s_cgi_cache_entry& entry = cgi_cache_[cache_key];
+            entry.job = job_id;
+            entry.lifetime = std::chrono::seconds(location.getCGIConfig().cache_valid);
+            job.cache_key = cache_key;
         }
-        else if (status_code != 0) {
-            return setupResponse(client_fd, 500, client_data);
+        if (client_fd != -1)
+        {
+            job.clients.push_back({client_fd, client_data});
+            cgi_client_jobs_[client_fd] = job_id;
+            cgi_update_.waiting.push_back(client_fd);
         }
 
-        // Format and send response with CGI output
-        std::ostringstream headers;
-        headers << "HTTP/1.1 200 OK\r\n"
-                << "Connection: close\r\n"
-                << "Content-Type: text/html\r\n"
-                << "Content-Length: " << response.length() << "\r\n\r\n"
-                << response;
+        CGIExecutor& executor = job.handler->getExecutor();
+        const int fds[] = {executor.getInputFd(), executor.getOutputFd(), executor.getErrorFd(), executor.getProcessFd()};
+        for (int fd : fds)
+        {
+            if (fd == -1)
+                continue;
+            epoll_event event{};
+            event.events = (fd == executor.getInputFd()) ? EPOLLOUT : EPOLLIN;
+            event.data.fd = fd;
+            cgi_update_.added.push_back(event);
+            cgi_fd_jobs_[fd] = job_id;
+            job.fds.push_back(fd);
+        }
+        ++cgi_pools_[&location].running;
+        return SRH_CGI_PENDING;
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("CGI error: " << e.what());
+        if (client_fd == -1)
+            return SRH_CGI_ERROR;
+        return setupResponse(client_fd, 500, *client_data);
+    }
+}
 
-        if (send(client_fd, headers.str().c_str(), headers.str().length(), 0) <= 0) {
-            return SRH_SEND_ERROR;
+/**
+ * @brief continues a script after one of its descriptors became ready,
+ * once the script is done its output is send to every client waiting for it
+ * 
+ * @param fd the descriptor of the script that had the event
+ */
+void ServerResponseHandler::handleCGIEvent(int fd)
+{
+    AllocPhase phase(ALLOC_PHASE_CGI);
+    std::unordered_map<int, int>::iterator it = cgi_fd_jobs_.find(fd);
+    if (it == cgi_fd_jobs_.end())
+        return;
+    int job_id = it->second;
+    s_cgi_job& job = cgi_jobs_.at(job_id);
+    CGIEvent result = job.handler->getExecutor().handleEvent(fd);
+    if (result == CGIEvent::Pending)
+        return;
+    if (result == CGIEvent::FdClosed)
+    {
+        // closing the fd already removed it from the epoll
+        cgi_fd_jobs_.erase(it);
+        job.fds.erase(std::find(job.fds.begin(), job.fds.end(), fd));
+        cgi_update_.closed.push_back(fd);
+        return;
+    }
+    finishCGI(job_id);
+}
+
+/**
+ * @brief kills the script of the client because the client timer ran out,
+ * every client waiting for the same script gets the 504
+ * 
+ * @param client_fd the file descriptor of the client
+ */
+void ServerResponseHandler::timeoutCGI(int client_fd)
+{
+    std::unordered_map<int, int>::iterator it = cgi_client_jobs_.find(client_fd);
+    if (it == cgi_client_jobs_.end())
+        return;
+    int job_id = it->second;
+    s_cgi_job& job = cgi_jobs_.at(job_id);
+    job.handler->getExecutor().terminate();
+    ServerStats::add(STAT_CGI_TIMEOUTS);
+    for (const std::pair<int, const s_client_data*>& client : job.clients)
+        cgi_update_.answered.push_back({client.first, setupResponse(client.first, 504, *client.second)});
+    releaseCGI(job_id);
+}
+
+/**
+ * @brief checks if the client waits for a running script
+ * 
+ * @param client_fd the file descriptor of the client
+ * @return true if a script is running for the client
+ */
+bool ServerResponseHandler::hasCGI(int client_fd) const
+{
+    return cgi_client_jobs_.find(client_fd) != cgi_client_jobs_.end();
+}
+
+/**
+ * @brief checks if any script runs, cache refreshes included
+ * 
+ * @return true if a script is running
+ */
+bool ServerResponseHandler::hasCGIJobs() const
+{
+    return !cgi_jobs_.empty();
+}
+
+/**
+ * @brief drops the client from its script or queue. A script nobody waits for anymore
+ * is killed, unless it fills the cache
+ * 
+ * @param client_fd the file descriptor of the client
+ */
+void ServerResponseHandler::removeCGI(int client_fd)
+{
+    std::unordered_map<int, int>::iterator it = cgi_client_jobs_.find(client_fd);
+    if (it != cgi_client_jobs_.end())
+    {
+        int job_id = it->second;
+        cgi_client_jobs_.erase(it);
+        s_cgi_job& job = cgi_jobs_.at(job_id);
+        for (std::vector<std::pair<int, const s_client_data*>>::iterator client = job.clients.begin(); client != job.clients.end(); ++client)
+        {
+            if (client->first == client_fd)
+            {
+                job.clients.erase(client);
+                break;
+            }
+        }
+        if (job.clients.empty() && job.cache_key.empty())
+            releaseCGI(job_id);
+        return;
+    }
+    if (cgi_waiting_ == 0)
+        return;
+    for (std::pair<const Location* const, s_cgi_pool>& pool : cgi_pools_)
+    {
+        for (std::deque<s_cgi_waiting>::iterator waiting = pool.second.queue.begin(); waiting != pool.second.queue.end(); ++waiting)
+        {
+            if (waiting->client_fd == client_fd)
+            {
+                pool.second.queue.erase(waiting);
+                --cgi_waiting_;
+                return;
+            }
         }
+    }
+}
 
-        return SRH_OK;
+/**
+ * @brief starts queued requests for locations that have a free slot again,
+ * sends a 503 to requests that waited longer than the queue timeout
+ * and kills cache refreshes that run longer than CGI_TIMEOUT_MS
+ */
+void ServerResponseHandler::updateCGI()
+{
+    AllocPhase phase(ALLOC_PHASE_CGI);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (cgi_jobs_.size() > cgi_client_jobs_.size())
+    {
+        std::vector<int> expired;
+        for (const std::pair<const int, s_cgi_job>& job : cgi_jobs_)
+        {
+            if (job.second.clients.empty() && now - job.second.started >= std::chrono::milliseconds(CGI_TIMEOUT_MS))
+                expired.push_back(job.first);
+        }
+        for (int job_id : expired)
+        {
+            LOG_WARN("CGI error: cache refresh of " << cgi_jobs_.at(job_id).cache_key << " timed out");
+            ServerStats::add(STAT_CGI_TIMEOUTS);
+            releaseCGI(job_id);
+        }
     }
-    catch (const std::exception& e) {
-        std::cerr << "CGI error: " << e.what() << std::endl;
+    if (cgi_waiting_ == 0)
+        return;
+    for (std::pair<const Location* const, s_cgi_pool>& entry : cgi_pools_)
+    {
+        const Location& location = *entry.first;
+        const Location::CGIConfig& config = location.getCGIConfig();
+        s_cgi_pool& pool = entry.second;
+        while (!pool.queue.empty())
+        {
+            s_cgi_waiting waiting = pool.queue.front();
+            uint64_t waited_us = std::chrono::duration_cast<std::chrono::microseconds>(now - waiting.queued_at).count();
+            bool expired = waited_us >= config.queue_timeout * 1000000;
+            if (!expired && pool.running >= config.max_concurrent)
+                break;
+            pool.queue.pop_front();
+            --cgi_waiting_;
+            pool.wait_total_us += waited_us;
+            ServerMetrics::recordHistogram(HIST_CGI_QUEUE_WAIT, waited_us);
+            if (waiting.client_data != nullptr)
+                waiting.client_data->cgi_wait_us = waited_us;
+            if (waited_us > pool.wait_max_us)
+                pool.wait_max_us = waited_us;
+            LOG_DEBUG("cgi queue " << location.getPath() << ": waited " << waited_us / 1000 << "ms, depth " << pool.queue.size() << (expired ? ", expired" : ""));
+            e_server_request_return result;
+            if (expired)
+            {
+                ++pool.expired_total;
+                result = setupResponse(waiting.client_fd, 503, *waiting.client_data);
+            }
+            else if (waiting.cache_key.empty() || !serveCachedCGI(waiting.client_fd, *waiting.client_data, location, waiting.script_path, waiting.cache_key, result))
+                result = startCGI(waiting.client_fd, waiting.client_data, location, waiting.script_path, waiting.cache_key);
+            if (result != SRH_CGI_PENDING)
+                cgi_update_.answered.push_back({waiting.client_fd, result});
+        }
+    }
+}
+
+/**
+ * @brief gives the time until the first queued request or cache refresh expires,
+ * to use as epoll_wait timeout
+ * 
+ * @return milliseconds until the first expiry,
+ * @return -1 if nothing can expire
+ */
+int ServerResponseHandler::getCGITimeout() const
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int64_t timeout = -1;
+    std::vector<std::chrono::steady_clock::time_point> deadlines;
+    if (cgi_waiting_ != 0)
+    {
+        for (const std::pair<const Location* const, s_cgi_pool>& entry : cgi_pools_)
+        {
+            if (!entry.second.queue.empty())
+                deadlines.push_back(entry.second.queue.front().queued_at + std::chrono::seconds(entry.first->getCGIConfig().queue_timeout));
+        }
+    }
+    if (cgi_jobs_.size() > cgi_client_jobs_.size())
+    {
+        for (const std::pair<const int, s_cgi_job>& job : cgi_jobs_)
+        {
+            if (job.second.clients.empty())
+                deadlines.push_back(job.second.started + std::chrono::milliseconds(CGI_TIMEOUT_MS));
+        }
+    }
+    for (std::chrono::steady_clock::time_point deadline : deadlines)
+    {
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        if (left < 0)
+            left = 0;
+        if (timeout == -1 || left < timeout)
+            timeout = left;
+    }
+    return static_cast<int>(timeout);
+}
+
+/**
+ * @brief hands the epoll changes collected since the last call to the server
+ * 
+ * @param update filled with the changes
+ * @return true if there are changes to make
+ */
+bool ServerResponseHandler::takeCGIUpdate(s_cgi_update& update)
+{
+    if (cgi_update_.added.empty() && cgi_update_.closed.empty() && cgi_update_.waiting.empty() && cgi_update_.answered.empty())
+        return false;
+    update = std::move(cgi_update_);
+    cgi_update_ = s_cgi_update();
+    return true;
+}
+
+/**
+ * @brief gives the CGI state per location, for statistics
+ * 
+ * @return the running scripts, queue and counters of each CGI location that has been used
+ */
+const std::unordered_map<const Location*, s_cgi_pool>& ServerResponseHandler::getCGIPools() const
+{
+    return cgi_pools_;
+}
+
+/**
+ * @brief sends the output of a finished script to every client waiting for it,
+ * stores it in the cache if it is cached and succeeded, and drops the script
+ * 
+ * @param job_id the script that finished
+ */
+void ServerResponseHandler::finishCGI(int job_id)
+{
+    s_cgi_job& job = cgi_jobs_.at(job_id);
+    CGIExecutor& executor = job.handler->getExecutor();
+    if (executor.getExitCode() == static_cast<int>(CGIExitStatus::Timeout))
+        ServerStats::add(STAT_CGI_TIMEOUTS);
+    for (const std::pair<int, const s_client_data*>& client : job.clients)
+        cgi_update_.answered.push_back({client.first, sendCGIResponse(client.first, *client.second, executor.getExitCode(), executor.getOutput(), job.cache_key.empty() ? nullptr : "MISS")});
+    if (!job.cache_key.empty() && executor.getExitCode() == 0)
+        storeCGIResponse(job.cache_key, executor.getOutput());
+    releaseCGI(job_id);
+}
+
+/**
+ * @brief stores the output of a script in the cache
+ * 
+ * @param cache_key the source the output belongs to
+ * @param output what the script wrote
+ */
+void ServerResponseHandler::storeCGIResponse(const std::string& cache_key, const std::string& output)
+{
+    std::unordered_map<std::string, s_cgi_cache_entry>::iterator it = cgi_cache_.find(cache_key);
+    if (it == cgi_cache_.end())
+        return;
+    it->second.output = output;
+    it->second.valid = true;
+    it->second.stored_at = std::chrono::steady_clock::now();
+    ServerStats::add(STAT_CGI_CACHE_STORES);
+}
+
+/**
+ * @brief drops a script, killing it if it is still running, and frees its slot in the location.
+ * Its open descriptors are reported as closed, the clients still waiting for it must be answered already
+ * 
+ * @param job_id the script to drop
+ */
+void ServerResponseHandler::releaseCGI(int job_id)
+{
+    std::unordered_map<int, s_cgi_job>::iterator job = cgi_jobs_.find(job_id);
+    s_cgi_pool& pool = cgi_pools_[&job->second.handler->getLocation()];
+    if (pool.running > 0)
+        --pool.running;
+    for (int fd : job->second.fds)
+    {
+        cgi_fd_jobs_.erase(fd);
+        cgi_update_.closed.push_back(fd);
+    }
+    for (const std::pair<int, const s_client_data*>& client : job->second.clients)
+        cgi_client_jobs_.erase(client.first);
+    if (!job->second.cache_key.empty())
+    {
+        std::unordered_map<std::string, s_cgi_cache_entry>::iterator entry = cgi_cache_.find(job->second.cache_key);
+        if (entry != cgi_cache_.end() && entry->second.job == job_id)
+        {
+            entry->second.job = -1;
+            if (!entry->second.valid)
+                cgi_cache_.erase(entry);
+        }
+    }
+    cgi_jobs_.erase(job);
+    ServerStats::add(STAT_CGI_RUNNING, -1);
+}
+
+/**
+ * @brief sends the response of a finished script to the client
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param client_data the data of the client from the request
+ * @param exit_code the exit code of the script
+ * @param output what the script wrote
+ * @param cache_status value of the X-Cache-Status header, nullptr if the location is not cached
+ * @return SRH_OK when done,
+ * @return SRH_SEND_ERROR if send() fails
+ */
+e_server_request_return ServerResponseHandler::sendCGIResponse(int client_fd, const s_client_data& client_data, int exit_code, const std::string& output, const char* cache_status)
+{
+    if (exit_code == static_cast<int>(CGIExitStatus::Timeout)) {
+        return setupResponse(client_fd, 504, client_data);
+    }
+    else if (exit_code != 0) {
         return setupResponse(client_fd, 500, client_data);
     }
+
+    // Format and send response with CGI output
+    std::ostringstream headers;
+    headers << "HTTP/1.1 200 OK\r\n"
+            << "Connection: close\r\n"
+            << "Content-Type: text/html\r\n";
+    if (cache_status)
+        headers << "X-Cache-Status: " << cache_status << "\r\n";
+    headers << "Content-Length: " << output.length() << "\r\n\r\n"
+            << output;
+
+    if (sendClient(client_fd, client_data, headers.str().c_str(), headers.str().length()) <= 0) {
+        return SRH_SEND_ERROR;
+    }
+
+    return SRH_OK;
+}
+
+/**
+ * @brief sends the live counters of the server, as plain text or as JSON when the query asks for format=json.
+ * Waiting are the connected clients that did not send anything yet, there is no keep alive to idle in
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param client_data the data of the client from the request
+ * @return SRH_OK when done,
+ * @return SRH_SEND_ERROR if send() fails
+ */
+e_server_request_return ServerResponseHandler::sendStatus(int client_fd, const s_client_data& client_data)
+{
+    std::array<int64_t, STAT_COUNT> stats = ServerStats::snapshot();
+    int64_t active = stats[STAT_HANDLED] - stats[STAT_CLOSED];
+    int64_t waiting = active - stats[STAT_READING] - stats[STAT_WRITING];
+    int64_t lookups = stats[STAT_CGI_CACHE_HITS] + stats[STAT_CGI_CACHE_STALE] + stats[STAT_CGI_CACHE_MISSES] + stats[STAT_CGI_CACHE_COLLAPSED];
+    double hit_ratio = lookups == 0 ? 0.0 : static_cast<double>(stats[STAT_CGI_CACHE_HITS] + stats[STAT_CGI_CACHE_STALE]) / lookups;
+    int64_t memory = stats[STAT_MEMORY_CLIENTS] + stats[STAT_MEMORY_BUFFERS] + stats[STAT_MEMORY_HEADERS] + stats[STAT_MEMORY_BODIES];
+    int64_t memory_per_connection = active == 0 ? 0 : memory / active;
+    size_t query = client_data.request_source.find('?');
+    bool json = query != std::string::npos && client_data.request_source.find("format=json", query) != std::string::npos;
+
+    // Allocations per request of each phase, only a make allocprof build counts them
+    s_alloc_counts allocations = AllocProfile::snapshot();
+    std::array<double, ALLOC_PHASE_COUNT> allocations_per_request{};
+    for (size_t phase = 0; phase < ALLOC_PHASE_COUNT && stats[STAT_REQUESTS] != 0; ++phase)
+        allocations_per_request[phase] = static_cast<double>(allocations.allocations[phase]) / stats[STAT_REQUESTS];
+
+    std::ostringstream body;
+    body.precision(3);
+    body << std::fixed;
+    if (json)
+    {
+        body << "{\"connections\":{\"active\":" << active << ",\"reading\":" << stats[STAT_READING]
+             << ",\"writing\":" << stats[STAT_WRITING] << ",\"waiting\":" << waiting
+             << ",\"accepted\":" << stats[STAT_ACCEPTED] << ",\"handled\":" << stats[STAT_HANDLED] << "}"
+             << ",\"requests\":" << stats[STAT_REQUESTS]
+             << ",\"cgi\":{\"running\":" << stats[STAT_CGI_RUNNING] << "}"
+             << ",\"cgi_cache\":{\"hits\":" << stats[STAT_CGI_CACHE_HITS] << ",\"stale\":" << stats[STAT_CGI_CACHE_STALE]
+             << ",\"misses\":" << stats[STAT_CGI_CACHE_MISSES] << ",\"collapsed\":" << stats[STAT_CGI_CACHE_COLLAPSED]
+             << ",\"stores\":" << stats[STAT_CGI_CACHE_STORES] << ",\"hit_ratio\":" << hit_ratio << "}"
+             << ",\"memory\":{\"records\":" << stats[STAT_MEMORY_CLIENTS] << ",\"buffers\":" << stats[STAT_MEMORY_BUFFERS]
+             << ",\"headers\":" << stats[STAT_MEMORY_HEADERS] << ",\"bodies\":" << stats[STAT_MEMORY_BODIES]
+             << ",\"per_connection\":" << memory_per_connection << "}";
+        if (AllocProfile::enabled)
+        {
+            body << ",\"allocations_per_request\":{";
+            for (size_t phase = 0; phase < ALLOC_PHASE_COUNT; ++phase)
+                body << (phase == 0 ? "\"" : ",\"") << AllocProfile::name(static_cast<e_alloc_phase>(phase)) << "\":" << allocations_per_request[phase];
+            body << "}";
+        }
+        body << "}\n";
+    }
+    else
+    {
+        body << "Active connections: " << active << "\n"
+             << "server accepts handled requests\n"
+             << " " << stats[STAT_ACCEPTED] << " " << stats[STAT_HANDLED] << " " << stats[STAT_REQUESTS] << "\n"
+             << "Reading: " << stats[STAT_READING] << " Writing: " << stats[STAT_WRITING] << " Waiting: " << waiting << "\n"
+             << "CGI running: " << stats[STAT_CGI_RUNNING] << "\n"
+             << "CGI cache: hits " << stats[STAT_CGI_CACHE_HITS] << " stale " << stats[STAT_CGI_CACHE_STALE]
+             << " misses " << stats[STAT_CGI_CACHE_MISSES] << " collapsed " << stats[STAT_CGI_CACHE_COLLAPSED]
+             << " stores " << stats[STAT_CGI_CACHE_STORES] << " hit ratio " << hit_ratio << "\n"
+             << "Connection memory: " << memory << " bytes, records " << stats[STAT_MEMORY_CLIENTS]
+             << " buffers " << stats[STAT_MEMORY_BUFFERS] << " headers " << stats[STAT_MEMORY_HEADERS]
+             << " bodies " << stats[STAT_MEMORY_BODIES] << ", " << memory_per_connection << " per connection\n";
+        if (AllocProfile::enabled)
+        {
+            body << "Allocations per request:";
+            for (size_t phase = 0; phase < ALLOC_PHASE_COUNT; ++phase)
+                body << " " << AllocProfile::name(static_cast<e_alloc_phase>(phase)) << " " << allocations_per_request[phase];
+            body << "\n";
+        }
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 200 OK\r\n"
+             << "Connection: close\r\n"
+             << "Content-Type: " << (json ? "application/json" : "text/plain") << "\r\n"
+             << "Cache-Control: no-cache\r\n"
+             << "Content-Length: " << body.str().size() << "\r\n\r\n"
+             << body.str();
+    if (sendClient(client_fd, client_data, response.str().c_str(), response.str().size()) <= 0)
+        return SRH_SEND_ERROR;
+    return SRH_OK;
+}
+
+/**
+ * @brief sends the request, latency and CGI metrics in the Prometheus text format
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param client_data the data of the client from the request
+ * @return SRH_OK when done,
+ * @return SRH_SEND_ERROR if send() fails
+ */
+e_server_request_return ServerResponseHandler::sendMetrics(int client_fd, const s_client_data& client_data)
+{
+    std::string body = ServerMetrics::exposition();
+    std::ostringstream response;
+    response << "HTTP/1.1 200 OK\r\n"
+             << "Connection: close\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Cache-Control: no-cache\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n"
+             << body;
+    if (sendClient(client_fd, client_data, response.str().c_str(), response.str().size()) <= 0)
+        return SRH_SEND_ERROR;
+    return SRH_OK;
+}
+
+/**
+ * @brief sends the phase timestamps of the last requests kept by the request trace
+ * 
+ * @param client_fd the file descriptor of the client
+ * @param client_data the request data from the client
+ * @return SRH_OK when response is send,
+ * @return SRH_SEND_ERROR if send function has a error
+ */
+e_server_request_return ServerResponseHandler::sendTrace(int client_fd, const s_client_data& client_data)
+{
+    std::string body = RequestTrace::dump();
+    std::ostringstream response;
+    response << "HTTP/1.1 200 OK\r\n"
+             << "Connection: close\r\n"
+             << "Content-Type: text/plain\r\n"
+             << "Cache-Control: no-cache\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n"
+             << body;
+    if (sendClient(client_fd, client_data, response.str().c_str(), response.str().size()) <= 0)
+        return SRH_SEND_ERROR;
+    return SRH_OK;
 }
 
 /**
@@ -552,10 +1232,11 @@ e_server_request_return ServerResponseHandler::handleCGI(
  * @param client_fd the file descriptor of the client
  * @param code the code that redirect/return has defined in its location
  * @param location where the redirect will go to
+ * @param data the request data from the client
  * @return SRH_OK when response is send,
  * @return SRH_SEND_ERROR if send function has a error
  */
-e_server_request_return ServerResponseHandler::sendRedirectResponse(int client_fd, uint16_t code, std::string& location)
+e_server_request_return ServerResponseHandler::sendRedirectResponse(int client_fd, uint16_t code, std::string& location, const s_client_data& data)
 {
     std::string status;
     if (status_codes_.find(code) != status_codes_.end())
@@ -566,7 +1247,7 @@ e_server_request_return ServerResponseHandler::sendRedirectResponse(int client_f
         }
         catch(const std::exception& e)
         {
-            std::cerr << e.what() << '\n';
+            LOG_ERROR(e.what());
             status = "500 Internal Server Error";
         }
     }
@@ -581,7 +1262,7 @@ e_server_request_return ServerResponseHandler::sendRedirectResponse(int client_f
     response << "Location: " << location << "\r\n";
     response << "Content-Length: 0\r\n\r\n";
     
-    if (send(client_fd, response.str().c_str(), response.str().size(), 0) <= 0)
+    if (sendClient(client_fd, data, response.str().c_str(), response.str().size()) <= 0)
         return SRH_SEND_ERROR;
     return SRH_OK;
 }
@@ -659,11 +1340,12 @@ void ServerResponseHandler::fillStatusCodes()
 
 e_server_request_return ServerResponseHandler::removeFile(int client_fd, s_client_data& client_data)
 {
-    if (!SRV_.fileExists(client_data.config_.get()->getRoot().substr(1) + client_data.request_source))
+    std::string file_path = client_data.config_.get()->getRoot().substr(1).append(client_data.request_source);
+    if (!SRV_.fileExists(file_path))
         return setupResponse(client_fd, 404, client_data);
-    if (!SRV_.filePermission(client_data.config_.get()->getRoot().substr(1) + client_data.request_source))
+    if (!SRV_.filePermission(file_path))
         return setupResponse(client_fd, 403, client_data);
-    if (!std::filesystem::remove(client_data.config_.get()->getRoot().substr(1) + client_data.request_source))
+    if (!std::filesystem::remove(file_path))
         return setupResponse(client_fd, 500, client_data);
     return setupResponse(client_fd, 200, client_data, "/");
 }
\ No newline at end of file
@@ -1,12 +1,12 @@
 #include "server/ServerResponseValidator.hpp"
+#include "log/Logger.hpp"
 #include <map>
-#include <iostream>
 #include <sys/stat.h>
 #include <filesystem>
 #include <regex>
 
 
-ServerResponseValidator::ServerResponseValidator(const std::vector<std::shared_ptr<Location>>& locations, const std::string& root) : locations_(locations), root_(root) {};
+ServerResponseValidator::ServerResponseValidator(const std::string& root) : root_(root) {};
 
 ServerResponseValidator::~ServerResponseValidator() {};
 
@@ -17,7 +17,7 @@ ServerResponseValidator::~ServerResponseValidator() {};
  * @return true if http_version is "HTTP/1.1"
  * @return false of http_version is not "HTTP/1.1"
  */
-bool ServerResponseValidator::checkHTTPVersion(std::string& http_version)
+bool ServerResponseValidator::checkHTTPVersion(std::string_view http_version)
 {
     if (http_version == "HTTP/1.1")
         return true;
@@ -28,6 +28,7 @@ bool ServerResponseValidator::checkHTTPVersion(std::string& http_version)
  * @brief checks if a location is known by the server
  * and if there is a more global defined return version defined before the complete version
  * 
+ * @param routes the routing snapshot of the connection
  * @param token_location the chunked location
  * @param file_path what will hold the location of the file
  * @param location_it what will hold the itterator point of the found and used location
@@ -35,17 +36,17 @@ bool ServerResponseValidator::checkHTTPVersion(std::string& http_version)
  * @return RVR_NOT_FOUND if no location matches the request location
  * @return RVR_RETURN if a redirect location was defined before the precise location
  */
-e_responeValReturn ServerResponseValidator::checkLocations(std::vector<std::string>& token_location, std::string& file_path, std::vector<std::shared_ptr<Location>>::const_iterator& location_it, s_client_data& client_data)
+e_responeValReturn ServerResponseValidator::checkLocations(const RouteTable& routes, std::vector<std::string>& token_location, std::string& file_path, t_route_iterator& location_it, s_client_data& client_data)
 {
-    std::map<size_t, std::shared_ptr<Location>> found_location;
+    std::map<size_t, const Location*> found_location;
     size_t token_size = token_location.size();
-    setPossibleLocation(token_size, token_location, found_location);
+    setPossibleLocation(routes, token_size, token_location, found_location);
 
     if (!found_location.empty())
     {
         size_t most_precise =  0;
-        std::map<size_t, std::shared_ptr<Location>>::iterator fl_it = found_location.begin();
-        std::map<size_t, std::shared_ptr<Location>>::iterator fl_ite = found_location.end();
+        std::map<size_t, const Location*>::iterator fl_it = found_location.begin();
+        std::map<size_t, const Location*>::iterator fl_ite = found_location.end();
         while (fl_it != fl_ite)
         {
             if (fl_it->first > most_precise)
@@ -59,26 +60,26 @@ e_responeValReturn ServerResponseValidator::checkLocations(std::vector<std::stri
             {
                 if (found_location.size() == 1)
                 {
-                    if (found_location.begin()->second.get()->getReturn().type != Location::ReturnType::NONE)
+                    if (found_location.begin()->second->getReturn().type != Location::ReturnType::NONE)
                     {
-                        location_it = std::next(locations_.begin(), found_location.begin()->first);
+                        location_it = routes.at(found_location.begin()->first);
                         return RVR_RETURN;
                     }
                 }
-                std::map<size_t, std::shared_ptr<Location>>::iterator it = found_location.find(i);
+                std::map<size_t, const Location*>::iterator it = found_location.find(i);
                 if (it != found_location.end())
                 {
                     if (found_location.at(i)->getReturn().type != Location::ReturnType::NONE)
                     {
-                        location_it = std::next(locations_.begin(), i);
-                        std::cout << "location_it is set to" << location_it->get()->getRoot() << std::endl;
+                        location_it = routes.at(i);
+                        LOG_DEBUG("location_it is set to" << (*location_it)->getRoot());
                         return RVR_RETURN;
                     }
                 }
             }
             catch(const std::exception& e) {
-                std::cerr << "find error\n";
-                std::cerr << e.what() << "\n";
+                LOG_ERROR("find error");
+                LOG_ERROR(e.what());
                 }
         }
 
@@ -90,29 +91,29 @@ e_responeValReturn ServerResponseValidator::checkLocations(std::vector<std::stri
                 full_request.append("/" + token_location.at(l));
         if (found_location.at(most_precise)->getPath() == full_request || found_location.at(most_precise)->getPath().find(".") != std::string::npos)
         {
-            location_it = std::next(locations_.begin(), most_precise);
+            location_it = routes.at(most_precise);
             std::string start = root_;
-            if (location_it->get()->getPath() == "/")
-               file_path = root_ + "/" + location_it->get()->getIndex();
+            if ((*location_it)->getPath() == "/")
+               file_path = root_ + "/" + (*location_it)->getIndex();
             else
-                file_path = root_ + location_it->get()->getRoot() + "/" + location_it->get()->getIndex();
+                file_path = root_ + (*location_it)->getRoot() + "/" + (*location_it)->getIndex();
         }
     }
     else
     {
-        setPossibleRegexLocation(found_location, client_data);
+        setPossibleRegexLocation(routes, found_location, client_data);
         if (!found_location.empty())
         {
-            location_it = std::next(locations_.begin(), found_location.begin()->first);
+            location_it = routes.at(found_location.begin()->first);
             return RVR_IS_REGEX;
         }
     }
     if (file_path.empty())
     {
-        setPossibleRegexLocation(found_location, client_data);
+        setPossibleRegexLocation(routes, found_location, client_data);
         if (!found_location.empty())
         {
-            location_it = std::next(locations_.begin(), found_location.begin()->first);
+            location_it = routes.at(found_location.begin()->first);
             return RVR_IS_REGEX;
         }
         return RVR_NOT_FOUND;
@@ -120,6 +121,29 @@ e_responeValReturn ServerResponseValidator::checkLocations(std::vector<std::stri
     return RVR_OK;
 }
 
+/**
+ * @brief checks if the request goes to a location the server answers itself instead of with a file,
+ * one that forwards to an upstream or shows the status page, the metrics or the request trace.
+ * Unlike other locations such a location handles every path below it,
+ * the longest location that matches the path decides
+ * 
+ * @param routes the routing snapshot of the connection
+ * @param path the request source without the query string
+ * @param location_it set to the location when found
+ * @return RVR_OK if the request is proxied or asks for the status,
+ * @return RVR_NOT_FOUND if it is not
+ */
+e_responeValReturn ServerResponseValidator::checkHandlerLocation(const RouteTable& routes, const std::string& path, t_route_iterator& location_it)
+{
+    if (!routes.hasHandlers())
+        return RVR_NOT_FOUND;
+    t_route_iterator best = routes.longestPrefix(path);
+    if (best == routes.end() || !((*best)->hasProxy() || (*best)->hasStubStatus() || (*best)->hasMetrics() || (*best)->hasTraceDump()))
+        return RVR_NOT_FOUND;
+    location_it = best;
+    return RVR_OK;
+}
+
 /**
  * @brief checks if the requested method is allowed on the requested location
  * 
@@ -129,16 +153,16 @@ e_responeValReturn ServerResponseValidator::checkLocations(std::vector<std::stri
  * @return RVR_METHOD_NOT_ALLOWED if method is not allowed,
  * @return RVR_BUFFER_NOT_EMPTY buffer error
  */
-e_responeValReturn ServerResponseValidator::checkAllowedMethods(std::vector<std::shared_ptr<Location>>::const_iterator& location_it, std::string& method)
+e_responeValReturn ServerResponseValidator::checkAllowedMethods(t_route_iterator& location_it, std::string_view method)
 {
-    std::vector<std::string>::const_iterator method_it = location_it->get()->getAllowedMethods().begin();
-    std::vector<std::string>::const_iterator method_ite = location_it->get()->getAllowedMethods().end();
+    std::vector<std::string>::const_iterator method_it = (*location_it)->getAllowedMethods().begin();
+    std::vector<std::string>::const_iterator method_ite = (*location_it)->getAllowedMethods().end();
 
     while (method_it != method_ite)
     {
         if (method_it->empty())
         {
-            std::cerr << "handle respone request buffer not empty\n";
+            LOG_ERROR("handle respone request buffer not empty");
             return RVR_BUFFER_NOT_EMPTY;
         }
         if (method_it->compare(method) == 0)
@@ -160,7 +184,7 @@ e_responeValReturn ServerResponseValidator::checkAllowedMethods(std::vector<std:
  * @return RVR_FOUND_AT_ROOT if the found was not in the folder but was found at the root of the website dirctory
  * @return RVR_AUTO_INDEX_ON the file cannot be found and auto indexing is on
  */
-e_responeValReturn ServerResponseValidator::checkFile(std::string& file_path, std::vector<std::shared_ptr<Location>>::const_iterator& location_it)
+e_responeValReturn ServerResponseValidator::checkFile(std::string& file_path, t_route_iterator& location_it)
 {
     bool erased = false;
     if (!file_path.empty() && file_path.front() == '/')
@@ -172,7 +196,7 @@ e_responeValReturn ServerResponseValidator::checkFile(std::string& file_path, st
     {
         if (filePermission(file_path))
         {
-            std::cout << "file_path: " << file_path << std::endl;
+            LOG_DEBUG("file_path: " << file_path);
             if (erased)
                 file_path.insert(0, "/");
             return RVR_OK;
@@ -180,13 +204,13 @@ e_responeValReturn ServerResponseValidator::checkFile(std::string& file_path, st
         else
             return RVR_NO_FILE_PERMISSION;
     }
-    else if (location_it->get()->getAutoindex())
+    else if ((*location_it)->getAutoindex())
         return RVR_AUTO_INDEX_ON;
-    else if (fileExists(root_ + location_it->get()->getIndex()))
+    else if (fileExists(root_ + (*location_it)->getIndex()))
     {
-        if (filePermission(root_ + location_it->get()->getIndex()))
+        if (filePermission(root_ + (*location_it)->getIndex()))
         {
-            file_path = root_ + location_it->get()->getIndex();
+            file_path = root_ + (*location_it)->getIndex();
             if (erased)
                 file_path.insert(0, "/");
             return RVR_FOUND_AT_ROOT;
@@ -198,7 +222,7 @@ e_responeValReturn ServerResponseValidator::checkFile(std::string& file_path, st
     {
         if (erased)
             file_path.insert(0, "/");
-        std::cerr << "file_path: \"" << file_path << "\" not found\n";
+        LOG_INFO("file_path: \"" << file_path << "\" not found");
         return RVR_NOT_FOUND;
     }
 }
@@ -225,9 +249,9 @@ bool ServerResponseValidator::filePermission(const std::string& path)
  * @return RVR_NOT_FOUND if the directory is not found
  * @return RVR_NO_FILE_PERMISSION if we don't have the permission to read the directory
  */
-e_responeValReturn ServerResponseValidator::checkAutoIndexing(std::vector<std::shared_ptr<Location>>::const_iterator& location_it)
+e_responeValReturn ServerResponseValidator::checkAutoIndexing(t_route_iterator& location_it)
 {
-    std::string path = root_.substr(1) + location_it->get()->getRoot();
+    std::string path = root_.substr(1) + (*location_it)->getRoot();
     if (!isDirectory(path))
         return RVR_NOT_FOUND;
     if (!filePermission(path))
@@ -262,35 +286,32 @@ const std::string& ServerResponseValidator::getRoot() const
 /**
  * @brief loops to the chunked location and checks it against all known locations
  * 
+ * @param routes the routing snapshot of the connection
  * @param token_size how many entries toke_location has
  * @param token_location the chunked sourse from the client request
  * @param found_location will hold the location that have matches to the chunked source
  */
-void ServerResponseValidator::setPossibleLocation(size_t token_size, std::vector<std::string>& token_location, std::map<size_t, std::shared_ptr<Location>>& found_location)
+void ServerResponseValidator::setPossibleLocation(const RouteTable& routes, size_t token_size, std::vector<std::string>& token_location, std::map<size_t, const Location*>& found_location)
 {
     if (token_size == 1 && token_location.at(0) == "/")
     {
-        for (std::shared_ptr<Location> location : locations_)
-        {
-            if (location && location->getPath() == "/")
-                found_location.emplace(0, location);
-        }
+        size_t index = routes.find("/");
+        if (index != routes.size())
+            found_location.emplace(0, *routes.at(index));
     }
     else
     {
+        // the whole path once, every shorter one is the part before its last '/'
+        std::string loc;
+        for (const std::string& token : token_location)
+            loc.append("/").append(token);
+        std::string_view current(loc);
         for (size_t i = 0; i < token_size; ++i)
         {
-            size_t current = token_size - i;
-            std::string loc = "";
-            for (size_t j = 0; j < current; ++j)
-                loc.append("/" + token_location.at(j));
-            size_t j = 0;
-            for (const std::shared_ptr<Location>& loc_ptr : locations_)
-            {
-                if (loc_ptr && loc_ptr->getPath() == loc)
-                    found_location.emplace(j, loc_ptr);
-                ++j;
-            }
+            size_t index = routes.find(current);
+            if (index != routes.size())
+                found_location.emplace(index, *routes.at(index));
+            current = current.substr(0, current.rfind('/'));
         }
     }
 }
@@ -308,26 +329,13 @@ bool ServerResponseValidator::fileExists(const std::string& path)
     return stat(path.c_str(), &buffer) == 0 && S_ISREG(buffer.st_mode);
 }
 
-void ServerResponseValidator::setPossibleRegexLocation(std::map<size_t, std::shared_ptr<Location>>& found_location, s_client_data& client_data)
+void ServerResponseValidator::setPossibleRegexLocation(const RouteTable& routes, std::map<size_t, const Location*>& found_location, s_client_data& client_data)
 {
-    auto it = locations_.begin();
-    auto ite = locations_.end();
-    std::string source;
-
-    source = client_data.request_source;
-    // for (std::string part : token_location)
-    //     source += part + "/";
-    // source = source.substr(0, source.size() - 1);
-    size_t i = 0;
-    while (it != ite)
+    std::string_view source = client_data.request_source.substr(0, client_data.request_source.find('?'));
+    for (size_t i : routes.regexLocations())
     {
-        if (it->get()->getMatchType() != Location::MatchType::PREFIX)
-        {
-            std::regex reg = it->get()->getRegex();
-            if (std::regex_search(source, reg))
-                found_location.emplace(i, *it);
-        }
-        ++it;
-        ++i;
+        const std::regex& reg = (*routes.at(i))->getRegex();
+        if (std::regex_search(source.begin(), source.end(), reg))
+            found_location.emplace(i, *routes.at(i));
     }
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "server/ServerStats.hpp"
+
+void ServerStats::moveClient(e_client_state& state, e_client_state to)
+{
+    if (state == to)
+        return;
+    if (state == CLIENT_READING)
+        add(STAT_READING, -1);
+    else if (state == CLIENT_WRITING)
+        add(STAT_WRITING, -1);
+    if (to == CLIENT_READING)
+        add(STAT_READING);
+    else if (to == CLIENT_WRITING)
+        add(STAT_WRITING);
+    state = to;
+}
+
+std::array<int64_t, STAT_COUNT> ServerStats::snapshot()
+{
+    std::array<int64_t, STAT_COUNT> totals{};
+    std::lock_guard<std::mutex> lock(slotsMutex());
+    for (const std::unique_ptr<s_stats_slot>& slot : slots())
+    {
+        for (size_t i = 0; i < STAT_COUNT; ++i)
+            totals[i] += slot->counters[i].load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+s_stats_slot& ServerStats::local()
+{
+    thread_local s_stats_slot* slot = nullptr;
+    if (slot == nullptr)
+    {
+        // Slots stay after their thread is gone, what it counted still counts
+        std::lock_guard<std::mutex> lock(slotsMutex());
+        slots().push_back(std::make_unique<s_stats_slot>());
+        slot = slots().back().get();
+    }
+    return *slot;
+}
+
+std::mutex& ServerStats::slotsMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<std::unique_ptr<s_stats_slot>>& ServerStats::slots()
+{
+    static std::vector<std::unique_ptr<s_stats_slot>> slots;
+    return slots;
+}
\ No newline at end of file
@@ -1,5 +1,5 @@
 #include "server/ServerValidator.hpp"
-#include <iostream>
+#include "log/Logger.hpp"
 #include <cstring>
 
 ServerValidator::ServerValidator()
@@ -59,7 +59,7 @@ int ServerValidator::checkErrno(int err)
     std::unordered_map<int, s_ErrorInfo>::iterator it = error_map_.find(err);
     if (it != error_map_.end())
     {
-        std::cerr << it->second.message << std::endl;
+        LOG_ERROR(it->second.message);
         if (err == EEXIST)
             return 1;
         else if (err == ENOENT)
@@ -67,6 +67,6 @@ int ServerValidator::checkErrno(int err)
         else if (err == 0) {};
         return it->second.return_value;
     }
-    std::cerr << "Unknown error:" << strerror(err) << std::endl;
+    LOG_ERROR("Unknown error:" << strerror(err));
     return -1;
 }
\ No newline at end of file